@@ -0,0 +1,23 @@
+// GLib
+#include <glib.h>
+
+// Local
+#include "bench_stats.h"
+
+gint BenchStatsCompareLatency(gconstpointer a, gconstpointer b)
+{
+    const gint64 x = *(const gint64 *)a;
+    const gint64 y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+gint64 BenchStatsPercentile(const GArray *sorted, guint permille)
+{
+    if (sorted->len == 0)
+    {
+        return 0;
+    }
+    guint64 rank = ((guint64)sorted->len * permille + 999) / 1000;
+    rank = CLAMP(rank, 1, sorted->len);
+    return g_array_index(sorted, gint64, rank - 1);
+}
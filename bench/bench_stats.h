@@ -0,0 +1,20 @@
+#ifndef _BENCH_STATS_H
+#define _BENCH_STATS_H
+
+#include <glib.h>
+
+/*
+ * Latency statistics shared by the benchmark clients. Latencies are gint64 microseconds in a
+ * GArray.
+ */
+
+// Sorts latencies in ascending order, for g_array_sort
+gint BenchStatsCompareLatency(gconstpointer a, gconstpointer b);
+
+/*
+ * Nearest rank percentile of a sorted array, in tenths of a percent so p99.9 can be given, eg. 500
+ * for the median. Returns 0 for an empty array.
+ */
+gint64 BenchStatsPercentile(const GArray *sorted, guint permille);
+
+#endif // _BENCH_STATS_H
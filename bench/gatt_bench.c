@@ -0,0 +1,1526 @@
+/*
+ * Benchmarks bluetoothServicesComponent on a private bus. The host process is spawned against a
+ * mock bluetoothd, and once its application and advertisement are registered the benchmark measures:
+ *
+ *   - time from spawn to RegisterApplication and to RegisterAdvertisement completing
+ *   - ReadValue latency percentiles for every readable characteristic and descriptor
+ *   - WriteValue throughput on the alert level characteristic with a window of outstanding writes
+ *   - the rate of battery level notifications while the host's fake battery app is pushing values,
+ *     and of the advertisement updates carrying the same values
+ *   - bulk service throughput, looping data through the sockets handed out by AcquireWrite and
+ *     AcquireNotify the way bluetoothd would use them
+ *   - how long it takes to download the battery level history collected during the run
+ *   - file transfer throughput through the transfer service, including resuming half way through
+ */
+
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// GLib
+#include <glib.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+
+// Local
+#include "mock_bluez.h"
+#include "bench_stats.h"
+
+#define DEVICE_PATH MOCK_BLUEZ_ADAPTER_PATH "/dev_00_00_5E_00_53_01"
+#define CALL_TIMEOUT_MS 5000
+
+#define ADVERTISEMENT_PATH "/io/mangoh/advertisement"
+#define BATTERY_LEVEL_UUID "2a19"
+#define ALERT_LEVEL_UUID "2a06"
+#define BULK_TX_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b5e01"
+#define BULK_RX_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b5e02"
+#define HISTORY_CONTROL_POINT_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b5d01"
+#define HISTORY_RECORDS_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b5d02"
+#define HISTORY_PACKET_LAST 0x8000
+#define HISTORY_RECORD_SIZE 8
+#define TRANSFER_CONTROL_POINT_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b6001"
+#define TRANSFER_DATA_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b6002"
+#define TRANSFER_FILE_NAME "bench.bin"
+#define TRANSFER_CHUNK_HEADER_SIZE 4
+#define CLIENT_MTU 247
+#define ATT_HEADER_SIZE 3
+
+struct BenchOptions
+{
+    gint iterations;
+    gint window;
+    gint notifySeconds;
+    gint timeoutSeconds;
+    gint bulkBytes;
+    gint transferBytes;
+    gboolean startUnpowered;
+};
+
+struct ReadPhase
+{
+    guint attribute;
+    guint done;
+    guint errors;
+    GArray *latencies;
+    gint64 callStart;
+};
+
+struct WritePhase
+{
+    const struct MockBluezAttribute *attribute;
+    guint issued;
+    guint completed;
+    guint errors;
+    gint64 startTime;
+};
+
+struct NotifyPhase
+{
+    const struct MockBluezAttribute *attribute;
+    guint subscription;
+    guint advertisementSubscription;
+    guint64 count;
+    guint64 advertisementUpdates;
+    gint64 startTime;
+    gint64 firstNotificationUs;
+};
+
+struct BulkPhase
+{
+    const struct MockBluezAttribute *tx;
+    const struct MockBluezAttribute *rx;
+    int notifyFd;
+    int writeFd;
+    guint16 notifyMtu;
+    guint16 writeMtu;
+    gsize sent;
+    gsize received;
+    guint64 corrupt;
+    guint writeWatch;
+    guint readWatch;
+    guint timeoutSource;
+    gint64 startTime;
+    guint8 packet[512];
+};
+
+struct HistoryPhase
+{
+    const struct MockBluezAttribute *controlPoint;
+    const struct MockBluezAttribute *records;
+    guint subscription;
+    guint timeoutSource;
+    guint64 packets;
+    guint64 numRecords;
+    guint16 nextSequence;
+    guint64 outOfOrder;
+    gint64 startTime;
+};
+
+struct TransferPhase
+{
+    const struct MockBluezAttribute *controlPoint;
+    const struct MockBluezAttribute *data;
+    guint subscription;
+    guint timeoutSource;
+    guint8 *file;
+    guint32 size;
+    guint32 crc;
+    guint16 chunkSize;
+    guint16 window;
+    guint32 sent;
+    guint32 acked;
+    guint64 chunks;
+    guint64 acks;
+    guint64 resends;
+    guint errors;
+    bool starting;
+    bool resumed;
+    guint32 resumedAt;
+    gint64 startTime;
+};
+
+struct Bench
+{
+    struct BenchOptions options;
+    GMainLoop *loop;
+    GDBusConnection *conn;
+    struct MockBluez mock;
+    GPid hostPid;
+    bool hostRunning;
+    bool finishing;
+    gint64 spawnTime;
+    guint timeoutSource;
+    struct ReadPhase read;
+    struct WritePhase write;
+    struct NotifyPhase notify;
+    struct BulkPhase bulk;
+    struct HistoryPhase history;
+    struct TransferPhase transfer;
+    int exitStatus;
+};
+
+static void StartWritePhase(struct Bench *bench);
+static void StartNotifyPhase(struct Bench *bench);
+static void StartBulkPhase(struct Bench *bench);
+static void StartHistoryPhase(struct Bench *bench);
+static void StartTransferPhase(struct Bench *bench);
+static void ReadNextAttribute(struct Bench *bench);
+
+static void Finish(struct Bench *bench, int exitStatus)
+{
+    if (bench->finishing)
+    {
+        return;
+    }
+    bench->finishing = true;
+    bench->exitStatus = exitStatus;
+    if (bench->hostRunning)
+    {
+        // The loop quits once the host has been reaped
+        kill(bench->hostPid, SIGTERM);
+    }
+    else
+    {
+        g_main_loop_quit(bench->loop);
+    }
+}
+
+static GVariant *BuildOptions(const gchar *writeType)
+{
+    GVariantBuilder options;
+    g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&options, "{sv}", "device", g_variant_new_object_path(DEVICE_PATH));
+    if (writeType != NULL)
+    {
+        g_variant_builder_add(&options, "{sv}", "type", g_variant_new_string(writeType));
+    }
+    else
+    {
+        g_variant_builder_add(&options, "{sv}", "offset", g_variant_new_uint16(0));
+    }
+    return g_variant_builder_end(&options);
+}
+
+static void ReportError(const gchar *what, GError *error, guint errors)
+{
+    // Only the first failure of a run is printed; the count shows up in the results
+    if (errors == 1)
+    {
+        g_printerr("%s failed: %s\n", what, error->message);
+    }
+    g_error_free(error);
+}
+
+static const struct MockBluezAttribute *CurrentReadAttribute(struct Bench *bench)
+{
+    return g_ptr_array_index(bench->mock.attributes, bench->read.attribute);
+}
+
+static void ReadValueCallback(GObject *source, GAsyncResult *res, gpointer userData);
+
+static void IssueRead(struct Bench *bench)
+{
+    const struct MockBluezAttribute *attribute = CurrentReadAttribute(bench);
+    bench->read.callStart = g_get_monotonic_time();
+    g_dbus_connection_call(
+        bench->conn,
+        bench->mock.appSender,
+        attribute->path,
+        attribute->interface,
+        "ReadValue",
+        g_variant_new("(@a{sv})", BuildOptions(NULL)),
+        G_VARIANT_TYPE("(ay)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        CALL_TIMEOUT_MS,
+        NULL,
+        ReadValueCallback,
+        bench);
+}
+
+static void ReportRead(struct Bench *bench)
+{
+    const struct MockBluezAttribute *attribute = CurrentReadAttribute(bench);
+    GArray *latencies = bench->read.latencies;
+    g_array_sort(latencies, BenchStatsCompareLatency);
+    g_print(
+        "read     %-36s %-42s n=%u err=%u p50=%" G_GINT64_FORMAT "us p90=%" G_GINT64_FORMAT
+        "us p99=%" G_GINT64_FORMAT "us max=%" G_GINT64_FORMAT "us\n",
+        attribute->uuid,
+        attribute->path,
+        latencies->len,
+        bench->read.errors,
+        BenchStatsPercentile(latencies, 500),
+        BenchStatsPercentile(latencies, 900),
+        BenchStatsPercentile(latencies, 990),
+        BenchStatsPercentile(latencies, 1000));
+}
+
+static void ReadValueCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct Bench *bench = userData;
+    const gint64 latency = g_get_monotonic_time() - bench->read.callStart;
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL)
+    {
+        bench->read.errors++;
+        ReportError("ReadValue", error, bench->read.errors);
+    }
+    else
+    {
+        g_array_append_val(bench->read.latencies, latency);
+        g_variant_unref(result);
+    }
+
+    if (bench->finishing)
+    {
+        return;
+    }
+
+    bench->read.done++;
+    if (bench->read.done < (guint)bench->options.iterations)
+    {
+        IssueRead(bench);
+        return;
+    }
+
+    ReportRead(bench);
+    bench->read.attribute++;
+    ReadNextAttribute(bench);
+}
+
+static void ReadNextAttribute(struct Bench *bench)
+{
+    GPtrArray *attributes = bench->mock.attributes;
+    while (bench->read.attribute < attributes->len &&
+           !MockBluezAttributeHasFlag(CurrentReadAttribute(bench), "read"))
+    {
+        bench->read.attribute++;
+    }
+
+    if (bench->read.attribute == attributes->len)
+    {
+        g_array_free(bench->read.latencies, TRUE);
+        bench->read.latencies = NULL;
+        StartWritePhase(bench);
+        return;
+    }
+
+    bench->read.done = 0;
+    bench->read.errors = 0;
+    g_array_set_size(bench->read.latencies, 0);
+    IssueRead(bench);
+}
+
+static void StartReadPhase(struct Bench *bench)
+{
+    bench->read.attribute = 0;
+    bench->read.latencies = g_array_sized_new(FALSE, FALSE, sizeof(gint64), bench->options.iterations);
+    ReadNextAttribute(bench);
+}
+
+static void WriteValueCallback(GObject *source, GAsyncResult *res, gpointer userData);
+
+static void IssueWrite(struct Bench *bench)
+{
+    const guint8 level = bench->write.issued % 3;
+    bench->write.issued++;
+    g_dbus_connection_call(
+        bench->conn,
+        bench->mock.appSender,
+        bench->write.attribute->path,
+        bench->write.attribute->interface,
+        "WriteValue",
+        g_variant_new(
+            "(@ay@a{sv})",
+            g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, &level, 1, sizeof(level)),
+            BuildOptions("request")),
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        CALL_TIMEOUT_MS,
+        NULL,
+        WriteValueCallback,
+        bench);
+}
+
+static void WriteValueCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct Bench *bench = userData;
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL)
+    {
+        bench->write.errors++;
+        ReportError("WriteValue", error, bench->write.errors);
+    }
+    else
+    {
+        g_variant_unref(result);
+    }
+
+    if (bench->finishing)
+    {
+        return;
+    }
+
+    bench->write.completed++;
+    if (bench->write.issued < (guint)bench->options.iterations)
+    {
+        IssueWrite(bench);
+        return;
+    }
+
+    if (bench->write.completed == bench->write.issued)
+    {
+        const gint64 elapsed = MAX(g_get_monotonic_time() - bench->write.startTime, 1);
+        g_print(
+            "write    %-36s %-42s n=%u err=%u window=%d rate=%.0f/s\n",
+            bench->write.attribute->uuid,
+            bench->write.attribute->path,
+            bench->write.completed,
+            bench->write.errors,
+            bench->options.window,
+            bench->write.completed * (double)G_USEC_PER_SEC / elapsed);
+        StartNotifyPhase(bench);
+    }
+}
+
+static void StartWritePhase(struct Bench *bench)
+{
+    bench->write.attribute = MockBluezFindAttribute(&bench->mock, ALERT_LEVEL_UUID);
+    if (bench->write.attribute == NULL)
+    {
+        g_print("write    skipped, no %s characteristic\n", ALERT_LEVEL_UUID);
+        StartNotifyPhase(bench);
+        return;
+    }
+
+    bench->write.startTime = g_get_monotonic_time();
+    const guint window = MIN(bench->options.window, bench->options.iterations);
+    for (guint i = 0; i < window; i++)
+    {
+        IssueWrite(bench);
+    }
+}
+
+static void NotificationHandler(
+    GDBusConnection *conn,
+    const gchar *sender,
+    const gchar *objectPath,
+    const gchar *interfaceName,
+    const gchar *signalName,
+    GVariant *parameters,
+    gpointer userData)
+{
+    struct Bench *bench = userData;
+    GVariant *changed = g_variant_get_child_value(parameters, 1);
+    GVariant *value = g_variant_lookup_value(changed, "Value", G_VARIANT_TYPE_BYTESTRING);
+    if (value != NULL)
+    {
+        if (bench->notify.count == 0)
+        {
+            bench->notify.firstNotificationUs = g_get_monotonic_time() - bench->notify.startTime;
+        }
+        bench->notify.count++;
+        g_variant_unref(value);
+    }
+    g_variant_unref(changed);
+}
+
+static void AdvertisementChangedHandler(
+    GDBusConnection *conn,
+    const gchar *sender,
+    const gchar *objectPath,
+    const gchar *interfaceName,
+    const gchar *signalName,
+    GVariant *parameters,
+    gpointer userData)
+{
+    struct Bench *bench = userData;
+    GVariant *changed = g_variant_get_child_value(parameters, 1);
+    GVariant *data = g_variant_lookup_value(changed, "ManufacturerData", NULL);
+    if (data != NULL)
+    {
+        bench->notify.advertisementUpdates++;
+        g_variant_unref(data);
+    }
+    g_variant_unref(changed);
+}
+
+static void StopNotifyCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct Bench *bench = userData;
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL)
+    {
+        ReportError("StopNotify", error, 1);
+        Finish(bench, EXIT_FAILURE);
+        return;
+    }
+    g_variant_unref(result);
+    StartBulkPhase(bench);
+}
+
+static gboolean NotifyPhaseExpired(gpointer userData)
+{
+    struct Bench *bench = userData;
+    const gint64 elapsed = MAX(g_get_monotonic_time() - bench->notify.startTime, 1);
+    g_dbus_connection_signal_unsubscribe(bench->conn, bench->notify.subscription);
+    g_dbus_connection_signal_unsubscribe(bench->conn, bench->notify.advertisementSubscription);
+    g_print(
+        "notify   %-36s %-42s n=%" G_GUINT64_FORMAT " first=%" G_GINT64_FORMAT "us rate=%.2f/s\n",
+        bench->notify.attribute->uuid,
+        bench->notify.attribute->path,
+        bench->notify.count,
+        bench->notify.firstNotificationUs,
+        bench->notify.count * (double)G_USEC_PER_SEC / elapsed);
+    g_print(
+        "advert   %-36s %-42s n=%" G_GUINT64_FORMAT " rate=%.2f/s\n",
+        "ManufacturerData",
+        ADVERTISEMENT_PATH,
+        bench->notify.advertisementUpdates,
+        bench->notify.advertisementUpdates * (double)G_USEC_PER_SEC / elapsed);
+
+    g_dbus_connection_call(
+        bench->conn,
+        bench->mock.appSender,
+        bench->notify.attribute->path,
+        bench->notify.attribute->interface,
+        "StopNotify",
+        NULL,
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        CALL_TIMEOUT_MS,
+        NULL,
+        StopNotifyCallback,
+        bench);
+    return G_SOURCE_REMOVE;
+}
+
+static void StartNotifyCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct Bench *bench = userData;
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL)
+    {
+        ReportError("StartNotify", error, 1);
+        Finish(bench, EXIT_FAILURE);
+        return;
+    }
+    g_variant_unref(result);
+    g_timeout_add_seconds(bench->options.notifySeconds, NotifyPhaseExpired, bench);
+}
+
+static void StartNotifyPhase(struct Bench *bench)
+{
+    bench->notify.attribute = MockBluezFindAttribute(&bench->mock, BATTERY_LEVEL_UUID);
+    if (bench->notify.attribute == NULL || bench->options.notifySeconds <= 0)
+    {
+        g_print("notify   skipped\n");
+        StartBulkPhase(bench);
+        return;
+    }
+
+    bench->notify.subscription = g_dbus_connection_signal_subscribe(
+        bench->conn,
+        bench->mock.appSender,
+        "org.freedesktop.DBus.Properties",
+        "PropertiesChanged",
+        bench->notify.attribute->path,
+        "org.bluez.GattCharacteristic1",
+        G_DBUS_SIGNAL_FLAGS_NONE,
+        NotificationHandler,
+        bench,
+        NULL);
+    bench->notify.advertisementSubscription = g_dbus_connection_signal_subscribe(
+        bench->conn,
+        bench->mock.appSender,
+        "org.freedesktop.DBus.Properties",
+        "PropertiesChanged",
+        ADVERTISEMENT_PATH,
+        "org.bluez.LEAdvertisement1",
+        G_DBUS_SIGNAL_FLAGS_NONE,
+        AdvertisementChangedHandler,
+        bench,
+        NULL);
+    bench->notify.startTime = g_get_monotonic_time();
+    g_dbus_connection_call(
+        bench->conn,
+        bench->mock.appSender,
+        bench->notify.attribute->path,
+        bench->notify.attribute->interface,
+        "StartNotify",
+        NULL,
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        CALL_TIMEOUT_MS,
+        NULL,
+        StartNotifyCallback,
+        bench);
+}
+
+static void StopBulkTransfer(struct Bench *bench)
+{
+    struct BulkPhase *bulk = &bench->bulk;
+    if (bulk->writeWatch != 0)
+    {
+        g_source_remove(bulk->writeWatch);
+        bulk->writeWatch = 0;
+    }
+    if (bulk->readWatch != 0)
+    {
+        g_source_remove(bulk->readWatch);
+        bulk->readWatch = 0;
+    }
+    if (bulk->timeoutSource != 0)
+    {
+        g_source_remove(bulk->timeoutSource);
+        bulk->timeoutSource = 0;
+    }
+    // Closing the sockets is how bluetoothd releases them, so the host logs its side too
+    if (bulk->notifyFd >= 0)
+    {
+        close(bulk->notifyFd);
+        bulk->notifyFd = -1;
+    }
+    if (bulk->writeFd >= 0)
+    {
+        close(bulk->writeFd);
+        bulk->writeFd = -1;
+    }
+}
+
+/*
+ * The payload is a byte counter, so the received stream can be checked without keeping a copy.
+ */
+static gboolean BulkWritable(gint fd, GIOCondition condition, gpointer userData)
+{
+    struct Bench *bench = userData;
+    struct BulkPhase *bulk = &bench->bulk;
+    const gsize total = bench->options.bulkBytes;
+    const gsize payload = bulk->writeMtu - ATT_HEADER_SIZE;
+    while (bulk->sent < total)
+    {
+        const gsize size = MIN(payload, total - bulk->sent);
+        for (gsize i = 0; i < size; i++)
+        {
+            bulk->packet[i] = (guint8)(bulk->sent + i);
+        }
+        const ssize_t written = send(fd, bulk->packet, size, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                return G_SOURCE_CONTINUE;
+            }
+            g_printerr("Bulk write failed: %s\n", g_strerror(errno));
+            bulk->writeWatch = 0;
+            StopBulkTransfer(bench);
+            Finish(bench, EXIT_FAILURE);
+            return G_SOURCE_REMOVE;
+        }
+        bulk->sent += size;
+    }
+
+    bulk->writeWatch = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean BulkReadable(gint fd, GIOCondition condition, gpointer userData)
+{
+    struct Bench *bench = userData;
+    struct BulkPhase *bulk = &bench->bulk;
+    guint8 packet[512];
+    while (true)
+    {
+        const ssize_t received = recv(fd, packet, sizeof(packet), 0);
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            return G_SOURCE_CONTINUE;
+        }
+        if (received <= 0)
+        {
+            g_printerr("Bulk notify socket closed by the host\n");
+            bulk->readWatch = 0;
+            StopBulkTransfer(bench);
+            Finish(bench, EXIT_FAILURE);
+            return G_SOURCE_REMOVE;
+        }
+
+        for (ssize_t i = 0; i < received; i++)
+        {
+            if (packet[i] != (guint8)(bulk->received + i))
+            {
+                bulk->corrupt++;
+            }
+        }
+        bulk->received += received;
+        if (bulk->received >= (gsize)bench->options.bulkBytes)
+        {
+            break;
+        }
+    }
+
+    const gint64 elapsed = MAX(g_get_monotonic_time() - bulk->startTime, 1);
+    g_print(
+        "bulk     %-36s %-42s bytes=%zu corrupt=%" G_GUINT64_FORMAT " mtu=%u rate=%.1fkB/s\n",
+        bulk->tx->uuid,
+        bulk->tx->path,
+        bulk->received,
+        bulk->corrupt,
+        bulk->notifyMtu,
+        bulk->received * (double)G_USEC_PER_SEC / elapsed / 1024.0);
+
+    bulk->readWatch = 0;
+    StopBulkTransfer(bench);
+    if (bulk->corrupt != 0)
+    {
+        Finish(bench, EXIT_FAILURE);
+        return G_SOURCE_REMOVE;
+    }
+    StartHistoryPhase(bench);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean BulkTimeoutExpired(gpointer userData)
+{
+    struct Bench *bench = userData;
+    bench->bulk.timeoutSource = 0;
+    g_printerr(
+        "Bulk transfer stalled after sending %zu and receiving %zu bytes\n",
+        bench->bulk.sent,
+        bench->bulk.received);
+    StopBulkTransfer(bench);
+    Finish(bench, EXIT_FAILURE);
+    return G_SOURCE_REMOVE;
+}
+
+static void StartBulkTransfer(struct Bench *bench)
+{
+    struct BulkPhase *bulk = &bench->bulk;
+    g_unix_set_fd_nonblocking(bulk->notifyFd, TRUE, NULL);
+    g_unix_set_fd_nonblocking(bulk->writeFd, TRUE, NULL);
+    bulk->startTime = g_get_monotonic_time();
+    bulk->readWatch = g_unix_fd_add(bulk->notifyFd, G_IO_IN | G_IO_HUP, BulkReadable, bench);
+    bulk->writeWatch = g_unix_fd_add(bulk->writeFd, G_IO_OUT, BulkWritable, bench);
+    bulk->timeoutSource =
+        g_timeout_add_seconds(bench->options.timeoutSeconds, BulkTimeoutExpired, bench);
+}
+
+/*
+ * Returns the socket from an Acquire* reply, or -1 on failure.
+ */
+static int AcquireFinish(GObject *source, GAsyncResult *res, const gchar *what, guint16 *mtu)
+{
+    GError *error = NULL;
+    GUnixFDList *fdList = NULL;
+    GVariant *result = g_dbus_connection_call_with_unix_fd_list_finish(
+        G_DBUS_CONNECTION(source), &fdList, res, &error);
+    if (result == NULL)
+    {
+        ReportError(what, error, 1);
+        return -1;
+    }
+
+    gint32 index;
+    g_variant_get(result, "(hq)", &index, mtu);
+    g_variant_unref(result);
+    const int fd = (fdList != NULL) ? g_unix_fd_list_get(fdList, index, &error) : -1;
+    if (fdList != NULL)
+    {
+        g_object_unref(fdList);
+    }
+    if (fd < 0)
+    {
+        g_printerr("%s returned no socket\n", what);
+        if (error != NULL)
+        {
+            g_error_free(error);
+        }
+    }
+    return fd;
+}
+
+static void AcquireWriteCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct Bench *bench = userData;
+    bench->bulk.writeFd = AcquireFinish(source, res, "AcquireWrite", &bench->bulk.writeMtu);
+    if (bench->bulk.writeFd < 0)
+    {
+        StopBulkTransfer(bench);
+        Finish(bench, EXIT_FAILURE);
+        return;
+    }
+    StartBulkTransfer(bench);
+}
+
+static void Acquire(
+    struct Bench *bench, const struct MockBluezAttribute *attribute, const gchar *method,
+    GAsyncReadyCallback callback)
+{
+    GVariantBuilder options;
+    g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&options, "{sv}", "device", g_variant_new_object_path(DEVICE_PATH));
+    g_variant_builder_add(&options, "{sv}", "mtu", g_variant_new_uint16(CLIENT_MTU));
+    g_variant_builder_add(&options, "{sv}", "link", g_variant_new_string("LE"));
+    g_dbus_connection_call_with_unix_fd_list(
+        bench->conn,
+        bench->mock.appSender,
+        attribute->path,
+        attribute->interface,
+        method,
+        g_variant_new("(a{sv})", &options),
+        G_VARIANT_TYPE("(hq)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        CALL_TIMEOUT_MS,
+        NULL,
+        NULL,
+        callback,
+        bench);
+}
+
+static void AcquireNotifyCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct Bench *bench = userData;
+    bench->bulk.notifyFd = AcquireFinish(source, res, "AcquireNotify", &bench->bulk.notifyMtu);
+    if (bench->bulk.notifyFd < 0)
+    {
+        Finish(bench, EXIT_FAILURE);
+        return;
+    }
+    Acquire(bench, bench->bulk.rx, "AcquireWrite", AcquireWriteCallback);
+}
+
+static void StartBulkPhase(struct Bench *bench)
+{
+    struct BulkPhase *bulk = &bench->bulk;
+    bulk->notifyFd = -1;
+    bulk->writeFd = -1;
+    bulk->tx = MockBluezFindAttribute(&bench->mock, BULK_TX_UUID);
+    bulk->rx = MockBluezFindAttribute(&bench->mock, BULK_RX_UUID);
+    if (bulk->tx == NULL || bulk->rx == NULL || bench->options.bulkBytes <= 0)
+    {
+        g_print("bulk     skipped\n");
+        StartHistoryPhase(bench);
+        return;
+    }
+
+    Acquire(bench, bulk->tx, "AcquireNotify", AcquireNotifyCallback);
+}
+
+static void StopHistoryPhase(struct Bench *bench)
+{
+    struct HistoryPhase *history = &bench->history;
+    if (history->subscription != 0)
+    {
+        g_dbus_connection_signal_unsubscribe(bench->conn, history->subscription);
+        history->subscription = 0;
+    }
+    if (history->timeoutSource != 0)
+    {
+        g_source_remove(history->timeoutSource);
+        history->timeoutSource = 0;
+    }
+}
+
+static void HistoryRecordsHandler(
+    GDBusConnection *conn,
+    const gchar *sender,
+    const gchar *objectPath,
+    const gchar *interfaceName,
+    const gchar *signalName,
+    GVariant *parameters,
+    gpointer userData)
+{
+    struct Bench *bench = userData;
+    struct HistoryPhase *history = &bench->history;
+    GVariant *changed = g_variant_get_child_value(parameters, 1);
+    GVariant *value = g_variant_lookup_value(changed, "Value", G_VARIANT_TYPE_BYTESTRING);
+    g_variant_unref(changed);
+    if (value == NULL)
+    {
+        return;
+    }
+
+    gsize size;
+    const guint8 *packet = g_variant_get_fixed_array(value, &size, sizeof(guint8));
+    if (size < 2)
+    {
+        g_variant_unref(value);
+        return;
+    }
+    const guint16 header = packet[0] | (packet[1] << 8);
+    if ((header & ~HISTORY_PACKET_LAST) != history->nextSequence)
+    {
+        history->outOfOrder++;
+    }
+    history->nextSequence = (header + 1) & ~HISTORY_PACKET_LAST;
+    history->packets++;
+    history->numRecords += (size - 2) / HISTORY_RECORD_SIZE;
+    g_variant_unref(value);
+
+    if ((header & HISTORY_PACKET_LAST) == 0)
+    {
+        return;
+    }
+
+    const gint64 elapsed = MAX(g_get_monotonic_time() - history->startTime, 1);
+    g_print(
+        "history  %-36s %-42s records=%" G_GUINT64_FORMAT " packets=%" G_GUINT64_FORMAT
+        " lost=%" G_GUINT64_FORMAT " time=%" G_GINT64_FORMAT "us rate=%.0f/s\n",
+        history->records->uuid,
+        history->records->path,
+        history->numRecords,
+        history->packets,
+        history->outOfOrder,
+        elapsed,
+        history->numRecords * (double)G_USEC_PER_SEC / elapsed);
+    StopHistoryPhase(bench);
+    if (history->outOfOrder != 0)
+    {
+        Finish(bench, EXIT_FAILURE);
+        return;
+    }
+    StartTransferPhase(bench);
+}
+
+static gboolean HistoryTimeoutExpired(gpointer userData)
+{
+    struct Bench *bench = userData;
+    bench->history.timeoutSource = 0;
+    g_printerr(
+        "History download stalled after %" G_GUINT64_FORMAT " packets\n", bench->history.packets);
+    StopHistoryPhase(bench);
+    Finish(bench, EXIT_FAILURE);
+    return G_SOURCE_REMOVE;
+}
+
+static void HistoryRequestCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct Bench *bench = userData;
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL)
+    {
+        ReportError("History request", error, 1);
+        StopHistoryPhase(bench);
+        Finish(bench, EXIT_FAILURE);
+        return;
+    }
+    g_variant_unref(result);
+}
+
+/*
+ * Asks for every battery level sample (history 0) recorded since the epoch.
+ */
+static void HistoryStartNotifyCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct Bench *bench = userData;
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL)
+    {
+        ReportError("StartNotify", error, 1);
+        StopHistoryPhase(bench);
+        Finish(bench, EXIT_FAILURE);
+        return;
+    }
+    g_variant_unref(result);
+
+    static const guint8 request[] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00};
+    GVariantBuilder options;
+    g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&options, "{sv}", "device", g_variant_new_object_path(DEVICE_PATH));
+    g_variant_builder_add(&options, "{sv}", "type", g_variant_new_string("request"));
+    g_variant_builder_add(&options, "{sv}", "mtu", g_variant_new_uint16(CLIENT_MTU));
+    bench->history.startTime = g_get_monotonic_time();
+    g_dbus_connection_call(
+        bench->conn,
+        bench->mock.appSender,
+        bench->history.controlPoint->path,
+        bench->history.controlPoint->interface,
+        "WriteValue",
+        g_variant_new(
+            "(@ay@a{sv})",
+            g_variant_new_fixed_array(
+                G_VARIANT_TYPE_BYTE, request, sizeof(request), sizeof(guint8)),
+            g_variant_builder_end(&options)),
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        CALL_TIMEOUT_MS,
+        NULL,
+        HistoryRequestCallback,
+        bench);
+}
+
+static void StartHistoryPhase(struct Bench *bench)
+{
+    struct HistoryPhase *history = &bench->history;
+    history->controlPoint = MockBluezFindAttribute(&bench->mock, HISTORY_CONTROL_POINT_UUID);
+    history->records = MockBluezFindAttribute(&bench->mock, HISTORY_RECORDS_UUID);
+    if (history->controlPoint == NULL || history->records == NULL)
+    {
+        g_print("history  skipped\n");
+        StartTransferPhase(bench);
+        return;
+    }
+
+    history->subscription = g_dbus_connection_signal_subscribe(
+        bench->conn,
+        bench->mock.appSender,
+        "org.freedesktop.DBus.Properties",
+        "PropertiesChanged",
+        history->records->path,
+        "org.bluez.GattCharacteristic1",
+        G_DBUS_SIGNAL_FLAGS_NONE,
+        HistoryRecordsHandler,
+        bench,
+        NULL);
+    history->timeoutSource =
+        g_timeout_add_seconds(bench->options.timeoutSeconds, HistoryTimeoutExpired, bench);
+    g_dbus_connection_call(
+        bench->conn,
+        bench->mock.appSender,
+        history->records->path,
+        history->records->interface,
+        "StartNotify",
+        NULL,
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        CALL_TIMEOUT_MS,
+        NULL,
+        HistoryStartNotifyCallback,
+        bench);
+}
+
+// CRC-32 as used by zlib, which is what the transfer service checks files with
+static guint32 Crc32(const guint8 *data, gsize size)
+{
+    guint32 crc = 0xffffffff;
+    for (gsize i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+static void StopTransferPhase(struct Bench *bench)
+{
+    struct TransferPhase *transfer = &bench->transfer;
+    if (transfer->subscription != 0)
+    {
+        g_dbus_connection_signal_unsubscribe(bench->conn, transfer->subscription);
+        transfer->subscription = 0;
+    }
+    if (transfer->timeoutSource != 0)
+    {
+        g_source_remove(transfer->timeoutSource);
+        transfer->timeoutSource = 0;
+    }
+    g_free(transfer->file);
+    transfer->file = NULL;
+}
+
+static void FailTransfer(struct Bench *bench, const gchar *message)
+{
+    g_printerr("Transfer failed: %s\n", message);
+    StopTransferPhase(bench);
+    Finish(bench, EXIT_FAILURE);
+}
+
+static void TransferControlCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct Bench *bench = userData;
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL)
+    {
+        ReportError("Transfer request", error, 1);
+        StopTransferPhase(bench);
+        Finish(bench, EXIT_FAILURE);
+        return;
+    }
+    g_variant_unref(result);
+}
+
+static void TransferDataCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct Bench *bench = userData;
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL)
+    {
+        bench->transfer.errors++;
+        ReportError("Transfer data write", error, bench->transfer.errors);
+        return;
+    }
+    g_variant_unref(result);
+}
+
+static void TransferWrite(
+    struct Bench *bench,
+    const struct MockBluezAttribute *attribute,
+    const guint8 *value,
+    gsize size,
+    const gchar *writeType,
+    GAsyncReadyCallback callback)
+{
+    GVariantBuilder options;
+    g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&options, "{sv}", "device", g_variant_new_object_path(DEVICE_PATH));
+    g_variant_builder_add(&options, "{sv}", "type", g_variant_new_string(writeType));
+    g_variant_builder_add(&options, "{sv}", "mtu", g_variant_new_uint16(CLIENT_MTU));
+    g_dbus_connection_call(
+        bench->conn,
+        bench->mock.appSender,
+        attribute->path,
+        attribute->interface,
+        "WriteValue",
+        g_variant_new(
+            "(@ay@a{sv})",
+            g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, value, size, sizeof(guint8)),
+            g_variant_builder_end(&options)),
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        CALL_TIMEOUT_MS,
+        NULL,
+        callback,
+        bench);
+}
+
+static void PutLe32(guint8 *buffer, guint32 value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        buffer[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static guint32 GetLe32(const guint8 *buffer)
+{
+    return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((guint32)buffer[3] << 24);
+}
+
+static void SendTransferStart(struct Bench *bench, bool restart)
+{
+    struct TransferPhase *transfer = &bench->transfer;
+    guint8 request[11 + sizeof(TRANSFER_FILE_NAME) - 1];
+    request[0] = 0x01;
+    // Replaces the file an earlier run may have left
+    request[1] = (restart ? 0x01 : 0x00) | 0x02;
+    PutLe32(&request[2], transfer->size);
+    PutLe32(&request[6], transfer->crc);
+    request[10] = sizeof(TRANSFER_FILE_NAME) - 1;
+    memcpy(&request[11], TRANSFER_FILE_NAME, sizeof(TRANSFER_FILE_NAME) - 1);
+    transfer->starting = true;
+    TransferWrite(
+        bench, transfer->controlPoint, request, sizeof(request), "request",
+        TransferControlCallback);
+}
+
+static void SendTransferCommit(struct Bench *bench)
+{
+    static const guint8 request[] = {0x02};
+    TransferWrite(
+        bench, bench->transfer.controlPoint, request, sizeof(request), "request",
+        TransferControlCallback);
+}
+
+/*
+ * Chunks go out as write commands, like a central streaming without responses, until a window's
+ * worth is unacknowledged.
+ */
+static void SendTransferChunks(struct Bench *bench)
+{
+    struct TransferPhase *transfer = &bench->transfer;
+    const guint32 limit = transfer->acked + (guint32)transfer->window * transfer->chunkSize;
+    guint8 chunk[TRANSFER_CHUNK_HEADER_SIZE + 512];
+    while (transfer->sent < transfer->size && transfer->sent < limit)
+    {
+        const guint32 size = MIN(transfer->chunkSize, transfer->size - transfer->sent);
+        PutLe32(chunk, transfer->sent);
+        memcpy(&chunk[TRANSFER_CHUNK_HEADER_SIZE], &transfer->file[transfer->sent], size);
+        TransferWrite(
+            bench, transfer->data, chunk, TRANSFER_CHUNK_HEADER_SIZE + size, "command",
+            TransferDataCallback);
+        transfer->sent += size;
+        transfer->chunks++;
+    }
+}
+
+// Compares what the service stored with what was sent, when the bench knows where it stores files
+static bool TransferredFileMatches(const struct TransferPhase *transfer)
+{
+    const gchar *directory = g_getenv("BLUETOOTH_SERVICES_TRANSFER_DIR");
+    if (directory == NULL)
+    {
+        return true;
+    }
+    gchar *path = g_build_filename(directory, TRANSFER_FILE_NAME, NULL);
+    gchar *contents = NULL;
+    gsize length = 0;
+    const bool matches = g_file_get_contents(path, &contents, &length, NULL) &&
+        length == transfer->size && memcmp(contents, transfer->file, length) == 0;
+    g_free(contents);
+    g_free(path);
+    return matches;
+}
+
+static void TransferStarted(struct Bench *bench, const guint8 *response, gsize size)
+{
+    struct TransferPhase *transfer = &bench->transfer;
+    if (size < 15 || response[2] != 0x00)
+    {
+        FailTransfer(bench, "start was refused");
+        return;
+    }
+    const guint32 offset = GetLe32(&response[3]);
+    if (offset > transfer->size || GetLe32(&response[7]) != Crc32(transfer->file, offset))
+    {
+        FailTransfer(bench, "the stored part doesn't match the file");
+        return;
+    }
+    transfer->chunkSize = MIN(response[11] | (response[12] << 8), 512);
+    transfer->window = response[13] | (response[14] << 8);
+    if (transfer->chunkSize == 0 || transfer->window == 0)
+    {
+        FailTransfer(bench, "no room to send chunks");
+        return;
+    }
+    transfer->starting = false;
+    transfer->sent = offset;
+    transfer->acked = offset;
+    if (transfer->resumed)
+    {
+        transfer->resumedAt = offset;
+    }
+
+    if (offset == transfer->size)
+    {
+        SendTransferCommit(bench);
+        return;
+    }
+    SendTransferChunks(bench);
+}
+
+static void TransferCommitted(struct Bench *bench, const guint8 *response, gsize size)
+{
+    struct TransferPhase *transfer = &bench->transfer;
+    if (size < 3 || response[2] != 0x00)
+    {
+        FailTransfer(bench, "commit was refused");
+        return;
+    }
+
+    const gint64 elapsed = MAX(g_get_monotonic_time() - transfer->startTime, 1);
+    const bool matches = TransferredFileMatches(transfer);
+    g_print(
+        "transfer %-36s %-42s bytes=%u chunks=%" G_GUINT64_FORMAT " acks=%" G_GUINT64_FORMAT
+        " resends=%" G_GUINT64_FORMAT " resumed_at=%u err=%u%s time=%" G_GINT64_FORMAT
+        "us rate=%.0fB/s\n",
+        transfer->data->uuid,
+        transfer->data->path,
+        transfer->size,
+        transfer->chunks,
+        transfer->acks,
+        transfer->resends,
+        transfer->resumedAt,
+        transfer->errors,
+        matches ? "" : " MISMATCH",
+        elapsed,
+        transfer->size * (double)G_USEC_PER_SEC / elapsed);
+    StopTransferPhase(bench);
+    Finish(bench, matches ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/*
+ * Half way through, the transfer is started again without the restart flag, like a client that
+ * reconnected, so the resume point and the CRC of the stored part are checked on every run.
+ */
+static void TransferAcknowledged(struct Bench *bench, guint8 opcode, guint32 offset)
+{
+    struct TransferPhase *transfer = &bench->transfer;
+    if (transfer->starting || offset > transfer->sent)
+    {
+        return;
+    }
+    if (opcode == 0x82)
+    {
+        transfer->resends++;
+        transfer->sent = offset;
+    }
+    else
+    {
+        transfer->acks++;
+    }
+    transfer->acked = MAX(transfer->acked, offset);
+
+    if (transfer->acked == transfer->size)
+    {
+        SendTransferCommit(bench);
+    }
+    else if (!transfer->resumed && transfer->acked >= transfer->size / 2)
+    {
+        transfer->resumed = true;
+        SendTransferStart(bench, false);
+    }
+    else
+    {
+        SendTransferChunks(bench);
+    }
+}
+
+static void TransferControlPointHandler(
+    GDBusConnection *conn,
+    const gchar *sender,
+    const gchar *objectPath,
+    const gchar *interfaceName,
+    const gchar *signalName,
+    GVariant *parameters,
+    gpointer userData)
+{
+    struct Bench *bench = userData;
+    GVariant *changed = g_variant_get_child_value(parameters, 1);
+    GVariant *value = g_variant_lookup_value(changed, "Value", G_VARIANT_TYPE_BYTESTRING);
+    g_variant_unref(changed);
+    if (value == NULL)
+    {
+        return;
+    }
+
+    gsize size;
+    const guint8 *notification = g_variant_get_fixed_array(value, &size, sizeof(guint8));
+    if (size >= 2 && notification[0] == 0x80 && notification[1] == 0x01)
+    {
+        TransferStarted(bench, notification, size);
+    }
+    else if (size >= 2 && notification[0] == 0x80 && notification[1] == 0x02)
+    {
+        TransferCommitted(bench, notification, size);
+    }
+    else if (size == 5 && (notification[0] == 0x81 || notification[0] == 0x82))
+    {
+        TransferAcknowledged(bench, notification[0], GetLe32(&notification[1]));
+    }
+    g_variant_unref(value);
+}
+
+static gboolean TransferTimeoutExpired(gpointer userData)
+{
+    struct Bench *bench = userData;
+    bench->transfer.timeoutSource = 0;
+    g_printerr("Transfer stalled after %u bytes were acknowledged\n", bench->transfer.acked);
+    StopTransferPhase(bench);
+    Finish(bench, EXIT_FAILURE);
+    return G_SOURCE_REMOVE;
+}
+
+static void TransferStartNotifyCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct Bench *bench = userData;
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL)
+    {
+        ReportError("StartNotify", error, 1);
+        StopTransferPhase(bench);
+        Finish(bench, EXIT_FAILURE);
+        return;
+    }
+    g_variant_unref(result);
+
+    bench->transfer.startTime = g_get_monotonic_time();
+    SendTransferStart(bench, true);
+}
+
+static void StartTransferPhase(struct Bench *bench)
+{
+    struct TransferPhase *transfer = &bench->transfer;
+    transfer->controlPoint = MockBluezFindAttribute(&bench->mock, TRANSFER_CONTROL_POINT_UUID);
+    transfer->data = MockBluezFindAttribute(&bench->mock, TRANSFER_DATA_UUID);
+    if (bench->options.transferBytes <= 0 || transfer->controlPoint == NULL ||
+        transfer->data == NULL)
+    {
+        g_print("transfer skipped\n");
+        Finish(bench, EXIT_SUCCESS);
+        return;
+    }
+
+    transfer->size = bench->options.transferBytes;
+    transfer->file = g_malloc(transfer->size);
+    for (guint32 i = 0; i < transfer->size; i++)
+    {
+        transfer->file[i] = (i * 2654435761u) >> 24;
+    }
+    transfer->crc = Crc32(transfer->file, transfer->size);
+
+    transfer->subscription = g_dbus_connection_signal_subscribe(
+        bench->conn,
+        bench->mock.appSender,
+        "org.freedesktop.DBus.Properties",
+        "PropertiesChanged",
+        transfer->controlPoint->path,
+        "org.bluez.GattCharacteristic1",
+        G_DBUS_SIGNAL_FLAGS_NONE,
+        TransferControlPointHandler,
+        bench,
+        NULL);
+    transfer->timeoutSource =
+        g_timeout_add_seconds(bench->options.timeoutSeconds, TransferTimeoutExpired, bench);
+    g_dbus_connection_call(
+        bench->conn,
+        bench->mock.appSender,
+        transfer->controlPoint->path,
+        transfer->controlPoint->interface,
+        "StartNotify",
+        NULL,
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        CALL_TIMEOUT_MS,
+        NULL,
+        TransferStartNotifyCallback,
+        bench);
+}
+
+static void HostReady(gpointer userData)
+{
+    struct Bench *bench = userData;
+    if (bench->finishing)
+    {
+        return;
+    }
+    g_source_remove(bench->timeoutSource);
+    bench->timeoutSource = 0;
+
+    g_print(
+        "startup  register_application=%.1fms advertising=%.1fms attributes=%u\n",
+        (bench->mock.applicationRegisteredTime - bench->spawnTime) / 1000.0,
+        (bench->mock.advertisementRegisteredTime - bench->spawnTime) / 1000.0,
+        bench->mock.attributes->len);
+    StartReadPhase(bench);
+}
+
+static gboolean StartupTimeoutExpired(gpointer userData)
+{
+    struct Bench *bench = userData;
+    bench->timeoutSource = 0;
+    g_printerr(
+        "Host didn't register within %ds (application %s, advertisement %s)\n",
+        bench->options.timeoutSeconds,
+        bench->mock.applicationRegistered ? "registered" : "missing",
+        bench->mock.advertisementRegistered ? "registered" : "missing");
+    Finish(bench, EXIT_FAILURE);
+    return G_SOURCE_REMOVE;
+}
+
+static void HostExited(GPid pid, gint status, gpointer userData)
+{
+    struct Bench *bench = userData;
+    bench->hostRunning = false;
+    g_spawn_close_pid(pid);
+    if (!bench->finishing)
+    {
+        g_printerr("Host exited unexpectedly\n");
+        bench->finishing = true;
+        bench->exitStatus = EXIT_FAILURE;
+    }
+    g_main_loop_quit(bench->loop);
+}
+
+static bool SpawnHost(struct Bench *bench, gchar **argv, GError **error)
+{
+    // The component prints every battery read on stdout, so only its stderr (logs) is kept
+    const GSpawnFlags flags = G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL;
+    bench->spawnTime = g_get_monotonic_time();
+    if (!g_spawn_async(NULL, argv, NULL, flags, NULL, NULL, &bench->hostPid, error))
+    {
+        return false;
+    }
+    bench->hostRunning = true;
+    g_child_watch_add(bench->hostPid, HostExited, bench);
+    bench->timeoutSource =
+        g_timeout_add_seconds(bench->options.timeoutSeconds, StartupTimeoutExpired, bench);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    struct Bench bench = {
+        .options = {
+            .iterations = 1000,
+            .window = 8,
+            .notifySeconds = 10,
+            .timeoutSeconds = 30,
+            .bulkBytes = 1024 * 1024,
+            .transferBytes = 1024 * 1024,
+        },
+    };
+    gchar **hostArgv = NULL;
+    const GOptionEntry entries[] = {
+        {"iterations", 'n', 0, G_OPTION_ARG_INT, &bench.options.iterations,
+         "Calls per read and write measurement", "N"},
+        {"window", 'w', 0, G_OPTION_ARG_INT, &bench.options.window,
+         "Outstanding WriteValue calls", "N"},
+        {"notify-seconds", 's', 0, G_OPTION_ARG_INT, &bench.options.notifySeconds,
+         "Duration of the notification measurement, 0 to skip", "S"},
+        {"timeout", 't', 0, G_OPTION_ARG_INT, &bench.options.timeoutSeconds,
+         "Seconds to wait for the host to register", "S"},
+        {"bulk-bytes", 'b', 0, G_OPTION_ARG_INT, &bench.options.bulkBytes,
+         "Bytes looped through the bulk service, 0 to skip", "N"},
+        {"transfer-bytes", 0, 0, G_OPTION_ARG_INT, &bench.options.transferBytes,
+         "Size of the file sent to the transfer service, 0 to skip", "N"},
+        {"unpowered", 0, 0, G_OPTION_ARG_NONE, &bench.options.startUnpowered,
+         "Start with the adapter powered off so the host has to power it on", NULL},
+        {G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &hostArgv, NULL, NULL},
+        {NULL},
+    };
+
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("-- HOST [ARGS...]");
+    g_option_context_set_summary(
+        context,
+        "Runs HOST against a mock bluetoothd on the system bus given by DBUS_SYSTEM_BUS_ADDRESS.");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+    if (hostArgv == NULL || bench.options.iterations <= 0 || bench.options.window <= 0)
+    {
+        g_printerr("A host command and positive iteration and window counts are required\n");
+        return EXIT_FAILURE;
+    }
+
+    bench.loop = g_main_loop_new(NULL, FALSE);
+    bench.conn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+    if (bench.conn == NULL ||
+        !MockBluezStart(
+            &bench.mock, bench.conn, !bench.options.startUnpowered, HostReady, &bench, &error) ||
+        !SpawnHost(&bench, hostArgv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    g_main_loop_run(bench.loop);
+
+    g_strfreev(hostArgv);
+    g_main_loop_unref(bench.loop);
+    return bench.exitStatus;
+}
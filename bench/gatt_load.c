@@ -0,0 +1,720 @@
+/*
+ * Generates load on bluetoothServicesComponent from many simulated centrals at once, to find where
+ * it saturates. The host process is spawned against the mock bluetoothd, and once its application
+ * is registered every virtual central keeps a fixed number of ReadValue, WriteValue, StartNotify
+ * and StopNotify calls in flight, picked at random from a configurable mix, for a fixed duration.
+ * The calls are made the way bluetoothd forwards ATT requests, on one connection, each carrying the
+ * central's "device" option. The report gives throughput, latency percentiles and errors for each
+ * operation and attribute.
+ */
+
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+// GLib
+#include <glib.h>
+#include <gio/gio.h>
+
+// Local
+#include "mock_bluez.h"
+#include "bench_stats.h"
+
+#define CALL_TIMEOUT_MS 5000
+#define DRAIN_TIMEOUT_S 10
+#define DEFAULT_SERVICES "battery,modem_info,immediate_alert"
+#define DEFAULT_MIX "read=70,write=20,notify=10"
+
+enum LoadOperation
+{
+    LOAD_OPERATION_READ,
+    LOAD_OPERATION_WRITE,
+    LOAD_OPERATION_NOTIFY,
+    LOAD_OPERATION_COUNT,
+};
+
+static const gchar *const OperationNames[LOAD_OPERATION_COUNT] = {
+    "read",
+    "write",
+    "notify",
+};
+
+struct LoadOptions
+{
+    gint clients;
+    gint depth;
+    gint durationSeconds;
+    gint timeoutSeconds;
+    gint mtu;
+    gint seed;
+    gchar *services;
+    gchar *mix;
+    gchar *writeType;
+    gboolean anonymous;
+};
+
+/*
+ * An attribute that one operation is aimed at, along with what was measured for it.
+ */
+struct LoadTarget
+{
+    const struct MockBluezAttribute *attribute;
+    enum LoadOperation operation;
+    // Index into each central's subscription flags, notify targets only
+    guint notifyIndex;
+    GArray *latencies; // gint64 microseconds, successful calls only
+    guint64 errors;
+};
+
+struct VirtualCentral
+{
+    struct Load *load;
+    gchar *device;
+    guint inFlight;
+    guint64 completed;
+    // Whether this central is subscribed to each notify target
+    bool *subscribed;
+};
+
+struct LoadCall
+{
+    struct VirtualCentral *central;
+    struct LoadTarget *target;
+    gint64 startTime;
+};
+
+struct Load
+{
+    struct LoadOptions options;
+    GMainLoop *loop;
+    GDBusConnection *conn;
+    struct MockBluez mock;
+    GRand *rand;
+    GPid hostPid;
+    bool hostRunning;
+    bool finishing;
+    bool stopping;
+    guint timeoutSource;
+    guint weights[LOAD_OPERATION_COUNT];
+    guint totalWeight;
+    GPtrArray *targets[LOAD_OPERATION_COUNT]; // struct LoadTarget
+    struct VirtualCentral *centrals;
+    guint inFlight;
+    GHashTable *errorNames; // D-Bus error name -> count
+    guint notificationSubscription;
+    guint64 notifications;
+    gint64 startTime;
+    gint64 elapsedUs;
+    int exitStatus;
+};
+
+static void IssueCall(struct VirtualCentral *central);
+
+static void Finish(struct Load *load, int exitStatus)
+{
+    if (load->finishing)
+    {
+        return;
+    }
+    load->finishing = true;
+    load->exitStatus = exitStatus;
+    if (load->hostRunning)
+    {
+        // The loop quits once the host has been reaped
+        kill(load->hostPid, SIGTERM);
+    }
+    else
+    {
+        g_main_loop_quit(load->loop);
+    }
+}
+
+/*
+ * Parses eg. "read=70,write=20,notify=10". Operations that aren't named get no weight.
+ */
+static bool ParseMix(struct Load *load, const gchar *mix)
+{
+    gchar **entries = g_strsplit(mix, ",", -1);
+    bool valid = true;
+    for (gchar **entry = entries; *entry != NULL && valid; entry++)
+    {
+        gchar **pair = g_strsplit(*entry, "=", 2);
+        valid = false;
+        for (guint i = 0; pair[0] != NULL && pair[1] != NULL && i < LOAD_OPERATION_COUNT; i++)
+        {
+            if (strcmp(g_strstrip(pair[0]), OperationNames[i]) == 0)
+            {
+                load->weights[i] = (guint)strtoul(pair[1], NULL, 10);
+                valid = true;
+            }
+        }
+        g_strfreev(pair);
+    }
+    g_strfreev(entries);
+
+    load->totalWeight = 0;
+    for (guint i = 0; i < LOAD_OPERATION_COUNT; i++)
+    {
+        load->totalWeight += load->weights[i];
+    }
+    return valid && load->totalWeight > 0;
+}
+
+// The service an attribute belongs to, ie. the first path component below the application
+static bool IsInServices(const struct Load *load, const struct MockBluezAttribute *attribute)
+{
+    const gsize appPathLen = strlen(load->mock.appPath);
+    if (strncmp(attribute->path, load->mock.appPath, appPathLen) != 0 ||
+        attribute->path[appPathLen] != '/')
+    {
+        return false;
+    }
+    const gchar *service = &attribute->path[appPathLen + 1];
+    const gsize serviceLen = strcspn(service, "/");
+
+    gchar **names = g_strsplit(load->options.services, ",", -1);
+    bool found = false;
+    for (gchar **name = names; *name != NULL && !found; name++)
+    {
+        found = (strlen(*name) == serviceLen && strncmp(*name, service, serviceLen) == 0);
+    }
+    g_strfreev(names);
+    return found;
+}
+
+static void AddTarget(
+    struct Load *load, const struct MockBluezAttribute *attribute, enum LoadOperation operation)
+{
+    struct LoadTarget *target = g_new0(struct LoadTarget, 1);
+    target->attribute = attribute;
+    target->operation = operation;
+    target->notifyIndex = load->targets[operation]->len;
+    target->latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+    g_ptr_array_add(load->targets[operation], target);
+}
+
+static void FreeTarget(gpointer data)
+{
+    struct LoadTarget *target = data;
+    g_array_free(target->latencies, TRUE);
+    g_free(target);
+}
+
+/*
+ * Notify targets are limited to characteristics that notify through PropertiesChanged. Those that
+ * only hand out a socket with AcquireNotify are left to gatt_bench.
+ */
+static void FindTargets(struct Load *load)
+{
+    for (guint i = 0; i < LOAD_OPERATION_COUNT; i++)
+    {
+        load->targets[i] = g_ptr_array_new_with_free_func(FreeTarget);
+    }
+
+    for (guint i = 0; i < load->mock.attributes->len; i++)
+    {
+        const struct MockBluezAttribute *attribute = g_ptr_array_index(load->mock.attributes, i);
+        if (!IsInServices(load, attribute))
+        {
+            continue;
+        }
+        if (MockBluezAttributeHasFlag(attribute, "read"))
+        {
+            AddTarget(load, attribute, LOAD_OPERATION_READ);
+        }
+        if (MockBluezAttributeHasFlag(attribute, "write") ||
+            MockBluezAttributeHasFlag(attribute, "write-without-response"))
+        {
+            AddTarget(load, attribute, LOAD_OPERATION_WRITE);
+        }
+        if (MockBluezAttributeHasFlag(attribute, "notify") &&
+            !MockBluezAttributeHasFlag(attribute, "notify-acquired"))
+        {
+            AddTarget(load, attribute, LOAD_OPERATION_NOTIFY);
+        }
+    }
+}
+
+static GVariant *BuildOptions(const struct VirtualCentral *central, bool write)
+{
+    const struct LoadOptions *options = &central->load->options;
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+    if (!options->anonymous)
+    {
+        g_variant_builder_add(
+            &builder, "{sv}", "device", g_variant_new_object_path(central->device));
+    }
+    if (options->mtu > 0)
+    {
+        g_variant_builder_add(&builder, "{sv}", "mtu", g_variant_new_uint16(options->mtu));
+    }
+    if (write)
+    {
+        g_variant_builder_add(&builder, "{sv}", "type", g_variant_new_string(options->writeType));
+    }
+    else
+    {
+        g_variant_builder_add(&builder, "{sv}", "offset", g_variant_new_uint16(0));
+    }
+    return g_variant_builder_end(&builder);
+}
+
+static void RecordError(struct Load *load, struct LoadTarget *target, GError *error)
+{
+    target->errors++;
+    gchar *name = g_dbus_error_get_remote_error(error);
+    if (name == NULL)
+    {
+        // Timeouts and disconnections are local errors
+        name = g_strdup(g_quark_to_string(error->domain));
+    }
+    gpointer count = g_hash_table_lookup(load->errorNames, name);
+    g_hash_table_insert(load->errorNames, name, GUINT_TO_POINTER(GPOINTER_TO_UINT(count) + 1));
+    g_error_free(error);
+}
+
+static void ReportTarget(const struct LoadTarget *target, gint64 elapsedUs)
+{
+    g_print(
+        "%-8s %-36s %-42s n=%u err=%" G_GUINT64_FORMAT " rate=%.0f/s p50=%" G_GINT64_FORMAT
+        "us p90=%" G_GINT64_FORMAT "us p99=%" G_GINT64_FORMAT "us p99.9=%" G_GINT64_FORMAT
+        "us max=%" G_GINT64_FORMAT "us\n",
+        OperationNames[target->operation],
+        (target->attribute != NULL) ? target->attribute->uuid : "total",
+        (target->attribute != NULL) ? target->attribute->path : "",
+        target->latencies->len,
+        target->errors,
+        target->latencies->len * (double)G_USEC_PER_SEC / elapsedUs,
+        BenchStatsPercentile(target->latencies, 500),
+        BenchStatsPercentile(target->latencies, 900),
+        BenchStatsPercentile(target->latencies, 990),
+        BenchStatsPercentile(target->latencies, 999),
+        BenchStatsPercentile(target->latencies, 1000));
+}
+
+static void Report(struct Load *load)
+{
+    const gint64 elapsedUs = MAX(load->elapsedUs, 1);
+    guint64 totalCalls = 0;
+    guint64 totalErrors = 0;
+    for (guint op = 0; op < LOAD_OPERATION_COUNT; op++)
+    {
+        GPtrArray *targets = load->targets[op];
+        struct LoadTarget total = {
+            .operation = op,
+            .latencies = g_array_new(FALSE, FALSE, sizeof(gint64)),
+        };
+        for (guint i = 0; i < targets->len; i++)
+        {
+            struct LoadTarget *target = g_ptr_array_index(targets, i);
+            g_array_sort(target->latencies, BenchStatsCompareLatency);
+            ReportTarget(target, elapsedUs);
+            g_array_append_vals(total.latencies, target->latencies->data, target->latencies->len);
+            total.errors += target->errors;
+        }
+        if (targets->len > 1)
+        {
+            g_array_sort(total.latencies, BenchStatsCompareLatency);
+            ReportTarget(&total, elapsedUs);
+        }
+        totalCalls += total.latencies->len + total.errors;
+        totalErrors += total.errors;
+        g_array_free(total.latencies, TRUE);
+    }
+
+    guint64 minCompleted = G_MAXUINT64;
+    guint64 maxCompleted = 0;
+    for (gint i = 0; i < load->options.clients; i++)
+    {
+        minCompleted = MIN(minCompleted, load->centrals[i].completed);
+        maxCompleted = MAX(maxCompleted, load->centrals[i].completed);
+    }
+    g_print(
+        "total    calls=%" G_GUINT64_FORMAT " err=%" G_GUINT64_FORMAT " (%.2f%%) rate=%.0f/s"
+        " per-client min=%" G_GUINT64_FORMAT " max=%" G_GUINT64_FORMAT
+        " notifications=%" G_GUINT64_FORMAT " (%.0f/s)\n",
+        totalCalls,
+        totalErrors,
+        (totalCalls > 0) ? 100.0 * totalErrors / totalCalls : 0.0,
+        totalCalls * (double)G_USEC_PER_SEC / elapsedUs,
+        minCompleted,
+        maxCompleted,
+        load->notifications,
+        load->notifications * (double)G_USEC_PER_SEC / elapsedUs);
+
+    GHashTableIter iter;
+    gpointer name;
+    gpointer count;
+    g_hash_table_iter_init(&iter, load->errorNames);
+    while (g_hash_table_iter_next(&iter, &name, &count))
+    {
+        g_print("errors   %-36s n=%u\n", (const gchar *)name, GPOINTER_TO_UINT(count));
+    }
+}
+
+static gboolean DrainTimeoutExpired(gpointer userData)
+{
+    struct Load *load = userData;
+    load->timeoutSource = 0;
+    g_printerr("%u calls still outstanding after %ds\n", load->inFlight, DRAIN_TIMEOUT_S);
+    Report(load);
+    Finish(load, EXIT_FAILURE);
+    return G_SOURCE_REMOVE;
+}
+
+static void CheckDrained(struct Load *load)
+{
+    if (!load->stopping || load->inFlight > 0 || load->finishing)
+    {
+        return;
+    }
+    if (load->timeoutSource != 0)
+    {
+        g_source_remove(load->timeoutSource);
+        load->timeoutSource = 0;
+    }
+    Report(load);
+    Finish(load, EXIT_SUCCESS);
+}
+
+static void CallCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct LoadCall *call = userData;
+    struct VirtualCentral *central = call->central;
+    struct Load *load = central->load;
+    const gint64 latency = g_get_monotonic_time() - call->startTime;
+
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL)
+    {
+        RecordError(load, call->target, error);
+    }
+    else
+    {
+        g_variant_unref(result);
+        g_array_append_val(call->target->latencies, latency);
+    }
+    g_free(call);
+
+    central->inFlight--;
+    load->inFlight--;
+    central->completed++;
+    if (load->stopping || load->finishing)
+    {
+        CheckDrained(load);
+        return;
+    }
+    IssueCall(central);
+}
+
+static enum LoadOperation PickOperation(struct Load *load)
+{
+    guint pick = g_rand_int_range(load->rand, 0, load->totalWeight);
+    for (guint op = 0; op < LOAD_OPERATION_COUNT; op++)
+    {
+        if (pick < load->weights[op])
+        {
+            return op;
+        }
+        pick -= load->weights[op];
+    }
+    return LOAD_OPERATION_READ;
+}
+
+/*
+ * Each central toggles its own subscription. bluetoothd would only forward the first StartNotify
+ * and the last StopNotify across all centrals, so this deliberately overstates notify traffic.
+ */
+static void IssueCall(struct VirtualCentral *central)
+{
+    struct Load *load = central->load;
+    const enum LoadOperation op = PickOperation(load);
+    GPtrArray *targets = load->targets[op];
+    struct LoadCall *call = g_new0(struct LoadCall, 1);
+    call->central = central;
+    call->target =
+        g_ptr_array_index(targets, g_rand_int_range(load->rand, 0, (gint32)targets->len));
+
+    const struct MockBluezAttribute *attribute = call->target->attribute;
+    const gchar *method;
+    GVariant *parameters;
+    switch (op)
+    {
+    case LOAD_OPERATION_READ:
+        method = "ReadValue";
+        parameters = g_variant_new("(@a{sv})", BuildOptions(central, false));
+        break;
+
+    case LOAD_OPERATION_WRITE:
+    {
+        // Every writable characteristic of the default services accepts a level from 0 to 2
+        const guint8 value = g_rand_int_range(load->rand, 0, 3);
+        method = "WriteValue";
+        parameters = g_variant_new(
+            "(@ay@a{sv})",
+            g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, &value, 1, sizeof(value)),
+            BuildOptions(central, true));
+        break;
+    }
+
+    default:
+    {
+        bool *subscribed = &central->subscribed[call->target->notifyIndex];
+        method = *subscribed ? "StopNotify" : "StartNotify";
+        parameters = NULL;
+        *subscribed = !*subscribed;
+        break;
+    }
+    }
+
+    central->inFlight++;
+    load->inFlight++;
+    call->startTime = g_get_monotonic_time();
+    g_dbus_connection_call(
+        load->conn,
+        load->mock.appSender,
+        attribute->path,
+        attribute->interface,
+        method,
+        parameters,
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        CALL_TIMEOUT_MS,
+        NULL,
+        CallCallback,
+        call);
+}
+
+static void NotificationHandler(
+    GDBusConnection *conn,
+    const gchar *sender,
+    const gchar *objectPath,
+    const gchar *interfaceName,
+    const gchar *signalName,
+    GVariant *parameters,
+    gpointer userData)
+{
+    struct Load *load = userData;
+    GVariant *changed = g_variant_get_child_value(parameters, 1);
+    GVariant *value = g_variant_lookup_value(changed, "Value", G_VARIANT_TYPE_BYTESTRING);
+    if (value != NULL)
+    {
+        load->notifications++;
+        g_variant_unref(value);
+    }
+    g_variant_unref(changed);
+}
+
+static gboolean DurationExpired(gpointer userData)
+{
+    struct Load *load = userData;
+    load->elapsedUs = g_get_monotonic_time() - load->startTime;
+    load->stopping = true;
+    load->timeoutSource = g_timeout_add_seconds(DRAIN_TIMEOUT_S, DrainTimeoutExpired, load);
+    CheckDrained(load);
+    return G_SOURCE_REMOVE;
+}
+
+static void HostReady(gpointer userData)
+{
+    struct Load *load = userData;
+    if (load->finishing)
+    {
+        return;
+    }
+    g_source_remove(load->timeoutSource);
+    load->timeoutSource = 0;
+
+    FindTargets(load);
+    for (guint op = 0; op < LOAD_OPERATION_COUNT; op++)
+    {
+        if (load->weights[op] > 0 && load->targets[op]->len == 0)
+        {
+            g_printerr(
+                "No %s targets in services %s\n", OperationNames[op], load->options.services);
+            Finish(load, EXIT_FAILURE);
+            return;
+        }
+    }
+
+    g_print(
+        "load     clients=%d depth=%d duration=%ds mix=%s services=%s device=%s write=%s\n",
+        load->options.clients,
+        load->options.depth,
+        load->options.durationSeconds,
+        load->options.mix,
+        load->options.services,
+        load->options.anonymous ? "none" : "per-client",
+        load->options.writeType);
+
+    load->notificationSubscription = g_dbus_connection_signal_subscribe(
+        load->conn,
+        load->mock.appSender,
+        "org.freedesktop.DBus.Properties",
+        "PropertiesChanged",
+        NULL,
+        "org.bluez.GattCharacteristic1",
+        G_DBUS_SIGNAL_FLAGS_NONE,
+        NotificationHandler,
+        load,
+        NULL);
+
+    const guint numNotifyTargets = load->targets[LOAD_OPERATION_NOTIFY]->len;
+    load->centrals = g_new0(struct VirtualCentral, load->options.clients);
+    for (gint i = 0; i < load->options.clients; i++)
+    {
+        struct VirtualCentral *central = &load->centrals[i];
+        central->load = load;
+        // Locally administered addresses, so they can't clash with a real device
+        central->device = g_strdup_printf(
+            "%s/dev_02_00_00_00_%02X_%02X", MOCK_BLUEZ_ADAPTER_PATH, (i >> 8) & 0xff, i & 0xff);
+        central->subscribed = g_new0(bool, MAX(numNotifyTargets, 1));
+    }
+
+    load->startTime = g_get_monotonic_time();
+    g_timeout_add_seconds(load->options.durationSeconds, DurationExpired, load);
+    for (gint d = 0; d < load->options.depth; d++)
+    {
+        for (gint i = 0; i < load->options.clients; i++)
+        {
+            IssueCall(&load->centrals[i]);
+        }
+    }
+}
+
+static gboolean StartupTimeoutExpired(gpointer userData)
+{
+    struct Load *load = userData;
+    load->timeoutSource = 0;
+    g_printerr("Host didn't register within %ds\n", load->options.timeoutSeconds);
+    Finish(load, EXIT_FAILURE);
+    return G_SOURCE_REMOVE;
+}
+
+static void HostExited(GPid pid, gint status, gpointer userData)
+{
+    struct Load *load = userData;
+    load->hostRunning = false;
+    g_spawn_close_pid(pid);
+    if (!load->finishing)
+    {
+        g_printerr("Host exited unexpectedly\n");
+        load->finishing = true;
+        load->exitStatus = EXIT_FAILURE;
+    }
+    g_main_loop_quit(load->loop);
+}
+
+static bool SpawnHost(struct Load *load, gchar **argv, GError **error)
+{
+    // The component prints every battery read on stdout, so only its stderr (logs) is kept
+    const GSpawnFlags flags = G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL;
+    if (!g_spawn_async(NULL, argv, NULL, flags, NULL, NULL, &load->hostPid, error))
+    {
+        return false;
+    }
+    load->hostRunning = true;
+    g_child_watch_add(load->hostPid, HostExited, load);
+    load->timeoutSource =
+        g_timeout_add_seconds(load->options.timeoutSeconds, StartupTimeoutExpired, load);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    struct Load load = {
+        .options = {
+            .clients = 16,
+            .depth = 1,
+            .durationSeconds = 10,
+            .timeoutSeconds = 30,
+            .mtu = 247,
+        },
+    };
+    gchar **hostArgv = NULL;
+    const GOptionEntry entries[] = {
+        {"clients", 'c', 0, G_OPTION_ARG_INT, &load.options.clients,
+         "Virtual centrals, each with its own device path", "N"},
+        {"depth", 'd', 0, G_OPTION_ARG_INT, &load.options.depth,
+         "Calls each central keeps in flight", "N"},
+        {"duration", 's', 0, G_OPTION_ARG_INT, &load.options.durationSeconds,
+         "Seconds to generate load for", "S"},
+        {"mix", 'm', 0, G_OPTION_ARG_STRING, &load.options.mix,
+         "Relative weights of the operations (default " DEFAULT_MIX ")", "OP=W,..."},
+        {"services", 0, 0, G_OPTION_ARG_STRING, &load.options.services,
+         "Services whose attributes are targeted (default " DEFAULT_SERVICES ")", "NAME,..."},
+        {"write-type", 0, 0, G_OPTION_ARG_STRING, &load.options.writeType,
+         "WriteValue type option: request (default), command or reliable", "TYPE"},
+        {"mtu", 0, 0, G_OPTION_ARG_INT, &load.options.mtu,
+         "MTU option passed with reads and writes, 0 to leave it out", "N"},
+        {"anonymous", 0, 0, G_OPTION_ARG_NONE, &load.options.anonymous,
+         "Leave out the device option, like bluetoothd before 5.48", NULL},
+        {"seed", 0, 0, G_OPTION_ARG_INT, &load.options.seed,
+         "Seed for picking operations, so runs can be repeated", "N"},
+        {"timeout", 't', 0, G_OPTION_ARG_INT, &load.options.timeoutSeconds,
+         "Seconds to wait for the host to register", "S"},
+        {G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &hostArgv, NULL, NULL},
+        {NULL},
+    };
+
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("-- HOST [ARGS...]");
+    g_option_context_set_summary(
+        context,
+        "Loads HOST from many virtual centrals through a mock bluetoothd on the system bus given "
+        "by DBUS_SYSTEM_BUS_ADDRESS.");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+    if (load.options.mix == NULL)
+    {
+        load.options.mix = g_strdup(DEFAULT_MIX);
+    }
+    if (load.options.services == NULL)
+    {
+        load.options.services = g_strdup(DEFAULT_SERVICES);
+    }
+    if (load.options.writeType == NULL)
+    {
+        load.options.writeType = g_strdup("request");
+    }
+    if (hostArgv == NULL || load.options.clients <= 0 || load.options.clients > 0xffff ||
+        load.options.depth <= 0 || load.options.durationSeconds <= 0)
+    {
+        g_printerr("A host command and positive client, depth and duration counts are required\n");
+        return EXIT_FAILURE;
+    }
+    if (!ParseMix(&load, load.options.mix))
+    {
+        g_printerr("Invalid mix %s\n", load.options.mix);
+        return EXIT_FAILURE;
+    }
+
+    load.rand = (load.options.seed != 0) ? g_rand_new_with_seed(load.options.seed) : g_rand_new();
+    load.errorNames = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    load.loop = g_main_loop_new(NULL, FALSE);
+    load.conn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+    if (load.conn == NULL ||
+        !MockBluezStart(&load.mock, load.conn, true, HostReady, &load, &error) ||
+        !SpawnHost(&load, hostArgv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    g_main_loop_run(load.loop);
+
+    g_strfreev(hostArgv);
+    g_main_loop_unref(load.loop);
+    return load.exitStatus;
+}
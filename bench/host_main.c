@@ -0,0 +1,132 @@
+/*
+ * Runs bluetoothServicesComponent as a plain process for benchmarking. The component is started the
+ * same way component.c does it, with the shim's event queue standing in for the Legato event loop,
+ * and a fake battery app feeds the data hub so notifications have something to carry.
+ */
+
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+
+// GLib
+#include <glib.h>
+#include <glib-unix.h>
+
+// Legato shim
+#include "legato.h"
+#include "interfaces.h"
+#include "bench_shim.h"
+
+// Component
+#include "primary.h"
+#include "executor.h"
+#include "legato_bridge.h"
+#include "gatt_stats.h"
+#include "value_cache.h"
+
+#define ENV_BATTERY_FEED_HZ "BENCH_BATTERY_FEED_HZ"
+
+static gboolean BatteryFeedTick(gpointer userData)
+{
+    static int percent = 50;
+    static int step = 1;
+
+    if (percent + step > 100 || percent + step < 0)
+    {
+        step = -step;
+    }
+    percent += step;
+
+    gchar json[32];
+    g_snprintf(json, sizeof(json), "{\"percent\":%d}", percent);
+    BenchShimFeedJson("/app/battery/value", json);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean ReloadSignalHandler(gpointer userData)
+{
+    BenchShimReloadConfig();
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean QuitSignalHandler(gpointer userData)
+{
+    g_main_loop_quit(userData);
+    return G_SOURCE_REMOVE;
+}
+
+int main(int argc, char **argv)
+{
+    BenchShimInit();
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    g_unix_signal_add(SIGTERM, QuitSignalHandler, loop);
+    g_unix_signal_add(SIGINT, QuitSignalHandler, loop);
+    g_unix_signal_add(SIGHUP, ReloadSignalHandler, NULL);
+
+    struct LegatoBridgeConfig bridgeConfig;
+    LegatoBridgeConfigFromEnv(&bridgeConfig);
+    LegatoBridgeStart(&bridgeConfig);
+    GattStatsAddSummary("legatoLoop", LegatoBridgeSummarize);
+
+    InitializeBluetoothServices();
+
+    const char *feedHz = getenv(ENV_BATTERY_FEED_HZ);
+    const guint hz = (feedHz != NULL) ? (guint)strtoul(feedHz, NULL, 10) : 0;
+    if (hz > 0)
+    {
+        g_timeout_add(MAX(1000 / hz, 1), BatteryFeedTick, NULL);
+    }
+
+    g_main_loop_run(loop);
+
+    BenchShimLogPushCounts();
+    static const char *const queueNames[EXECUTOR_QUEUE_COUNT] = {
+        [EXECUTOR_QUEUE_MODEM] = "modem",
+        [EXECUTOR_QUEUE_DATAHUB] = "datahub",
+        [EXECUTOR_QUEUE_STORAGE] = "storage",
+    };
+    for (guint i = 0; i < EXECUTOR_QUEUE_COUNT; i++)
+    {
+        struct ExecutorStats executor;
+        ExecutorGetStats(i, &executor);
+        fprintf(
+            stderr,
+            "host: %s provider jobs %" G_GUINT64_FORMAT " rejected %" G_GUINT64_FORMAT
+            " timed out %" G_GUINT64_FORMAT " max queued %u max wait %" G_GINT64_FORMAT
+            " us max run %" G_GINT64_FORMAT " us\n",
+            queueNames[i],
+            executor.submitted,
+            executor.rejected,
+            executor.timedOut,
+            executor.maxQueued,
+            executor.maxWaitUs,
+            executor.maxRunUs);
+    }
+    struct LegatoBridgeStats bridge;
+    LegatoBridgeGetStats(&bridge);
+    fprintf(
+        stderr,
+        "host: legato wakeups %" G_GUINT64_FORMAT " events %" G_GUINT64_FORMAT
+        " max per wakeup %u budget exhausted %" G_GUINT64_FORMAT " mean dispatch %"
+        G_GINT64_FORMAT " us max dispatch %" G_GINT64_FORMAT " us\n",
+        bridge.wakeups,
+        bridge.iterations,
+        bridge.maxIterationsPerWakeup,
+        bridge.budgetExhausted,
+        (bridge.wakeups > 0) ? bridge.totalDispatchUs / (gint64)bridge.wakeups : 0,
+        bridge.maxDispatchUs);
+    struct ValueCacheStats cache;
+    ValueCacheGetTotals(&cache);
+    fprintf(
+        stderr,
+        "host: value cache hits %" G_GUINT64_FORMAT " misses %" G_GUINT64_FORMAT "\n",
+        cache.hits,
+        cache.misses);
+    g_main_loop_unref(loop);
+    return 0;
+}
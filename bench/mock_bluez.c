@@ -0,0 +1,529 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// GLib
+#include <glib.h>
+#include <gio/gio.h>
+
+// Local
+#include "mock_bluez.h"
+
+#define BLUEZ_BUS_NAME "org.bluez"
+#define DBUS_NAME_FLAG_DO_NOT_QUEUE 4
+#define DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER 1
+#define APPLICATION_CALL_TIMEOUT_MS 5000
+
+static const gchar MockBluezXml[] =
+    "<node>"
+    "  <interface name='org.freedesktop.DBus.ObjectManager'>"
+    "    <method name='GetManagedObjects'>"
+    "      <arg name='objects' type='a{oa{sa{sv}}}' direction='out'/>"
+    "    </method>"
+    "    <signal name='InterfacesAdded'>"
+    "      <arg name='object' type='o'/>"
+    "      <arg name='interfaces' type='a{sa{sv}}'/>"
+    "    </signal>"
+    "    <signal name='InterfacesRemoved'>"
+    "      <arg name='object' type='o'/>"
+    "      <arg name='interfaces' type='as'/>"
+    "    </signal>"
+    "  </interface>"
+    "  <interface name='org.bluez.Adapter1'>"
+    "    <property name='Address' type='s' access='read'/>"
+    "    <property name='Name' type='s' access='read'/>"
+    "    <property name='Alias' type='s' access='readwrite'/>"
+    "    <property name='Powered' type='b' access='readwrite'/>"
+    "    <property name='Discoverable' type='b' access='readwrite'/>"
+    "    <property name='Pairable' type='b' access='readwrite'/>"
+    "    <property name='Discovering' type='b' access='read'/>"
+    "    <property name='UUIDs' type='as' access='read'/>"
+    "  </interface>"
+    "  <interface name='org.bluez.GattManager1'>"
+    "    <method name='RegisterApplication'>"
+    "      <arg name='application' type='o' direction='in'/>"
+    "      <arg name='options' type='a{sv}' direction='in'/>"
+    "    </method>"
+    "    <method name='UnregisterApplication'>"
+    "      <arg name='application' type='o' direction='in'/>"
+    "    </method>"
+    "  </interface>"
+    "  <interface name='org.bluez.LEAdvertisingManager1'>"
+    "    <method name='RegisterAdvertisement'>"
+    "      <arg name='advertisement' type='o' direction='in'/>"
+    "      <arg name='options' type='a{sv}' direction='in'/>"
+    "    </method>"
+    "    <method name='UnregisterAdvertisement'>"
+    "      <arg name='service' type='o' direction='in'/>"
+    "    </method>"
+    "    <property name='ActiveInstances' type='y' access='read'/>"
+    "    <property name='SupportedInstances' type='y' access='read'/>"
+    "    <property name='SupportedIncludes' type='as' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+struct PendingRegistration
+{
+    struct MockBluez *mock;
+    GDBusMethodInvocation *invocation;
+};
+
+static GVariant *GetAdapterProperty(struct MockBluez *mock, const gchar *name)
+{
+    if (strcmp(name, "Address") == 0)
+    {
+        return g_variant_new_string("00:00:5E:00:53:00");
+    }
+    if (strcmp(name, "Name") == 0 || strcmp(name, "Alias") == 0)
+    {
+        return g_variant_new_string("mock-hci0");
+    }
+    if (strcmp(name, "Powered") == 0)
+    {
+        return g_variant_new_boolean(mock->powered);
+    }
+    if (strcmp(name, "UUIDs") == 0)
+    {
+        return g_variant_new_strv(NULL, 0);
+    }
+    // Discoverable, Pairable and Discovering
+    return g_variant_new_boolean(FALSE);
+}
+
+static GVariant *GetAdvertisingManagerProperty(struct MockBluez *mock, const gchar *name)
+{
+    if (strcmp(name, "ActiveInstances") == 0)
+    {
+        return g_variant_new_byte(mock->advertisementRegistered ? 1 : 0);
+    }
+    if (strcmp(name, "SupportedInstances") == 0)
+    {
+        return g_variant_new_byte(5);
+    }
+    return g_variant_new_strv(NULL, 0);
+}
+
+static GVariant *GetProperty(
+    GDBusConnection *conn,
+    const gchar *sender,
+    const gchar *objectPath,
+    const gchar *interfaceName,
+    const gchar *propertyName,
+    GError **error,
+    gpointer userData)
+{
+    struct MockBluez *mock = userData;
+    if (strcmp(interfaceName, "org.bluez.Adapter1") == 0)
+    {
+        return GetAdapterProperty(mock, propertyName);
+    }
+    return GetAdvertisingManagerProperty(mock, propertyName);
+}
+
+static void EmitAdapterPropertyChanged(struct MockBluez *mock, const gchar *name)
+{
+    GVariantBuilder changed;
+    g_variant_builder_init(&changed, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&changed, "{sv}", name, GetAdapterProperty(mock, name));
+    g_dbus_connection_emit_signal(
+        mock->conn,
+        NULL,
+        MOCK_BLUEZ_ADAPTER_PATH,
+        "org.freedesktop.DBus.Properties",
+        "PropertiesChanged",
+        g_variant_new(
+            "(sa{sv}@as)", "org.bluez.Adapter1", &changed, g_variant_new_strv(NULL, 0)),
+        NULL);
+}
+
+static gboolean SetProperty(
+    GDBusConnection *conn,
+    const gchar *sender,
+    const gchar *objectPath,
+    const gchar *interfaceName,
+    const gchar *propertyName,
+    GVariant *value,
+    GError **error,
+    gpointer userData)
+{
+    struct MockBluez *mock = userData;
+    if (strcmp(propertyName, "Powered") == 0)
+    {
+        const bool powered = g_variant_get_boolean(value);
+        if (powered != mock->powered)
+        {
+            mock->powered = powered;
+            EmitAdapterPropertyChanged(mock, propertyName);
+        }
+    }
+    return TRUE;
+}
+
+static GVariant *BuildInterfaceProperties(struct MockBluez *mock, const GDBusInterfaceInfo *info)
+{
+    GVariantBuilder properties;
+    g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+    for (guint i = 0; info->properties != NULL && info->properties[i] != NULL; i++)
+    {
+        const gchar *name = info->properties[i]->name;
+        g_variant_builder_add(
+            &properties,
+            "{sv}",
+            name,
+            GetProperty(mock->conn, NULL, NULL, info->name, name, NULL, mock));
+    }
+    return g_variant_builder_end(&properties);
+}
+
+static GVariant *BuildManagedObjects(struct MockBluez *mock)
+{
+    GVariantBuilder interfaces;
+    g_variant_builder_init(&interfaces, G_VARIANT_TYPE("a{sa{sv}}"));
+    for (guint i = 0; mock->nodeInfo->interfaces[i] != NULL; i++)
+    {
+        const GDBusInterfaceInfo *info = mock->nodeInfo->interfaces[i];
+        if (g_str_has_prefix(info->name, "org.bluez."))
+        {
+            g_variant_builder_add(
+                &interfaces, "{s@a{sv}}", info->name, BuildInterfaceProperties(mock, info));
+        }
+    }
+
+    GVariantBuilder objects;
+    g_variant_builder_init(&objects, G_VARIANT_TYPE("a{oa{sa{sv}}}"));
+    g_variant_builder_add(&objects, "{oa{sa{sv}}}", MOCK_BLUEZ_ADAPTER_PATH, &interfaces);
+    return g_variant_builder_end(&objects);
+}
+
+static void CheckReady(struct MockBluez *mock)
+{
+    if (mock->applicationRegistered && mock->advertisementRegistered && mock->ready != NULL)
+    {
+        MockBluezReadyFunc ready = mock->ready;
+        mock->ready = NULL;
+        ready(mock->readyData);
+    }
+}
+
+static void FreeAttribute(gpointer data)
+{
+    struct MockBluezAttribute *attribute = data;
+    g_free(attribute->path);
+    g_free(attribute->uuid);
+    g_strfreev(attribute->flags);
+    g_free(attribute);
+}
+
+static void AddAttribute(
+    struct MockBluez *mock, const gchar *path, const gchar *interface, GVariant *properties)
+{
+    struct MockBluezAttribute *attribute = g_new0(struct MockBluezAttribute, 1);
+    attribute->path = g_strdup(path);
+    attribute->interface = interface;
+    if (!g_variant_lookup(properties, "UUID", "s", &attribute->uuid))
+    {
+        attribute->uuid = g_strdup("");
+    }
+    if (!g_variant_lookup(properties, "Flags", "^as", &attribute->flags))
+    {
+        attribute->flags = g_new0(gchar *, 1);
+    }
+    g_ptr_array_add(mock->attributes, attribute);
+}
+
+static void ApplicationObjectsCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct PendingRegistration *pending = userData;
+    struct MockBluez *mock = pending->mock;
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL)
+    {
+        g_dbus_method_invocation_return_dbus_error(
+            pending->invocation, "org.bluez.Error.Failed", error->message);
+        g_error_free(error);
+        g_free(pending);
+        return;
+    }
+
+    g_ptr_array_set_size(mock->attributes, 0);
+    GVariantIter *objects;
+    g_variant_get(result, "(a{oa{sa{sv}}})", &objects);
+    const gchar *path;
+    GVariant *interfaces;
+    while (g_variant_iter_next(objects, "{&o@a{sa{sv}}}", &path, &interfaces))
+    {
+        GVariant *properties;
+        properties = g_variant_lookup_value(
+            interfaces, "org.bluez.GattCharacteristic1", G_VARIANT_TYPE_VARDICT);
+        if (properties != NULL)
+        {
+            AddAttribute(mock, path, "org.bluez.GattCharacteristic1", properties);
+            g_variant_unref(properties);
+        }
+        properties = g_variant_lookup_value(
+            interfaces, "org.bluez.GattDescriptor1", G_VARIANT_TYPE_VARDICT);
+        if (properties != NULL)
+        {
+            AddAttribute(mock, path, "org.bluez.GattDescriptor1", properties);
+            g_variant_unref(properties);
+        }
+        g_variant_unref(interfaces);
+    }
+    g_variant_iter_free(objects);
+    g_variant_unref(result);
+
+    mock->applicationRegistered = true;
+    mock->applicationRegisteredTime = g_get_monotonic_time();
+    g_dbus_method_invocation_return_value(pending->invocation, NULL);
+    g_free(pending);
+    CheckReady(mock);
+}
+
+static void AdvertisementPropertiesCallback(GObject *source, GAsyncResult *res, gpointer userData)
+{
+    struct PendingRegistration *pending = userData;
+    struct MockBluez *mock = pending->mock;
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL)
+    {
+        g_dbus_method_invocation_return_dbus_error(
+            pending->invocation, "org.bluez.Error.Failed", error->message);
+        g_error_free(error);
+        g_free(pending);
+        return;
+    }
+    g_variant_unref(result);
+
+    mock->advertisementRegistered = true;
+    mock->advertisementRegisteredTime = g_get_monotonic_time();
+    g_dbus_method_invocation_return_value(pending->invocation, NULL);
+    g_free(pending);
+    CheckReady(mock);
+}
+
+static void CallApplication(
+    struct MockBluez *mock,
+    GDBusMethodInvocation *invocation,
+    const gchar *path,
+    const gchar *interface,
+    const gchar *method,
+    GVariant *parameters,
+    GAsyncReadyCallback callback)
+{
+    struct PendingRegistration *pending = g_new0(struct PendingRegistration, 1);
+    pending->mock = mock;
+    pending->invocation = invocation;
+    g_dbus_connection_call(
+        mock->conn,
+        g_dbus_method_invocation_get_sender(invocation),
+        path,
+        interface,
+        method,
+        parameters,
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        APPLICATION_CALL_TIMEOUT_MS,
+        NULL,
+        callback,
+        pending);
+}
+
+static void HandleMethodCall(
+    GDBusConnection *conn,
+    const gchar *sender,
+    const gchar *objectPath,
+    const gchar *interfaceName,
+    const gchar *methodName,
+    GVariant *parameters,
+    GDBusMethodInvocation *invocation,
+    gpointer userData)
+{
+    struct MockBluez *mock = userData;
+    if (strcmp(methodName, "GetManagedObjects") == 0)
+    {
+        g_dbus_method_invocation_return_value(
+            invocation, g_variant_new("(@a{oa{sa{sv}}})", BuildManagedObjects(mock)));
+    }
+    else if (strcmp(methodName, "RegisterApplication") == 0)
+    {
+        if (mock->applicationRegistered)
+        {
+            g_dbus_method_invocation_return_dbus_error(
+                invocation, "org.bluez.Error.AlreadyExists", "Already Exists");
+            return;
+        }
+        const gchar *path;
+        g_variant_get(parameters, "(&o@a{sv})", &path, NULL);
+        g_free(mock->appSender);
+        mock->appSender = g_strdup(sender);
+        g_free(mock->appPath);
+        mock->appPath = g_strdup(path);
+        CallApplication(
+            mock,
+            invocation,
+            path,
+            "org.freedesktop.DBus.ObjectManager",
+            "GetManagedObjects",
+            NULL,
+            ApplicationObjectsCallback);
+    }
+    else if (strcmp(methodName, "RegisterAdvertisement") == 0)
+    {
+        if (!mock->powered)
+        {
+            g_dbus_method_invocation_return_dbus_error(
+                invocation, "org.bluez.Error.NotReady", "Not Ready");
+            return;
+        }
+        const gchar *path;
+        g_variant_get(parameters, "(&o@a{sv})", &path, NULL);
+        CallApplication(
+            mock,
+            invocation,
+            path,
+            "org.freedesktop.DBus.Properties",
+            "GetAll",
+            g_variant_new("(s)", "org.bluez.LEAdvertisement1"),
+            AdvertisementPropertiesCallback);
+    }
+    else if (strcmp(methodName, "UnregisterApplication") == 0)
+    {
+        mock->applicationRegistered = false;
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    }
+    else if (strcmp(methodName, "UnregisterAdvertisement") == 0)
+    {
+        mock->advertisementRegistered = false;
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    }
+    else
+    {
+        g_dbus_method_invocation_return_dbus_error(
+            invocation, "org.freedesktop.DBus.Error.UnknownMethod", methodName);
+    }
+}
+
+static const GDBusInterfaceVTable MockBluezVTable = {
+    .method_call = HandleMethodCall,
+    .get_property = GetProperty,
+    .set_property = SetProperty,
+};
+
+static guint RegisterInterface(
+    struct MockBluez *mock, const gchar *path, const gchar *interface, GError **error)
+{
+    return g_dbus_connection_register_object(
+        mock->conn,
+        path,
+        g_dbus_node_info_lookup_interface(mock->nodeInfo, interface),
+        &MockBluezVTable,
+        mock,
+        NULL,
+        error);
+}
+
+static bool RequestBluezName(struct MockBluez *mock, GError **error)
+{
+    GVariant *reply = g_dbus_connection_call_sync(
+        mock->conn,
+        "org.freedesktop.DBus",
+        "/org/freedesktop/DBus",
+        "org.freedesktop.DBus",
+        "RequestName",
+        g_variant_new("(su)", BLUEZ_BUS_NAME, DBUS_NAME_FLAG_DO_NOT_QUEUE),
+        G_VARIANT_TYPE("(u)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        NULL,
+        error);
+    if (reply == NULL)
+    {
+        return false;
+    }
+
+    guint32 result;
+    g_variant_get(reply, "(u)", &result);
+    g_variant_unref(reply);
+    if (result != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER)
+    {
+        g_set_error(
+            error, G_IO_ERROR, G_IO_ERROR_EXISTS, "%s is already owned on this bus",
+            BLUEZ_BUS_NAME);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Exports the mock objects and takes the org.bluez name. The ready function is called once the
+ * application and its advertisement have both been registered.
+ */
+bool MockBluezStart(
+    struct MockBluez *mock,
+    GDBusConnection *conn,
+    bool powered,
+    MockBluezReadyFunc ready,
+    gpointer readyData,
+    GError **error)
+{
+    memset(mock, 0, sizeof(*mock));
+    mock->conn = g_object_ref(conn);
+    mock->powered = powered;
+    mock->ready = ready;
+    mock->readyData = readyData;
+    mock->attributes = g_ptr_array_new_with_free_func(FreeAttribute);
+    mock->nodeInfo = g_dbus_node_info_new_for_xml(MockBluezXml, error);
+    if (mock->nodeInfo == NULL)
+    {
+        return false;
+    }
+
+    mock->objectManagerRegistration =
+        RegisterInterface(mock, "/", "org.freedesktop.DBus.ObjectManager", error);
+    if (mock->objectManagerRegistration == 0)
+    {
+        return false;
+    }
+    mock->adapterRegistration =
+        RegisterInterface(mock, MOCK_BLUEZ_ADAPTER_PATH, "org.bluez.Adapter1", error);
+    if (mock->adapterRegistration == 0)
+    {
+        return false;
+    }
+    mock->gattManagerRegistration =
+        RegisterInterface(mock, MOCK_BLUEZ_ADAPTER_PATH, "org.bluez.GattManager1", error);
+    if (mock->gattManagerRegistration == 0)
+    {
+        return false;
+    }
+    mock->advertisingManagerRegistration = RegisterInterface(
+        mock, MOCK_BLUEZ_ADAPTER_PATH, "org.bluez.LEAdvertisingManager1", error);
+    if (mock->advertisingManagerRegistration == 0)
+    {
+        return false;
+    }
+
+    return RequestBluezName(mock, error);
+}
+
+const struct MockBluezAttribute *MockBluezFindAttribute(
+    const struct MockBluez *mock, const gchar *uuid)
+{
+    for (guint i = 0; i < mock->attributes->len; i++)
+    {
+        const struct MockBluezAttribute *attribute = g_ptr_array_index(mock->attributes, i);
+        if (g_ascii_strcasecmp(attribute->uuid, uuid) == 0)
+        {
+            return attribute;
+        }
+    }
+    return NULL;
+}
+
+bool MockBluezAttributeHasFlag(const struct MockBluezAttribute *attribute, const gchar *flag)
+{
+    return g_strv_contains((const gchar *const *)attribute->flags, flag);
+}
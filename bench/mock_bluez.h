@@ -0,0 +1,61 @@
+#ifndef _MOCK_BLUEZ_H
+#define _MOCK_BLUEZ_H
+
+#include <stdbool.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#define MOCK_BLUEZ_ADAPTER_PATH "/org/bluez/hci0"
+
+/*
+ * A GATT characteristic or descriptor discovered in the application's object tree.
+ */
+struct MockBluezAttribute
+{
+    gchar *path;
+    gchar *uuid;
+    gchar **flags;
+    const gchar *interface;
+};
+
+typedef void (*MockBluezReadyFunc)(gpointer userData);
+
+/*
+ * Stand-in for bluetoothd on a private bus. It owns org.bluez and exports a single powered (or
+ * unpowered) adapter with GattManager1 and LEAdvertisingManager1. Like bluetoothd, it walks the
+ * application's object tree before replying to RegisterApplication and reads the advertisement's
+ * properties before replying to RegisterAdvertisement.
+ */
+struct MockBluez
+{
+    GDBusConnection *conn;
+    GDBusNodeInfo *nodeInfo;
+    guint objectManagerRegistration;
+    guint adapterRegistration;
+    guint gattManagerRegistration;
+    guint advertisingManagerRegistration;
+    bool powered;
+    gchar *appSender;
+    gchar *appPath;
+    GPtrArray *attributes;
+    bool applicationRegistered;
+    bool advertisementRegistered;
+    gint64 applicationRegisteredTime;
+    gint64 advertisementRegisteredTime;
+    MockBluezReadyFunc ready;
+    gpointer readyData;
+};
+
+bool MockBluezStart(
+    struct MockBluez *mock,
+    GDBusConnection *conn,
+    bool powered,
+    MockBluezReadyFunc ready,
+    gpointer readyData,
+    GError **error);
+const struct MockBluezAttribute *MockBluezFindAttribute(
+    const struct MockBluez *mock, const gchar *uuid);
+bool MockBluezAttributeHasFlag(const struct MockBluezAttribute *attribute, const gchar *flag);
+
+#endif // _MOCK_BLUEZ_H
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Runs the benchmark on a private dbus-daemon. Arguments are passed to gatt_bench, eg.
+#   ./run_bench.sh --iterations 5000 --window 16
+# or, after "load", to the load generator, eg.
+#   ./run_bench.sh load --clients 64 --depth 4 --duration 30
+# BENCH_BATTERY_FEED_HZ sets how often the host's fake battery app publishes (default 20).
+# Files sent to the transfer service land in a temporary directory unless
+# BLUETOOTH_SERVICES_TRANSFER_DIR is set.
+set -eu
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+BUILD_DIR="$BENCH_DIR/build"
+WORK_DIR=$(mktemp -d)
+
+cleanup()
+{
+    if [ -s "$WORK_DIR/pid" ]; then
+        kill "$(cat "$WORK_DIR/pid")" 2>/dev/null || true
+    fi
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+dbus-daemon --config-file="$BENCH_DIR/dbus-bench.conf" --fork \
+    --print-address=3 --print-pid=4 3>"$WORK_DIR/address" 4>"$WORK_DIR/pid"
+
+DBUS_SYSTEM_BUS_ADDRESS=$(head -n 1 "$WORK_DIR/address")
+BENCH_BATTERY_FEED_HZ=${BENCH_BATTERY_FEED_HZ:-20}
+BLUETOOTH_SERVICES_TRANSFER_DIR=${BLUETOOTH_SERVICES_TRANSFER_DIR:-$WORK_DIR/transfers}
+export DBUS_SYSTEM_BUS_ADDRESS BENCH_BATTERY_FEED_HZ BLUETOOTH_SERVICES_TRANSFER_DIR
+
+TOOL=gatt_bench
+if [ "${1:-}" = load ]; then
+    TOOL=gatt_load
+    shift
+fi
+
+"$BUILD_DIR/$TOOL" "$@" -- "$BUILD_DIR/bluetoothServicesHost"
@@ -0,0 +1,916 @@
+/*
+ * In-process implementations of the Legato APIs used by bluetoothServicesComponent. The data hub
+ * is reduced to what the component relies on: observations with a source, JSON extraction of a
+ * single member, and numeric and string push handlers. Every push is counted so the host can report
+ * how much work reached the actuators. The config tree is read only and is loaded from the file
+ * named by BENCH_CONFIG, one "<path> <value>" pair per line, on top of defaults that enable the
+ * opt-in services the bench measures.
+ *
+ * Pushes from the fake battery app and from the component's other threads are delivered through a
+ * stand-in for the Legato event loop: they are queued and an fd is signalled, and the component's
+ * Legato bridge services the queue from the main loop, which is where the data hub would call the
+ * component's push handlers. Setting BENCH_IPC_DELAY_US makes every data hub push and
+ * le_info call block the calling thread for that long, like a round trip to another process.
+ */
+
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+// GLib
+#include <glib.h>
+
+// Local
+#include "legato.h"
+#include "interfaces.h"
+#include "bench_shim.h"
+
+struct dhubAdmin_NumericPushHandler
+{
+    gchar *path;
+    dhubAdmin_NumericPushHandlerFunc_t func;
+    void *context;
+};
+
+struct dhubAdmin_StringPushHandler
+{
+    gchar *path;
+    dhubAdmin_StringPushHandlerFunc_t func;
+    void *context;
+};
+
+struct le_thread
+{
+    gchar *name;
+    le_thread_MainFunc_t mainFunc;
+    void *context;
+};
+
+enum PushType
+{
+    PUSH_TYPE_BOOLEAN,
+    PUSH_TYPE_NUMERIC,
+    PUSH_TYPE_STRING,
+    PUSH_TYPE_JSON,
+};
+
+struct DeferredPush
+{
+    enum PushType type;
+    gchar *path;
+    double timestamp;
+    bool boolean;
+    double number;
+    gchar *string;
+};
+
+struct le_cfg_Iterator
+{
+    gchar *path;
+};
+
+struct le_cfg_ChangeHandler
+{
+    gchar *path;
+    le_cfg_ChangeHandlerFunc_t func;
+    void *context;
+};
+
+struct Observation
+{
+    gchar *path;
+    gchar *source;
+    gchar *extraction;
+};
+
+static le_log_Level_t LogLevel = LE_LOG_WARN;
+static GHashTable *Observations;   // path -> struct Observation
+static GPtrArray *NumericHandlers; // struct dhubAdmin_NumericPushHandler
+static GPtrArray *StringHandlers;  // struct dhubAdmin_StringPushHandler
+static GHashTable *PushCounts;     // path -> count
+static GHashTable *Config;         // leaf path -> value
+static GPtrArray *ConfigHandlers;  // struct le_cfg_ChangeHandler
+static GThread *MainThread;
+static gulong IpcDelayUs;
+// Deliveries waiting for the Legato bridge. The fd is readable while the queue isn't empty.
+static GMutex EventLock;
+static GQueue EventQueue = G_QUEUE_INIT;
+static int EventFd = -1;
+
+static const char *const DefaultConfig[][2] = {
+    {"/services/bulk/enabled", "true"},
+    {"/services/transfer/enabled", "true"},
+};
+
+static void LoadDefaultConfig(void)
+{
+    for (size_t i = 0; i < G_N_ELEMENTS(DefaultConfig); i++)
+    {
+        g_hash_table_insert(Config, g_strdup(DefaultConfig[i][0]), g_strdup(DefaultConfig[i][1]));
+    }
+}
+
+static void LoadConfig(const char *fileName)
+{
+    gchar *contents;
+    GError *error = NULL;
+    if (!g_file_get_contents(fileName, &contents, NULL, &error))
+    {
+        fprintf(stderr, "host: couldn't read %s: %s\n", fileName, error->message);
+        g_error_free(error);
+        return;
+    }
+
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    for (gchar **line = lines; *line != NULL; line++)
+    {
+        gchar *entry = g_strstrip(*line);
+        if (entry[0] != '/')
+        {
+            continue; // Blank lines and comments
+        }
+        gchar *value = strpbrk(entry, " \t");
+        if (value == NULL)
+        {
+            continue;
+        }
+        *value++ = '\0';
+        g_hash_table_insert(Config, g_strdup(entry), g_strdup(g_strstrip(value)));
+    }
+    g_strfreev(lines);
+    g_free(contents);
+}
+
+void BenchShimInit(void)
+{
+    Observations = g_hash_table_new(g_str_hash, g_str_equal);
+    NumericHandlers = g_ptr_array_new();
+    StringHandlers = g_ptr_array_new();
+    PushCounts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    Config = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    ConfigHandlers = g_ptr_array_new();
+    MainThread = g_thread_self();
+    EventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    const char *ipcDelay = getenv("BENCH_IPC_DELAY_US");
+    if (ipcDelay != NULL)
+    {
+        IpcDelayUs = strtoul(ipcDelay, NULL, 10);
+    }
+
+    LoadDefaultConfig();
+    const char *config = getenv("BENCH_CONFIG");
+    if (config != NULL)
+    {
+        LoadConfig(config);
+    }
+
+    const char *level = getenv("LE_LOG_LEVEL");
+    if (level != NULL)
+    {
+        if (strcmp(level, "DEBUG") == 0)
+        {
+            LogLevel = LE_LOG_DEBUG;
+        }
+        else if (strcmp(level, "INFO") == 0)
+        {
+            LogLevel = LE_LOG_INFO;
+        }
+        else if (strcmp(level, "ERR") == 0)
+        {
+            LogLevel = LE_LOG_ERR;
+        }
+    }
+}
+
+void bench_Log(le_log_Level_t level, const char *file, int line, const char *format, ...)
+{
+    static const char *const names[] = {"DBUG", "INFO", "WARN", "=ERR=", "CRT"};
+    if (level < LogLevel)
+    {
+        return;
+    }
+
+    fprintf(stderr, "%s | %s:%d | ", names[level], file, line);
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+const char *bench_ResultTxt(le_result_t result)
+{
+    switch (result)
+    {
+    case LE_OK:
+        return "LE_OK";
+    case LE_NOT_FOUND:
+        return "LE_NOT_FOUND";
+    case LE_OVERFLOW:
+        return "LE_OVERFLOW";
+    case LE_DUPLICATE:
+        return "LE_DUPLICATE";
+    default:
+        return "LE_FAULT";
+    }
+}
+
+le_thread_Ref_t le_thread_Create(const char *name, le_thread_MainFunc_t mainFunc, void *context)
+{
+    le_thread_Ref_t thread = g_new0(struct le_thread, 1);
+    thread->name = g_strdup(name);
+    thread->mainFunc = mainFunc;
+    thread->context = context;
+    return thread;
+}
+
+void le_thread_Start(le_thread_Ref_t thread)
+{
+    g_thread_unref(g_thread_new(thread->name, thread->mainFunc, thread->context));
+}
+
+static void SimulateIpc(void)
+{
+    if (IpcDelayUs > 0)
+    {
+        g_usleep(IpcDelayUs);
+    }
+}
+
+static void CountPush(const char *path)
+{
+    guint64 *count = g_hash_table_lookup(PushCounts, path);
+    if (count == NULL)
+    {
+        count = g_new0(guint64, 1);
+        g_hash_table_insert(PushCounts, g_strdup(path), count);
+    }
+    (*count)++;
+}
+
+/*
+ * Like the data hub, replaces IO_NOW with the time the value arrived.
+ */
+static double Stamp(double timestamp)
+{
+    return (timestamp == IO_NOW) ? g_get_real_time() / (double)G_USEC_PER_SEC : timestamp;
+}
+
+static void DeliverNumeric(const char *path, double timestamp, double value)
+{
+    for (guint i = 0; i < NumericHandlers->len; i++)
+    {
+        struct dhubAdmin_NumericPushHandler *handler = g_ptr_array_index(NumericHandlers, i);
+        if (strcmp(handler->path, path) == 0)
+        {
+            handler->func(timestamp, value, handler->context);
+        }
+    }
+}
+
+static void DeliverString(const char *path, double timestamp, const char *value)
+{
+    for (guint i = 0; i < StringHandlers->len; i++)
+    {
+        struct dhubAdmin_StringPushHandler *handler = g_ptr_array_index(StringHandlers, i);
+        if (strcmp(handler->path, path) == 0)
+        {
+            handler->func(timestamp, value, handler->context);
+        }
+    }
+}
+
+le_result_t dhubAdmin_CreateObs(const char *path)
+{
+    gchar *absolute = g_strconcat("/obs/", path, NULL);
+    if (g_hash_table_contains(Observations, absolute))
+    {
+        g_free(absolute);
+        return LE_OK;
+    }
+
+    struct Observation *obs = g_new0(struct Observation, 1);
+    obs->path = absolute;
+    g_hash_table_insert(Observations, obs->path, obs);
+    return LE_OK;
+}
+
+le_result_t dhubAdmin_DeleteObs(const char *path)
+{
+    gchar *absolute = g_strconcat("/obs/", path, NULL);
+    struct Observation *obs = g_hash_table_lookup(Observations, absolute);
+    g_free(absolute);
+    if (obs == NULL)
+    {
+        return LE_NOT_FOUND;
+    }
+    g_hash_table_remove(Observations, obs->path);
+    g_free(obs->path);
+    g_free(obs->source);
+    g_free(obs->extraction);
+    g_free(obs);
+    return LE_OK;
+}
+
+le_result_t dhubAdmin_SetSource(const char *destPath, const char *srcPath)
+{
+    struct Observation *obs = g_hash_table_lookup(Observations, destPath);
+    if (obs == NULL)
+    {
+        return LE_NOT_FOUND;
+    }
+    g_free(obs->source);
+    obs->source = g_strdup(srcPath);
+    return LE_OK;
+}
+
+void dhubAdmin_SetJsonExtraction(const char *obsPath, const char *extractionSpec)
+{
+    struct Observation *obs = g_hash_table_lookup(Observations, obsPath);
+    if (obs != NULL)
+    {
+        g_free(obs->extraction);
+        obs->extraction = g_strdup(extractionSpec);
+    }
+}
+
+dhubAdmin_NumericPushHandlerRef_t dhubAdmin_AddNumericPushHandler(
+    const char *path, dhubAdmin_NumericPushHandlerFunc_t handler, void *context)
+{
+    struct dhubAdmin_NumericPushHandler *ref = g_new0(struct dhubAdmin_NumericPushHandler, 1);
+    ref->path = g_strdup(path);
+    ref->func = handler;
+    ref->context = context;
+    g_ptr_array_add(NumericHandlers, ref);
+    return ref;
+}
+
+void dhubAdmin_RemoveNumericPushHandler(dhubAdmin_NumericPushHandlerRef_t handlerRef)
+{
+    if (g_ptr_array_remove(NumericHandlers, handlerRef))
+    {
+        g_free(handlerRef->path);
+        g_free(handlerRef);
+    }
+}
+
+dhubAdmin_StringPushHandlerRef_t dhubAdmin_AddStringPushHandler(
+    const char *path, dhubAdmin_StringPushHandlerFunc_t handler, void *context)
+{
+    struct dhubAdmin_StringPushHandler *ref = g_new0(struct dhubAdmin_StringPushHandler, 1);
+    ref->path = g_strdup(path);
+    ref->func = handler;
+    ref->context = context;
+    g_ptr_array_add(StringHandlers, ref);
+    return ref;
+}
+
+void dhubAdmin_RemoveStringPushHandler(dhubAdmin_StringPushHandlerRef_t handlerRef)
+{
+    if (g_ptr_array_remove(StringHandlers, handlerRef))
+    {
+        g_free(handlerRef->path);
+        g_free(handlerRef);
+    }
+}
+
+void dhubAdmin_ConnectService(void)
+{
+}
+
+static void PushBoolean(const char *path, double timestamp, bool value)
+{
+    CountPush(path);
+}
+
+static void PushNumeric(const char *path, double timestamp, double value)
+{
+    CountPush(path);
+    DeliverNumeric(path, timestamp, value);
+
+    GHashTableIter iter;
+    gpointer key;
+    gpointer obsPtr;
+    g_hash_table_iter_init(&iter, Observations);
+    while (g_hash_table_iter_next(&iter, &key, &obsPtr))
+    {
+        struct Observation *obs = obsPtr;
+        if (obs->source != NULL && obs->extraction == NULL && strcmp(obs->source, path) == 0)
+        {
+            DeliverNumeric(obs->path, timestamp, value);
+        }
+    }
+}
+
+static void PushString(const char *path, double timestamp, const char *value)
+{
+    CountPush(path);
+    DeliverString(path, timestamp, value);
+
+    GHashTableIter iter;
+    gpointer key;
+    gpointer obsPtr;
+    g_hash_table_iter_init(&iter, Observations);
+    while (g_hash_table_iter_next(&iter, &key, &obsPtr))
+    {
+        struct Observation *obs = obsPtr;
+        if (obs->source != NULL && obs->extraction == NULL && strcmp(obs->source, path) == 0)
+        {
+            DeliverString(obs->path, timestamp, value);
+        }
+    }
+}
+
+/*
+ * Only extraction of a numeric top level member (eg. "percent") is supported.
+ */
+static bool ExtractNumber(const char *json, const char *member, double *value)
+{
+    gchar *key = g_strdup_printf("\"%s\"", member);
+    const char *found = strstr(json, key);
+    g_free(key);
+    if (found == NULL)
+    {
+        return false;
+    }
+
+    const char *colon = strchr(found, ':');
+    if (colon == NULL)
+    {
+        return false;
+    }
+
+    char *end;
+    *value = g_ascii_strtod(colon + 1, &end);
+    return end != colon + 1;
+}
+
+static void PushJson(const char *path, double timestamp, const char *value)
+{
+    CountPush(path);
+
+    GHashTableIter iter;
+    gpointer key;
+    gpointer obsPtr;
+    g_hash_table_iter_init(&iter, Observations);
+    while (g_hash_table_iter_next(&iter, &key, &obsPtr))
+    {
+        struct Observation *obs = obsPtr;
+        double number;
+        if (obs->source != NULL && obs->extraction != NULL && strcmp(obs->source, path) == 0 &&
+            ExtractNumber(value, obs->extraction, &number))
+        {
+            DeliverNumeric(obs->path, timestamp, number);
+        }
+    }
+}
+
+static void DeliverDeferredPush(struct DeferredPush *push)
+{
+    switch (push->type)
+    {
+    case PUSH_TYPE_BOOLEAN:
+        PushBoolean(push->path, push->timestamp, push->boolean);
+        break;
+    case PUSH_TYPE_NUMERIC:
+        PushNumeric(push->path, push->timestamp, push->number);
+        break;
+    case PUSH_TYPE_STRING:
+        PushString(push->path, push->timestamp, push->string);
+        break;
+    case PUSH_TYPE_JSON:
+        PushJson(push->path, push->timestamp, push->string);
+        break;
+    }
+
+    g_free(push->path);
+    g_free(push->string);
+    g_free(push);
+}
+
+static void QueueEvent(struct DeferredPush *push)
+{
+    g_mutex_lock(&EventLock);
+    g_queue_push_tail(&EventQueue, push);
+    eventfd_write(EventFd, 1);
+    g_mutex_unlock(&EventLock);
+}
+
+int le_event_GetFd(void)
+{
+    return EventFd;
+}
+
+/*
+ * Delivers one queued push. The fd is only drained once the queue is found empty, under the same
+ * lock as pushes are queued, so a push can't be left queued behind an fd that isn't readable.
+ */
+le_result_t le_event_ServiceLoop(void)
+{
+    g_mutex_lock(&EventLock);
+    struct DeferredPush *push = g_queue_pop_head(&EventQueue);
+    if (push == NULL)
+    {
+        eventfd_t count;
+        eventfd_read(EventFd, &count);
+        g_mutex_unlock(&EventLock);
+        return LE_WOULD_BLOCK;
+    }
+    g_mutex_unlock(&EventLock);
+
+    DeliverDeferredPush(push);
+    return LE_OK;
+}
+
+/*
+ * Returns true if the push was queued for the main loop, otherwise the caller delivers it.
+ */
+static bool DeferPush(
+    enum PushType type,
+    const char *path,
+    double timestamp,
+    bool boolean,
+    double number,
+    const char *string)
+{
+    if (g_thread_self() == MainThread)
+    {
+        return false;
+    }
+
+    struct DeferredPush *push = g_new0(struct DeferredPush, 1);
+    push->type = type;
+    push->path = g_strdup(path);
+    push->timestamp = timestamp;
+    push->boolean = boolean;
+    push->number = number;
+    push->string = g_strdup(string);
+    QueueEvent(push);
+    return true;
+}
+
+void dhubAdmin_PushBoolean(const char *path, double timestamp, bool value)
+{
+    SimulateIpc();
+    timestamp = Stamp(timestamp);
+    if (!DeferPush(PUSH_TYPE_BOOLEAN, path, timestamp, value, 0.0, NULL))
+    {
+        PushBoolean(path, timestamp, value);
+    }
+}
+
+void dhubAdmin_PushNumeric(const char *path, double timestamp, double value)
+{
+    SimulateIpc();
+    timestamp = Stamp(timestamp);
+    if (!DeferPush(PUSH_TYPE_NUMERIC, path, timestamp, false, value, NULL))
+    {
+        PushNumeric(path, timestamp, value);
+    }
+}
+
+void dhubAdmin_PushString(const char *path, double timestamp, const char *value)
+{
+    SimulateIpc();
+    timestamp = Stamp(timestamp);
+    if (!DeferPush(PUSH_TYPE_STRING, path, timestamp, false, 0.0, value))
+    {
+        PushString(path, timestamp, value);
+    }
+}
+
+void dhubAdmin_PushJson(const char *path, double timestamp, const char *value)
+{
+    SimulateIpc();
+    timestamp = Stamp(timestamp);
+    if (!DeferPush(PUSH_TYPE_JSON, path, timestamp, false, 0.0, value))
+    {
+        PushJson(path, timestamp, value);
+    }
+}
+
+void BenchShimFeedJson(const char *path, const char *value)
+{
+    struct DeferredPush *push = g_new0(struct DeferredPush, 1);
+    push->type = PUSH_TYPE_JSON;
+    push->path = g_strdup(path);
+    push->timestamp = Stamp(IO_NOW);
+    push->string = g_strdup(value);
+    QueueEvent(push);
+}
+
+void BenchShimLogPushCounts(void)
+{
+    GHashTableIter iter;
+    gpointer path;
+    gpointer count;
+    g_hash_table_iter_init(&iter, PushCounts);
+    while (g_hash_table_iter_next(&iter, &path, &count))
+    {
+        fprintf(stderr, "host: pushes %s %" G_GUINT64_FORMAT "\n", (const char *)path,
+                *(guint64 *)count);
+    }
+}
+
+void le_info_ConnectService(void)
+{
+}
+
+static le_result_t CopyString(const char *value, char *buffer, size_t size)
+{
+    SimulateIpc();
+    if (g_strlcpy(buffer, value, size) >= size)
+    {
+        return LE_OVERFLOW;
+    }
+    return LE_OK;
+}
+
+le_result_t le_info_GetImei(char *imei, size_t imeiSize)
+{
+    return CopyString("359377060000000", imei, imeiSize);
+}
+
+le_result_t le_info_GetPlatformSerialNumber(char *serial, size_t serialSize)
+{
+    return CopyString("LL000000000000", serial, serialSize);
+}
+
+le_result_t le_info_GetDeviceModel(char *model, size_t modelSize)
+{
+    return CopyString("WP7702", model, modelSize);
+}
+
+le_result_t le_info_GetFirmwareVersion(char *version, size_t versionSize)
+{
+    return CopyString("SWI9X06Y_02.00.00.00", version, versionSize);
+}
+
+le_result_t le_info_GetManufacturerName(char *name, size_t nameSize)
+{
+    return CopyString("Sierra Wireless, Incorporated", name, nameSize);
+}
+
+/*
+ * Resolves a path relative to the iterator, including "." and ".." components.
+ */
+static gchar *ResolveConfigPath(le_cfg_IteratorRef_t iter, const char *path)
+{
+    gchar *joined = (path[0] == '/') ? g_strdup(path) : g_strconcat(iter->path, "/", path, NULL);
+    gchar **parts = g_strsplit(joined, "/", -1);
+    g_free(joined);
+
+    GPtrArray *resolved = g_ptr_array_new();
+    for (gchar **part = parts; *part != NULL; part++)
+    {
+        if ((*part)[0] == '\0' || strcmp(*part, ".") == 0)
+        {
+            continue;
+        }
+        if (strcmp(*part, "..") == 0)
+        {
+            if (resolved->len > 0)
+            {
+                g_ptr_array_set_size(resolved, resolved->len - 1);
+            }
+            continue;
+        }
+        g_ptr_array_add(resolved, *part);
+    }
+    g_ptr_array_add(resolved, NULL);
+
+    gchar *relative = g_strjoinv("/", (gchar **)resolved->pdata);
+    gchar *absolute = g_strconcat("/", relative, NULL);
+    g_free(relative);
+    g_ptr_array_free(resolved, TRUE);
+    g_strfreev(parts);
+    return absolute;
+}
+
+static gint CompareNames(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/*
+ * Returns the sorted names of the children of a node. The tree only stores leaves, so children are
+ * derived from the leaf paths below the node.
+ */
+static GPtrArray *ListConfigChildren(const char *path)
+{
+    gchar *prefix = (strcmp(path, "/") == 0) ? g_strdup("/") : g_strconcat(path, "/", NULL);
+    const size_t prefixLen = strlen(prefix);
+    GPtrArray *children = g_ptr_array_new_with_free_func(g_free);
+
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, Config);
+    while (g_hash_table_iter_next(&iter, &key, NULL))
+    {
+        const char *leaf = key;
+        if (strncmp(leaf, prefix, prefixLen) != 0)
+        {
+            continue;
+        }
+        const char *name = leaf + prefixLen;
+        const char *end = strchr(name, '/');
+        gchar *child = (end != NULL) ? g_strndup(name, end - name) : g_strdup(name);
+        bool seen = false;
+        for (guint i = 0; i < children->len && !seen; i++)
+        {
+            seen = (strcmp(g_ptr_array_index(children, i), child) == 0);
+        }
+        if (seen)
+        {
+            g_free(child);
+        }
+        else
+        {
+            g_ptr_array_add(children, child);
+        }
+    }
+    g_ptr_array_sort(children, CompareNames);
+    g_free(prefix);
+    return children;
+}
+
+static void MoveIterator(le_cfg_IteratorRef_t iter, gchar *path)
+{
+    g_free(iter->path);
+    iter->path = path;
+}
+
+le_cfg_IteratorRef_t le_cfg_CreateReadTxn(const char *basePath)
+{
+    struct le_cfg_Iterator *iter = g_new0(struct le_cfg_Iterator, 1);
+    iter->path = g_strdup("/");
+    MoveIterator(iter, ResolveConfigPath(iter, basePath));
+    return iter;
+}
+
+void le_cfg_CancelTxn(le_cfg_IteratorRef_t iteratorRef)
+{
+    g_free(iteratorRef->path);
+    g_free(iteratorRef);
+}
+
+void le_cfg_GoToNode(le_cfg_IteratorRef_t iteratorRef, const char *newPath)
+{
+    MoveIterator(iteratorRef, ResolveConfigPath(iteratorRef, newPath));
+}
+
+le_result_t le_cfg_GoToParent(le_cfg_IteratorRef_t iteratorRef)
+{
+    if (strcmp(iteratorRef->path, "/") == 0)
+    {
+        return LE_NOT_FOUND;
+    }
+    le_cfg_GoToNode(iteratorRef, "..");
+    return LE_OK;
+}
+
+le_result_t le_cfg_GoToFirstChild(le_cfg_IteratorRef_t iteratorRef)
+{
+    GPtrArray *children = ListConfigChildren(iteratorRef->path);
+    const le_result_t result = (children->len > 0) ? LE_OK : LE_NOT_FOUND;
+    if (result == LE_OK)
+    {
+        le_cfg_GoToNode(iteratorRef, g_ptr_array_index(children, 0));
+    }
+    g_ptr_array_free(children, TRUE);
+    return result;
+}
+
+le_result_t le_cfg_GoToNextSibling(le_cfg_IteratorRef_t iteratorRef)
+{
+    if (strcmp(iteratorRef->path, "/") == 0)
+    {
+        return LE_NOT_FOUND;
+    }
+
+    gchar *parent = ResolveConfigPath(iteratorRef, "..");
+    const char *name = strrchr(iteratorRef->path, '/') + 1;
+    GPtrArray *children = ListConfigChildren(parent);
+    le_result_t result = LE_NOT_FOUND;
+    for (guint i = 0; i + 1 < children->len; i++)
+    {
+        if (strcmp(g_ptr_array_index(children, i), name) == 0)
+        {
+            const char *separator = (strcmp(parent, "/") == 0) ? "" : "/";
+            MoveIterator(
+                iteratorRef,
+                g_strconcat(parent, separator, g_ptr_array_index(children, i + 1), NULL));
+            result = LE_OK;
+            break;
+        }
+    }
+    g_ptr_array_free(children, TRUE);
+    g_free(parent);
+    return result;
+}
+
+le_result_t le_cfg_GetNodeName(
+    le_cfg_IteratorRef_t iteratorRef, const char *path, char *name, size_t nameSize)
+{
+    gchar *resolved = ResolveConfigPath(iteratorRef, path);
+    const le_result_t result =
+        (g_strlcpy(name, strrchr(resolved, '/') + 1, nameSize) < nameSize) ? LE_OK : LE_OVERFLOW;
+    g_free(resolved);
+    return result;
+}
+
+bool le_cfg_NodeExists(le_cfg_IteratorRef_t iteratorRef, const char *path)
+{
+    gchar *resolved = ResolveConfigPath(iteratorRef, path);
+    bool exists = g_hash_table_contains(Config, resolved);
+    if (!exists)
+    {
+        GPtrArray *children = ListConfigChildren(resolved);
+        exists = (children->len > 0);
+        g_ptr_array_free(children, TRUE);
+    }
+    g_free(resolved);
+    return exists;
+}
+
+static const char *LookupConfig(le_cfg_IteratorRef_t iteratorRef, const char *path)
+{
+    gchar *resolved = ResolveConfigPath(iteratorRef, path);
+    const char *value = g_hash_table_lookup(Config, resolved);
+    g_free(resolved);
+    return value;
+}
+
+le_result_t le_cfg_GetString(
+    le_cfg_IteratorRef_t iteratorRef,
+    const char *path,
+    char *value,
+    size_t valueSize,
+    const char *defaultValue)
+{
+    const char *found = LookupConfig(iteratorRef, path);
+    return CopyString((found != NULL) ? found : defaultValue, value, valueSize);
+}
+
+int32_t le_cfg_GetInt(le_cfg_IteratorRef_t iteratorRef, const char *path, int32_t defaultValue)
+{
+    const char *found = LookupConfig(iteratorRef, path);
+    return (found != NULL) ? (int32_t)strtol(found, NULL, 10) : defaultValue;
+}
+
+double le_cfg_GetFloat(le_cfg_IteratorRef_t iteratorRef, const char *path, double defaultValue)
+{
+    const char *found = LookupConfig(iteratorRef, path);
+    return (found != NULL) ? g_ascii_strtod(found, NULL) : defaultValue;
+}
+
+bool le_cfg_GetBool(le_cfg_IteratorRef_t iteratorRef, const char *path, bool defaultValue)
+{
+    const char *found = LookupConfig(iteratorRef, path);
+    return (found != NULL) ? (strcmp(found, "true") == 0) : defaultValue;
+}
+
+le_cfg_ChangeHandlerRef_t le_cfg_AddChangeHandler(
+    const char *newPath, le_cfg_ChangeHandlerFunc_t handlerPtr, void *contextPtr)
+{
+    struct le_cfg_ChangeHandler *ref = g_new0(struct le_cfg_ChangeHandler, 1);
+    ref->path = g_strdup(newPath);
+    ref->func = handlerPtr;
+    ref->context = contextPtr;
+    g_ptr_array_add(ConfigHandlers, ref);
+    return ref;
+}
+
+void le_cfg_RemoveChangeHandler(le_cfg_ChangeHandlerRef_t handlerRef)
+{
+    if (g_ptr_array_remove(ConfigHandlers, handlerRef))
+    {
+        g_free(handlerRef->path);
+        g_free(handlerRef);
+    }
+}
+
+/*
+ * Reads BENCH_CONFIG again and calls every change handler, as if the whole tree had been written.
+ */
+void BenchShimReloadConfig(void)
+{
+    const char *config = getenv("BENCH_CONFIG");
+    g_hash_table_remove_all(Config);
+    LoadDefaultConfig();
+    if (config != NULL)
+    {
+        LoadConfig(config);
+    }
+    for (guint i = 0; i < ConfigHandlers->len; i++)
+    {
+        struct le_cfg_ChangeHandler *handler = g_ptr_array_index(ConfigHandlers, i);
+        handler->func(handler->context);
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef _BENCH_SHIM_H
+#define _BENCH_SHIM_H
+
+/*
+ * Helpers for the host process that aren't part of any Legato API.
+ */
+void BenchShimInit(void);
+// Pushes as another app would, through the Legato event queue without the simulated IPC delay
+void BenchShimFeedJson(const char *path, const char *value);
+void BenchShimLogPushCounts(void);
+// Reloads BENCH_CONFIG and notifies the component's config change handlers
+void BenchShimReloadConfig(void);
+
+#endif // _BENCH_SHIM_H
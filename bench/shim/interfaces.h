@@ -0,0 +1,80 @@
+/*
+ * Stand-in for the generated interfaces.h of bluetoothServicesComponent. Only the client APIs the
+ * component requires are declared; bench_shim.c implements them in-process.
+ */
+#ifndef _BENCH_INTERFACES_H
+#define _BENCH_INTERFACES_H
+
+#include "legato.h"
+
+// io.api [types-only]
+#define IO_NOW 0.0
+
+// admin.api
+typedef void (*dhubAdmin_NumericPushHandlerFunc_t)(double timestamp, double value, void *context);
+typedef struct dhubAdmin_NumericPushHandler *dhubAdmin_NumericPushHandlerRef_t;
+typedef void (*dhubAdmin_StringPushHandlerFunc_t)(
+    double timestamp, const char *value, void *context);
+typedef struct dhubAdmin_StringPushHandler *dhubAdmin_StringPushHandlerRef_t;
+
+void dhubAdmin_ConnectService(void);
+le_result_t dhubAdmin_CreateObs(const char *path);
+le_result_t dhubAdmin_DeleteObs(const char *path);
+le_result_t dhubAdmin_SetSource(const char *destPath, const char *srcPath);
+void dhubAdmin_SetJsonExtraction(const char *obsPath, const char *extractionSpec);
+dhubAdmin_NumericPushHandlerRef_t dhubAdmin_AddNumericPushHandler(
+    const char *path, dhubAdmin_NumericPushHandlerFunc_t handler, void *context);
+void dhubAdmin_RemoveNumericPushHandler(dhubAdmin_NumericPushHandlerRef_t handlerRef);
+dhubAdmin_StringPushHandlerRef_t dhubAdmin_AddStringPushHandler(
+    const char *path, dhubAdmin_StringPushHandlerFunc_t handler, void *context);
+void dhubAdmin_RemoveStringPushHandler(dhubAdmin_StringPushHandlerRef_t handlerRef);
+void dhubAdmin_PushBoolean(const char *path, double timestamp, bool value);
+void dhubAdmin_PushNumeric(const char *path, double timestamp, double value);
+void dhubAdmin_PushString(const char *path, double timestamp, const char *value);
+void dhubAdmin_PushJson(const char *path, double timestamp, const char *value);
+
+// le_info.api
+#define LE_INFO_IMEI_MAX_BYTES 16
+#define LE_INFO_MAX_VERS_BYTES 257
+#define LE_INFO_MAX_MODEL_BYTES 257
+#define LE_INFO_MAX_MFR_NAME_BYTES 129
+#define LE_INFO_MAX_PSN_BYTES 15
+
+void le_info_ConnectService(void);
+le_result_t le_info_GetImei(char *imei, size_t imeiSize);
+le_result_t le_info_GetPlatformSerialNumber(char *serial, size_t serialSize);
+le_result_t le_info_GetDeviceModel(char *model, size_t modelSize);
+le_result_t le_info_GetFirmwareVersion(char *version, size_t versionSize);
+le_result_t le_info_GetManufacturerName(char *name, size_t nameSize);
+
+// le_cfg.api
+#define LE_CFG_STR_LEN_BYTES 512
+#define LE_CFG_NAME_LEN_BYTES 128
+
+typedef struct le_cfg_Iterator *le_cfg_IteratorRef_t;
+typedef void (*le_cfg_ChangeHandlerFunc_t)(void *contextPtr);
+typedef struct le_cfg_ChangeHandler *le_cfg_ChangeHandlerRef_t;
+
+le_cfg_IteratorRef_t le_cfg_CreateReadTxn(const char *basePath);
+void le_cfg_CancelTxn(le_cfg_IteratorRef_t iteratorRef);
+void le_cfg_GoToNode(le_cfg_IteratorRef_t iteratorRef, const char *newPath);
+le_result_t le_cfg_GoToParent(le_cfg_IteratorRef_t iteratorRef);
+le_result_t le_cfg_GoToFirstChild(le_cfg_IteratorRef_t iteratorRef);
+le_result_t le_cfg_GoToNextSibling(le_cfg_IteratorRef_t iteratorRef);
+le_result_t le_cfg_GetNodeName(
+    le_cfg_IteratorRef_t iteratorRef, const char *path, char *name, size_t nameSize);
+bool le_cfg_NodeExists(le_cfg_IteratorRef_t iteratorRef, const char *path);
+le_result_t le_cfg_GetString(
+    le_cfg_IteratorRef_t iteratorRef,
+    const char *path,
+    char *value,
+    size_t valueSize,
+    const char *defaultValue);
+int32_t le_cfg_GetInt(le_cfg_IteratorRef_t iteratorRef, const char *path, int32_t defaultValue);
+double le_cfg_GetFloat(le_cfg_IteratorRef_t iteratorRef, const char *path, double defaultValue);
+bool le_cfg_GetBool(le_cfg_IteratorRef_t iteratorRef, const char *path, bool defaultValue);
+le_cfg_ChangeHandlerRef_t le_cfg_AddChangeHandler(
+    const char *newPath, le_cfg_ChangeHandlerFunc_t handlerPtr, void *contextPtr);
+void le_cfg_RemoveChangeHandler(le_cfg_ChangeHandlerRef_t handlerRef);
+
+#endif // _BENCH_INTERFACES_H
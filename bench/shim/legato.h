@@ -0,0 +1,82 @@
+/*
+ * Minimal stand-in for the parts of legato.h used by bluetoothServicesComponent, so that the
+ * component can be built and run as a plain Linux process by the benchmark harness.
+ */
+#ifndef _BENCH_LEGATO_H
+#define _BENCH_LEGATO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+typedef enum
+{
+    LE_OK = 0,
+    LE_NOT_FOUND = -1,
+    LE_NOT_POSSIBLE = -2,
+    LE_OUT_OF_RANGE = -3,
+    LE_NO_MEMORY = -4,
+    LE_NOT_PERMITTED = -5,
+    LE_FAULT = -6,
+    LE_COMM_ERROR = -7,
+    LE_TIMEOUT = -8,
+    LE_OVERFLOW = -9,
+    LE_UNDERFLOW = -10,
+    LE_WOULD_BLOCK = -11,
+    LE_DEADLOCK = -12,
+    LE_FORMAT_ERROR = -13,
+    LE_DUPLICATE = -14,
+    LE_BAD_PARAMETER = -15,
+    LE_CLOSED = -16,
+    LE_BUSY = -17,
+    LE_UNSUPPORTED = -18,
+    LE_IO_ERROR = -19,
+    LE_NOT_IMPLEMENTED = -20,
+    LE_UNAVAILABLE = -21,
+    LE_TERMINATED = -22,
+} le_result_t;
+
+typedef enum
+{
+    LE_LOG_DEBUG,
+    LE_LOG_INFO,
+    LE_LOG_WARN,
+    LE_LOG_ERR,
+    LE_LOG_CRIT,
+} le_log_Level_t;
+
+void bench_Log(le_log_Level_t level, const char *file, int line, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+const char *bench_ResultTxt(le_result_t result);
+
+#define LE_DEBUG(...) bench_Log(LE_LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
+#define LE_INFO(...) bench_Log(LE_LOG_INFO, __FILE__, __LINE__, __VA_ARGS__)
+#define LE_WARN(...) bench_Log(LE_LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
+#define LE_ERROR(...) bench_Log(LE_LOG_ERR, __FILE__, __LINE__, __VA_ARGS__)
+#define LE_CRIT(...) bench_Log(LE_LOG_CRIT, __FILE__, __LINE__, __VA_ARGS__)
+#define LE_FATAL(...) do { LE_CRIT(__VA_ARGS__); abort(); } while (0)
+#define LE_FATAL_IF(condition, ...) do { if (condition) { LE_FATAL(__VA_ARGS__); } } while (0)
+#define LE_ERROR_IF(condition, ...) do { if (condition) { LE_ERROR(__VA_ARGS__); } } while (0)
+#define LE_WARN_IF(condition, ...) do { if (condition) { LE_WARN(__VA_ARGS__); } } while (0)
+#define LE_ASSERT(condition) \
+    do { if (!(condition)) { LE_FATAL("Assert Failed: '%s'", #condition); } } while (0)
+#define LE_ASSERT_OK(expression) LE_ASSERT((expression) == LE_OK)
+#define LE_RESULT_TXT(result) bench_ResultTxt(result)
+#define LE_UNUSED(x) ((void)(x))
+
+typedef struct le_thread *le_thread_Ref_t;
+typedef void *(*le_thread_MainFunc_t)(void *context);
+
+le_thread_Ref_t le_thread_Create(const char *name, le_thread_MainFunc_t mainFunc, void *context);
+void le_thread_Start(le_thread_Ref_t thread);
+
+// The Legato event loop, reduced to a queue of data hub deliveries signalled through an fd
+int le_event_GetFd(void);
+le_result_t le_event_ServiceLoop(void);
+
+#endif // _BENCH_LEGATO_H
@@ -0,0 +1,258 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// GLib
+#include <glib.h>
+#include <gio/gio.h>
+
+// Legato
+#include "legato.h"
+#include "interfaces.h"
+
+// Local
+#include "advertisement_data.h"
+
+#define ENV_ADVERTISEMENT_INTERVAL "BLUETOOTH_SERVICES_ADVERTISEMENT_INTERVAL_MS"
+#define DEFAULT_ADVERTISEMENT_INTERVAL_MS 1000
+#define LEGACY_ADVERTISING_DATA_MAX_LEN 31
+// Format version and field bitmap
+#define ADVERTISEMENT_HEADER_SIZE 2
+
+struct AdvertisementField
+{
+    guint id;
+    gchar *name;
+    gsize size;
+    guint8 *value;
+    bool included;
+};
+
+static GPtrArray *Fields; // Sorted by id
+static BluezLEAdvertisement1 *Advertisement;
+static guint16 CompanyId = ADVERTISEMENT_DEFAULT_COMPANY_ID;
+static gsize Capacity;
+static gsize PayloadSize;
+static guint IntervalMs = DEFAULT_ADVERTISEMENT_INTERVAL_MS;
+static guint IntervalTimer;
+static bool Dirty;
+
+static void Layout(struct AdvertisementField *field)
+{
+    if (PayloadSize + field->size > Capacity)
+    {
+        LE_WARN(
+            "Live value %s (%zu bytes) doesn't fit in the advertisement, %zu of %zu bytes are used",
+            field->name,
+            field->size,
+            PayloadSize,
+            Capacity);
+        return;
+    }
+    field->included = true;
+    PayloadSize += field->size;
+}
+
+static void Relayout(void)
+{
+    PayloadSize = ADVERTISEMENT_HEADER_SIZE;
+    for (guint i = 0; i < Fields->len; i++)
+    {
+        struct AdvertisementField *field = g_ptr_array_index(Fields, i);
+        field->included = false;
+        Layout(field);
+    }
+}
+
+/*
+ * BlueZ watches the advertisement's properties and refreshes what the controller broadcasts when
+ * ManufacturerData changes.
+ */
+static void Publish(void)
+{
+    guint8 payload[LEGACY_ADVERTISING_DATA_MAX_LEN];
+    guint8 bitmap = 0;
+    gsize offset = ADVERTISEMENT_HEADER_SIZE;
+    for (guint i = 0; i < Fields->len; i++)
+    {
+        const struct AdvertisementField *field = g_ptr_array_index(Fields, i);
+        if (field->included)
+        {
+            bitmap |= 1 << field->id;
+            memcpy(&payload[offset], field->value, field->size);
+            offset += field->size;
+        }
+    }
+    payload[0] = ADVERTISEMENT_FORMAT_VERSION;
+    payload[1] = bitmap;
+
+    GVariantBuilder data;
+    g_variant_builder_init(&data, G_VARIANT_TYPE("a{qv}"));
+    g_variant_builder_add(
+        &data,
+        "{qv}",
+        CompanyId,
+        g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, payload, offset, sizeof(guint8)));
+    bluez_leadvertisement1_set_manufacturer_data(Advertisement, g_variant_builder_end(&data));
+    Dirty = false;
+}
+
+static gboolean IntervalTimerExpired(gpointer userData)
+{
+    if (!Dirty)
+    {
+        IntervalTimer = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    // Keep the interval running so a value that changes constantly is published once per interval
+    Publish();
+    return G_SOURCE_CONTINUE;
+}
+
+struct AdvertisementField *AdvertisementDataAddField(guint id, const gchar *name, gsize size)
+{
+    if (Fields == NULL)
+    {
+        Fields = g_ptr_array_new();
+    }
+    if (id >= ADVERTISEMENT_FIELD_COUNT)
+    {
+        LE_ERROR("Not advertising %s, its id %u is out of range", name, id);
+        return NULL;
+    }
+
+    guint position = 0;
+    while (position < Fields->len)
+    {
+        const struct AdvertisementField *other = g_ptr_array_index(Fields, position);
+        if (other->id == id)
+        {
+            LE_ERROR("Not advertising %s, its id %u is taken by %s", name, id, other->name);
+            return NULL;
+        }
+        if (other->id > id)
+        {
+            break;
+        }
+        position++;
+    }
+
+    struct AdvertisementField *field = g_new0(struct AdvertisementField, 1);
+    field->id = id;
+    field->name = g_strdup(name);
+    field->size = size;
+    field->value = g_malloc0(size);
+    g_ptr_array_insert(Fields, position, field);
+    if (Advertisement != NULL)
+    {
+        // Fields after this one are laid out again, since they now come later in the payload
+        Relayout();
+        Publish();
+    }
+    return field;
+}
+
+void AdvertisementDataRemoveField(struct AdvertisementField *field)
+{
+    g_ptr_array_remove(Fields, field);
+    const bool included = field->included;
+    g_free(field->name);
+    g_free(field->value);
+    g_free(field);
+
+    if (Advertisement != NULL && included)
+    {
+        Relayout();
+        Publish();
+    }
+}
+
+/*
+ * Publishes a change straight away if nothing was published during the last interval, otherwise
+ * when the interval ends. Only the latest value is published.
+ */
+void AdvertisementDataSet(struct AdvertisementField *field, const guint8 *data)
+{
+    if (memcmp(field->value, data, field->size) == 0)
+    {
+        return;
+    }
+    memcpy(field->value, data, field->size);
+    if (!field->included || Advertisement == NULL)
+    {
+        return;
+    }
+
+    Dirty = true;
+    if (IntervalTimer != 0)
+    {
+        return;
+    }
+    Publish();
+    if (IntervalMs > 0)
+    {
+        IntervalTimer = g_timeout_add(IntervalMs, IntervalTimerExpired, NULL);
+    }
+}
+
+static void LoadCompanyId(void)
+{
+    le_cfg_IteratorRef_t iter = le_cfg_CreateReadTxn(ADVERTISEMENT_CONFIG_ROOT);
+    const int32_t companyId = le_cfg_GetInt(iter, "companyId", ADVERTISEMENT_DEFAULT_COMPANY_ID);
+    le_cfg_CancelTxn(iter);
+
+    if (companyId < 0 || companyId > G_MAXUINT16)
+    {
+        LE_ERROR(
+            "Company identifier %d is out of range, using 0x%04x",
+            (int)companyId,
+            ADVERTISEMENT_DEFAULT_COMPANY_ID);
+        return;
+    }
+    CompanyId = companyId;
+    if (CompanyId == ADVERTISEMENT_DEFAULT_COMPANY_ID)
+    {
+        LE_WARN(
+            "Advertising live values under the test company identifier, set %s/companyId",
+            ADVERTISEMENT_CONFIG_ROOT);
+    }
+}
+
+void AdvertisementDataStart(BluezLEAdvertisement1 *advertisement, gsize budget)
+{
+    const char *interval = getenv(ENV_ADVERTISEMENT_INTERVAL);
+    if (interval != NULL)
+    {
+        IntervalMs = (guint)strtoul(interval, NULL, 10);
+    }
+
+    budget = MIN(budget, LEGACY_ADVERTISING_DATA_MAX_LEN);
+    const gsize overhead = ADVERTISEMENT_MANUFACTURER_DATA_OVERHEAD + ADVERTISEMENT_HEADER_SIZE;
+    Capacity = (budget > overhead) ? budget - ADVERTISEMENT_MANUFACTURER_DATA_OVERHEAD : 0;
+    if (Capacity == 0)
+    {
+        LE_INFO("No room for live values in the advertisement");
+        return;
+    }
+
+    LoadCompanyId();
+
+    // Fields may also be added later, when services are enabled at runtime
+    Advertisement = g_object_ref(advertisement);
+    if (Fields == NULL)
+    {
+        Fields = g_ptr_array_new();
+    }
+    Relayout();
+    LE_INFO(
+        "Advertising %zu bytes of live values under company 0x%04x, published at most every %u ms",
+        PayloadSize - ADVERTISEMENT_HEADER_SIZE,
+        CompanyId,
+        IntervalMs);
+
+    // The initial values are in place before the advertisement is registered
+    Publish();
+}
@@ -0,0 +1,53 @@
+#ifndef _ADVERTISEMENT_DATA_H
+#define _ADVERTISEMENT_DATA_H
+
+#include <glib.h>
+
+#include "org.bluez.LEAdvertisement1.h"
+
+/*
+ * Broadcasts live values in the advertisement's ManufacturerData, so scanners can read them without
+ * connecting. Producers add fixed size fields, each under a fixed id, and update them whenever
+ * their value changes. The payload starts with a format version (u8) and a bitmap of the field ids
+ * that follow (u8, bit n for id n), and the fields follow in id order. A scanner can therefore read
+ * every board, whichever services it has enabled. Fields that don't fit in the space left in the
+ * advertisement are left out of the bitmap. Changes are published at most once per
+ * BLUETOOTH_SERVICES_ADVERTISEMENT_INTERVAL_MS.
+ */
+
+/*
+ * The company identifier is read from /advertisement/companyId when publishing starts. Until the
+ * product's identifier is configured, the one reserved by the Bluetooth SIG for testing is used.
+ */
+#define ADVERTISEMENT_CONFIG_ROOT "/advertisement"
+#define ADVERTISEMENT_DEFAULT_COMPANY_ID 0xffff
+
+// The ManufacturerData AD structure's own length, type and company identifier
+#define ADVERTISEMENT_MANUFACTURER_DATA_OVERHEAD 4
+
+#define ADVERTISEMENT_FORMAT_VERSION 1
+
+enum AdvertisementFieldId
+{
+    ADVERTISEMENT_FIELD_BATTERY_PERCENT = 0,
+    ADVERTISEMENT_FIELD_ALERT_LEVEL = 1,
+    // Bridged characteristics take the id set by their advertiseId, from here up
+    ADVERTISEMENT_FIELD_FIRST_BRIDGED = 2,
+    ADVERTISEMENT_FIELD_COUNT = 8,
+};
+
+struct AdvertisementField;
+
+// Returns NULL, after logging why, if the id is out of range or already taken
+struct AdvertisementField *AdvertisementDataAddField(guint id, const gchar *name, gsize size);
+// The field's bit is cleared, and a field that didn't fit before may now be included
+void AdvertisementDataRemoveField(struct AdvertisementField *field);
+void AdvertisementDataSet(struct AdvertisementField *field, const guint8 *data);
+
+/*
+ * Starts publishing to the advertisement. budget is the number of bytes of the advertising payload
+ * that are still free, including the ManufacturerData overhead.
+ */
+void AdvertisementDataStart(BluezLEAdvertisement1 *advertisement, gsize budget);
+
+#endif // _ADVERTISEMENT_DATA_H
@@ -2,6 +2,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 // GLib
 #include <glib.h>
@@ -13,28 +15,191 @@
 
 // Local
 #include "battery_service.h"
+#include "value_cache.h"
+#include "notify_policy.h"
+#include "subscriptions.h"
+#include "sample_history.h"
+#include "window_stats.h"
+#include "advertisement_data.h"
+#include "gatt_stats.h"
 #include "org.bluez.GattCharacteristic1.h"
-#include "org.bluez.GattService1.h"
 
 #define BLE_BATTERY_LEVEL_CHARACTERISTIC_UUID "2a19"
+#define BLE_BATTERY_TIME_STATUS_CHARACTERISTIC_UUID "2bee"
+#define BATTERY_TREND_CHARACTERISTIC_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b5f01"
 #define BLUE_CCCD_UUID "2902"
 
+// A day of samples at the 30s period requested from the battery app
+#define BATTERY_HISTORY_CAPACITY (24 * 60 * 2)
+
+/*
+ * Trends are computed over the last hour, which is 120 samples at the 30s period. The capacity
+ * leaves room for a faster battery app, beyond which the window covers less than an hour.
+ */
+#define BATTERY_TREND_WINDOW_S (60 * 60)
+#define BATTERY_TREND_CAPACITY 256
+
+// Battery Time Status values are in minutes, as a uint24
+#define TIME_STATUS_UNKNOWN 0xffffff
+#define TIME_STATUS_GREATER 0xfffffe
+#define TREND_TIME_UNKNOWN G_MAXUINT32
+
+/*
+ * The level is reported in whole percent, so there is nothing to notify until it changes by at
+ * least one. Bursts are limited to one notification every 5s and subscribers hear from us at least
+ * every 10 minutes.
+ */
+static const struct NotifyPolicy battery_level_notify_policy = {
+    .deadband = 1.0,
+    .minIntervalMs = 5 * 1000,
+    .maxIntervalMs = 10 * 60 * 1000,
+};
+
 struct BSContext {
     guint8 batt_percent;
     gint8 batt_delta;
-    bool notifying;
     BluezGattCharacteristic1 *battery_characteristic;
+    struct Subscription level_subscription;
+    /*
+     * The serialized level. Reads are served from the read pool, so the variant is replaced under
+     * level_lock, and readers take their own reference under it. It is only replaced on the main
+     * loop, which can use it without the lock.
+     */
+    GMutex level_lock;
+    GVariant *level_value;
+    struct Notifier level_notifier;
+    struct SampleHistory *level_history;
+    struct AdvertisementField *level_advertisement;
+    dhubAdmin_NumericPushHandlerRef_t percent_handler;
+    // Derived from the pushed samples and encoded as they arrive, so reads only serve the caches
+    struct WindowStats level_stats;
+    struct ValueCache time_status_cache;
+    struct ValueCache trend_cache;
 };
 
-static void notify_battery_level(
-    BluezGattCharacteristic1 *gatt_characteristic_object,
-    guint8 battery_percent)
+static void put_le24(guint8 *buffer, guint32 value)
+{
+    buffer[0] = value & 0xff;
+    buffer[1] = (value >> 8) & 0xff;
+    buffer[2] = (value >> 16) & 0xff;
+}
+
+static void put_le32(guint8 *buffer, guint32 value)
+{
+    const guint32 le = GUINT32_TO_LE(value);
+    memcpy(buffer, &le, sizeof(le));
+}
+
+static void put_float32(guint8 *buffer, double value)
+{
+    const gfloat raw = (gfloat)value;
+    guint32 bits;
+    memcpy(&bits, &raw, sizeof(bits));
+    put_le32(buffer, bits);
+}
+
+/*
+ * Seconds until the regression line of the level reaches zero, or a negative value if the level
+ * isn't falling.
+ */
+static double estimate_time_to_empty(const struct WindowStats *stats)
+{
+    double slope;
+    if (WindowStatsCount(stats) == 0 || !WindowStatsSlope(stats, &slope) || slope >= 0.0)
+    {
+        return -1.0;
+    }
+    const double level = WindowStatsFitted(stats, WindowStatsNewest(stats)->timestamp);
+    return MAX(level, 0.0) / -slope;
+}
+
+/*
+ * Battery Time Status: flags (u8, no optional fields) and the time until discharged in minutes
+ * (u24), which is unknown until the level has been seen falling.
+ */
+static void update_time_status(struct BSContext *ctx, double time_to_empty)
+{
+    guint32 minutes = TIME_STATUS_UNKNOWN;
+    if (time_to_empty >= 0.0)
+    {
+        minutes = (guint32)MIN(round(time_to_empty / 60.0), (double)TIME_STATUS_GREATER);
+    }
+
+    guint8 buffer[4] = {0};
+    put_le24(&buffer[1], minutes);
+    ValueCacheSet(&ctx->time_status_cache, buffer, sizeof(buffer));
+}
+
+/*
+ * Little endian: number of samples in the window (u16), seconds between the oldest and newest
+ * (u32), minimum, maximum and mean level in percent (float32 each, NaN while there are no
+ * samples), rate of change in percent per hour (float32, negative while discharging, NaN until
+ * known) and minutes until empty (u32, 0xffffffff until the level has been seen falling).
+ */
+static void update_trend(struct BSContext *ctx, double time_to_empty)
 {
-    guint8 value_array[] = {battery_percent};
-    GVariant *value = g_variant_new_fixed_array(
-        G_VARIANT_TYPE_BYTE, value_array, G_N_ELEMENTS(value_array), sizeof(value_array[0]));
+    const struct WindowStats *stats = &ctx->level_stats;
+    const guint count = WindowStatsCount(stats);
+    double slope;
+    if (!WindowStatsSlope(stats, &slope))
+    {
+        slope = NAN;
+    }
 
-    bluez_gatt_characteristic1_set_value(gatt_characteristic_object, value);
+    guint8 buffer[26];
+    buffer[0] = count & 0xff;
+    buffer[1] = (count >> 8) & 0xff;
+    put_le32(&buffer[2], (count > 0) ? (guint32)round(WindowStatsSpan(stats)) : 0);
+    put_float32(&buffer[6], (count > 0) ? WindowStatsMin(stats) : NAN);
+    put_float32(&buffer[10], (count > 0) ? WindowStatsMax(stats) : NAN);
+    put_float32(&buffer[14], (count > 0) ? WindowStatsMean(stats) : NAN);
+    put_float32(&buffer[18], slope * 60.0 * 60.0);
+    put_le32(
+        &buffer[22],
+        (time_to_empty >= 0.0) ?
+            (guint32)MIN(round(time_to_empty / 60.0), (double)(TREND_TIME_UNKNOWN - 1)) :
+            TREND_TIME_UNKNOWN);
+    ValueCacheSet(&ctx->trend_cache, buffer, sizeof(buffer));
+}
+
+static void set_level_value(struct BSContext *ctx, guint8 level)
+{
+    GVariant *value = g_variant_ref_sink(
+        g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, &level, 1, sizeof(level)));
+    g_mutex_lock(&ctx->level_lock);
+    GVariant *old = ctx->level_value;
+    ctx->level_value = value;
+    g_mutex_unlock(&ctx->level_lock);
+    if (old != NULL)
+    {
+        g_variant_unref(old);
+    }
+}
+
+static void notify_battery_level(double percent, gpointer context)
+{
+    struct BSContext *ctx = context;
+    // The variant always holds the latest level, which is the one the notifier asked for
+    NotifyCharacteristicValue(ctx->battery_characteristic, ctx->level_value);
+    SubscriptionRecordNotification(&ctx->level_subscription, g_variant_get_size(ctx->level_value));
+}
+
+/*
+ * The notifier and its timers only run while someone is subscribed. Starting it notifies the
+ * current level.
+ */
+static void level_subscription_changed(
+    struct Subscription *subscription, const gchar *device, bool subscribed, gpointer context)
+{
+    struct BSContext *ctx = context;
+    if (SubscriptionIsActive(subscription) && !ctx->level_notifier.active)
+    {
+        NotifierStart(&ctx->level_notifier, ctx->batt_percent);
+    }
+    else if (!SubscriptionIsActive(subscription))
+    {
+        NotifierStop(&ctx->level_notifier);
+    }
 }
 
 static gboolean handle_start_notify(
@@ -43,11 +208,7 @@ static gboolean handle_start_notify(
     gpointer user_data)
 {
     struct BSContext *ctx = user_data;
-    if (!ctx->notifying)
-    {
-        ctx->notifying = true;
-        notify_battery_level(interface, ctx->batt_percent);
-    }
+    SubscriptionAdd(&ctx->level_subscription, NULL);
 
     bluez_gatt_characteristic1_complete_start_notify(interface, invocation);
     return TRUE;
@@ -59,7 +220,7 @@ static gboolean handle_stop_notify(
     gpointer user_data)
 {
     struct BSContext *ctx = user_data;
-    ctx->notifying = false;
+    SubscriptionRemove(&ctx->level_subscription, NULL);
 
     bluez_gatt_characteristic1_complete_stop_notify(interface, invocation);
     return TRUE;
@@ -72,19 +233,11 @@ static gboolean handle_read_value(
     gpointer user_data)
 {
     struct BSContext *ctx = user_data;
-    g_print("%s called\n", __func__);
-    guint8 valueArray[] = {ctx->batt_percent};
-    GVariant *value = g_variant_new_fixed_array(
-        G_VARIANT_TYPE_BYTE, valueArray, G_N_ELEMENTS(valueArray), sizeof(valueArray[0]));
-    /*
-     * It seems that it is necessary to sink the reference because if something else sinks the
-     * reference and then frees it, then the variant might be freed while it is still needed later
-     * in this function.
-     */
-    g_variant_ref_sink(value);
-
-    bluez_gatt_characteristic1_set_value(interface, value);
-    bluez_gatt_characteristic1_complete_read_value(interface, invocation, value);
+    // Runs on the read pool, so a push may replace the value while the reply is built
+    g_mutex_lock(&ctx->level_lock);
+    GVariant *value = g_variant_ref(ctx->level_value);
+    g_mutex_unlock(&ctx->level_lock);
+    GattCharacteristicCompleteRead(interface, invocation, value);
     g_variant_unref(value);
 
     return TRUE;
@@ -99,59 +252,141 @@ static void BatteryPercentPushHandler(double timestamp, double percent, void *co
         LE_ERROR("Invalid battery percentage received: %f", percent);
         return;
     }
-    ctx->batt_percent = (guint8)round(percent);
-    if (ctx->notifying) {
-        notify_battery_level(ctx->battery_characteristic, ctx->batt_percent);
-    }
+    const guint8 level = (guint8)round(percent);
+    ctx->batt_percent = level;
+    set_level_value(ctx, level);
+    NotifierSubmit(&ctx->level_notifier, level);
+    SampleHistoryRecord(ctx->level_history, timestamp, percent);
+    AdvertisementDataSet(ctx->level_advertisement, &level);
+
+    WindowStatsAdd(&ctx->level_stats, timestamp, percent);
+    const double time_to_empty = estimate_time_to_empty(&ctx->level_stats);
+    update_time_status(ctx, time_to_empty);
+    update_trend(ctx, time_to_empty);
 }
 
-void battery_register_services(
-    GDBusObjectManagerServer *services_om,
-    size_t *num_services_registered)
+static gboolean handle_read_time_status(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer user_data)
+{
+    struct BSContext *ctx = user_data;
+    GattCharacteristicCompleteRead(interface, invocation, ValueCacheGet(&ctx->time_status_cache));
+    return TRUE;
+}
+
+static gboolean handle_read_trend(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer user_data)
+{
+    struct BSContext *ctx = user_data;
+    GattCharacteristicCompleteRead(interface, invocation, ValueCacheGet(&ctx->trend_cache));
+    return TRUE;
+}
+
+static void bind_battery_level(gpointer context, BluezGattCharacteristic1 *characteristic)
+{
+    struct BSContext *ctx = context;
+    ctx->battery_characteristic = characteristic;
+}
+
+static gpointer battery_init(void)
 {
     struct BSContext *ctx = g_malloc0(sizeof(*ctx));
-    ctx->batt_percent = 50;
-    const gchar *om_path =
-        g_dbus_object_manager_get_object_path(G_DBUS_OBJECT_MANAGER(services_om));
-
-    gchar *service_path = g_strdup_printf("%s/service%zu", om_path, *num_services_registered);
-    GDBusObjectSkeleton *bos = g_dbus_object_skeleton_new(service_path);
-    BluezGattService1 *bgs = bluez_gatt_service1_skeleton_new();
-    bluez_gatt_service1_set_uuid(bgs, BLE_BATTERY_SERVICE_UUID);
-    bluez_gatt_service1_set_primary(bgs, TRUE);
-    g_dbus_object_skeleton_add_interface(bos, G_DBUS_INTERFACE_SKELETON(bgs));
-    g_object_unref(bgs);
-    g_dbus_object_manager_server_export(services_om, G_DBUS_OBJECT_SKELETON(bos));
-    g_object_unref(bos);
-
-    gchar *characteristic_path = g_strconcat(service_path, "/char0", NULL);
-    bos = g_dbus_object_skeleton_new(characteristic_path);
-    BluezGattCharacteristic1 *bgc = bluez_gatt_characteristic1_skeleton_new();
-    bluez_gatt_characteristic1_set_uuid(bgc, BLE_BATTERY_LEVEL_CHARACTERISTIC_UUID);
-    const gchar *batteryLevelCharacteristicFlags[] = {
-        "read",
-        "notify",
-        NULL
-    };
-    bluez_gatt_characteristic1_set_flags(bgc, batteryLevelCharacteristicFlags);
-    bluez_gatt_characteristic1_set_service(bgc, service_path);
-    g_signal_connect(bgc, "handle-read-value", G_CALLBACK(handle_read_value), ctx);
-    g_signal_connect(bgc, "handle-start-notify", G_CALLBACK(handle_start_notify), ctx);
-    g_signal_connect(bgc, "handle-stop-notify", G_CALLBACK(handle_stop_notify), ctx);
-    g_dbus_object_skeleton_add_interface(bos, G_DBUS_INTERFACE_SKELETON(bgc));
-    ctx->battery_characteristic = bgc;
-    g_dbus_object_manager_server_export(services_om, G_DBUS_OBJECT_SKELETON(bos));
-    g_object_unref(bos);
-
-    g_free(characteristic_path);
-    g_free(service_path);
-
-    *num_services_registered += 1;
+    const guint8 level = 50;
+    ctx->batt_percent = level;
+    g_mutex_init(&ctx->level_lock);
+    set_level_value(ctx, level);
+    NotifierInit(
+        &ctx->level_notifier, &battery_level_notify_policy, notify_battery_level, ctx);
+    SubscriptionInit(
+        &ctx->level_subscription, "battery/level", level_subscription_changed, ctx);
+    ctx->level_history = SampleHistoryNew("battery/percent", BATTERY_HISTORY_CAPACITY);
+    ctx->level_advertisement =
+        AdvertisementDataAddField(ADVERTISEMENT_FIELD_BATTERY_PERCENT, "battery/percent", 1);
+    AdvertisementDataSet(ctx->level_advertisement, &level);
+    WindowStatsInit(&ctx->level_stats, BATTERY_TREND_WINDOW_S, BATTERY_TREND_CAPACITY);
+    ValueCacheInit(&ctx->time_status_cache);
+    update_time_status(ctx, -1.0);
+    ValueCacheInit(&ctx->trend_cache);
+    update_trend(ctx, -1.0);
 
     LE_ASSERT_OK(dhubAdmin_CreateObs("battery/percent"));
     LE_ASSERT_OK(dhubAdmin_SetSource("/obs/battery/percent", "/app/battery/value"));
     dhubAdmin_SetJsonExtraction("/obs/battery/percent", "percent");
-    dhubAdmin_AddNumericPushHandler("/obs/battery/percent", BatteryPercentPushHandler, ctx);
+    ctx->percent_handler = dhubAdmin_AddNumericPushHandler(
+        "/obs/battery/percent", BatteryPercentPushHandler, ctx);
     dhubAdmin_PushNumeric("/app/battery/period", IO_NOW, 30.0);
     dhubAdmin_PushBoolean("/app/battery/enable", IO_NOW, true);
+
+    return ctx;
+}
+
+/*
+ * The battery app is left running, since other apps may be using it. The observation is kept too,
+ * so enabling the service again picks up where it left off.
+ */
+static void battery_fini(gpointer context)
+{
+    struct BSContext *ctx = context;
+    dhubAdmin_RemoveNumericPushHandler(ctx->percent_handler);
+    NotifierStop(&ctx->level_notifier);
+    SubscriptionFini(&ctx->level_subscription);
+    SampleHistoryRetire(ctx->level_history);
+    AdvertisementDataRemoveField(ctx->level_advertisement);
+    g_variant_unref(ctx->level_value);
+    g_mutex_clear(&ctx->level_lock);
+    ValueCacheInvalidate(&ctx->time_status_cache);
+    ValueCacheInvalidate(&ctx->trend_cache);
+    WindowStatsFini(&ctx->level_stats);
+    g_free(ctx);
 }
+
+static const gchar *const battery_level_flags[] = {
+    "read",
+    "notify",
+    NULL
+};
+
+static const gchar *const battery_read_flags[] = {
+    "read",
+    NULL
+};
+
+static const struct GattCharacteristicDefinition battery_characteristics[] = {
+    {
+        .name = "level",
+        .uuid = BLE_BATTERY_LEVEL_CHARACTERISTIC_UUID,
+        .flags = battery_level_flags,
+        .read = handle_read_value,
+        .startNotify = handle_start_notify,
+        .stopNotify = handle_stop_notify,
+        .bind = bind_battery_level,
+        .threadedRead = true,
+    },
+    {
+        .name = "time_status",
+        .uuid = BLE_BATTERY_TIME_STATUS_CHARACTERISTIC_UUID,
+        .flags = battery_read_flags,
+        .read = handle_read_time_status,
+    },
+    {
+        .name = "trend",
+        .uuid = BATTERY_TREND_CHARACTERISTIC_UUID,
+        .flags = battery_read_flags,
+        .read = handle_read_trend,
+    },
+};
+
+const struct GattServiceDefinition battery_service_definition = {
+    .name = "battery",
+    .uuid = BLE_BATTERY_SERVICE_UUID,
+    .primary = true,
+    .init = battery_init,
+    .fini = battery_fini,
+    .characteristics = battery_characteristics,
+    .numCharacteristics = G_N_ELEMENTS(battery_characteristics),
+};
@@ -1,10 +1,10 @@
 #ifndef _BATTERY_SERVICE_H
 #define _BATTERY_SERVICE_H
 
+#include "gatt_database.h"
+
 #define BLE_BATTERY_SERVICE_UUID "180f"
 
-void battery_register_services(
-    GDBusObjectManagerServer *services_om,
-    size_t *num_services_registered);
+extern const struct GattServiceDefinition battery_service_definition;
 
 #endif // _BATTERY_SERVICE_H
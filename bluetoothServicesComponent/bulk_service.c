@@ -0,0 +1,572 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// GLib
+#include <glib.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+
+// Legato
+#include "legato.h"
+#include "interfaces.h"
+
+// Local
+#include "bulk_service.h"
+#include "byte_ring.h"
+#include "subscriptions.h"
+#include "gatt_stats.h"
+#include "org.bluez.GattCharacteristic1.h"
+
+#define BULK_TX_CHARACTERISTIC_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b5e01"
+#define BULK_RX_CHARACTERISTIC_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b5e02"
+#define BULK_THROUGHPUT_CHARACTERISTIC_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b5e03"
+
+#define BULK_TX_RING_CAPACITY (64 * 1024)
+#define ATT_DEFAULT_MTU 23
+#define ATT_MAX_MTU 517
+#define ATT_NOTIFICATION_HEADER_SIZE 3
+
+/*
+ * One end of a socket pair whose other end was handed to bluetoothd by AcquireNotify or
+ * AcquireWrite. Each packet on the socket is one notification or write command.
+ */
+struct BulkChannel
+{
+    const char *name;
+    int fd; // -1 while not acquired
+    guint watch;
+    guint16 mtu;
+    gint64 acquiredAt;
+    guint64 bytes; // Since acquired
+    guint32 lastRate; // Bytes per second of the previous acquisition
+};
+
+struct BulkContext
+{
+    BluezGattCharacteristic1 *tx_characteristic;
+    BluezGattCharacteristic1 *rx_characteristic;
+    struct ByteRing tx_ring;
+    struct BulkChannel tx;
+    struct BulkChannel rx;
+    struct Subscription tx_subscription;
+    gchar *tx_device; // The device that acquired tx notifications, if bluetoothd said
+    bool tx_blocked; // Waiting for the tx socket to become writable
+    bool rx_paused; // Not reading the rx socket until the tx ring drains
+    guint8 packet[ATT_MAX_MTU];
+    guint64 total_tx_bytes;
+    guint64 total_rx_bytes;
+    guint32 tx_stalls;
+    guint32 tx_dropped;
+};
+
+static struct BulkContext *bulk_ctx;
+static BulkReceiveFunc bulk_receiver;
+static gpointer bulk_receiver_context;
+
+static void flush_tx(struct BulkContext *ctx);
+static void watch_rx(struct BulkContext *ctx);
+
+static guint32 channel_rate(const struct BulkChannel *channel)
+{
+    if (channel->fd < 0)
+    {
+        return channel->lastRate;
+    }
+    const gint64 elapsed = MAX(g_get_monotonic_time() - channel->acquiredAt, 1);
+    return (guint32)MIN(channel->bytes * G_USEC_PER_SEC / elapsed, G_MAXUINT32);
+}
+
+static void release_channel(struct BulkContext *ctx, struct BulkChannel *channel)
+{
+    if (channel->fd < 0)
+    {
+        return;
+    }
+
+    channel->lastRate = channel_rate(channel);
+    LE_INFO(
+        "Bulk %s released after %" G_GUINT64_FORMAT " bytes (%u B/s)",
+        channel->name,
+        channel->bytes,
+        channel->lastRate);
+
+    if (channel->watch != 0)
+    {
+        g_source_remove(channel->watch);
+        channel->watch = 0;
+    }
+    close(channel->fd);
+    channel->fd = -1;
+
+    if (channel == &ctx->tx)
+    {
+        ctx->tx_blocked = false;
+        bluez_gatt_characteristic1_set_notify_acquired(ctx->tx_characteristic, FALSE);
+        gchar *device = ctx->tx_device;
+        ctx->tx_device = NULL;
+        SubscriptionRemove(&ctx->tx_subscription, device);
+        g_free(device);
+    }
+    else
+    {
+        ctx->rx_paused = false;
+        bluez_gatt_characteristic1_set_write_acquired(ctx->rx_characteristic, FALSE);
+    }
+}
+
+static void set_watch(
+    struct BulkChannel *channel, GIOCondition condition, GUnixFDSourceFunc func, gpointer data)
+{
+    if (channel->watch != 0)
+    {
+        g_source_remove(channel->watch);
+    }
+    channel->watch = g_unix_fd_add(channel->fd, condition, func, data);
+}
+
+/*
+ * Creates the socket pair and replies to the Acquire* call with bluetoothd's end. The MTU offered
+ * by bluetoothd is accepted as is.
+ */
+static bool acquire_channel(
+    struct BulkChannel *channel,
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    enum GattOperation operation)
+{
+    if (channel->fd >= 0)
+    {
+        GattReturnError(
+            interface, invocation, operation, "org.bluez.Error.NotPermitted", "Already acquired");
+        return false;
+    }
+
+    guint16 mtu = ATT_DEFAULT_MTU;
+    g_variant_lookup(options, "mtu", "q", &mtu);
+    mtu = CLAMP(mtu, ATT_DEFAULT_MTU, ATT_MAX_MTU);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0)
+    {
+        LE_ERROR("Couldn't create bulk %s socket: %s", channel->name, strerror(errno));
+        GattReturnError(interface, invocation, operation, "org.bluez.Error.Failed", "No socket");
+        return false;
+    }
+
+    GError *error = NULL;
+    if (!g_unix_set_fd_nonblocking(fds[0], TRUE, &error))
+    {
+        LE_ERROR("Couldn't make bulk %s socket non-blocking: %s", channel->name, error->message);
+        g_error_free(error);
+        close(fds[0]);
+        close(fds[1]);
+        GattReturnError(interface, invocation, operation, "org.bluez.Error.Failed", "No socket");
+        return false;
+    }
+
+    GUnixFDList *fdList = g_unix_fd_list_new();
+    const gint index = g_unix_fd_list_append(fdList, fds[1], &error);
+    // The list holds its own duplicate
+    close(fds[1]);
+    if (index < 0)
+    {
+        LE_ERROR("Couldn't pass bulk %s socket: %s", channel->name, error->message);
+        g_error_free(error);
+        g_object_unref(fdList);
+        close(fds[0]);
+        GattReturnError(interface, invocation, operation, "org.bluez.Error.Failed", "No socket");
+        return false;
+    }
+
+    channel->fd = fds[0];
+    channel->mtu = mtu;
+    channel->bytes = 0;
+    channel->acquiredAt = g_get_monotonic_time();
+    g_dbus_method_invocation_return_value_with_unix_fd_list(
+        invocation, g_variant_new("(hq)", index, mtu), fdList);
+    g_object_unref(fdList);
+
+    LE_INFO("Bulk %s acquired with MTU %u", channel->name, mtu);
+    return true;
+}
+
+static gboolean tx_socket_ready(gint fd, GIOCondition condition, gpointer user_data)
+{
+    struct BulkContext *ctx = user_data;
+    if (condition & (G_IO_HUP | G_IO_ERR))
+    {
+        // bluetoothd closes its end when the client unsubscribes or disconnects
+        ctx->tx.watch = 0;
+        release_channel(ctx, &ctx->tx);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (condition & G_IO_OUT)
+    {
+        ctx->tx_blocked = false;
+        ctx->tx.watch = 0;
+        set_watch(&ctx->tx, G_IO_HUP | G_IO_ERR, tx_socket_ready, ctx);
+        flush_tx(ctx);
+        return G_SOURCE_REMOVE;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Sends as much of the tx ring as the socket takes, one notification per packet. When the socket
+ * is full, sending resumes once it becomes writable again.
+ */
+static void flush_tx(struct BulkContext *ctx)
+{
+    if (ctx->tx.fd < 0 || ctx->tx_blocked)
+    {
+        return;
+    }
+
+    const gsize payload = ctx->tx.mtu - ATT_NOTIFICATION_HEADER_SIZE;
+    while (ByteRingLength(&ctx->tx_ring) > 0)
+    {
+        const gsize size = ByteRingPeek(&ctx->tx_ring, ctx->packet, payload);
+        const ssize_t sent = send(ctx->tx.fd, ctx->packet, size, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                ctx->tx_blocked = true;
+                ctx->tx_stalls++;
+                set_watch(&ctx->tx, G_IO_OUT | G_IO_HUP | G_IO_ERR, tx_socket_ready, ctx);
+                return;
+            }
+            LE_WARN("Bulk tx failed: %s", strerror(errno));
+            release_channel(ctx, &ctx->tx);
+            return;
+        }
+
+        ByteRingConsume(&ctx->tx_ring, size);
+        ctx->tx.bytes += size;
+        ctx->total_tx_bytes += size;
+        GattStatsRecordNotification(ctx->tx_characteristic, size);
+        SubscriptionRecordNotification(&ctx->tx_subscription, size);
+    }
+
+    if (ctx->rx_paused)
+    {
+        watch_rx(ctx);
+    }
+}
+
+/*
+ * The loopback only exists for the bench, so a board never echoes what one client writes to
+ * whoever listens on tx. Looping data back is only worth it while someone is subscribed to tx.
+ * Otherwise it would just fill the tx ring with stale data.
+ */
+static bool is_looping_back(const struct BulkContext *ctx)
+{
+#ifdef BULK_SERVICE_LOOPBACK
+    return bulk_receiver == NULL && SubscriptionIsActive(&ctx->tx_subscription);
+#else
+    return false;
+#endif
+}
+
+static void deliver_rx(struct BulkContext *ctx, const guint8 *data, gsize size)
+{
+    ctx->total_rx_bytes += size;
+    if (bulk_receiver != NULL)
+    {
+        bulk_receiver(data, size, bulk_receiver_context);
+    }
+    else if (is_looping_back(ctx))
+    {
+        bulk_service_send(data, size);
+    }
+}
+
+static gboolean rx_socket_ready(gint fd, GIOCondition condition, gpointer user_data)
+{
+    struct BulkContext *ctx = user_data;
+    while (true)
+    {
+        // When looping back, stop reading rather than drop data. bluetoothd then stops taking
+        // write commands once its end of the socket is full.
+        if (is_looping_back(ctx) && ByteRingSpace(&ctx->tx_ring) < ctx->rx.mtu)
+        {
+            ctx->rx_paused = true;
+            ctx->rx.watch = 0;
+            return G_SOURCE_REMOVE;
+        }
+
+        const ssize_t received = recv(ctx->rx.fd, ctx->packet, ctx->rx.mtu, 0);
+        if (received > 0)
+        {
+            ctx->rx.bytes += received;
+            GattStatsRecordBytes(ctx->rx_characteristic, GATT_OPERATION_WRITE, received);
+            deliver_rx(ctx, ctx->packet, received);
+            continue;
+        }
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return G_SOURCE_CONTINUE;
+        }
+
+        // End of stream or error: the client is gone
+        ctx->rx.watch = 0;
+        release_channel(ctx, &ctx->rx);
+        return G_SOURCE_REMOVE;
+    }
+}
+
+static void watch_rx(struct BulkContext *ctx)
+{
+    ctx->rx_paused = false;
+    set_watch(&ctx->rx, G_IO_IN | G_IO_HUP | G_IO_ERR, rx_socket_ready, ctx);
+}
+
+static gboolean handle_acquire_notify(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer user_data)
+{
+    struct BulkContext *ctx = user_data;
+    if (acquire_channel(&ctx->tx, interface, invocation, options, GATT_OPERATION_ACQUIRE_NOTIFY))
+    {
+        ctx->tx_device = g_strdup(GattOptionsGetDevice(options));
+        SubscriptionAdd(&ctx->tx_subscription, ctx->tx_device);
+        bluez_gatt_characteristic1_set_notify_acquired(interface, TRUE);
+        set_watch(&ctx->tx, G_IO_HUP | G_IO_ERR, tx_socket_ready, ctx);
+        flush_tx(ctx);
+    }
+
+    return TRUE;
+}
+
+static gboolean handle_acquire_write(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer user_data)
+{
+    struct BulkContext *ctx = user_data;
+    if (acquire_channel(&ctx->rx, interface, invocation, options, GATT_OPERATION_ACQUIRE_WRITE))
+    {
+        bluez_gatt_characteristic1_set_write_acquired(interface, TRUE);
+        watch_rx(ctx);
+    }
+
+    return TRUE;
+}
+
+/*
+ * Write requests (and write commands from clients BlueZ doesn't hand a socket for) still arrive
+ * through WriteValue.
+ */
+static gboolean handle_rx_write_value(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *value,
+    GVariant *options,
+    gpointer user_data)
+{
+    struct BulkContext *ctx = user_data;
+    gsize size;
+    const guint8 *data = g_variant_get_fixed_array(value, &size, sizeof(guint8));
+    deliver_rx(ctx, data, size);
+    bluez_gatt_characteristic1_complete_write_value(interface, invocation);
+
+    return TRUE;
+}
+
+static void put_le32(guint8 *buffer, guint32 value)
+{
+    const guint32 le = GUINT32_TO_LE(value);
+    memcpy(buffer, &le, sizeof(le));
+}
+
+static void put_le64(guint8 *buffer, guint64 value)
+{
+    const guint64 le = GUINT64_TO_LE(value);
+    memcpy(buffer, &le, sizeof(le));
+}
+
+/*
+ * Little endian: total tx bytes (u64), total rx bytes (u64), tx and rx rates in bytes per second
+ * over the current or previous acquisition (u32 each), tx stalls (u32) and bytes dropped because
+ * the tx ring was full (u32).
+ */
+static gboolean handle_read_throughput(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer user_data)
+{
+    struct BulkContext *ctx = user_data;
+    guint8 buffer[32];
+    put_le64(&buffer[0], ctx->total_tx_bytes);
+    put_le64(&buffer[8], ctx->total_rx_bytes);
+    put_le32(&buffer[16], channel_rate(&ctx->tx));
+    put_le32(&buffer[20], channel_rate(&ctx->rx));
+    put_le32(&buffer[24], ctx->tx_stalls);
+    put_le32(&buffer[28], ctx->tx_dropped);
+
+    GattCharacteristicCompleteRead(
+        interface,
+        invocation,
+        g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, buffer, sizeof(buffer), sizeof(guint8)));
+
+    return TRUE;
+}
+
+/*
+ * Queues data for the tx characteristic. Data is kept until a client acquires notifications, up
+ * to the capacity of the tx ring. Returns how many bytes were queued.
+ */
+gsize bulk_service_send(const guint8 *data, gsize size)
+{
+    struct BulkContext *ctx = bulk_ctx;
+    if (ctx == NULL)
+    {
+        return 0;
+    }
+
+    const gsize queued = ByteRingWrite(&ctx->tx_ring, data, size);
+    ctx->tx_dropped += size - queued;
+    flush_tx(ctx);
+    return queued;
+}
+
+void bulk_service_set_receiver(BulkReceiveFunc receiver, gpointer context)
+{
+    bulk_receiver = receiver;
+    bulk_receiver_context = context;
+}
+
+static void bind_tx(gpointer context, BluezGattCharacteristic1 *characteristic)
+{
+    struct BulkContext *ctx = context;
+    ctx->tx_characteristic = characteristic;
+}
+
+static void bind_rx(gpointer context, BluezGattCharacteristic1 *characteristic)
+{
+    struct BulkContext *ctx = context;
+    ctx->rx_characteristic = characteristic;
+}
+
+/*
+ * bluetoothd closes its end of the tx socket when the device goes away, but the disconnect may be
+ * seen first. Once nobody listens, a loopback that was paused on a full tx ring resumes and
+ * discards what it reads.
+ */
+static void tx_subscription_changed(
+    struct Subscription *subscription, const gchar *device, bool subscribed, gpointer context)
+{
+    struct BulkContext *ctx = context;
+    if (subscribed || SubscriptionIsActive(subscription))
+    {
+        return;
+    }
+
+    release_channel(ctx, &ctx->tx);
+    if (ctx->rx_paused && ctx->rx.fd >= 0)
+    {
+        watch_rx(ctx);
+    }
+}
+
+static gpointer bulk_init(void)
+{
+    struct BulkContext *ctx = g_malloc0(sizeof(*ctx));
+    ByteRingInit(&ctx->tx_ring, BULK_TX_RING_CAPACITY);
+    ctx->tx.name = "tx";
+    ctx->tx.fd = -1;
+    ctx->rx.name = "rx";
+    ctx->rx.fd = -1;
+    SubscriptionInit(&ctx->tx_subscription, "bulk/tx", tx_subscription_changed, ctx);
+    bulk_ctx = ctx;
+
+    return ctx;
+}
+
+/*
+ * Closing our ends of the sockets tells bluetoothd the channels are gone. Data still queued for tx
+ * is dropped.
+ */
+static void bulk_fini(gpointer context)
+{
+    struct BulkContext *ctx = context;
+    release_channel(ctx, &ctx->tx);
+    release_channel(ctx, &ctx->rx);
+    SubscriptionFini(&ctx->tx_subscription);
+    ByteRingFini(&ctx->tx_ring);
+    bulk_ctx = NULL;
+    g_free(ctx);
+}
+
+static const gchar *const bulk_tx_flags[] = {
+    "notify",
+    NULL
+};
+
+static const gchar *const bulk_rx_flags[] = {
+    "write-without-response",
+    "write",
+    NULL
+};
+
+static const gchar *const bulk_throughput_flags[] = {
+    "read",
+    NULL
+};
+
+static const struct GattCharacteristicDefinition bulk_characteristics[] = {
+    {
+        .name = "tx",
+        .uuid = BULK_TX_CHARACTERISTIC_UUID,
+        .flags = bulk_tx_flags,
+        .acquireNotify = handle_acquire_notify,
+        .bind = bind_tx,
+    },
+    {
+        .name = "rx",
+        .uuid = BULK_RX_CHARACTERISTIC_UUID,
+        .flags = bulk_rx_flags,
+        .write = handle_rx_write_value,
+        .acquireWrite = handle_acquire_write,
+        .bind = bind_rx,
+    },
+    {
+        .name = "throughput",
+        .uuid = BULK_THROUGHPUT_CHARACTERISTIC_UUID,
+        .flags = bulk_throughput_flags,
+        .read = handle_read_throughput,
+    },
+};
+
+const struct GattServiceDefinition bulk_service_definition = {
+    .name = "bulk",
+    .uuid = BULK_SERVICE_UUID,
+    .primary = true,
+    .optIn = true,
+    .init = bulk_init,
+    .fini = bulk_fini,
+    .characteristics = bulk_characteristics,
+    .numCharacteristics = G_N_ELEMENTS(bulk_characteristics),
+};
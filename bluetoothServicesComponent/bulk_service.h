@@ -0,0 +1,22 @@
+#ifndef _BULK_SERVICE_H
+#define _BULK_SERVICE_H
+
+#include <glib.h>
+
+#include "gatt_database.h"
+
+#define BULK_SERVICE_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b5e00"
+
+extern const struct GattServiceDefinition bulk_service_definition;
+
+/*
+ * Called with every packet a client writes to the rx characteristic. Until a receiver is set,
+ * received data is only counted, or looped back to the tx characteristic in builds with
+ * BULK_SERVICE_LOOPBACK defined (the bench host).
+ */
+typedef void (*BulkReceiveFunc)(const guint8 *data, gsize size, gpointer context);
+
+gsize bulk_service_send(const guint8 *data, gsize size);
+void bulk_service_set_receiver(BulkReceiveFunc receiver, gpointer context);
+
+#endif // _BULK_SERVICE_H
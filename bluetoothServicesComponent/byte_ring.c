@@ -0,0 +1,70 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// GLib
+#include <glib.h>
+
+// Local
+#include "byte_ring.h"
+
+void ByteRingInit(struct ByteRing *ring, gsize capacity)
+{
+    ring->data = g_malloc(capacity);
+    ring->capacity = capacity;
+    ring->head = 0;
+    ring->length = 0;
+}
+
+/*
+ * Appends as much of the data as fits and returns how many bytes were taken.
+ */
+gsize ByteRingWrite(struct ByteRing *ring, const guint8 *data, gsize size)
+{
+    size = MIN(size, ByteRingSpace(ring));
+    const gsize tail = (ring->head + ring->length) % ring->capacity;
+    const gsize first = MIN(size, ring->capacity - tail);
+    memcpy(&ring->data[tail], data, first);
+    memcpy(ring->data, data + first, size - first);
+    ring->length += size;
+    return size;
+}
+
+/*
+ * Copies up to size bytes from the front of the ring without removing them.
+ */
+gsize ByteRingPeek(const struct ByteRing *ring, guint8 *buffer, gsize size)
+{
+    size = MIN(size, ring->length);
+    const gsize first = MIN(size, ring->capacity - ring->head);
+    memcpy(buffer, &ring->data[ring->head], first);
+    memcpy(buffer + first, ring->data, size - first);
+    return size;
+}
+
+void ByteRingConsume(struct ByteRing *ring, gsize size)
+{
+    size = MIN(size, ring->length);
+    ring->head = (ring->head + size) % ring->capacity;
+    ring->length -= size;
+    if (ring->length == 0)
+    {
+        ring->head = 0;
+    }
+}
+
+void ByteRingClear(struct ByteRing *ring)
+{
+    ring->head = 0;
+    ring->length = 0;
+}
+
+void ByteRingFini(struct ByteRing *ring)
+{
+    g_free(ring->data);
+    ring->data = NULL;
+    ring->capacity = 0;
+    ByteRingClear(ring);
+}
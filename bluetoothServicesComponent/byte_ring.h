@@ -0,0 +1,35 @@
+#ifndef _BYTE_RING_H
+#define _BYTE_RING_H
+
+#include <glib.h>
+
+/*
+ * Fixed capacity FIFO of bytes. Writers never block: whatever doesn't fit is refused and the
+ * caller decides whether to drop it or retry later.
+ */
+struct ByteRing
+{
+    guint8 *data;
+    gsize capacity;
+    gsize head; // Next byte to read
+    gsize length;
+};
+
+void ByteRingInit(struct ByteRing *ring, gsize capacity);
+gsize ByteRingWrite(struct ByteRing *ring, const guint8 *data, gsize size);
+gsize ByteRingPeek(const struct ByteRing *ring, guint8 *buffer, gsize size);
+void ByteRingConsume(struct ByteRing *ring, gsize size);
+void ByteRingClear(struct ByteRing *ring);
+void ByteRingFini(struct ByteRing *ring);
+
+static inline gsize ByteRingLength(const struct ByteRing *ring)
+{
+    return ring->length;
+}
+
+static inline gsize ByteRingSpace(const struct ByteRing *ring)
+{
+    return ring->capacity - ring->length;
+}
+
+#endif // _BYTE_RING_H
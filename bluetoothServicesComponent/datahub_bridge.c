@@ -0,0 +1,769 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// GLib
+#include <glib.h>
+#include <gio/gio.h>
+
+// Legato
+#include "legato.h"
+#include "interfaces.h"
+
+// Local
+#include "datahub_bridge.h"
+#include "value_cache.h"
+#include "notify_policy.h"
+#include "subscriptions.h"
+#include "sample_history.h"
+#include "advertisement_data.h"
+#include "gatt_stats.h"
+#include "write_assembly.h"
+#include "executor.h"
+#include "org.bluez.GattCharacteristic1.h"
+
+// Keeps the exported object paths well inside GATT_OBJECT_PATH_MAX_LEN
+#define BRIDGE_NAME_MAX_LEN 32
+#define ATT_MAX_VALUE_LEN 512
+
+enum BridgeEncoding
+{
+    BRIDGE_ENCODING_UINT8,
+    BRIDGE_ENCODING_SINT16,
+    BRIDGE_ENCODING_FLOAT32,
+    BRIDGE_ENCODING_UTF8,
+};
+
+static const struct
+{
+    const char *name;
+    enum BridgeEncoding encoding;
+} Encodings[] = {
+    {"uint8", BRIDGE_ENCODING_UINT8},
+    {"sint16", BRIDGE_ENCODING_SINT16},
+    {"float32", BRIDGE_ENCODING_FLOAT32},
+    {"utf8", BRIDGE_ENCODING_UTF8},
+};
+
+/*
+ * One bridged data hub resource. Pushed values are encoded once into the cache, so reads and
+ * notifications serve the same bytes without converting anything.
+ */
+struct BridgedCharacteristic
+{
+    gchar *obsPath;
+    enum BridgeEncoding encoding;
+    double scale;
+    struct NotifyPolicy policy;
+    BluezGattCharacteristic1 *characteristic;
+    struct ValueCache cache;
+    struct Notifier notifier;
+    struct SampleHistory *history; // Optional, numeric encodings only
+    struct AdvertisementField *advertisement; // Optional, numeric encodings only
+    struct Subscription subscription;
+    dhubAdmin_NumericPushHandlerRef_t numericHandler;
+    dhubAdmin_StringPushHandlerRef_t stringHandler;
+    gchar *destination; // Optional, where written values are pushed
+    struct WriteAssembler writes;
+    // The last pushed number, or for utf8 a count of distinct strings so the notifier sees changes
+    double latestValue;
+};
+
+/*
+ * What the config tree says about one characteristic, read before anything is created so a
+ * service's settings can be compared with those it was loaded with.
+ */
+struct CharacteristicConfig
+{
+    char name[LE_CFG_NAME_LEN_BYTES];
+    char uuid[LE_CFG_STR_LEN_BYTES];
+    char source[LE_CFG_STR_LEN_BYTES];
+    char extraction[LE_CFG_STR_LEN_BYTES];
+    char encoding[LE_CFG_STR_LEN_BYTES];
+    char destination[LE_CFG_STR_LEN_BYTES];
+    double scale;
+    bool notify;
+    struct NotifyPolicy policy;
+    int32_t history;
+    bool advertise;
+    int advertiseId;
+};
+
+/*
+ * A written value on its way to the destination. The push is made on the provider worker.
+ */
+struct BridgedWrite
+{
+    gchar *destination;
+    bool isString;
+    double number;
+    gchar string[ATT_MAX_VALUE_LEN + 1];
+};
+
+static const gchar *const ReadFlags[] = {
+    "read",
+    NULL
+};
+
+static const gchar *const ReadNotifyFlags[] = {
+    "read",
+    "notify",
+    NULL
+};
+
+static const gchar *const ReadWriteFlags[] = {
+    "read",
+    "write",
+    "reliable-write",
+    NULL
+};
+
+static const gchar *const ReadNotifyWriteFlags[] = {
+    "read",
+    "notify",
+    "write",
+    "reliable-write",
+    NULL
+};
+
+static void PutLe16(guint8 *buffer, guint16 value)
+{
+    buffer[0] = value & 0xff;
+    buffer[1] = value >> 8;
+}
+
+static void PutLe32(guint8 *buffer, guint32 value)
+{
+    PutLe16(&buffer[0], value & 0xffff);
+    PutLe16(&buffer[2], value >> 16);
+}
+
+static guint16 GetLe16(const guint8 *buffer)
+{
+    return buffer[0] | (buffer[1] << 8);
+}
+
+static guint32 GetLe32(const guint8 *buffer)
+{
+    return GetLe16(&buffer[0]) | ((guint32)GetLe16(&buffer[2]) << 16);
+}
+
+static gsize EncodedSize(enum BridgeEncoding encoding)
+{
+    switch (encoding)
+    {
+    case BRIDGE_ENCODING_UINT8:
+        return 1;
+    case BRIDGE_ENCODING_SINT16:
+        return 2;
+    case BRIDGE_ENCODING_FLOAT32:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static void NumericPushHandler(double timestamp, double value, void *context)
+{
+    struct BridgedCharacteristic *bridged = context;
+    const double scaled = value * bridged->scale;
+    if (isnan(scaled) && bridged->encoding != BRIDGE_ENCODING_FLOAT32)
+    {
+        LE_WARN("Dropping NaN pushed to %s", bridged->obsPath);
+        return;
+    }
+
+    guint8 buffer[4];
+    gsize size = 0;
+    switch (bridged->encoding)
+    {
+    case BRIDGE_ENCODING_UINT8:
+        buffer[0] = (guint8)CLAMP(round(scaled), 0.0, (double)G_MAXUINT8);
+        size = 1;
+        break;
+
+    case BRIDGE_ENCODING_SINT16:
+    {
+        const gint16 raw = (gint16)CLAMP(round(scaled), (double)G_MININT16, (double)G_MAXINT16);
+        PutLe16(buffer, (guint16)raw);
+        size = 2;
+        break;
+    }
+
+    case BRIDGE_ENCODING_FLOAT32:
+    {
+        const float raw = (float)scaled;
+        guint32 bits;
+        memcpy(&bits, &raw, sizeof(bits));
+        PutLe32(buffer, bits);
+        size = 4;
+        break;
+    }
+
+    case BRIDGE_ENCODING_UTF8:
+        LE_WARN("Ignoring numeric push to string characteristic %s", bridged->obsPath);
+        return;
+    }
+
+    ValueCacheSet(&bridged->cache, buffer, size);
+    bridged->latestValue = value;
+    NotifierSubmit(&bridged->notifier, value);
+    if (bridged->history != NULL)
+    {
+        SampleHistoryRecord(bridged->history, timestamp, value);
+    }
+    if (bridged->advertisement != NULL)
+    {
+        AdvertisementDataSet(bridged->advertisement, buffer);
+    }
+}
+
+static void StringPushHandler(double timestamp, const char *value, void *context)
+{
+    struct BridgedCharacteristic *bridged = context;
+    const gsize size = MIN(strlen(value), ATT_MAX_VALUE_LEN);
+
+    gsize currentSize = 0;
+    const guint8 *current = NULL;
+    if (bridged->cache.value != NULL)
+    {
+        current = g_variant_get_fixed_array(bridged->cache.value, &currentSize, sizeof(guint8));
+    }
+    if (currentSize == size && (size == 0 || memcmp(current, value, size) == 0))
+    {
+        return;
+    }
+
+    ValueCacheSet(&bridged->cache, (const guint8 *)value, size);
+    bridged->latestValue += 1.0;
+    NotifierSubmit(&bridged->notifier, bridged->latestValue);
+}
+
+static void NotifyBridgedValue(double value, gpointer context)
+{
+    struct BridgedCharacteristic *bridged = context;
+    NotifyCharacteristicValue(bridged->characteristic, bridged->cache.value);
+    SubscriptionRecordNotification(
+        &bridged->subscription, g_variant_get_size(bridged->cache.value));
+}
+
+static void SubscriptionChanged(
+    struct Subscription *subscription, const gchar *device, bool subscribed, gpointer context)
+{
+    struct BridgedCharacteristic *bridged = context;
+    if (SubscriptionIsActive(subscription) && !bridged->notifier.active)
+    {
+        NotifierStart(&bridged->notifier, bridged->latestValue);
+    }
+    else if (!SubscriptionIsActive(subscription))
+    {
+        NotifierStop(&bridged->notifier);
+    }
+}
+
+static gboolean HandleReadValue(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer userData)
+{
+    struct BridgedCharacteristic *bridged = userData;
+    GattCharacteristicCompleteRead(interface, invocation, ValueCacheGet(&bridged->cache));
+    return TRUE;
+}
+
+static const gchar *ValidateWrite(const guint8 *data, gsize size, gpointer context)
+{
+    struct BridgedCharacteristic *bridged = context;
+    if (bridged->encoding == BRIDGE_ENCODING_UTF8)
+    {
+        return g_utf8_validate((const gchar *)data, size, NULL) ? NULL : "org.bluez.Error.Failed";
+    }
+    return (size == EncodedSize(bridged->encoding)) ? NULL : "org.bluez.Error.InvalidValueLength";
+}
+
+// Runs on the provider worker
+static void PushWrite(gpointer data)
+{
+    const struct BridgedWrite *write = data;
+    if (write->isString)
+    {
+        dhubAdmin_PushString(write->destination, IO_NOW, write->string);
+    }
+    else
+    {
+        dhubAdmin_PushNumeric(write->destination, IO_NOW, write->number);
+    }
+}
+
+static void FreeWrite(gpointer data)
+{
+    struct BridgedWrite *write = data;
+    g_free(write->destination);
+    g_free(write);
+}
+
+/*
+ * Pushes a written value to the destination in source units. Reads keep serving the last value
+ * pushed to the observation.
+ */
+static void CommitWrite(const guint8 *data, gsize size, gpointer context)
+{
+    struct BridgedCharacteristic *bridged = context;
+    struct BridgedWrite *write = g_new0(struct BridgedWrite, 1);
+    write->destination = g_strdup(bridged->destination);
+    switch (bridged->encoding)
+    {
+    case BRIDGE_ENCODING_UINT8:
+        write->number = data[0];
+        break;
+
+    case BRIDGE_ENCODING_SINT16:
+        write->number = (gint16)GetLe16(data);
+        break;
+
+    case BRIDGE_ENCODING_FLOAT32:
+    {
+        const guint32 bits = GetLe32(data);
+        float raw;
+        memcpy(&raw, &bits, sizeof(raw));
+        write->number = raw;
+        break;
+    }
+
+    case BRIDGE_ENCODING_UTF8:
+        write->isString = true;
+        memcpy(write->string, data, size);
+        write->string[size] = '\0';
+        break;
+    }
+
+    if (!write->isString && bridged->scale != 0.0)
+    {
+        write->number /= bridged->scale;
+    }
+    const bool queued = ExecutorSubmit(
+        EXECUTOR_QUEUE_DATAHUB, "bridge write", PushWrite, NULL, write, FreeWrite, 0);
+    if (!queued)
+    {
+        LE_WARN("Dropping value written to %s", bridged->obsPath);
+        FreeWrite(write);
+    }
+}
+
+static gboolean HandleWriteValue(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *value,
+    GVariant *options,
+    gpointer userData)
+{
+    struct BridgedCharacteristic *bridged = userData;
+    WriteAssemblerHandle(&bridged->writes, interface, invocation, value, options);
+    return TRUE;
+}
+
+static gboolean HandleStartNotify(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    gpointer userData)
+{
+    struct BridgedCharacteristic *bridged = userData;
+    SubscriptionAdd(&bridged->subscription, NULL);
+
+    bluez_gatt_characteristic1_complete_start_notify(interface, invocation);
+    return TRUE;
+}
+
+static gboolean HandleStopNotify(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    gpointer userData)
+{
+    struct BridgedCharacteristic *bridged = userData;
+    SubscriptionRemove(&bridged->subscription, NULL);
+
+    bluez_gatt_characteristic1_complete_stop_notify(interface, invocation);
+    return TRUE;
+}
+
+static void BindCharacteristic(gpointer context, BluezGattCharacteristic1 *characteristic)
+{
+    struct BridgedCharacteristic *bridged = context;
+    bridged->characteristic = characteristic;
+}
+
+/*
+ * Names become D-Bus object path components and data hub path components.
+ */
+static bool IsValidName(const char *name)
+{
+    const size_t len = strlen(name);
+    if (len == 0 || len > BRIDGE_NAME_MAX_LEN)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!g_ascii_isalnum(name[i]) && name[i] != '_')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ParseEncoding(const char *name, enum BridgeEncoding *encoding)
+{
+    for (size_t i = 0; i < G_N_ELEMENTS(Encodings); i++)
+    {
+        if (strcmp(name, Encodings[i].name) == 0)
+        {
+            *encoding = Encodings[i].encoding;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Reads the settings of the characteristic at the iterator's current node. Returns false if a
+ * string doesn't fit or a required setting is missing.
+ */
+static bool ReadCharacteristicConfig(
+    le_cfg_IteratorRef_t iter, struct CharacteristicConfig *config)
+{
+    memset(config, 0, sizeof(*config));
+    le_cfg_GetNodeName(iter, "", config->name, sizeof(config->name));
+    const bool valid =
+        le_cfg_GetString(iter, "uuid", config->uuid, sizeof(config->uuid), "") == LE_OK &&
+        le_cfg_GetString(iter, "source", config->source, sizeof(config->source), "") == LE_OK &&
+        le_cfg_GetString(
+            iter, "extraction", config->extraction, sizeof(config->extraction), "") == LE_OK &&
+        le_cfg_GetString(
+            iter, "encoding", config->encoding, sizeof(config->encoding), "") == LE_OK &&
+        le_cfg_GetString(
+            iter, "destination", config->destination, sizeof(config->destination), "") == LE_OK;
+    config->scale = le_cfg_GetFloat(iter, "scale", 1.0);
+    config->notify = le_cfg_NodeExists(iter, "notify");
+    if (config->notify)
+    {
+        config->policy.deadband = MAX(le_cfg_GetFloat(iter, "notify/deadband", 0.0), 0.0);
+        config->policy.minIntervalMs = MAX(le_cfg_GetInt(iter, "notify/minIntervalMs", 0), 0);
+        config->policy.maxIntervalMs = MAX(le_cfg_GetInt(iter, "notify/maxIntervalMs", 0), 0);
+    }
+    config->history = le_cfg_GetInt(iter, "history", 0);
+    config->advertise = le_cfg_GetBool(iter, "advertise", false);
+    config->advertiseId = le_cfg_GetInt(iter, "advertiseId", -1);
+    return valid && IsValidName(config->name) && config->uuid[0] != '\0' &&
+        config->source[0] != '\0';
+}
+
+static void AppendCharacteristicConfig(
+    GString *description, const struct CharacteristicConfig *config)
+{
+    g_string_append_printf(
+        description,
+        "%s:uuid=%s,source=%s,extraction=%s,encoding=%s,destination=%s,scale=%g,notify=%d,"
+        "deadband=%g,minIntervalMs=%u,maxIntervalMs=%u,history=%d,advertise=%d,advertiseId=%d;",
+        config->name,
+        config->uuid,
+        config->source,
+        config->extraction,
+        config->encoding,
+        config->destination,
+        config->scale,
+        config->notify,
+        config->policy.deadband,
+        config->policy.minIntervalMs,
+        config->policy.maxIntervalMs,
+        config->history,
+        config->advertise,
+        config->advertiseId);
+}
+
+/*
+ * Creates the observation for a characteristic and fills in its definition. Returns false, after
+ * logging why, if the entry is skipped.
+ */
+static bool LoadCharacteristic(
+    const struct CharacteristicConfig *config,
+    const char *serviceName,
+    struct GattCharacteristicDefinition *def)
+{
+    enum BridgeEncoding encoding;
+    if (!ParseEncoding(config->encoding, &encoding))
+    {
+        LE_ERROR(
+            "Skipping bridge characteristic %s/%s with unknown encoding \"%s\"",
+            serviceName,
+            config->name,
+            config->encoding);
+        return false;
+    }
+
+    gchar *obsName = g_strdup_printf("bluetoothServices/bridge/%s/%s", serviceName, config->name);
+    le_result_t r = dhubAdmin_CreateObs(obsName);
+    if (r != LE_OK)
+    {
+        LE_ERROR("Couldn't create observation %s: %s", obsName, LE_RESULT_TXT(r));
+        g_free(obsName);
+        return false;
+    }
+
+    /*
+     * The source comes from the config tree and may be refused (eg. if it would make a loop of
+     * sources), so it is set before anything else is allocated for the characteristic.
+     */
+    gchar *obsPath = g_strconcat("/obs/", obsName, NULL);
+    r = dhubAdmin_SetSource(obsPath, config->source);
+    if (r != LE_OK)
+    {
+        LE_ERROR(
+            "Skipping bridge characteristic %s/%s, couldn't set its source to %s: %s",
+            serviceName,
+            config->name,
+            config->source,
+            LE_RESULT_TXT(r));
+        dhubAdmin_DeleteObs(obsName);
+        g_free(obsPath);
+        g_free(obsName);
+        return false;
+    }
+    g_free(obsName);
+
+    struct BridgedCharacteristic *bridged = g_new0(struct BridgedCharacteristic, 1);
+    bridged->obsPath = obsPath;
+    bridged->encoding = encoding;
+    bridged->scale = config->scale;
+    ValueCacheInit(&bridged->cache);
+    ValueCacheSet(&bridged->cache, NULL, 0);
+
+    bridged->policy = config->policy;
+    NotifierInit(&bridged->notifier, &bridged->policy, NotifyBridgedValue, bridged);
+    SubscriptionInit(&bridged->subscription, bridged->obsPath, SubscriptionChanged, bridged);
+
+    gchar *shortName = g_strdup_printf("%s/%s", serviceName, config->name);
+    if (config->history > 0 && encoding != BRIDGE_ENCODING_UTF8)
+    {
+        bridged->history = SampleHistoryNew(shortName, config->history);
+    }
+    if (config->advertise && encoding != BRIDGE_ENCODING_UTF8)
+    {
+        if (config->advertiseId < ADVERTISEMENT_FIELD_FIRST_BRIDGED)
+        {
+            LE_ERROR(
+                "Not advertising %s, it needs an advertiseId from %d to %d",
+                shortName,
+                ADVERTISEMENT_FIELD_FIRST_BRIDGED,
+                ADVERTISEMENT_FIELD_COUNT - 1);
+        }
+        else
+        {
+            bridged->advertisement =
+                AdvertisementDataAddField(config->advertiseId, shortName, EncodedSize(encoding));
+        }
+    }
+    if (config->destination[0] != '\0')
+    {
+        bridged->destination = g_strdup(config->destination);
+        WriteAssemblerInit(
+            &bridged->writes,
+            bridged->obsPath,
+            (encoding == BRIDGE_ENCODING_UTF8) ? ATT_MAX_VALUE_LEN : EncodedSize(encoding),
+            ValidateWrite,
+            CommitWrite,
+            bridged);
+    }
+    g_free(shortName);
+
+    if (config->extraction[0] != '\0')
+    {
+        dhubAdmin_SetJsonExtraction(bridged->obsPath, config->extraction);
+    }
+    if (encoding == BRIDGE_ENCODING_UTF8)
+    {
+        bridged->stringHandler =
+            dhubAdmin_AddStringPushHandler(bridged->obsPath, StringPushHandler, bridged);
+    }
+    else
+    {
+        bridged->numericHandler =
+            dhubAdmin_AddNumericPushHandler(bridged->obsPath, NumericPushHandler, bridged);
+    }
+
+    memset(def, 0, sizeof(*def));
+    def->name = g_strdup(config->name);
+    def->uuid = g_strdup(config->uuid);
+    if (bridged->destination != NULL)
+    {
+        def->flags = config->notify ? ReadNotifyWriteFlags : ReadWriteFlags;
+        def->write = HandleWriteValue;
+    }
+    else
+    {
+        def->flags = config->notify ? ReadNotifyFlags : ReadFlags;
+    }
+    def->read = HandleReadValue;
+    def->startNotify = config->notify ? HandleStartNotify : NULL;
+    def->stopNotify = config->notify ? HandleStopNotify : NULL;
+    def->bind = BindCharacteristic;
+    def->context = bridged;
+
+    LE_INFO(
+        "Bridging %s to %s/%s (%s)", config->source, serviceName, config->name, config->encoding);
+    return true;
+}
+
+/*
+ * Undoes LoadCharacteristic. The observation is deleted too, so a characteristic that is removed
+ * from the mapping doesn't keep receiving its source's values.
+ */
+static void FreeCharacteristic(struct BridgedCharacteristic *bridged)
+{
+    if (bridged->numericHandler != NULL)
+    {
+        dhubAdmin_RemoveNumericPushHandler(bridged->numericHandler);
+    }
+    if (bridged->stringHandler != NULL)
+    {
+        dhubAdmin_RemoveStringPushHandler(bridged->stringHandler);
+    }
+    dhubAdmin_DeleteObs(bridged->obsPath + strlen("/obs/"));
+
+    NotifierStop(&bridged->notifier);
+    SubscriptionFini(&bridged->subscription);
+    if (bridged->history != NULL)
+    {
+        SampleHistoryRetire(bridged->history);
+    }
+    if (bridged->advertisement != NULL)
+    {
+        AdvertisementDataRemoveField(bridged->advertisement);
+    }
+    if (bridged->destination != NULL)
+    {
+        WriteAssemblerFini(&bridged->writes);
+        g_free(bridged->destination);
+    }
+    ValueCacheInvalidate(&bridged->cache);
+    g_free(bridged->obsPath);
+    g_free(bridged);
+}
+
+gchar **DataHubBridgeListServices(void)
+{
+    GPtrArray *names = g_ptr_array_new();
+    le_cfg_IteratorRef_t iter = le_cfg_CreateReadTxn(DATAHUB_BRIDGE_CONFIG_ROOT);
+    if (le_cfg_GoToFirstChild(iter) == LE_OK)
+    {
+        do
+        {
+            char name[LE_CFG_NAME_LEN_BYTES];
+            le_cfg_GetNodeName(iter, "", name, sizeof(name));
+            g_ptr_array_add(names, g_strdup(name));
+        } while (le_cfg_GoToNextSibling(iter) == LE_OK);
+    }
+    le_cfg_CancelTxn(iter);
+
+    g_ptr_array_add(names, NULL);
+    return (gchar **)g_ptr_array_free(names, FALSE);
+}
+
+gchar *DataHubBridgeDescribeService(const char *name)
+{
+    le_cfg_IteratorRef_t iter = le_cfg_CreateReadTxn(DATAHUB_BRIDGE_CONFIG_ROOT);
+    if (!le_cfg_NodeExists(iter, name))
+    {
+        le_cfg_CancelTxn(iter);
+        return NULL;
+    }
+    le_cfg_GoToNode(iter, name);
+
+    char uuid[LE_CFG_STR_LEN_BYTES];
+    le_cfg_GetString(iter, "uuid", uuid, sizeof(uuid), "");
+    GString *description = g_string_new(NULL);
+    g_string_append_printf(description, "uuid=%s;", uuid);
+    le_cfg_GoToNode(iter, "characteristics");
+    if (le_cfg_GoToFirstChild(iter) == LE_OK)
+    {
+        do
+        {
+            struct CharacteristicConfig config;
+            ReadCharacteristicConfig(iter, &config);
+            AppendCharacteristicConfig(description, &config);
+        } while (le_cfg_GoToNextSibling(iter) == LE_OK);
+    }
+    le_cfg_CancelTxn(iter);
+
+    return g_string_free(description, FALSE);
+}
+
+struct GattServiceDefinition *DataHubBridgeLoadService(const char *name)
+{
+    char uuid[LE_CFG_STR_LEN_BYTES];
+    le_cfg_IteratorRef_t iter = le_cfg_CreateReadTxn(DATAHUB_BRIDGE_CONFIG_ROOT);
+    le_cfg_GoToNode(iter, name);
+    if (!IsValidName(name) || le_cfg_GetString(iter, "uuid", uuid, sizeof(uuid), "") != LE_OK ||
+        uuid[0] == '\0')
+    {
+        LE_ERROR("Skipping invalid bridge service %s", name);
+        le_cfg_CancelTxn(iter);
+        return NULL;
+    }
+
+    GArray *characteristics =
+        g_array_new(FALSE, TRUE, sizeof(struct GattCharacteristicDefinition));
+    le_cfg_GoToNode(iter, "characteristics");
+    if (le_cfg_GoToFirstChild(iter) == LE_OK)
+    {
+        do
+        {
+            struct CharacteristicConfig config;
+            struct GattCharacteristicDefinition characteristic;
+            if (!ReadCharacteristicConfig(iter, &config))
+            {
+                LE_ERROR("Skipping invalid bridge characteristic %s/%s", name, config.name);
+            }
+            else if (LoadCharacteristic(&config, name, &characteristic))
+            {
+                g_array_append_val(characteristics, characteristic);
+            }
+        } while (le_cfg_GoToNextSibling(iter) == LE_OK);
+    }
+    le_cfg_CancelTxn(iter);
+
+    if (characteristics->len == 0)
+    {
+        LE_WARN("Bridge service %s has no characteristics", name);
+        g_array_free(characteristics, TRUE);
+        return NULL;
+    }
+
+    struct GattServiceDefinition *def = g_new0(struct GattServiceDefinition, 1);
+    def->name = g_strdup(name);
+    def->uuid = g_strdup(uuid);
+    def->primary = true;
+    def->numCharacteristics = characteristics->len;
+    def->characteristics =
+        (const struct GattCharacteristicDefinition *)g_array_free(characteristics, FALSE);
+    return def;
+}
+
+void DataHubBridgeFreeService(struct GattServiceDefinition *def)
+{
+    for (size_t i = 0; i < def->numCharacteristics; i++)
+    {
+        const struct GattCharacteristicDefinition *characteristic = &def->characteristics[i];
+        FreeCharacteristic(characteristic->context);
+        g_free((gchar *)characteristic->name);
+        g_free((gchar *)characteristic->uuid);
+    }
+    g_free((gpointer)def->characteristics);
+    g_free((gchar *)def->name);
+    g_free((gchar *)def->uuid);
+    g_free(def);
+}
@@ -0,0 +1,58 @@
+#ifndef _DATAHUB_BRIDGE_H
+#define _DATAHUB_BRIDGE_H
+
+#include <glib.h>
+
+#include "gatt_database.h"
+
+/*
+ * Exposes data hub resources as GATT characteristics without a hand-written service per sensor.
+ * The mapping is read from the app's config tree under /bridge:
+ *
+ *   /bridge/<service>/uuid
+ *   /bridge/<service>/characteristics/<characteristic>/uuid
+ *                                                     /source      data hub path to observe
+ *                                                     /extraction  optional JSON member
+ *                                                     /encoding    uint8, sint16, float32 or utf8
+ *                                                     /scale       optional, default 1
+ *                                                     /notify/deadband
+ *                                                     /notify/minIntervalMs
+ *                                                     /notify/maxIntervalMs
+ *                                                     /history     optional number of samples
+ *                                                     /advertise   optional, default false
+ *                                                     /destination optional data hub path
+ *
+ * Characteristics without a notify node don't notify. With history, numeric values are also
+ * recorded for download through the history service. With advertise, the encoded value is also
+ * broadcast in the advertisement if there is room. With destination, the characteristic is also
+ * writable: written values, which may be long or reliable writes, are decoded in the same encoding,
+ * divided by scale and pushed to the destination.
+ */
+
+#define DATAHUB_BRIDGE_CONFIG_ROOT "/bridge"
+
+/*
+ * The names of the services under /bridge, which may not all be valid. Free with g_strfreev().
+ */
+gchar **DataHubBridgeListServices(void);
+
+/*
+ * Returns a string holding every setting of the service, so a change to the mapping can be spotted
+ * by comparing it with the one the service was loaded with, or NULL if the service isn't
+ * configured. Free with g_free().
+ */
+gchar *DataHubBridgeDescribeService(const char *name);
+
+/*
+ * Reads the service's mapping, creates its observations and returns the definition to export, or
+ * NULL, after logging why, if the service is invalid or has no valid characteristics.
+ */
+struct GattServiceDefinition *DataHubBridgeLoadService(const char *name);
+
+/*
+ * Releases a definition returned by DataHubBridgeLoadService once its objects have been unexported,
+ * deleting its observations.
+ */
+void DataHubBridgeFreeService(struct GattServiceDefinition *def);
+
+#endif // _DATAHUB_BRIDGE_H
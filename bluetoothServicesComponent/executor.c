@@ -0,0 +1,179 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// GLib
+#include <glib.h>
+
+// Legato
+#include "legato.h"
+#include "interfaces.h"
+
+// Local
+#include "executor.h"
+
+struct ExecutorQueue
+{
+    const char *workerName;
+    GAsyncQueue *jobs;
+    // Jobs submitted that the worker hasn't finished. Incremented on the main loop only.
+    gint queuedJobs;
+    struct ExecutorStats stats;
+};
+
+struct ExecutorJob
+{
+    struct ExecutorQueue *queue;
+    const gchar *name;
+    ExecutorWorkFunc work;
+    ExecutorCompleteFunc complete;
+    gpointer data;
+    GDestroyNotify destroy;
+    guint timeoutTimer;
+    bool completed;
+    // Written by the worker, read on the main loop once the job is finished
+    gint64 submitTime;
+    gint64 startTime;
+    gint64 endTime;
+};
+
+static struct ExecutorQueue Queues[EXECUTOR_QUEUE_COUNT] = {
+    [EXECUTOR_QUEUE_MODEM] = {.workerName = "ModemWorker"},
+    [EXECUTOR_QUEUE_DATAHUB] = {.workerName = "DataHubWorker"},
+    [EXECUTOR_QUEUE_STORAGE] = {.workerName = "StorageWorker"},
+};
+
+static void Complete(struct ExecutorJob *job, enum ExecutorResult result)
+{
+    job->completed = true;
+    if (job->complete != NULL)
+    {
+        job->complete(result, job->data);
+    }
+}
+
+static gboolean JobTimedOut(gpointer userData)
+{
+    struct ExecutorJob *job = userData;
+    job->timeoutTimer = 0;
+    job->queue->stats.timedOut++;
+    LE_WARN("Provider call %s timed out", job->name);
+    Complete(job, EXECUTOR_RESULT_TIMED_OUT);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean JobFinished(gpointer userData)
+{
+    struct ExecutorJob *job = userData;
+    struct ExecutorStats *stats = &job->queue->stats;
+    stats->maxWaitUs = MAX(stats->maxWaitUs, job->startTime - job->submitTime);
+    stats->maxRunUs = MAX(stats->maxRunUs, job->endTime - job->startTime);
+    if (!job->completed)
+    {
+        if (job->timeoutTimer != 0)
+        {
+            g_source_remove(job->timeoutTimer);
+            job->timeoutTimer = 0;
+        }
+        Complete(job, EXECUTOR_RESULT_DONE);
+    }
+    else
+    {
+        LE_INFO(
+            "Provider call %s finished %" G_GINT64_FORMAT " us after it was submitted",
+            job->name,
+            job->endTime - job->submitTime);
+    }
+
+    if (job->destroy != NULL)
+    {
+        job->destroy(job->data);
+    }
+    g_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+static void *WorkerMain(void *context)
+{
+    struct ExecutorQueue *queue = context;
+
+    // Client APIs have to be connected on each thread that uses them
+    if (queue == &Queues[EXECUTOR_QUEUE_MODEM])
+    {
+        le_info_ConnectService();
+    }
+    else if (queue == &Queues[EXECUTOR_QUEUE_DATAHUB])
+    {
+        dhubAdmin_ConnectService();
+    }
+
+    for (;;)
+    {
+        struct ExecutorJob *job = g_async_queue_pop(queue->jobs);
+        job->startTime = g_get_monotonic_time();
+        job->work(job->data);
+        job->endTime = g_get_monotonic_time();
+        g_atomic_int_add(&queue->queuedJobs, -1);
+        // Same priority as D-Bus method calls, so completions aren't starved by incoming requests
+        g_idle_add_full(G_PRIORITY_DEFAULT, JobFinished, job, NULL);
+    }
+
+    return NULL;
+}
+
+void ExecutorStart(void)
+{
+    for (size_t i = 0; i < G_N_ELEMENTS(Queues); i++)
+    {
+        struct ExecutorQueue *queue = &Queues[i];
+        queue->jobs = g_async_queue_new();
+        le_thread_Ref_t worker = le_thread_Create(queue->workerName, WorkerMain, queue);
+        le_thread_Start(worker);
+    }
+}
+
+bool ExecutorSubmit(
+    enum ExecutorQueueId queueId,
+    const gchar *name,
+    ExecutorWorkFunc work,
+    ExecutorCompleteFunc complete,
+    gpointer data,
+    GDestroyNotify destroy,
+    guint timeoutMs)
+{
+    struct ExecutorQueue *queue = &Queues[queueId];
+
+    // Only the worker decrements the count in the meantime, so the check can't overshoot
+    const gint queued = g_atomic_int_get(&queue->queuedJobs);
+    if (queued >= EXECUTOR_QUEUE_MAX_LEN)
+    {
+        queue->stats.rejected++;
+        LE_WARN("%s queue is full, rejecting %s", queue->workerName, name);
+        return false;
+    }
+
+    struct ExecutorJob *job = g_new0(struct ExecutorJob, 1);
+    job->queue = queue;
+    job->name = name;
+    job->work = work;
+    job->complete = complete;
+    job->data = data;
+    job->destroy = destroy;
+    job->submitTime = g_get_monotonic_time();
+    if (timeoutMs > 0)
+    {
+        job->timeoutTimer = g_timeout_add(timeoutMs, JobTimedOut, job);
+    }
+
+    g_atomic_int_inc(&queue->queuedJobs);
+    queue->stats.submitted++;
+    queue->stats.maxQueued = MAX(queue->stats.maxQueued, (guint)queued + 1);
+    g_async_queue_push(queue->jobs, job);
+    return true;
+}
+
+void ExecutorGetStats(enum ExecutorQueueId queue, struct ExecutorStats *stats)
+{
+    *stats = Queues[queue].stats;
+}
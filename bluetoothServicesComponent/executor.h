@@ -0,0 +1,69 @@
+#ifndef _EXECUTOR_H
+#define _EXECUTOR_H
+
+#include <stdbool.h>
+
+#include <glib.h>
+
+/*
+ * Runs blocking provider calls, ie. Legato IPC to the modem or the data hub, and file system work
+ * on worker threads so they can't stall the GLib main loop that serves every D-Bus request. Each
+ * provider has its own queue and worker, so a data hub push never waits behind a slow modem query
+ * or a file being read. Jobs on a queue run
+ * one at a time in the order they were submitted, and each job's completion is called back on the
+ * main loop, where a deferred GDBusMethodInvocation can be completed.
+ *
+ * At most EXECUTOR_QUEUE_MAX_LEN jobs may be waiting or running on each queue. A job submitted with
+ * a timeout is completed with EXECUTOR_RESULT_TIMED_OUT if the worker hasn't finished it in time.
+ * The work still runs to completion on the worker, and its data is only destroyed after that.
+ */
+
+#define EXECUTOR_QUEUE_MAX_LEN 32
+
+enum ExecutorQueueId
+{
+    EXECUTOR_QUEUE_MODEM,   // le_info
+    EXECUTOR_QUEUE_DATAHUB, // dhubAdmin
+    EXECUTOR_QUEUE_STORAGE, // Files received by the services
+    EXECUTOR_QUEUE_COUNT,
+};
+
+enum ExecutorResult
+{
+    EXECUTOR_RESULT_DONE,
+    EXECUTOR_RESULT_TIMED_OUT,
+};
+
+// Called on the worker thread
+typedef void (*ExecutorWorkFunc)(gpointer data);
+// Called on the main loop, exactly once
+typedef void (*ExecutorCompleteFunc)(enum ExecutorResult result, gpointer data);
+
+struct ExecutorStats
+{
+    guint64 submitted;
+    guint64 rejected;
+    guint64 timedOut;
+    guint maxQueued;
+    gint64 maxWaitUs; // Longest a job sat in the queue before the worker picked it up
+    gint64 maxRunUs;
+};
+
+void ExecutorStart(void);
+
+/*
+ * Queues a job. complete and destroy may be NULL, and timeoutMs may be 0 for no timeout. Returns
+ * false without taking ownership of data if the queue is full.
+ */
+bool ExecutorSubmit(
+    enum ExecutorQueueId queue,
+    const gchar *name,
+    ExecutorWorkFunc work,
+    ExecutorCompleteFunc complete,
+    gpointer data,
+    GDestroyNotify destroy,
+    guint timeoutMs);
+
+void ExecutorGetStats(enum ExecutorQueueId queue, struct ExecutorStats *stats);
+
+#endif // _EXECUTOR_H
@@ -0,0 +1,110 @@
+#ifndef _GATT_DATABASE_H
+#define _GATT_DATABASE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "org.bluez.GattCharacteristic1.h"
+#include "org.bluez.GattDescriptor1.h"
+
+/*
+ * Handler signatures match the "handle-*" signals generated for org.bluez.GattCharacteristic1 and
+ * org.bluez.GattDescriptor1. The user_data passed to each handler is the context returned by the
+ * init function of the service that owns the characteristic or descriptor.
+ */
+typedef gboolean (*GattCharacteristicReadHandler)(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer user_data);
+
+typedef gboolean (*GattCharacteristicWriteHandler)(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *value,
+    GVariant *options,
+    gpointer user_data);
+
+typedef gboolean (*GattCharacteristicNotifyHandler)(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    gpointer user_data);
+
+/*
+ * AcquireWrite and AcquireNotify reply with a socket and the MTU, so handlers complete the
+ * invocation with g_dbus_method_invocation_return_value_with_unix_fd_list().
+ */
+typedef gboolean (*GattCharacteristicAcquireHandler)(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer user_data);
+
+typedef gboolean (*GattDescriptorReadHandler)(
+    BluezGattDescriptor1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer user_data);
+
+struct GattDescriptorDefinition
+{
+    const gchar *name; // Object path component, relative to the characteristic
+    const gchar *uuid;
+    const gchar *const *flags;
+    GattDescriptorReadHandler read;
+};
+
+struct GattCharacteristicDefinition
+{
+    const gchar *name; // Object path component, relative to the service
+    const gchar *uuid;
+    const gchar *const *flags;
+    GattCharacteristicReadHandler read;
+    GattCharacteristicWriteHandler write;
+    GattCharacteristicNotifyHandler startNotify;
+    GattCharacteristicNotifyHandler stopNotify;
+    // Optional. If set, BlueZ hands writes without response and notifications over a socket.
+    GattCharacteristicAcquireHandler acquireWrite;
+    GattCharacteristicAcquireHandler acquireNotify;
+    // Optional. Lets the service keep a reference to the exported characteristic (eg. to notify).
+    void (*bind)(gpointer context, BluezGattCharacteristic1 *characteristic);
+    // Optional. Replaces the service context for this characteristic and its descriptors.
+    gpointer context;
+    /*
+     * Optional. Runs the read handler on the engine's read pool rather than the main loop, so
+     * concurrent reads are served in parallel. The handler must then be thread safe. Every other
+     * method of the characteristic is still handled on the main loop, in the order it arrives.
+     */
+    bool threadedRead;
+    const struct GattDescriptorDefinition *descriptors;
+    size_t numDescriptors;
+};
+
+struct GattServiceDefinition
+{
+    const gchar *name; // Object path component, relative to the object manager root
+    const gchar *uuid;
+    bool primary;
+    // Only served once /services/<name>/enabled is set to true, rather than unless it is false
+    bool optIn;
+    // Optional. Called each time the service is exported. The result is passed to all handlers.
+    gpointer (*init)(void);
+    /*
+     * Optional. Called when the service is disabled, after its handlers have been disconnected and
+     * before its objects are released. Frees the context and undoes whatever init set up.
+     */
+    void (*fini)(gpointer context);
+    const struct GattCharacteristicDefinition *characteristics;
+    size_t numCharacteristics;
+};
+
+struct GattDatabaseStats
+{
+    size_t numObjects;
+    gint64 exportDurationUs;
+};
+
+#endif // _GATT_DATABASE_H
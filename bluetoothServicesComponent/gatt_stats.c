@@ -0,0 +1,354 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// GLib
+#include <glib.h>
+#include <gio/gio.h>
+
+// Legato
+#include "legato.h"
+#include "interfaces.h"
+
+// Local
+#include "gatt_stats.h"
+#include "read_snapshot.h"
+
+#define ENV_STATS_PERIOD "BLUETOOTH_SERVICES_STATS_PERIOD"
+#define DEFAULT_STATS_PERIOD_S 60
+#define STATS_OBS_PREFIX "bluetoothServices/gatt/"
+#define SUMMARY_OBS_PREFIX "bluetoothServices/"
+
+struct Summary
+{
+    gchar *obsPath;
+    GattStatsSummaryFunc summarize;
+    gchar *published;
+};
+
+static const gchar *const OperationNames[GATT_OPERATION_COUNT] = {
+    [GATT_OPERATION_READ] = "read",
+    [GATT_OPERATION_WRITE] = "write",
+    [GATT_OPERATION_START_NOTIFY] = "startNotify",
+    [GATT_OPERATION_STOP_NOTIFY] = "stopNotify",
+    [GATT_OPERATION_ACQUIRE_WRITE] = "acquireWrite",
+    [GATT_OPERATION_ACQUIRE_NOTIFY] = "acquireNotify",
+};
+
+static GPtrArray *AllStats;
+static GPtrArray *Summaries;
+static GQuark StatsQuark;
+// Threaded reads record from the read pool while the main loop records and publishes
+static GMutex StatsLock;
+
+static struct GattStats *Lookup(gpointer skeleton)
+{
+    return g_object_get_qdata(G_OBJECT(skeleton), StatsQuark);
+}
+
+/*
+ * Creates the counters for an exported characteristic or descriptor, along with the observation
+ * they are published on. The name is the object path relative to the GATT root (eg.
+ * "battery/level"). An object exported again under the same name, after its service was disabled
+ * and enabled, carries on with the same counters, so they stay cumulative.
+ */
+struct GattStats *GattStatsNew(gpointer skeleton, const gchar *name)
+{
+    if (AllStats == NULL)
+    {
+        AllStats = g_ptr_array_new();
+        StatsQuark = g_quark_from_static_string("gatt-stats");
+    }
+
+    gchar *obsName = g_strconcat(STATS_OBS_PREFIX, name, NULL);
+    for (guint i = 0; i < AllStats->len; i++)
+    {
+        struct GattStats *stats = g_ptr_array_index(AllStats, i);
+        if (strcmp(stats->obsPath + strlen("/obs/"), obsName) == 0)
+        {
+            g_free(obsName);
+            g_object_set_qdata(G_OBJECT(skeleton), StatsQuark, stats);
+            return stats;
+        }
+    }
+
+    struct GattStats *stats = g_new0(struct GattStats, 1);
+    const le_result_t r = dhubAdmin_CreateObs(obsName);
+    if (r != LE_OK)
+    {
+        LE_WARN("Couldn't create observation %s: %s", obsName, LE_RESULT_TXT(r));
+    }
+    stats->obsPath = g_strconcat("/obs/", obsName, NULL);
+    g_free(obsName);
+
+    g_ptr_array_add(AllStats, stats);
+    g_object_set_qdata(G_OBJECT(skeleton), StatsQuark, stats);
+    return stats;
+}
+
+void GattStatsRecordCall(struct GattStats *stats, enum GattOperation operation, gint64 latencyUs)
+{
+    struct GattOperationStats *op = &stats->operations[operation];
+    const guint bucket = MIN(g_bit_storage((gulong)MAX(latencyUs, 0)) - 1,
+                             GATT_STATS_LATENCY_BUCKETS - 1);
+    g_mutex_lock(&StatsLock);
+    op->count++;
+    op->latency[bucket]++;
+    op->maxLatencyUs = MAX(op->maxLatencyUs, latencyUs);
+    g_mutex_unlock(&StatsLock);
+}
+
+void GattStatsRecordBytes(gpointer skeleton, enum GattOperation operation, gsize bytes)
+{
+    struct GattStats *stats = Lookup(skeleton);
+    if (stats != NULL)
+    {
+        g_mutex_lock(&StatsLock);
+        stats->operations[operation].bytes += bytes;
+        g_mutex_unlock(&StatsLock);
+    }
+}
+
+void GattStatsRecordError(gpointer skeleton, enum GattOperation operation)
+{
+    struct GattStats *stats = Lookup(skeleton);
+    if (stats != NULL)
+    {
+        g_mutex_lock(&StatsLock);
+        stats->operations[operation].errors++;
+        g_mutex_unlock(&StatsLock);
+    }
+}
+
+void GattStatsRecordNotification(gpointer skeleton, gsize bytes)
+{
+    struct GattStats *stats = Lookup(skeleton);
+    if (stats != NULL)
+    {
+        g_mutex_lock(&StatsLock);
+        stats->notifications++;
+        stats->notifiedBytes += bytes;
+        g_mutex_unlock(&StatsLock);
+    }
+}
+
+static void ReturnNoValue(gpointer skeleton, GDBusMethodInvocation *invocation)
+{
+    GattReturnError(
+        skeleton, invocation, GATT_OPERATION_READ, "org.bluez.Error.Failed", "No value yet");
+}
+
+static void ReturnInvalidOffset(gpointer skeleton, GDBusMethodInvocation *invocation)
+{
+    GattReturnError(
+        skeleton,
+        invocation,
+        GATT_OPERATION_READ,
+        "org.bluez.Error.InvalidOffset",
+        "Offset is past the end of the value");
+}
+
+/*
+ * Replies with the value from the offset the read asked for. The value may be floating. It may
+ * also be NULL, eg. a cache miss before the producer has set a value, which fails the read.
+ */
+void GattCharacteristicCompleteRead(
+    BluezGattCharacteristic1 *interface, GDBusMethodInvocation *invocation, GVariant *value)
+{
+    if (value == NULL)
+    {
+        ReturnNoValue(interface, invocation);
+        return;
+    }
+    g_variant_ref_sink(value);
+    GVariant *reply = ReadSnapshotPrepare(interface, invocation, value);
+    if (reply == NULL)
+    {
+        ReturnInvalidOffset(interface, invocation);
+    }
+    else
+    {
+        GattStatsRecordBytes(interface, GATT_OPERATION_READ, g_variant_get_size(reply));
+        bluez_gatt_characteristic1_complete_read_value(interface, invocation, reply);
+        g_variant_unref(reply);
+    }
+    g_variant_unref(value);
+}
+
+void GattDescriptorCompleteRead(
+    BluezGattDescriptor1 *interface, GDBusMethodInvocation *invocation, GVariant *value)
+{
+    if (value == NULL)
+    {
+        ReturnNoValue(interface, invocation);
+        return;
+    }
+    g_variant_ref_sink(value);
+    GVariant *reply = ReadSnapshotPrepare(interface, invocation, value);
+    if (reply == NULL)
+    {
+        ReturnInvalidOffset(interface, invocation);
+    }
+    else
+    {
+        GattStatsRecordBytes(interface, GATT_OPERATION_READ, g_variant_get_size(reply));
+        bluez_gatt_descriptor1_complete_read_value(interface, invocation, reply);
+        g_variant_unref(reply);
+    }
+    g_variant_unref(value);
+}
+
+/*
+ * Fails a request with one of the org.bluez.Error.* names BlueZ expects from GATT handlers.
+ */
+void GattReturnError(
+    gpointer skeleton,
+    GDBusMethodInvocation *invocation,
+    enum GattOperation operation,
+    const gchar *errorName,
+    const gchar *message)
+{
+    GattStatsRecordError(skeleton, operation);
+    g_dbus_method_invocation_return_dbus_error(invocation, errorName, message);
+}
+
+static guint64 Activity(const struct GattStats *stats)
+{
+    guint64 activity = stats->notifications;
+    for (size_t i = 0; i < GATT_OPERATION_COUNT; i++)
+    {
+        activity += stats->operations[i].count + stats->operations[i].errors;
+    }
+    return activity;
+}
+
+static void AppendOperation(GString *json, const gchar *name, const struct GattOperationStats *op)
+{
+    g_string_append_printf(
+        json,
+        "\"%s\":{\"count\":%" G_GUINT64_FORMAT ",\"errors\":%" G_GUINT64_FORMAT
+        ",\"bytes\":%" G_GUINT64_FORMAT ",\"maxUs\":%" G_GINT64_FORMAT ",\"latencyLog2Us\":[",
+        name,
+        op->count,
+        op->errors,
+        op->bytes,
+        op->maxLatencyUs);
+
+    // Trailing empty buckets are left out
+    size_t numBuckets = GATT_STATS_LATENCY_BUCKETS;
+    while (numBuckets > 0 && op->latency[numBuckets - 1] == 0)
+    {
+        numBuckets--;
+    }
+    for (size_t i = 0; i < numBuckets; i++)
+    {
+        g_string_append_printf(json, "%s%" G_GUINT64_FORMAT, (i > 0) ? "," : "", op->latency[i]);
+    }
+    g_string_append(json, "]},");
+}
+
+static void Publish(GString *json, const struct GattStats *stats)
+{
+    g_string_truncate(json, 0);
+    g_string_append_c(json, '{');
+    for (size_t i = 0; i < GATT_OPERATION_COUNT; i++)
+    {
+        const struct GattOperationStats *op = &stats->operations[i];
+        if (op->count != 0 || op->errors != 0)
+        {
+            AppendOperation(json, OperationNames[i], op);
+        }
+    }
+    g_string_append_printf(
+        json,
+        "\"notify\":{\"count\":%" G_GUINT64_FORMAT ",\"bytes\":%" G_GUINT64_FORMAT "}}",
+        stats->notifications,
+        stats->notifiedBytes);
+
+    dhubAdmin_PushJson(stats->obsPath, IO_NOW, json->str);
+}
+
+void GattStatsAddSummary(const gchar *name, GattStatsSummaryFunc summarize)
+{
+    if (Summaries == NULL)
+    {
+        Summaries = g_ptr_array_new();
+    }
+
+    gchar *obsName = g_strconcat(SUMMARY_OBS_PREFIX, name, NULL);
+    const le_result_t r = dhubAdmin_CreateObs(obsName);
+    if (r != LE_OK)
+    {
+        LE_WARN("Couldn't create observation %s: %s", obsName, LE_RESULT_TXT(r));
+    }
+
+    struct Summary *summary = g_new0(struct Summary, 1);
+    summary->obsPath = g_strconcat("/obs/", obsName, NULL);
+    summary->summarize = summarize;
+    g_ptr_array_add(Summaries, summary);
+    g_free(obsName);
+}
+
+static void PublishSummaries(GString *json)
+{
+    for (guint i = 0; Summaries != NULL && i < Summaries->len; i++)
+    {
+        struct Summary *summary = g_ptr_array_index(Summaries, i);
+        g_string_truncate(json, 0);
+        summary->summarize(json);
+        if (g_strcmp0(json->str, summary->published) != 0)
+        {
+            g_free(summary->published);
+            summary->published = g_strdup(json->str);
+            dhubAdmin_PushJson(summary->obsPath, IO_NOW, json->str);
+        }
+    }
+}
+
+static gboolean PublishTimerExpired(gpointer userData)
+{
+    GString *json = userData;
+    PublishSummaries(json);
+    for (guint i = 0; AllStats != NULL && i < AllStats->len; i++)
+    {
+        struct GattStats *stats = g_ptr_array_index(AllStats, i);
+        // Published from a copy, so the lock isn't held across the data hub call
+        g_mutex_lock(&StatsLock);
+        const struct GattStats snapshot = *stats;
+        g_mutex_unlock(&StatsLock);
+        const guint64 activity = Activity(&snapshot);
+        // Idle objects aren't republished
+        if (activity != stats->publishedActivity)
+        {
+            stats->publishedActivity = activity;
+            Publish(json, &snapshot);
+        }
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Publishes the counters every BLUETOOTH_SERVICES_STATS_PERIOD seconds (60 by default, 0 disables).
+ * The counters are cumulative, so the collector can compute rates from consecutive samples.
+ */
+void GattStatsStartPublishing(void)
+{
+    guint periodS = DEFAULT_STATS_PERIOD_S;
+    const char *period = getenv(ENV_STATS_PERIOD);
+    if (period != NULL)
+    {
+        periodS = (guint)strtoul(period, NULL, 10);
+    }
+
+    if (periodS == 0 || (AllStats == NULL && Summaries == NULL))
+    {
+        LE_INFO("GATT statistics are not published");
+        return;
+    }
+
+    LE_INFO("Publishing GATT statistics every %u s", periodS);
+    g_timeout_add_seconds(periodS, PublishTimerExpired, g_string_sized_new(512));
+}
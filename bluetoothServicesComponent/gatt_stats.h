@@ -0,0 +1,73 @@
+#ifndef _GATT_STATS_H
+#define _GATT_STATS_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "org.bluez.GattCharacteristic1.h"
+#include "org.bluez.GattDescriptor1.h"
+
+/*
+ * Per characteristic (and descriptor) counters for the GATT handlers. The engine times every
+ * handler it dispatches; services report what only they know (bytes read, failed requests) through
+ * the helpers below. Recording only touches counters in memory, under a lock so it may be done from
+ * the read pool. Summaries are published to the data hub from a timer, as JSON on one observation
+ * per object. Other subsystems can add a summary of their own counters to the same publication.
+ */
+
+enum GattOperation
+{
+    GATT_OPERATION_READ,
+    GATT_OPERATION_WRITE,
+    GATT_OPERATION_START_NOTIFY,
+    GATT_OPERATION_STOP_NOTIFY,
+    GATT_OPERATION_ACQUIRE_WRITE,
+    GATT_OPERATION_ACQUIRE_NOTIFY,
+    GATT_OPERATION_COUNT,
+};
+
+// Bucket k counts handler latencies in [2^k, 2^(k+1)) us. The last bucket also counts anything longer.
+#define GATT_STATS_LATENCY_BUCKETS 20
+
+struct GattOperationStats
+{
+    guint64 count;
+    guint64 errors;
+    guint64 bytes;
+    gint64 maxLatencyUs;
+    guint64 latency[GATT_STATS_LATENCY_BUCKETS];
+};
+
+struct GattStats
+{
+    gchar *obsPath;
+    struct GattOperationStats operations[GATT_OPERATION_COUNT];
+    guint64 notifications;
+    guint64 notifiedBytes;
+    guint64 publishedActivity;
+};
+
+struct GattStats *GattStatsNew(gpointer skeleton, const gchar *name);
+void GattStatsRecordCall(struct GattStats *stats, enum GattOperation operation, gint64 latencyUs);
+void GattStatsRecordBytes(gpointer skeleton, enum GattOperation operation, gsize bytes);
+void GattStatsRecordError(gpointer skeleton, enum GattOperation operation);
+void GattStatsRecordNotification(gpointer skeleton, gsize bytes);
+// Appends a JSON object to the string. Called on the main loop.
+typedef void (*GattStatsSummaryFunc)(GString *json);
+
+// Publishes what summarize appends on /obs/bluetoothServices/<name>, whenever it changes
+void GattStatsAddSummary(const gchar *name, GattStatsSummaryFunc summarize);
+void GattStatsStartPublishing(void);
+
+void GattCharacteristicCompleteRead(
+    BluezGattCharacteristic1 *interface, GDBusMethodInvocation *invocation, GVariant *value);
+void GattDescriptorCompleteRead(
+    BluezGattDescriptor1 *interface, GDBusMethodInvocation *invocation, GVariant *value);
+void GattReturnError(
+    gpointer skeleton,
+    GDBusMethodInvocation *invocation,
+    enum GattOperation operation,
+    const gchar *errorName,
+    const gchar *message);
+
+#endif // _GATT_STATS_H
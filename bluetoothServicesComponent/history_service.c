@@ -0,0 +1,482 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// GLib
+#include <glib.h>
+#include <gio/gio.h>
+
+// Legato
+#include "legato.h"
+
+// Local
+#include "history_service.h"
+#include "sample_history.h"
+#include "notify_policy.h"
+#include "subscriptions.h"
+#include "gatt_stats.h"
+#include "org.bluez.GattCharacteristic1.h"
+
+#define HISTORY_CONTROL_POINT_CHARACTERISTIC_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b5d01"
+#define HISTORY_RECORDS_CHARACTERISTIC_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b5d02"
+#define HISTORY_CATALOG_CHARACTERISTIC_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b5d03"
+
+#define ATT_DEFAULT_MTU 23
+#define ATT_NOTIFICATION_HEADER_SIZE 3
+#define ATT_MAX_VALUE_LEN 512
+
+/*
+ * Records packets start with a little endian sequence number. The last packet of a transfer has
+ * the top bit set, and may hold no records if there was nothing to send.
+ */
+#define HISTORY_PACKET_HEADER_SIZE 2
+#define HISTORY_PACKET_LAST 0x8000
+#define HISTORY_RECORD_SIZE 8
+
+/*
+ * Packets are queued a few at a time from an idle source, so a long transfer doesn't hold off D-Bus
+ * requests and Legato events. The next batch waits until the previous one has been written to the
+ * bus, so a slow link backs up into the transfer instead of the connection's send queue.
+ */
+#define HISTORY_PACKETS_PER_DISPATCH 4
+
+enum HistoryOpcode
+{
+    HISTORY_OPCODE_SEND_SINCE = 0x01, // id (u8), since (u32 seconds since the epoch)
+    HISTORY_OPCODE_ABORT = 0x02,
+};
+
+struct HSContext {
+    BluezGattCharacteristic1 *records_characteristic;
+    struct Subscription records_subscription;
+    // The transfer in progress, if any
+    struct SampleHistory *history;
+    gchar *transfer_device; // NULL if the request didn't say which device sent it
+    guint64 next_index;
+    guint64 end_index;
+    guint16 sequence;
+    gsize payload_size;
+    guint64 skipped;
+    guint transfer_source;
+    struct HistoryFlush *transfer_flush; // The batch being flushed to the bus, if any
+    gint64 transfer_start;
+};
+
+/*
+ * Outlives a transfer that is stopped while its batch is being flushed. stop_transfer() clears ctx
+ * and the flush callback then just frees it.
+ */
+struct HistoryFlush
+{
+    struct HSContext *ctx;
+};
+
+static void put_le16(guint8 *buffer, guint16 value)
+{
+    buffer[0] = value & 0xff;
+    buffer[1] = value >> 8;
+}
+
+static void put_le32(guint8 *buffer, guint32 value)
+{
+    put_le16(&buffer[0], value & 0xffff);
+    put_le16(&buffer[2], value >> 16);
+}
+
+static guint32 get_le32(const guint8 *buffer)
+{
+    return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((guint32)buffer[3] << 24);
+}
+
+static void stop_transfer(struct HSContext *ctx)
+{
+    if (ctx->transfer_source != 0)
+    {
+        g_source_remove(ctx->transfer_source);
+        ctx->transfer_source = 0;
+    }
+    if (ctx->transfer_flush != NULL)
+    {
+        ctx->transfer_flush->ctx = NULL;
+        ctx->transfer_flush = NULL;
+    }
+    // The producer may have retired the history in the meantime
+    if (ctx->history != NULL)
+    {
+        SampleHistoryUnref(ctx->history);
+        ctx->history = NULL;
+    }
+
+    gchar *device = ctx->transfer_device;
+    ctx->transfer_device = NULL;
+    if (device != NULL)
+    {
+        SubscriptionRemove(&ctx->records_subscription, device);
+        g_free(device);
+    }
+}
+
+/*
+ * Fills one notification with as many records as the MTU allows. Returns true once the last packet
+ * of the transfer has been sent.
+ */
+static bool send_records_packet(struct HSContext *ctx)
+{
+    struct SampleHistory *history = ctx->history;
+    const guint64 first = SampleHistoryFirstIndex(history);
+    if (ctx->next_index < first)
+    {
+        // The client is slower than the producer and the oldest requested records are gone
+        ctx->skipped += first - ctx->next_index;
+        ctx->next_index = first;
+    }
+
+    guint8 packet[ATT_MAX_VALUE_LEN];
+    gsize size = HISTORY_PACKET_HEADER_SIZE;
+    while (ctx->next_index < ctx->end_index && size + HISTORY_RECORD_SIZE <= ctx->payload_size)
+    {
+        const struct HistorySample *sample = SampleHistoryGet(history, ctx->next_index);
+        guint32 bits;
+        memcpy(&bits, &sample->value, sizeof(bits));
+        put_le32(&packet[size], sample->timestamp);
+        put_le32(&packet[size + 4], bits);
+        size += HISTORY_RECORD_SIZE;
+        ctx->next_index++;
+    }
+
+    const bool last = (ctx->next_index >= ctx->end_index);
+    put_le16(packet, ctx->sequence | (last ? HISTORY_PACKET_LAST : 0));
+    ctx->sequence = (ctx->sequence + 1) & ~HISTORY_PACKET_LAST;
+
+    GVariant *value = g_variant_ref_sink(
+        g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, packet, size, sizeof(guint8)));
+    NotifyCharacteristicPacket(ctx->records_characteristic, value);
+    SubscriptionRecordNotification(&ctx->records_subscription, size);
+    g_variant_unref(value);
+
+    return last;
+}
+
+static gboolean transfer_dispatch(gpointer user_data);
+
+static void transfer_flushed(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    struct HistoryFlush *flush = user_data;
+    struct HSContext *ctx = flush->ctx;
+    GError *error = NULL;
+    g_dbus_connection_flush_finish(G_DBUS_CONNECTION(source), res, &error);
+    g_free(flush);
+    if (ctx == NULL)
+    {
+        g_clear_error(&error);
+        return;
+    }
+
+    ctx->transfer_flush = NULL;
+    if (error != NULL)
+    {
+        LE_WARN("Abandoning %s history transfer: %s", ctx->history->name, error->message);
+        g_error_free(error);
+        stop_transfer(ctx);
+        return;
+    }
+    ctx->transfer_source =
+        g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, transfer_dispatch, ctx, NULL);
+}
+
+static gboolean transfer_dispatch(gpointer user_data)
+{
+    struct HSContext *ctx = user_data;
+    for (guint i = 0; i < HISTORY_PACKETS_PER_DISPATCH; i++)
+    {
+        if (send_records_packet(ctx))
+        {
+            LE_INFO(
+                "Sent %s history in %u packets (%" G_GUINT64_FORMAT " records overwritten) in %"
+                G_GINT64_FORMAT " us",
+                ctx->history->name,
+                ctx->sequence,
+                ctx->skipped,
+                g_get_monotonic_time() - ctx->transfer_start);
+            ctx->transfer_source = 0;
+            stop_transfer(ctx);
+            return G_SOURCE_REMOVE;
+        }
+    }
+
+    GDBusConnection *conn = g_dbus_interface_skeleton_get_connection(
+        G_DBUS_INTERFACE_SKELETON(ctx->records_characteristic));
+    if (conn == NULL)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+
+    struct HistoryFlush *flush = g_new0(struct HistoryFlush, 1);
+    flush->ctx = ctx;
+    ctx->transfer_flush = flush;
+    ctx->transfer_source = 0;
+    g_dbus_connection_flush(conn, NULL, transfer_flushed, flush);
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * A new request replaces any transfer in progress. The end of the transfer is fixed when it is
+ * requested, so a producer that keeps pushing can't keep it going forever.
+ */
+static void start_transfer(
+    struct HSContext *ctx,
+    struct SampleHistory *history,
+    guint32 since,
+    guint16 mtu,
+    const gchar *device)
+{
+    stop_transfer(ctx);
+    ctx->history = SampleHistoryRef(history);
+    if (device != NULL)
+    {
+        // The transfer is abandoned if the device that asked for it disconnects
+        ctx->transfer_device = g_strdup(device);
+        SubscriptionAdd(&ctx->records_subscription, device);
+    }
+    ctx->next_index = SampleHistoryFindSince(history, since);
+    ctx->end_index = history->numRecorded;
+    ctx->sequence = 0;
+    ctx->skipped = 0;
+    ctx->payload_size = MIN(mtu - ATT_NOTIFICATION_HEADER_SIZE, ATT_MAX_VALUE_LEN);
+    ctx->transfer_start = g_get_monotonic_time();
+    ctx->transfer_source =
+        g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, transfer_dispatch, ctx, NULL);
+
+    LE_DEBUG(
+        "Sending %" G_GUINT64_FORMAT " %s records since %u with mtu %u",
+        ctx->end_index - ctx->next_index,
+        history->name,
+        since,
+        mtu);
+}
+
+static gboolean handle_control_point_write(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *value,
+    GVariant *options,
+    gpointer user_data)
+{
+    struct HSContext *ctx = user_data;
+    gsize size = 0;
+    const guint8 *request = NULL;
+    if (g_variant_is_of_type(value, G_VARIANT_TYPE_BYTESTRING))
+    {
+        request = g_variant_get_fixed_array(value, &size, sizeof(guint8));
+    }
+    if (size == 0)
+    {
+        GattReturnError(
+            interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.InvalidValueLength",
+            "Empty request");
+        return TRUE;
+    }
+
+    switch (request[0])
+    {
+    case HISTORY_OPCODE_SEND_SINCE:
+    {
+        if (size != 6)
+        {
+            GattReturnError(
+                interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.InvalidValueLength",
+                "Expected opcode, id and since");
+            return TRUE;
+        }
+        struct SampleHistory *history = SampleHistoryAt(request[1]);
+        if (history == NULL)
+        {
+            GattReturnError(
+                interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.Failed",
+                "Unknown history");
+            return TRUE;
+        }
+        if (!SubscriptionHas(&ctx->records_subscription, NULL))
+        {
+            GattReturnError(
+                interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.NotPermitted",
+                "Records notifications are off");
+            return TRUE;
+        }
+
+        guint16 mtu = ATT_DEFAULT_MTU;
+        g_variant_lookup(options, "mtu", "q", &mtu);
+        start_transfer(
+            ctx,
+            history,
+            get_le32(&request[2]),
+            MAX(mtu, ATT_DEFAULT_MTU),
+            GattOptionsGetDevice(options));
+        break;
+    }
+
+    case HISTORY_OPCODE_ABORT:
+        stop_transfer(ctx);
+        break;
+
+    default:
+        GattReturnError(
+            interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.NotSupported",
+            "Unknown opcode");
+        return TRUE;
+    }
+
+    bluez_gatt_characteristic1_complete_write_value(interface, invocation);
+    return TRUE;
+}
+
+static gboolean handle_records_start_notify(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    gpointer user_data)
+{
+    struct HSContext *ctx = user_data;
+    SubscriptionAdd(&ctx->records_subscription, NULL);
+
+    bluez_gatt_characteristic1_complete_start_notify(interface, invocation);
+    return TRUE;
+}
+
+static gboolean handle_records_stop_notify(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    gpointer user_data)
+{
+    struct HSContext *ctx = user_data;
+    SubscriptionRemove(&ctx->records_subscription, NULL);
+
+    bluez_gatt_characteristic1_complete_stop_notify(interface, invocation);
+    return TRUE;
+}
+
+/*
+ * One entry per history, in id order: id (u8), number of records (u32), oldest and newest
+ * timestamps (u32 each, 0 if empty), name length (u8) and the name.
+ */
+static gboolean handle_catalog_read(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer user_data)
+{
+    GByteArray *catalog = g_byte_array_new();
+    for (guint id = 0; id < SampleHistoryCount(); id++)
+    {
+        const struct SampleHistory *history = SampleHistoryAt(id);
+        if (history == NULL)
+        {
+            continue;
+        }
+        const struct HistorySample *oldest =
+            SampleHistoryGet(history, SampleHistoryFirstIndex(history));
+        const struct HistorySample *newest =
+            SampleHistoryGet(history, history->numRecorded - 1);
+        const gsize name_len = MIN(strlen(history->name), G_MAXUINT8);
+
+        guint8 entry[14];
+        entry[0] = id;
+        put_le32(&entry[1], history->length);
+        put_le32(&entry[5], (oldest != NULL) ? oldest->timestamp : 0);
+        put_le32(&entry[9], (newest != NULL) ? newest->timestamp : 0);
+        entry[13] = name_len;
+        g_byte_array_append(catalog, entry, sizeof(entry));
+        g_byte_array_append(catalog, (const guint8 *)history->name, name_len);
+    }
+
+    GVariant *value = g_variant_new_fixed_array(
+        G_VARIANT_TYPE_BYTE, catalog->data, catalog->len, sizeof(guint8));
+    g_byte_array_unref(catalog);
+    GattCharacteristicCompleteRead(interface, invocation, value);
+    return TRUE;
+}
+
+static void bind_records(gpointer context, BluezGattCharacteristic1 *characteristic)
+{
+    struct HSContext *ctx = context;
+    ctx->records_characteristic = characteristic;
+}
+
+/*
+ * A transfer stops when bluetoothd reports that nobody is subscribed any more, or when the device
+ * that requested it goes away.
+ */
+static void records_subscription_changed(
+    struct Subscription *subscription, const gchar *device, bool subscribed, gpointer context)
+{
+    struct HSContext *ctx = context;
+    if (!subscribed && (device == NULL || g_strcmp0(device, ctx->transfer_device) == 0))
+    {
+        stop_transfer(ctx);
+    }
+}
+
+static gpointer history_init(void)
+{
+    struct HSContext *ctx = g_malloc0(sizeof(*ctx));
+    SubscriptionInit(
+        &ctx->records_subscription, "history/records", records_subscription_changed, ctx);
+    return ctx;
+}
+
+static void history_fini(gpointer context)
+{
+    struct HSContext *ctx = context;
+    stop_transfer(ctx);
+    SubscriptionFini(&ctx->records_subscription);
+    g_free(ctx);
+}
+
+static const gchar *const control_point_flags[] = {
+    "write",
+    NULL
+};
+
+static const gchar *const records_flags[] = {
+    "notify",
+    NULL
+};
+
+static const gchar *const catalog_flags[] = {
+    "read",
+    NULL
+};
+
+static const struct GattCharacteristicDefinition history_characteristics[] = {
+    {
+        .name = "control_point",
+        .uuid = HISTORY_CONTROL_POINT_CHARACTERISTIC_UUID,
+        .flags = control_point_flags,
+        .write = handle_control_point_write,
+    },
+    {
+        .name = "records",
+        .uuid = HISTORY_RECORDS_CHARACTERISTIC_UUID,
+        .flags = records_flags,
+        .startNotify = handle_records_start_notify,
+        .stopNotify = handle_records_stop_notify,
+        .bind = bind_records,
+    },
+    {
+        .name = "catalog",
+        .uuid = HISTORY_CATALOG_CHARACTERISTIC_UUID,
+        .flags = catalog_flags,
+        .read = handle_catalog_read,
+    },
+};
+
+const struct GattServiceDefinition history_service_definition = {
+    .name = "history",
+    .uuid = HISTORY_SERVICE_UUID,
+    .primary = true,
+    .init = history_init,
+    .fini = history_fini,
+    .characteristics = history_characteristics,
+    .numCharacteristics = G_N_ELEMENTS(history_characteristics),
+};
@@ -0,0 +1,10 @@
+#ifndef _HISTORY_SERVICE_H
+#define _HISTORY_SERVICE_H
+
+#include "gatt_database.h"
+
+#define HISTORY_SERVICE_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b5d00"
+
+extern const struct GattServiceDefinition history_service_definition;
+
+#endif // _HISTORY_SERVICE_H
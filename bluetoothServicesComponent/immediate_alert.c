@@ -13,11 +13,23 @@
 
 // Local
 #include "immediate_alert.h"
+#include "gatt_stats.h"
+#include "advertisement_data.h"
+#include "write_assembly.h"
+#include "executor.h"
 #include "org.bluez.GattCharacteristic1.h"
-#include "org.bluez.GattService1.h"
 
 #define ALERT_LEVEL_CHARACTERISTIC_UUID "2a06"
 
+/*
+ * The first write is applied straight away. Writes arriving within this long of the last applied
+ * level are held back and only the latest of them is applied when the window closes.
+ */
+#define ALERT_COALESCE_WINDOW_MS 100
+
+#define BUZZER_PERIOD 1.0
+#define BUZZER_PERCENT 50.0
+
 /*
  * Note that these values are chosen to match the immediate alert service specification, so don't
  * change them.
@@ -29,102 +41,239 @@ enum AlertLevel
     ALERT_LEVEL_HIGH = 2,
 };
 
-static void set_alert_level(enum AlertLevel alert_level)
+/*
+ * What has been pushed to the actuator apps. Nothing is known until the first push, so every value
+ * is pushed then.
+ */
+struct actuator_state {
+    bool valid;
+    bool led_enable;
+    bool buzzer_enable;
+    // The buzzer settings never change, so they only need pushing once
+    bool buzzer_configured;
+};
+
+struct IAContext {
+    /*
+     * Only used on the main loop. It is updated when the pushes are queued, and the worker is
+     * given its own copy of them, so it never reads this.
+     */
+    struct actuator_state applied;
+    enum AlertLevel requested_level;
+    bool pending;
+    guint coalesce_timer;
+    struct AdvertisementField *level_advertisement;
+    struct WriteAssembler level_writes;
+    guint64 num_writes;
+    guint64 num_applied;
+    guint64 num_pushes;
+};
+
+/*
+ * The pushes for one applied level. They are made on the data hub worker, so a slow data hub
+ * doesn't hold up other clients' requests, and the worker runs them in the order they were applied.
+ * The update is owned by the worker once it is queued.
+ */
+struct actuator_update {
+    bool push_led_enable;
+    bool led_enable;
+    bool configure_buzzer;
+    bool push_buzzer_enable;
+    bool buzzer_enable;
+};
+
+// Runs on the data hub worker
+static void push_actuators(gpointer data)
+{
+    struct actuator_update *update = data;
+    if (update->push_led_enable)
+    {
+        dhubAdmin_PushBoolean("/app/leds/mono/enable", IO_NOW, update->led_enable);
+    }
+    if (update->configure_buzzer)
+    {
+        dhubAdmin_PushNumeric("/app/buzzer/period", IO_NOW, BUZZER_PERIOD);
+        dhubAdmin_PushNumeric("/app/buzzer/percent", IO_NOW, BUZZER_PERCENT);
+    }
+    if (update->push_buzzer_enable)
+    {
+        dhubAdmin_PushBoolean("/app/buzzer/enable", IO_NOW, update->buzzer_enable);
+    }
+}
+
+/*
+ * Pushes only the actuator values that differ from what was last applied, in the order the
+ * actuators expect them (the buzzer is configured before it is enabled). If the provider queue is
+ * full the level is left pending and applied when the coalescing window closes.
+ */
+static void set_alert_level(struct IAContext *ctx, enum AlertLevel alert_level)
 {
     LE_DEBUG("Processing request to set alert_level to %d (0=none, 1=mild, 2=high)", alert_level);
 
-    switch (alert_level)
+    const bool led_enable = (alert_level != ALERT_LEVEL_NONE);
+    const bool buzzer_enable = (alert_level == ALERT_LEVEL_HIGH);
+    struct actuator_state *applied = &ctx->applied;
+
+    struct actuator_update *update = g_new0(struct actuator_update, 1);
+    update->push_led_enable = !applied->valid || applied->led_enable != led_enable;
+    update->led_enable = led_enable;
+    update->configure_buzzer = buzzer_enable && !applied->buzzer_configured;
+    update->push_buzzer_enable = !applied->valid || applied->buzzer_enable != buzzer_enable;
+    update->buzzer_enable = buzzer_enable;
+    // Counted here rather than when the worker finishes, since the service may be gone by then
+    const guint num_pushes =
+        update->push_led_enable + 2 * update->configure_buzzer + update->push_buzzer_enable;
+    if (num_pushes > 0)
     {
-    case ALERT_LEVEL_NONE:
-        dhubAdmin_PushBoolean("/app/leds/mono/enable", IO_NOW, false);
-        dhubAdmin_PushBoolean("/app/buzzer/enable", IO_NOW, false);
-        break;
-
-    case ALERT_LEVEL_MILD:
-        dhubAdmin_PushBoolean("/app/leds/mono/enable", IO_NOW, true);
-        dhubAdmin_PushBoolean("/app/buzzer/enable", IO_NOW, false);
-        break;
-
-    case ALERT_LEVEL_HIGH:
-        dhubAdmin_PushBoolean("/app/leds/mono/enable", IO_NOW, true);
-        dhubAdmin_PushNumeric("/app/buzzer/period", IO_NOW, 1.0);
-        dhubAdmin_PushNumeric("/app/buzzer/percent", IO_NOW, 50);
-        dhubAdmin_PushBoolean("/app/buzzer/enable", IO_NOW, true);
-        break;
+        const bool queued = ExecutorSubmit(
+            EXECUTOR_QUEUE_DATAHUB, "alert actuators", push_actuators, NULL, update, g_free, 0);
+        if (!queued)
+        {
+            g_free(update);
+            ctx->pending = true;
+            return;
+        }
+        ctx->num_pushes += num_pushes;
     }
+    else
+    {
+        g_free(update);
+    }
+
+    applied->valid = true;
+    applied->led_enable = led_enable;
+    applied->buzzer_enable = buzzer_enable;
+    applied->buzzer_configured = applied->buzzer_configured || buzzer_enable;
+    ctx->num_applied++;
+    const guint8 level = alert_level;
+    AdvertisementDataSet(ctx->level_advertisement, &level);
+    LE_DEBUG(
+        "Alert writes=%" G_GUINT64_FORMAT " applied=%" G_GUINT64_FORMAT
+        " pushes=%" G_GUINT64_FORMAT,
+        ctx->num_writes,
+        ctx->num_applied,
+        ctx->num_pushes);
 }
 
-static gboolean handle_write_value(
-    BluezGattCharacteristic1 *interface,
-    GDBusMethodInvocation *invocation,
-    GVariant *value,
-    GVariant *options,
-    gpointer user_data)
+static gboolean coalesce_timer_expired(gpointer user_data)
 {
-    // TODO: check options
-
-    if (!g_variant_is_of_type(value, G_VARIANT_TYPE_BYTESTRING)) {
-        g_print(
-            "%s received value of unexpected type: \"%s\"\n",
-            __func__,
-            g_variant_get_type_string(value));
-        goto done;
+    struct IAContext *ctx = user_data;
+    if (!ctx->pending)
+    {
+        ctx->coalesce_timer = 0;
+        return G_SOURCE_REMOVE;
     }
 
-    gsize n_elements;
-    const guint8 *value_array = g_variant_get_fixed_array(value, &n_elements, sizeof(guint8));
-    if (n_elements !=  1) {
-        g_print("%s received value of unexpected length: %zu\n", __func__, n_elements);
-        goto done;
+    // Keep the window open so a sustained burst is applied at most once per window
+    ctx->pending = false;
+    set_alert_level(ctx, ctx->requested_level);
+    return G_SOURCE_CONTINUE;
+}
+
+static void request_alert_level(struct IAContext *ctx, enum AlertLevel alert_level)
+{
+    ctx->num_writes++;
+    ctx->requested_level = alert_level;
+    if (ctx->coalesce_timer != 0)
+    {
+        ctx->pending = true;
+        return;
     }
 
-    const guint8 alert_level = value_array[0];
-    set_alert_level((enum AlertLevel)alert_level);
+    set_alert_level(ctx, alert_level);
+    ctx->coalesce_timer = g_timeout_add(ALERT_COALESCE_WINDOW_MS, coalesce_timer_expired, ctx);
+}
 
-done:
-    bluez_gatt_characteristic1_complete_write_value(interface, invocation);
+static const gchar *validate_alert_level(const guint8 *data, gsize size, gpointer context)
+{
+    if (size != 1)
+    {
+        return "org.bluez.Error.InvalidValueLength";
+    }
+    if (data[0] > ALERT_LEVEL_HIGH)
+    {
+        return "org.bluez.Error.Failed";
+    }
+    return NULL;
+}
 
+static void commit_alert_level(const guint8 *data, gsize size, gpointer context)
+{
+    request_alert_level(context, (enum AlertLevel)data[0]);
+}
+
+static gboolean handle_write_value(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *value,
+    GVariant *options,
+    gpointer user_data)
+{
+    struct IAContext *ctx = user_data;
+    WriteAssemblerHandle(&ctx->level_writes, interface, invocation, value, options);
     return TRUE;
 }
 
-void alert_register_services(
-    GDBusObjectManagerServer *services_om,
-    size_t *num_services_registered)
+static gpointer alert_init(void)
 {
-    const gchar *om_path =
-        g_dbus_object_manager_get_object_path(G_DBUS_OBJECT_MANAGER(services_om));
-
-    gchar *service_path = g_strdup_printf("%s/service%zu", om_path, *num_services_registered);
-    GDBusObjectSkeleton *service_object = g_dbus_object_skeleton_new(service_path);
-    BluezGattService1 *service_interface = bluez_gatt_service1_skeleton_new();
-    bluez_gatt_service1_set_uuid(service_interface, IMMEDIATE_ALERT_SERVICE_UUID);
-    bluez_gatt_service1_set_primary(service_interface, TRUE);
-    g_dbus_object_skeleton_add_interface(
-        service_object, G_DBUS_INTERFACE_SKELETON(service_interface));
-    g_object_unref(service_interface);
-    g_dbus_object_manager_server_export(services_om, service_object);
-    g_object_unref(service_object);
-
-    gchar *characteristic_path = g_strconcat(service_path, "/char0", NULL);
-    GDBusObjectSkeleton *characteristic_object = g_dbus_object_skeleton_new(characteristic_path);
-    BluezGattCharacteristic1 *characteristic_interface = bluez_gatt_characteristic1_skeleton_new();
-    bluez_gatt_characteristic1_set_uuid(characteristic_interface, ALERT_LEVEL_CHARACTERISTIC_UUID);
-    const gchar *characteristic_flags[] = {
-        "write",
-        NULL
-    };
-    bluez_gatt_characteristic1_set_flags(characteristic_interface, characteristic_flags);
-    bluez_gatt_characteristic1_set_service(characteristic_interface, service_path);
-    g_signal_connect(
-        characteristic_interface, "handle-write-value", G_CALLBACK(handle_write_value), NULL);
-    g_dbus_object_skeleton_add_interface(
-        characteristic_object, G_DBUS_INTERFACE_SKELETON(characteristic_interface));
-    g_object_unref(characteristic_interface);
-    g_dbus_object_manager_server_export(services_om, characteristic_object);
-    g_object_unref(characteristic_object);
-
-    g_free(characteristic_path);
-    g_free(service_path);
-
-    *num_services_registered += 1;
+    struct IAContext *ctx = g_malloc0(sizeof(*ctx));
+    // Starts out as none, which is what the zeroed field holds
+    ctx->level_advertisement =
+        AdvertisementDataAddField(ADVERTISEMENT_FIELD_ALERT_LEVEL, "alert/level", 1);
+    WriteAssemblerInit(
+        &ctx->level_writes, "alert/level", 1, validate_alert_level, commit_alert_level, ctx);
+    return ctx;
 }
+
+/*
+ * An alert that is sounding when the service is disabled would otherwise be left on, since no
+ * client can reach the level any more.
+ */
+static void alert_fini(gpointer context)
+{
+    struct IAContext *ctx = context;
+    if (ctx->coalesce_timer != 0)
+    {
+        g_source_remove(ctx->coalesce_timer);
+    }
+    if (ctx->applied.led_enable || ctx->applied.buzzer_enable)
+    {
+        set_alert_level(ctx, ALERT_LEVEL_NONE);
+        if (ctx->pending)
+        {
+            LE_WARN("Provider queue is full, the alert may be left on");
+        }
+    }
+    WriteAssemblerFini(&ctx->level_writes);
+    AdvertisementDataRemoveField(ctx->level_advertisement);
+    g_free(ctx);
+}
+
+/*
+ * The alert level is write without response in the immediate alert service specification, so
+ * phones don't wait for an ATT round trip. Plain writes are still accepted.
+ */
+static const gchar *const alert_level_flags[] = {
+    "write-without-response",
+    "write",
+    NULL
+};
+
+static const struct GattCharacteristicDefinition alert_characteristics[] = {
+    {
+        .name = "level",
+        .uuid = ALERT_LEVEL_CHARACTERISTIC_UUID,
+        .flags = alert_level_flags,
+        .write = handle_write_value,
+    },
+};
+
+const struct GattServiceDefinition alert_service_definition = {
+    .name = "immediate_alert",
+    .uuid = IMMEDIATE_ALERT_SERVICE_UUID,
+    .primary = true,
+    .init = alert_init,
+    .fini = alert_fini,
+    .characteristics = alert_characteristics,
+    .numCharacteristics = G_N_ELEMENTS(alert_characteristics),
+};
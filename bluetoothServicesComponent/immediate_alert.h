@@ -1,10 +1,10 @@
 #ifndef _IMMEDIATE_ALERT_SERVICE_H
 #define _IMMEDIATE_ALERT_SERVICE_H
 
+#include "gatt_database.h"
+
 #define IMMEDIATE_ALERT_SERVICE_UUID "1802"
 
-void alert_register_services(
-    GDBusObjectManagerServer *services_om,
-    size_t *num_services_registered);
+extern const struct GattServiceDefinition alert_service_definition;
 
 #endif // _IMMEDIATE_ALERT_SERVICE_H
@@ -0,0 +1,153 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// GLib
+#include <glib.h>
+
+// Legato
+#include "legato.h"
+
+// Local
+#include "legato_bridge.h"
+
+#define ENV_BUDGET "BLUETOOTH_SERVICES_LEGATO_BUDGET"
+#define ENV_PRIORITY "BLUETOOTH_SERVICES_LEGATO_PRIORITY"
+
+static struct LegatoBridgeConfig Config;
+static struct LegatoBridgeStats Stats;
+static guint ContinuationSource;
+
+static gboolean LegatoContinuation(gpointer userData);
+
+/*
+ * Services up to the configured budget of Legato events. Returns true if there may be more work.
+ */
+static bool ServiceLegatoEvents(void)
+{
+    const gint64 startTime = g_get_monotonic_time();
+    guint iterations = 0;
+    bool moreWork = true;
+
+    while (Config.budget == 0 || iterations < Config.budget)
+    {
+        le_result_t r = le_event_ServiceLoop();
+        if (r == LE_WOULD_BLOCK)
+        {
+            // All of the work is done, so break out
+            moreWork = false;
+            break;
+        }
+        LE_ASSERT_OK(r);
+        iterations++;
+    }
+
+    const gint64 duration = g_get_monotonic_time() - startTime;
+    Stats.wakeups++;
+    Stats.iterations += iterations;
+    Stats.maxIterationsPerWakeup = MAX(Stats.maxIterationsPerWakeup, iterations);
+    Stats.totalDispatchUs += duration;
+    Stats.maxDispatchUs = MAX(Stats.maxDispatchUs, duration);
+    if (moreWork)
+    {
+        Stats.budgetExhausted++;
+    }
+
+    return moreWork;
+}
+
+/*
+ * The Legato event fd isn't guaranteed to stay readable when events are left queued, so leftover
+ * work is picked up by an idle source at the same priority instead.
+ */
+static void ScheduleContinuation(void)
+{
+    if (ContinuationSource == 0)
+    {
+        ContinuationSource = g_idle_add_full(Config.priority, LegatoContinuation, NULL, NULL);
+    }
+}
+
+static gboolean LegatoContinuation(gpointer userData)
+{
+    if (ServiceLegatoEvents())
+    {
+        return G_SOURCE_CONTINUE;
+    }
+
+    ContinuationSource = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean LegatoFdHandler(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    if (ServiceLegatoEvents())
+    {
+        ScheduleContinuation();
+    }
+
+    return TRUE;
+}
+
+void LegatoBridgeConfigFromEnv(struct LegatoBridgeConfig *config)
+{
+    config->budget = 0;
+    config->priority = G_PRIORITY_DEFAULT;
+
+    const char *budget = getenv(ENV_BUDGET);
+    if (budget != NULL)
+    {
+        config->budget = (guint)strtoul(budget, NULL, 10);
+    }
+
+    const char *priority = getenv(ENV_PRIORITY);
+    if (priority != NULL)
+    {
+        if (strcmp(priority, "low") == 0)
+        {
+            // Runs after D-Bus method invocations, which GDBus dispatches at default priority
+            config->priority = G_PRIORITY_HIGH_IDLE;
+        }
+        else if (strcmp(priority, "default") != 0)
+        {
+            LE_WARN("Ignoring unknown %s value \"%s\"", ENV_PRIORITY, priority);
+        }
+    }
+}
+
+void LegatoBridgeStart(const struct LegatoBridgeConfig *config)
+{
+    Config = *config;
+    LE_INFO(
+        "Servicing Legato events with budget=%u (0=unbounded), priority=%d",
+        Config.budget,
+        Config.priority);
+
+    int legatoEventLoopFd = le_event_GetFd();
+    GIOChannel *channel = g_io_channel_unix_new(legatoEventLoopFd);
+    gpointer userData = NULL;
+    g_io_add_watch_full(channel, Config.priority, G_IO_IN, LegatoFdHandler, userData, NULL);
+    g_io_channel_unref(channel);
+}
+
+void LegatoBridgeGetStats(struct LegatoBridgeStats *stats)
+{
+    *stats = Stats;
+}
+
+void LegatoBridgeSummarize(GString *json)
+{
+    g_string_append_printf(
+        json,
+        "{\"wakeups\":%" G_GUINT64_FORMAT ",\"events\":%" G_GUINT64_FORMAT
+        ",\"maxEventsPerWakeup\":%u,\"budgetExhausted\":%" G_GUINT64_FORMAT
+        ",\"meanDispatchUs\":%" G_GINT64_FORMAT ",\"maxDispatchUs\":%" G_GINT64_FORMAT "}",
+        Stats.wakeups,
+        Stats.iterations,
+        Stats.maxIterationsPerWakeup,
+        Stats.budgetExhausted,
+        (Stats.wakeups > 0) ? Stats.totalDispatchUs / (gint64)Stats.wakeups : 0,
+        Stats.maxDispatchUs);
+}
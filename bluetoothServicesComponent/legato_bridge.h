@@ -0,0 +1,37 @@
+#ifndef _LEGATO_BRIDGE_H
+#define _LEGATO_BRIDGE_H
+
+#include <glib.h>
+
+/*
+ * Services the Legato event loop from the GLib main loop.
+ *
+ * By default all pending Legato events are serviced each time the Legato event fd becomes readable,
+ * at the same priority as GLib I/O. With a non-zero budget at most that many events are serviced
+ * per dispatch and the rest are picked up in a later main loop iteration, so a burst of dataHub
+ * pushes can't hold up pending D-Bus method calls. Giving Legato work a lower priority than GLib
+ * I/O additionally lets BlueZ requests go first whenever both are ready.
+ */
+struct LegatoBridgeConfig
+{
+    guint budget; // Max Legato events per dispatch. 0 means service until there is nothing left.
+    gint priority; // GLib priority of Legato work
+};
+
+struct LegatoBridgeStats
+{
+    guint64 wakeups;
+    guint64 iterations;
+    guint maxIterationsPerWakeup;
+    guint64 budgetExhausted;
+    gint64 totalDispatchUs;
+    gint64 maxDispatchUs; // Longest time the GLib main loop was stalled servicing Legato events
+};
+
+void LegatoBridgeConfigFromEnv(struct LegatoBridgeConfig *config);
+void LegatoBridgeStart(const struct LegatoBridgeConfig *config);
+void LegatoBridgeGetStats(struct LegatoBridgeStats *stats);
+// Appends the stats as a JSON object, for publishing with the GATT statistics
+void LegatoBridgeSummarize(GString *json);
+
+#endif // _LEGATO_BRIDGE_H
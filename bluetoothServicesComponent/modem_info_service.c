@@ -13,152 +13,491 @@
 
 // Local
 #include "modem_info_service.h"
+#include "value_cache.h"
+#include "gatt_stats.h"
+#include "executor.h"
 #include "org.bluez.GattCharacteristic1.h"
-#include "org.bluez.GattService1.h"
 #include "org.bluez.GattDescriptor1.h"
 
+#define MODEM_INFO_MODEL_NUMBER_CHARACTERISTIC_UUID "2A24"
 #define MODEM_INFO_FSN_CHARACTERISTIC_UUID "2A25"
+#define MODEM_INFO_FIRMWARE_REVISION_CHARACTERISTIC_UUID "2A26"
+#define MODEM_INFO_SOFTWARE_REVISION_CHARACTERISTIC_UUID "2A28"
+#define MODEM_INFO_MANUFACTURER_NAME_CHARACTERISTIC_UUID "2A29"
 #define MODEM_INFO_IMEI_CHARACTERISTIC_UUID "fb22d0b6-7c72-4e29-a156-df6518f69ec4"
 #define CHARACTERISTIC_PRESENTATION_FORMAT_UUID "2904"
 
-static gboolean handle_read_fsn_value(
+// Served as the Software Revision String since le_info has no notion of the Legato version
+#define LEGATO_VERSION_FILE "/legato/systems/current/version"
+
+/*
+ * How long a read that arrives before the values have been fetched waits for them. le_info calls
+ * can take seconds while the modem is busy.
+ */
+#define MODEM_INFO_READ_TIMEOUT_MS 5000
+
+/*
+ * How long fetched values are served before a read fetches them again. Firmware updates don't
+ * restart the app, and a value the modem couldn't give at startup is only known after a refetch.
+ */
+#define MODEM_INFO_TTL_US (10 * 60 * G_USEC_PER_SEC)
+
+/*
+ * The identity values served by this service rarely change, so they are all fetched from the
+ * modem in one batch at startup and reads are served from memory. Once they expire, the next read
+ * still gets them and fetches them all again in the background. Fetches run on the provider
+ * worker, so a slow modem doesn't hold up startup or other clients' requests.
+ */
+enum ModemInfoField
+{
+    MODEM_INFO_FIELD_MODEL_NUMBER,
+    MODEM_INFO_FIELD_FSN,
+    MODEM_INFO_FIELD_FIRMWARE_REVISION,
+    MODEM_INFO_FIELD_SOFTWARE_REVISION,
+    MODEM_INFO_FIELD_MANUFACTURER_NAME,
+    MODEM_INFO_FIELD_IMEI,
+    MODEM_INFO_FIELD_COUNT,
+};
+
+/*
+ * Referenced by the service and by each job queued for it, so jobs still on the worker when the
+ * service is disabled complete safely.
+ */
+struct ModemInfoContext {
+    guint refs;
+    struct ValueCache values[MODEM_INFO_FIELD_COUNT];
+    bool fetched;
+    bool refreshing;
+    /*
+     * Written by the worker, then read on the main loop after the fetch job has finished. NULL if
+     * the modem couldn't give the value.
+     */
+    gchar *fetched_values[MODEM_INFO_FIELD_COUNT];
+};
+
+/*
+ * A read that arrived before the fetch finished. It is queued behind the fetch, so it completes
+ * once the values are known.
+ */
+struct deferred_read {
+    struct ModemInfoContext *ctx;
+    enum ModemInfoField field;
+    BluezGattCharacteristic1 *interface;
+    GDBusMethodInvocation *invocation;
+};
+
+/*
+ * Characteristic Presentation Format for IMEI
+ * - Format:        0x19    (UTF-8 string)
+ * - Exponent:      0x00    (No change)
+ * - Unit:          0x2700  (Unitless)
+ * - Namespace:     0x01    (Bluetooth SIG Assigned Numbers)
+ * - Description:   0x0000  (Unknown)
+ */
+static const guint8 imei_cpf_value[] = { 0x19, 0x00, 0x00, 0x27, 0x01, 0x00, 0x00 };
+static struct ValueCache imei_cpf_cache;
+
+/*
+ * Device Information Service strings are UTF-8 without a terminating NUL, so the value is built
+ * from the string bytes only.
+ */
+static void set_string_value(
+    struct ModemInfoContext *ctx, enum ModemInfoField field, const gchar *str)
+{
+    ValueCacheSet(&ctx->values[field], (const guint8 *)str, strlen(str));
+}
+
+static void fetch_le_info_value(
+    struct ModemInfoContext *ctx,
+    enum ModemInfoField field,
+    const char *name,
+    le_result_t (*getter)(char *, size_t),
+    size_t max_bytes)
+{
+    gchar buffer[LE_INFO_MAX_VERS_BYTES];
+    LE_ASSERT(max_bytes <= sizeof(buffer));
+    le_result_t res = getter(buffer, max_bytes);
+    if (res != LE_OK)
+    {
+        LE_WARN("Couldn't read %s from modem: %s", name, LE_RESULT_TXT(res));
+        return;
+    }
+    LE_DEBUG("Modem %s: %s", name, buffer);
+    ctx->fetched_values[field] = g_strdup(buffer);
+}
+
+static void fetch_software_revision(struct ModemInfoContext *ctx)
+{
+    gchar *version = NULL;
+    GError *error = NULL;
+    if (!g_file_get_contents(LEGATO_VERSION_FILE, &version, NULL, &error))
+    {
+        LE_WARN("Couldn't read Legato version: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+    g_strstrip(version);
+    LE_DEBUG("Legato version: %s", version);
+    ctx->fetched_values[MODEM_INFO_FIELD_SOFTWARE_REVISION] = version;
+}
+
+// Runs on the provider worker
+static void fetch_values(gpointer data)
+{
+    struct ModemInfoContext *ctx = data;
+    const gint64 start_time = g_get_monotonic_time();
+
+    fetch_le_info_value(
+        ctx, MODEM_INFO_FIELD_MODEL_NUMBER, "model number", le_info_GetDeviceModel,
+        LE_INFO_MAX_MODEL_BYTES);
+    fetch_le_info_value(
+        ctx, MODEM_INFO_FIELD_FSN, "FSN", le_info_GetPlatformSerialNumber, LE_INFO_MAX_PSN_BYTES);
+    fetch_le_info_value(
+        ctx, MODEM_INFO_FIELD_FIRMWARE_REVISION, "firmware revision", le_info_GetFirmwareVersion,
+        LE_INFO_MAX_VERS_BYTES);
+    fetch_le_info_value(
+        ctx, MODEM_INFO_FIELD_MANUFACTURER_NAME, "manufacturer name",
+        le_info_GetManufacturerName, LE_INFO_MAX_MFR_NAME_BYTES);
+    fetch_le_info_value(
+        ctx, MODEM_INFO_FIELD_IMEI, "IMEI", le_info_GetImei, LE_INFO_IMEI_MAX_BYTES);
+    fetch_software_revision(ctx);
+
+    LE_INFO(
+        "Fetched device information in %" G_GINT64_FORMAT " us",
+        g_get_monotonic_time() - start_time);
+}
+
+/*
+ * Also called by deferred reads, which may complete before the fetch job itself if it timed out.
+ */
+static void store_fetched_values(struct ModemInfoContext *ctx)
+{
+    if (ctx->fetched)
+    {
+        return;
+    }
+    for (size_t i = 0; i < MODEM_INFO_FIELD_COUNT; i++)
+    {
+        // Served empty until a refetch gets it
+        set_string_value(ctx, i, (ctx->fetched_values[i] != NULL) ? ctx->fetched_values[i] : "");
+        g_free(ctx->fetched_values[i]);
+        ctx->fetched_values[i] = NULL;
+    }
+    ctx->fetched = true;
+}
+
+static void fetch_complete(enum ExecutorResult result, gpointer data)
+{
+    if (result == EXECUTOR_RESULT_DONE)
+    {
+        store_fetched_values(data);
+    }
+}
+
+static struct ModemInfoContext *modem_info_ref(struct ModemInfoContext *ctx)
+{
+    ctx->refs++;
+    return ctx;
+}
+
+static void modem_info_unref(gpointer data)
+{
+    struct ModemInfoContext *ctx = data;
+    if (--ctx->refs > 0)
+    {
+        return;
+    }
+    for (size_t i = 0; i < MODEM_INFO_FIELD_COUNT; i++)
+    {
+        ValueCacheInvalidate(&ctx->values[i]);
+        g_free(ctx->fetched_values[i]);
+    }
+    g_free(ctx);
+}
+
+// A value the modem couldn't give this time keeps the one fetched before
+static void refresh_complete(enum ExecutorResult result, gpointer data)
+{
+    struct ModemInfoContext *ctx = data;
+    ctx->refreshing = false;
+    for (size_t i = 0; i < MODEM_INFO_FIELD_COUNT; i++)
+    {
+        if (ctx->fetched_values[i] != NULL)
+        {
+            set_string_value(ctx, i, ctx->fetched_values[i]);
+            g_free(ctx->fetched_values[i]);
+            ctx->fetched_values[i] = NULL;
+        }
+        else
+        {
+            ValueCacheRenew(&ctx->values[i]);
+        }
+    }
+}
+
+/*
+ * Called by the first read of each expired value. The values expire together, so they are fetched
+ * again in one batch.
+ */
+static void refresh_values(gpointer context)
+{
+    struct ModemInfoContext *ctx = context;
+    if (ctx->refreshing)
+    {
+        return;
+    }
+
+    const bool queued = ExecutorSubmit(
+        EXECUTOR_QUEUE_MODEM,
+        "modem info refresh",
+        fetch_values,
+        refresh_complete,
+        modem_info_ref(ctx),
+        modem_info_unref,
+        0);
+    if (!queued)
+    {
+        // Tried again once the values expire again
+        modem_info_unref(ctx);
+        for (size_t i = 0; i < MODEM_INFO_FIELD_COUNT; i++)
+        {
+            ValueCacheRenew(&ctx->values[i]);
+        }
+        return;
+    }
+    ctx->refreshing = true;
+}
+
+static gpointer modem_info_init(void)
+{
+    struct ModemInfoContext *ctx = g_malloc0(sizeof(*ctx));
+    ctx->refs = 1;
+    for (size_t i = 0; i < MODEM_INFO_FIELD_COUNT; i++)
+    {
+        ValueCacheInitPulled(&ctx->values[i], MODEM_INFO_TTL_US, refresh_values, ctx);
+    }
+    ValueCacheInitStatic(&imei_cpf_cache, imei_cpf_value, sizeof(imei_cpf_value));
+
+    const bool queued = ExecutorSubmit(
+        EXECUTOR_QUEUE_MODEM,
+        "modem info fetch",
+        fetch_values,
+        fetch_complete,
+        modem_info_ref(ctx),
+        modem_info_unref,
+        0);
+    if (!queued)
+    {
+        // Only possible when the service is enabled at runtime while the queue is full
+        LE_WARN("Provider queue is full, device information will be fetched when it expires");
+        modem_info_unref(ctx);
+        store_fetched_values(ctx);
+    }
+
+    return ctx;
+}
+
+static void modem_info_fini(gpointer context)
+{
+    ValueCacheInvalidate(&imei_cpf_cache);
+    modem_info_unref(context);
+}
+
+// Nothing to do on the worker, the read only has to wait for the fetch queued ahead of it
+static void wait_for_fetch(gpointer data)
+{
+}
+
+static void deferred_read_complete(enum ExecutorResult result, gpointer data)
+{
+    struct deferred_read *read = data;
+    if (result == EXECUTOR_RESULT_TIMED_OUT)
+    {
+        GattReturnError(
+            read->interface, read->invocation, GATT_OPERATION_READ, "org.bluez.Error.Failed",
+            "Timed out waiting for the modem");
+        return;
+    }
+
+    store_fetched_values(read->ctx);
+    GattCharacteristicCompleteRead(
+        read->interface, read->invocation, ValueCacheGet(&read->ctx->values[read->field]));
+}
+
+static void free_deferred_read(gpointer data)
+{
+    struct deferred_read *read = data;
+    g_object_unref(read->interface);
+    modem_info_unref(read->ctx);
+    g_free(read);
+}
+
+static gboolean complete_read_field(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    struct ModemInfoContext *ctx,
+    enum ModemInfoField field)
+{
+    if (!ctx->fetched)
+    {
+        struct deferred_read *read = g_new0(struct deferred_read, 1);
+        read->ctx = modem_info_ref(ctx);
+        read->field = field;
+        read->interface = g_object_ref(interface);
+        read->invocation = invocation;
+        const bool queued = ExecutorSubmit(
+            EXECUTOR_QUEUE_MODEM,
+            "modem info read",
+            wait_for_fetch,
+            deferred_read_complete,
+            read,
+            free_deferred_read,
+            MODEM_INFO_READ_TIMEOUT_MS);
+        if (!queued)
+        {
+            free_deferred_read(read);
+            GattReturnError(
+                interface, invocation, GATT_OPERATION_READ, "org.bluez.Error.Failed", "Busy");
+        }
+        return TRUE;
+    }
+
+    GVariant *value = ValueCacheGet(&ctx->values[field]);
+    GattCharacteristicCompleteRead(interface, invocation, value);
+
+    return TRUE;
+}
+
+static gboolean handle_read_model_number_value(
     BluezGattCharacteristic1 *interface,
     GDBusMethodInvocation *invocation,
     GVariant *options,
     gpointer user_data)
 {
-    gchar fsn[32];
-    le_info_GetPlatformSerialNumber(fsn, 32);
-    g_print("%s called with FSN: %s\n", __func__, fsn);
-    GVariant *value = g_variant_new_bytestring((const gchar *)fsn);
-    g_variant_ref_sink(value);
-    bluez_gatt_characteristic1_set_value(interface, value);
-    bluez_gatt_characteristic1_complete_read_value(interface, invocation, value);
-    g_variant_unref(value);
+    return complete_read_field(interface, invocation, user_data, MODEM_INFO_FIELD_MODEL_NUMBER);
+}
 
-    return TRUE;
+static gboolean handle_read_fsn_value(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer user_data)
+{
+    return complete_read_field(interface, invocation, user_data, MODEM_INFO_FIELD_FSN);
 }
 
-static gboolean handle_read_imei_value(
+static gboolean handle_read_firmware_revision_value(
     BluezGattCharacteristic1 *interface,
     GDBusMethodInvocation *invocation,
     GVariant *options,
     gpointer user_data)
 {
-    gchar imei[32];
-    le_info_GetImei(imei, 32);
-    g_print("%s called with IMEI: %s\n", __func__, imei);
-    GVariant *value = g_variant_new_bytestring ((const gchar *)imei);
-    g_variant_ref_sink(value);
-    bluez_gatt_characteristic1_set_value(interface, value);
-    bluez_gatt_characteristic1_complete_read_value(interface, invocation, value);
-    g_variant_unref(value);
+    return complete_read_field(
+        interface, invocation, user_data, MODEM_INFO_FIELD_FIRMWARE_REVISION);
+}
 
-    return TRUE;
+static gboolean handle_read_software_revision_value(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer user_data)
+{
+    return complete_read_field(
+        interface, invocation, user_data, MODEM_INFO_FIELD_SOFTWARE_REVISION);
 }
 
-static gboolean handle_read_cpf_value(
+static gboolean handle_read_manufacturer_name_value(
     BluezGattCharacteristic1 *interface,
     GDBusMethodInvocation *invocation,
     GVariant *options,
     gpointer user_data)
 {
-    /**
-     * Characteristic Presentation Format for IMEI
-     * - Format:        0x19    (UTF-8 string)
-     * - Exponent:      0x00    (No change)
-     * - Unit:          0x2700  (Unitless)
-     * - Namespace:     0x01    (Bluetooth SIG Assigned Numbers)
-     * - Description:   0x0000  (Unknown)
-     */
-    guint8 custom_format[] = { 0x19, 0x00, 0x00, 0x27, 0x01, 0x00, 0x00 };
+    return complete_read_field(
+        interface, invocation, user_data, MODEM_INFO_FIELD_MANUFACTURER_NAME);
+}
 
-    g_print("%s called\n", __func__);
+static gboolean handle_read_imei_value(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer user_data)
+{
+    return complete_read_field(interface, invocation, user_data, MODEM_INFO_FIELD_IMEI);
+}
 
-    GVariant *value = g_variant_new_fixed_array(
-        G_VARIANT_TYPE_BYTE, custom_format, G_N_ELEMENTS(custom_format), sizeof(custom_format[0]));
-    g_variant_ref_sink(value);
-    bluez_gatt_characteristic1_set_value(interface, value);
-    bluez_gatt_characteristic1_complete_read_value(interface, invocation, value);
-    g_variant_unref(value);
+static gboolean handle_read_cpf_value(
+    BluezGattDescriptor1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer user_data)
+{
+    GVariant *value = ValueCacheGet(&imei_cpf_cache);
+    GattDescriptorCompleteRead(interface, invocation, value);
 
     return TRUE;
 }
 
+static const gchar *const modem_info_read_flags[] = {
+    "read",
+    NULL
+};
 
-void modem_info_register_services(
-    GDBusObjectManagerServer *services_om,
-    size_t *num_services_registered)
-{
-    const gchar *om_path =
-        g_dbus_object_manager_get_object_path(G_DBUS_OBJECT_MANAGER(services_om));
-
-    gchar *service_path = g_strdup_printf("%s/service%zu", om_path, *num_services_registered);
-    GDBusObjectSkeleton *bos = g_dbus_object_skeleton_new(service_path);
-    BluezGattService1 *bgs = bluez_gatt_service1_skeleton_new();
-    bluez_gatt_service1_set_uuid(bgs, MODEM_INFO_SERVICE_UUID);
-    bluez_gatt_service1_set_primary(bgs, TRUE);
-    g_dbus_object_skeleton_add_interface(bos, G_DBUS_INTERFACE_SKELETON(bgs));
-    g_object_unref(bgs);
-    g_dbus_object_manager_server_export(services_om, G_DBUS_OBJECT_SKELETON(bos));
-    g_object_unref(bos);
-
-    // FSN
-    gchar *fsn_characteristic_path = g_strconcat(service_path, "/fsn", NULL);
-    bos = g_dbus_object_skeleton_new(fsn_characteristic_path);
-
-    BluezGattCharacteristic1 *bgc = bluez_gatt_characteristic1_skeleton_new();
-    bluez_gatt_characteristic1_set_uuid(bgc, MODEM_INFO_FSN_CHARACTERISTIC_UUID);
-    const gchar *modem_info_fsn_CharacteristicFlags[] = {
-        "read",
-        NULL
-    };
-    bluez_gatt_characteristic1_set_flags(bgc, modem_info_fsn_CharacteristicFlags);
-    bluez_gatt_characteristic1_set_service(bgc, service_path);
-    g_signal_connect(bgc, "handle-read-value", G_CALLBACK(handle_read_fsn_value), NULL);
-    g_dbus_object_skeleton_add_interface(bos, G_DBUS_INTERFACE_SKELETON(bgc));
-    g_dbus_object_manager_server_export(services_om, G_DBUS_OBJECT_SKELETON(bos));
-    g_object_unref(bos);
-
-    // IMEI
-    gchar *imei_characteristic_path = g_strconcat(service_path, "/imei", NULL);
-    bos = g_dbus_object_skeleton_new(imei_characteristic_path);
-
-    bgc = bluez_gatt_characteristic1_skeleton_new();
-    bluez_gatt_characteristic1_set_uuid(bgc, MODEM_INFO_IMEI_CHARACTERISTIC_UUID);
-    const gchar *modem_info_imei_CharacteristicFlags[] = {
-        "read",
-        NULL
-    };
-    bluez_gatt_characteristic1_set_flags(bgc, modem_info_imei_CharacteristicFlags);
-    bluez_gatt_characteristic1_set_service(bgc, service_path);
-    g_signal_connect(bgc, "handle-read-value", G_CALLBACK(handle_read_imei_value), NULL);
-    g_dbus_object_skeleton_add_interface(bos, G_DBUS_INTERFACE_SKELETON(bgc));
-    g_dbus_object_manager_server_export(services_om, G_DBUS_OBJECT_SKELETON(bos));
-    g_object_unref(bos);
-
-    // Characteristic Presentation Format
-    gchar *cpf_characteristic_path = g_strconcat(imei_characteristic_path, "/imei_cpf", NULL);
-    bos = g_dbus_object_skeleton_new(cpf_characteristic_path);
-
-    BluezGattDescriptor1 *bgd = bluez_gatt_descriptor1_skeleton_new();
-    bluez_gatt_descriptor1_set_uuid(bgd, CHARACTERISTIC_PRESENTATION_FORMAT_UUID);
-    const gchar *cpf_CharacteristicFlags[] = {
-        "read",
-        NULL
-    };
-    bluez_gatt_descriptor1_set_flags(bgd, cpf_CharacteristicFlags);
-    bluez_gatt_descriptor1_set_characteristic(bgd, imei_characteristic_path);
-    g_signal_connect(bgd, "handle-read-value", G_CALLBACK(handle_read_cpf_value), NULL);
-    g_dbus_object_skeleton_add_interface(bos, G_DBUS_INTERFACE_SKELETON(bgd));
-    g_dbus_object_manager_server_export(services_om, G_DBUS_OBJECT_SKELETON(bos));
-    g_object_unref(bos);
-
-    /* cleanup */
-    g_free(fsn_characteristic_path);
-    g_free(imei_characteristic_path);
-    g_free(cpf_characteristic_path);
-    g_free(service_path);
-
-    *num_services_registered += 1;
-}
+static const struct GattDescriptorDefinition modem_info_imei_descriptors[] = {
+    {
+        .name = "imei_cpf",
+        .uuid = CHARACTERISTIC_PRESENTATION_FORMAT_UUID,
+        .flags = modem_info_read_flags,
+        .read = handle_read_cpf_value,
+    },
+};
+
+static const struct GattCharacteristicDefinition modem_info_characteristics[] = {
+    {
+        .name = "model_number",
+        .uuid = MODEM_INFO_MODEL_NUMBER_CHARACTERISTIC_UUID,
+        .flags = modem_info_read_flags,
+        .read = handle_read_model_number_value,
+    },
+    {
+        .name = "fsn",
+        .uuid = MODEM_INFO_FSN_CHARACTERISTIC_UUID,
+        .flags = modem_info_read_flags,
+        .read = handle_read_fsn_value,
+    },
+    {
+        .name = "firmware_revision",
+        .uuid = MODEM_INFO_FIRMWARE_REVISION_CHARACTERISTIC_UUID,
+        .flags = modem_info_read_flags,
+        .read = handle_read_firmware_revision_value,
+    },
+    {
+        .name = "software_revision",
+        .uuid = MODEM_INFO_SOFTWARE_REVISION_CHARACTERISTIC_UUID,
+        .flags = modem_info_read_flags,
+        .read = handle_read_software_revision_value,
+    },
+    {
+        .name = "manufacturer_name",
+        .uuid = MODEM_INFO_MANUFACTURER_NAME_CHARACTERISTIC_UUID,
+        .flags = modem_info_read_flags,
+        .read = handle_read_manufacturer_name_value,
+    },
+    {
+        .name = "imei",
+        .uuid = MODEM_INFO_IMEI_CHARACTERISTIC_UUID,
+        .flags = modem_info_read_flags,
+        .read = handle_read_imei_value,
+        .descriptors = modem_info_imei_descriptors,
+        .numDescriptors = G_N_ELEMENTS(modem_info_imei_descriptors),
+    },
+};
+
+const struct GattServiceDefinition modem_info_service_definition = {
+    .name = "modem_info",
+    .uuid = MODEM_INFO_SERVICE_UUID,
+    .primary = true,
+    .init = modem_info_init,
+    .fini = modem_info_fini,
+    .characteristics = modem_info_characteristics,
+    .numCharacteristics = G_N_ELEMENTS(modem_info_characteristics),
+};
@@ -1,10 +1,10 @@
 #ifndef __MODEM_INFO_SERVICE_H_
 #define __MODEM_INFO_SERVICE_H_
 
+#include "gatt_database.h"
+
 #define MODEM_INFO_SERVICE_UUID "180A"
 
-void modem_info_register_services(
-    GDBusObjectManagerServer *services_om,
-    size_t *num_services_registered);
+extern const struct GattServiceDefinition modem_info_service_definition;
 
 #endif // __MODEM_INFO_SERVICE_H_
@@ -0,0 +1,202 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <math.h>
+
+// GLib
+#include <glib.h>
+#include <gio/gio.h>
+
+// Legato
+#include "legato.h"
+
+// Local
+#include "notify_policy.h"
+#include "gatt_stats.h"
+
+static gboolean HeartbeatTimerExpired(gpointer userData);
+
+static void ArmHeartbeat(struct Notifier *notifier)
+{
+    if (notifier->heartbeatTimer != 0)
+    {
+        g_source_remove(notifier->heartbeatTimer);
+        notifier->heartbeatTimer = 0;
+    }
+
+    if (notifier->policy->maxIntervalMs > 0)
+    {
+        notifier->heartbeatTimer =
+            g_timeout_add(notifier->policy->maxIntervalMs, HeartbeatTimerExpired, notifier);
+    }
+}
+
+static void Emit(struct Notifier *notifier, double value)
+{
+    notifier->pending = false;
+    notifier->lastEmittedValue = value;
+    notifier->lastEmitTime = g_get_monotonic_time();
+    notifier->numEmitted++;
+    notifier->emit(value, notifier->context);
+    ArmHeartbeat(notifier);
+}
+
+static gboolean HeartbeatTimerExpired(gpointer userData)
+{
+    struct Notifier *notifier = userData;
+    notifier->heartbeatTimer = 0;
+    Emit(notifier, notifier->latestValue);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean MinIntervalTimerExpired(gpointer userData)
+{
+    struct Notifier *notifier = userData;
+    notifier->minIntervalTimer = 0;
+    if (notifier->pending)
+    {
+        Emit(notifier, notifier->latestValue);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+void NotifierInit(
+    struct Notifier *notifier,
+    const struct NotifyPolicy *policy,
+    NotifierEmitFunc emit,
+    gpointer context)
+{
+    memset(notifier, 0, sizeof(*notifier));
+    notifier->policy = policy;
+    notifier->emit = emit;
+    notifier->context = context;
+}
+
+/*
+ * Called when a client subscribes. The current value is always notified immediately.
+ */
+void NotifierStart(struct Notifier *notifier, double currentValue)
+{
+    notifier->active = true;
+    notifier->latestValue = currentValue;
+    Emit(notifier, currentValue);
+}
+
+void NotifierStop(struct Notifier *notifier)
+{
+    notifier->active = false;
+    notifier->pending = false;
+    if (notifier->minIntervalTimer != 0)
+    {
+        g_source_remove(notifier->minIntervalTimer);
+        notifier->minIntervalTimer = 0;
+    }
+    if (notifier->heartbeatTimer != 0)
+    {
+        g_source_remove(notifier->heartbeatTimer);
+        notifier->heartbeatTimer = 0;
+    }
+}
+
+/*
+ * Called by the producer for every new value. Does nothing while no client is subscribed.
+ */
+void NotifierSubmit(struct Notifier *notifier, double value)
+{
+    if (!notifier->active)
+    {
+        return;
+    }
+
+    notifier->numSubmitted++;
+    notifier->latestValue = value;
+
+    const double delta = fabs(value - notifier->lastEmittedValue);
+    if (delta == 0.0 || delta < notifier->policy->deadband)
+    {
+        // The latest value wins, so a held back value that is now inside the deadband is dropped
+        notifier->pending = false;
+        return;
+    }
+
+    const gint64 sinceLastEmitMs = (g_get_monotonic_time() - notifier->lastEmitTime) / 1000;
+    if (sinceLastEmitMs < notifier->policy->minIntervalMs)
+    {
+        notifier->pending = true;
+        if (notifier->minIntervalTimer == 0)
+        {
+            notifier->minIntervalTimer = g_timeout_add(
+                notifier->policy->minIntervalMs - sinceLastEmitMs,
+                MinIntervalTimerExpired,
+                notifier);
+        }
+        return;
+    }
+
+    Emit(notifier, value);
+}
+
+static void EmitValueChanged(BluezGattCharacteristic1 *characteristic, GVariant *value)
+{
+    GDBusInterfaceSkeleton *skeleton = G_DBUS_INTERFACE_SKELETON(characteristic);
+    GDBusConnection *conn = g_dbus_interface_skeleton_get_connection(skeleton);
+    if (conn == NULL)
+    {
+        return;
+    }
+
+    GVariantBuilder changed;
+    g_variant_builder_init(&changed, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&changed, "{sv}", "Value", value);
+    GError *error = NULL;
+    g_dbus_connection_emit_signal(
+        conn,
+        NULL,
+        g_dbus_interface_skeleton_get_object_path(skeleton),
+        "org.freedesktop.DBus.Properties",
+        "PropertiesChanged",
+        g_variant_new(
+            "(sa{sv}@as)",
+            "org.bluez.GattCharacteristic1",
+            &changed,
+            g_variant_new_strv(NULL, 0)),
+        &error);
+    if (error != NULL)
+    {
+        LE_WARN("Couldn't emit notification: %s", error->message);
+        g_error_free(error);
+    }
+}
+
+/*
+ * Sends the value to subscribed clients. The generated skeleton doesn't emit PropertiesChanged
+ * when the new value equals the current one, so in that case (eg. a heartbeat) the signal is
+ * emitted directly.
+ */
+void NotifyCharacteristicValue(BluezGattCharacteristic1 *characteristic, GVariant *value)
+{
+    GattStatsRecordNotification(characteristic, g_variant_get_size(value));
+
+    GVariant *current = bluez_gatt_characteristic1_get_value(characteristic);
+    if (current == NULL || !g_variant_equal(current, value))
+    {
+        bluez_gatt_characteristic1_set_value(characteristic, value);
+        return;
+    }
+
+    EmitValueChanged(characteristic, value);
+}
+
+/*
+ * The skeleton coalesces property changes made in one main loop iteration into one
+ * PropertiesChanged, sent later with only the latest value, so every packet of a stream is emitted
+ * directly instead. The Value property is left alone, so a read doesn't return the last packet.
+ */
+void NotifyCharacteristicPacket(BluezGattCharacteristic1 *characteristic, GVariant *value)
+{
+    GattStatsRecordNotification(characteristic, g_variant_get_size(value));
+    EmitValueChanged(characteristic, value);
+}
@@ -0,0 +1,55 @@
+#ifndef _NOTIFY_POLICY_H
+#define _NOTIFY_POLICY_H
+
+#include <stdbool.h>
+
+#include <glib.h>
+
+#include "org.bluez.GattCharacteristic1.h"
+
+/*
+ * Decides when a changing value is worth a notification. A value is notified only when it differs
+ * from the last notified value by at least the deadband. Values submitted less than minIntervalMs
+ * after the previous notification are held back and the latest one is sent when the interval
+ * expires. If maxIntervalMs is set, the latest value is notified again after that long without a
+ * notification.
+ */
+struct NotifyPolicy
+{
+    double deadband;
+    guint minIntervalMs;
+    guint maxIntervalMs;
+};
+
+typedef void (*NotifierEmitFunc)(double value, gpointer context);
+
+struct Notifier
+{
+    const struct NotifyPolicy *policy;
+    NotifierEmitFunc emit;
+    gpointer context;
+    bool active;
+    bool pending;
+    double latestValue;
+    double lastEmittedValue;
+    gint64 lastEmitTime;
+    guint minIntervalTimer;
+    guint heartbeatTimer;
+    guint64 numSubmitted;
+    guint64 numEmitted;
+};
+
+void NotifierInit(
+    struct Notifier *notifier,
+    const struct NotifyPolicy *policy,
+    NotifierEmitFunc emit,
+    gpointer context);
+void NotifierStart(struct Notifier *notifier, double currentValue);
+void NotifierStop(struct Notifier *notifier);
+void NotifierSubmit(struct Notifier *notifier, double value);
+
+void NotifyCharacteristicValue(BluezGattCharacteristic1 *characteristic, GVariant *value);
+// For values sent back to back, eg. the packets of a transfer. Each one is notified.
+void NotifyCharacteristicPacket(BluezGattCharacteristic1 *characteristic, GVariant *value);
+
+#endif // _NOTIFY_POLICY_H
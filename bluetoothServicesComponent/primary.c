@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 // GLib
 #include <glib.h>
@@ -15,6 +16,17 @@
 #include "battery_service.h"
 #include "modem_info_service.h"
 #include "immediate_alert.h"
+#include "bulk_service.h"
+#include "history_service.h"
+#include "transfer_service.h"
+#include "datahub_bridge.h"
+#include "advertisement_data.h"
+#include "gatt_database.h"
+#include "gatt_stats.h"
+#include "value_cache.h"
+#include "executor.h"
+#include "read_snapshot.h"
+#include "subscriptions.h"
 #include "org.bluez.Adapter1.h"
 #include "org.bluez.Device1.h"
 #include "org.bluez.GattCharacteristic1.h"
@@ -28,14 +40,38 @@
 #define BLUEZ_INTF_GATT_MANAGER "org.bluez.GattManager1"
 #define BLUEZ_INTF_LE_ADVERTISING_MANAGER "org.bluez.LEAdvertisingManager1"
 
+#define GATT_OBJECT_PATH_MAX_LEN 128
+#define LEGACY_ADVERTISING_DATA_MAX_LEN 31
+// Each AD structure starts with a length and a type
+#define AD_HEADER_SIZE 2
+#define AD_FLAGS_SIZE (AD_HEADER_SIZE + 1)
+#define AD_APPEARANCE_SIZE (AD_HEADER_SIZE + 2)
+#define REGISTRATION_RETRY_DELAY_S 2
+// A config change is usually several writes, so services are updated once they stop for this long
+#define CONFIG_SETTLE_MS 500
+
+#define SERVICES_CONFIG_ROOT "/services"
+
+#define ENV_BLUEZ_ADAPTER "BLUETOOTH_SERVICES_ADAPTER"
+#define ENV_ADVERTISING_POLICY "BLUETOOTH_SERVICES_ADVERTISING_POLICY"
+#define ENV_MAX_CONNECTIONS "BLUETOOTH_SERVICES_MAX_CONNECTIONS_PER_ADAPTER"
+#define ENV_BLUEZ_TRACK_DEVICES "BLUETOOTH_SERVICES_TRACK_DEVICES"
+#define ENV_READ_THREADS "BLUETOOTH_SERVICES_READ_THREADS"
+
 
 enum BluezState
 {
     BLUEZ_STATE_WAITING_FOR_NAME,
     BLUEZ_STATE_CREATING_OBJECT_MANAGER,
-    BLUEZ_STATE_SEARCHING_FOR_ADAPTER,
-    BLUEZ_STATE_POWERING_ON_ADAPTER,
-    BLUEZ_STATE_ADAPTER_POWERED_ON,
+    BLUEZ_STATE_TRACKING_ADAPTERS,
+};
+
+enum AdapterState
+{
+    ADAPTER_STATE_ABSENT,
+    ADAPTER_STATE_CREATING_PROXY,
+    ADAPTER_STATE_POWERING_ON,
+    ADAPTER_STATE_POWERED_ON,
 };
 
 enum ServicesState
@@ -43,274 +79,1912 @@ enum ServicesState
     SERVICES_STATE_INIT,
     SERVICES_STATE_DEFINED_IN_OM,
     SERVICES_STATE_EXPORTED_AT_NAME,
-    SERVICES_STATE_REGISTERING_APPLICAITON, // Depends on BLUEZ_STATE_ADAPTER_POWERED_ON
-    SERVICES_STATE_REGISTERING_ADVERTISEMENT,
-    SERVICES_STATE_RUNNING,
+};
+
+enum RegistrationState
+{
+    REGISTRATION_STATE_IDLE,
+    REGISTRATION_STATE_REGISTERING, // Depends on ADAPTER_STATE_POWERED_ON
+    REGISTRATION_STATE_RUNNING,
+};
+
+/*
+ * An outage starts when a registration is lost (bluetoothd restart, adapter removal or power off)
+ * and ends when the application and the advertisement are registered again on every adapter.
+ */
+struct BluezRecoveryStats
+{
+    guint numOutages;
+    guint numRecoveries;
+    gint64 outageStartTime;
+    gint64 lastRecoveryUs;
+    gint64 maxRecoveryUs;
+};
+
+/*
+ * How much of the org.bluez object tree is tracked. The full mode proxies every BlueZ object,
+ * including every device seen by a scan and its remote GATT objects, and serves on every adapter.
+ * The adapter mode only watches the configured adapters.
+ */
+enum BluezTrackingMode
+{
+    BLUEZ_TRACKING_FULL,
+    BLUEZ_TRACKING_ADAPTER,
+};
+
+/*
+ * Which adapters advertise when the app serves on several. A central connects through the adapter
+ * it heard advertising, so this decides how connections are spread across the controllers.
+ * Either way, an adapter stops advertising while it is at its connection limit.
+ */
+enum AdvertisingPolicy
+{
+    ADVERTISING_POLICY_ALL,
+    // Only the adapter with the fewest connected devices advertises
+    ADVERTISING_POLICY_LEAST_LOADED,
+};
+
+struct State;
+
+/*
+ * The application and the advertisement are registered separately with each adapter, so one
+ * controller being reset or removed doesn't disturb the others.
+ */
+struct Adapter
+{
+    struct State *state;
+    gchar *path;
+    enum AdapterState adapterState;
+    enum RegistrationState registrationState;
+    BluezAdapter1 *proxy;
+    BluezGattManager1 *gattManager;
+    BluezLEAdvertisingManager1 *advertisingManager;
+    bool applicationRegistered;
+    // Services were added after BlueZ read the application, so it has to be registered again
+    bool applicationStale;
+    bool advertisementRegistered;
+    // A RegisterAdvertisement or UnregisterAdvertisement call is in flight
+    bool advertisementPending;
+    GHashTable *connectedDevices;
+    // Cancelled whenever the registration is reset, so callbacks from before that are ignored
+    GCancellable *cancellable;
+    guint registrationRetryTimer;
+    // Only used in BLUEZ_TRACKING_ADAPTER mode
+    guint interfacesAddedSubscription;
+    guint interfacesRemovedSubscription;
+    gint64 registrationStartTime;
 };
 
 struct State
 {
-    enum BluezState bluezState;
-    enum ServicesState servicesState;
-    GDBusObjectManagerServer *servicesObjectManager;
-    guint bluezWatchHandle;
-    guint mangohOwnHandle;
-    GDBusObjectManager *bluezObjectManager;
-    BluezAdapter1 *adapter;
-};
+    enum BluezState bluezState;
+    enum BluezTrackingMode trackingMode;
+    enum ServicesState servicesState;
+    GDBusObjectManagerServer *servicesObjectManager;
+    guint bluezWatchHandle;
+    guint mangohOwnHandle;
+    GDBusObjectManager *bluezObjectManager;
+    // The selected adapters in the order they were configured or found
+    GPtrArray *adapters;
+    enum AdvertisingPolicy advertisingPolicy;
+    // 0 means no limit
+    guint maxConnectionsPerAdapter;
+    // Otherwise connected devices are only tracked while one of them holds a session
+    bool trackConnectedDevices;
+    GDBusConnection *bluezConnection;
+    guint devicePropertiesSubscription;
+    // Cancelled whenever BlueZ goes away, so callbacks from before that are ignored
+    GCancellable *bluezCancellable;
+    struct BluezRecoveryStats recovery;
+    gint64 initTime;
+    struct GattDatabaseStats gattDatabaseStats;
+    // Exported services by name
+    GHashTable *services;
+    BluezLEAdvertisement1 *advertisement;
+    guint configSettleTimer;
+};
+
+/*
+ * The services built into this app, which are served unless disabled in the config tree. Each
+ * service is exported below the object manager root at a path derived from its name, so paths
+ * don't depend on the order of this table.
+ */
+static const struct GattServiceDefinition *const GattServices[] = {
+    &battery_service_definition,
+    &modem_info_service_definition,
+    &alert_service_definition,
+    &bulk_service_definition,
+    &history_service_definition,
+    &transfer_service_definition,
+};
+
+// The services whose 16 bit UUIDs are listed in the advertisement
+static const struct GattServiceDefinition *const AdvertisedServices[] = {
+    &battery_service_definition,
+    &alert_service_definition,
+};
+
+
+/*
+ * Serves the reads of characteristics that opted in with threadedRead. NULL if the pool is
+ * disabled, in which case those reads are handled on the main loop like any other.
+ */
+static GThreadPool *ReadPool;
+
+static void TryCreateBluezObjectManager(struct State *state);
+
+static GType BluezProxyTypeFunc
+(
+    GDBusObjectManagerClient *manager,
+    const gchar *objectPath,
+    const gchar *interfaceName,
+    gpointer userData
+)
+{
+    LE_DEBUG("Handling request for objectPath=%s, interfaceName=%s", objectPath, interfaceName);
+    if (interfaceName == NULL)
+    {
+        return g_dbus_object_proxy_get_type();
+    }
+
+    if (g_strcmp0(interfaceName, "org.bluez.Adapter1") == 0)
+    {
+        return BLUEZ_TYPE_ADAPTER1_PROXY;
+    }
+    else if (g_strcmp0(interfaceName, "org.bluez.Device1") == 0)
+    {
+        return BLUEZ_TYPE_DEVICE1_PROXY;
+    }
+    else if (g_strcmp0(interfaceName, "org.bluez.GattService1") == 0)
+    {
+        return BLUEZ_TYPE_GATT_SERVICE1_PROXY;
+    }
+    else if (g_strcmp0(interfaceName, "org.bluez.GattCharacteristic1") == 0)
+    {
+        return BLUEZ_TYPE_GATT_CHARACTERISTIC1_PROXY;
+    }
+    else if (g_strcmp0(interfaceName, "org.bluez.GattDescriptor1") == 0)
+    {
+        return BLUEZ_TYPE_GATT_DESCRIPTOR1_PROXY;
+    }
+
+    return g_dbus_proxy_get_type();
+}
+
+static void BuildGattObjectPath(gchar *buffer, const gchar *parentPath, const gchar *name)
+{
+    const int len = g_snprintf(buffer, GATT_OBJECT_PATH_MAX_LEN, "%s/%s", parentPath, name);
+    LE_FATAL_IF(
+        len >= GATT_OBJECT_PATH_MAX_LEN, "GATT object path too long: %s/%s", parentPath, name);
+}
+
+/*
+ * What the engine's handler trampolines need to dispatch to a service handler and time it. Owned by
+ * the exported skeleton.
+ */
+struct ExportedCharacteristic
+{
+    const struct GattCharacteristicDefinition *def;
+    gpointer context;
+    struct GattStats *stats;
+    // Reads queued on the read pool or running there, which the context must outlive
+    GMutex lock;
+    GCond idle;
+    guint pendingReads;
+};
+
+struct ExportedDescriptor
+{
+    const struct GattDescriptorDefinition *def;
+    gpointer context;
+    struct GattStats *stats;
+};
+
+static void FreeExportedCharacteristic(gpointer data)
+{
+    struct ExportedCharacteristic *exported = data;
+    g_mutex_clear(&exported->lock);
+    g_cond_clear(&exported->idle);
+    g_free(exported);
+}
+
+static gboolean HandleCharacteristicRead(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    struct ExportedCharacteristic *exported)
+{
+    const gint64 startTime = g_get_monotonic_time();
+    gboolean handled = TRUE;
+    GVariant *snapshot = ReadSnapshotLookup(interface, options);
+    if (snapshot != NULL)
+    {
+        GattCharacteristicCompleteRead(interface, invocation, snapshot);
+        g_variant_unref(snapshot);
+    }
+    else
+    {
+        handled = exported->def->read(interface, invocation, options, exported->context);
+    }
+    GattStatsRecordCall(exported->stats, GATT_OPERATION_READ, g_get_monotonic_time() - startTime);
+    return handled;
+}
+
+// A read handed to the read pool. The skeleton is kept alive until the read is done.
+struct ThreadedRead
+{
+    BluezGattCharacteristic1 *interface;
+    GDBusMethodInvocation *invocation;
+    GVariant *options;
+    struct ExportedCharacteristic *exported;
+};
+
+// Runs on a read pool thread
+static void RunThreadedRead(gpointer data, gpointer userData)
+{
+    struct ThreadedRead *read = data;
+    struct ExportedCharacteristic *exported = read->exported;
+    if (!HandleCharacteristicRead(read->interface, read->invocation, read->options, exported))
+    {
+        g_dbus_method_invocation_return_dbus_error(
+            read->invocation, "org.bluez.Error.NotSupported", "Read not handled");
+    }
+
+    g_mutex_lock(&exported->lock);
+    if (--exported->pendingReads == 0)
+    {
+        g_cond_broadcast(&exported->idle);
+    }
+    g_mutex_unlock(&exported->lock);
+
+    g_variant_unref(read->options);
+    g_object_unref(read->interface);
+    g_free(read);
+}
+
+/*
+ * Called when a service is disabled, so its context isn't released under a read that is still
+ * running on the pool. Reads are short, so this only holds up the main loop briefly.
+ */
+static void WaitForThreadedReads(struct ExportedCharacteristic *exported)
+{
+    g_mutex_lock(&exported->lock);
+    while (exported->pendingReads > 0)
+    {
+        g_cond_wait(&exported->idle, &exported->lock);
+    }
+    g_mutex_unlock(&exported->lock);
+}
+
+static gboolean DispatchCharacteristicRead(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer userData)
+{
+    struct ExportedCharacteristic *exported = userData;
+    if (!exported->def->threadedRead || ReadPool == NULL)
+    {
+        return HandleCharacteristicRead(interface, invocation, options, exported);
+    }
+
+    struct ThreadedRead *read = g_new0(struct ThreadedRead, 1);
+    read->interface = g_object_ref(interface);
+    read->invocation = invocation;
+    read->options = g_variant_ref(options);
+    read->exported = exported;
+    g_mutex_lock(&exported->lock);
+    exported->pendingReads++;
+    g_mutex_unlock(&exported->lock);
+    g_thread_pool_push(ReadPool, read, NULL);
+    return TRUE;
+}
+
+static gboolean DispatchCharacteristicWrite(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *value,
+    GVariant *options,
+    gpointer userData)
+{
+    struct ExportedCharacteristic *exported = userData;
+    const gint64 startTime = g_get_monotonic_time();
+    const gboolean handled =
+        exported->def->write(interface, invocation, value, options, exported->context);
+    GattStatsRecordCall(exported->stats, GATT_OPERATION_WRITE, g_get_monotonic_time() - startTime);
+    GattStatsRecordBytes(interface, GATT_OPERATION_WRITE, g_variant_get_size(value));
+    return handled;
+}
+
+static gboolean DispatchCharacteristicStartNotify(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    gpointer userData)
+{
+    struct ExportedCharacteristic *exported = userData;
+    const gint64 startTime = g_get_monotonic_time();
+    const gboolean handled = exported->def->startNotify(interface, invocation, exported->context);
+    GattStatsRecordCall(
+        exported->stats, GATT_OPERATION_START_NOTIFY, g_get_monotonic_time() - startTime);
+    return handled;
+}
+
+static gboolean DispatchCharacteristicStopNotify(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    gpointer userData)
+{
+    struct ExportedCharacteristic *exported = userData;
+    const gint64 startTime = g_get_monotonic_time();
+    const gboolean handled = exported->def->stopNotify(interface, invocation, exported->context);
+    GattStatsRecordCall(
+        exported->stats, GATT_OPERATION_STOP_NOTIFY, g_get_monotonic_time() - startTime);
+    return handled;
+}
+
+static gboolean DispatchCharacteristicAcquireWrite(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer userData)
+{
+    struct ExportedCharacteristic *exported = userData;
+    const gint64 startTime = g_get_monotonic_time();
+    const gboolean handled =
+        exported->def->acquireWrite(interface, invocation, options, exported->context);
+    GattStatsRecordCall(
+        exported->stats, GATT_OPERATION_ACQUIRE_WRITE, g_get_monotonic_time() - startTime);
+    return handled;
+}
+
+static gboolean DispatchCharacteristicAcquireNotify(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer userData)
+{
+    struct ExportedCharacteristic *exported = userData;
+    const gint64 startTime = g_get_monotonic_time();
+    const gboolean handled =
+        exported->def->acquireNotify(interface, invocation, options, exported->context);
+    GattStatsRecordCall(
+        exported->stats, GATT_OPERATION_ACQUIRE_NOTIFY, g_get_monotonic_time() - startTime);
+    return handled;
+}
+
+static gboolean DispatchDescriptorRead(
+    BluezGattDescriptor1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *options,
+    gpointer userData)
+{
+    struct ExportedDescriptor *exported = userData;
+    const gint64 startTime = g_get_monotonic_time();
+    gboolean handled = TRUE;
+    GVariant *snapshot = ReadSnapshotLookup(interface, options);
+    if (snapshot != NULL)
+    {
+        GattDescriptorCompleteRead(interface, invocation, snapshot);
+        g_variant_unref(snapshot);
+    }
+    else
+    {
+        handled = exported->def->read(interface, invocation, options, exported->context);
+    }
+    GattStatsRecordCall(exported->stats, GATT_OPERATION_READ, g_get_monotonic_time() - startTime);
+    return handled;
+}
+
+// The path of a GATT object relative to the object manager root, eg. "battery/level"
+static const gchar *GattObjectName(GDBusObjectManagerServer *objectManager, const gchar *path)
+{
+    const gchar *rootPath =
+        g_dbus_object_manager_get_object_path(G_DBUS_OBJECT_MANAGER(objectManager));
+    return path + strlen(rootPath) + 1;
+}
+
+static void ExportGattDescriptor(
+    GDBusObjectManagerServer *objectManager,
+    const struct GattDescriptorDefinition *def,
+    const gchar *characteristicPath,
+    gpointer context,
+    GPtrArray *objects)
+{
+    gchar path[GATT_OBJECT_PATH_MAX_LEN];
+    BuildGattObjectPath(path, characteristicPath, def->name);
+
+    GDBusObjectSkeleton *obj = g_dbus_object_skeleton_new(path);
+    BluezGattDescriptor1 *desc = bluez_gatt_descriptor1_skeleton_new();
+    bluez_gatt_descriptor1_set_uuid(desc, def->uuid);
+    bluez_gatt_descriptor1_set_flags(desc, def->flags);
+    bluez_gatt_descriptor1_set_characteristic(desc, characteristicPath);
+
+    struct ExportedDescriptor *exported = g_new0(struct ExportedDescriptor, 1);
+    exported->def = def;
+    exported->context = context;
+    exported->stats = GattStatsNew(desc, GattObjectName(objectManager, path));
+    g_object_set_data_full(G_OBJECT(desc), "gatt-exported", exported, g_free);
+    if (def->read != NULL)
+    {
+        g_signal_connect(desc, "handle-read-value", G_CALLBACK(DispatchDescriptorRead), exported);
+    }
+    g_dbus_object_skeleton_add_interface(obj, G_DBUS_INTERFACE_SKELETON(desc));
+    g_object_unref(desc);
+
+    g_dbus_object_manager_server_export(objectManager, obj);
+    g_ptr_array_add(objects, obj);
+}
+
+static void ExportGattCharacteristic(
+    GDBusObjectManagerServer *objectManager,
+    const struct GattCharacteristicDefinition *def,
+    const gchar *servicePath,
+    gpointer context,
+    GPtrArray *objects)
+{
+    gchar path[GATT_OBJECT_PATH_MAX_LEN];
+    BuildGattObjectPath(path, servicePath, def->name);
+    if (def->context != NULL)
+    {
+        context = def->context;
+    }
+
+    GDBusObjectSkeleton *obj = g_dbus_object_skeleton_new(path);
+    BluezGattCharacteristic1 *characteristic = bluez_gatt_characteristic1_skeleton_new();
+    bluez_gatt_characteristic1_set_uuid(characteristic, def->uuid);
+    bluez_gatt_characteristic1_set_flags(characteristic, def->flags);
+    bluez_gatt_characteristic1_set_service(characteristic, servicePath);
+
+    // Handlers are dispatched through the engine so every call is counted and timed
+    struct ExportedCharacteristic *exported = g_new0(struct ExportedCharacteristic, 1);
+    exported->def = def;
+    exported->context = context;
+    exported->stats = GattStatsNew(characteristic, GattObjectName(objectManager, path));
+    g_mutex_init(&exported->lock);
+    g_cond_init(&exported->idle);
+    g_object_set_data_full(
+        G_OBJECT(characteristic), "gatt-exported", exported, FreeExportedCharacteristic);
+    if (def->read != NULL)
+    {
+        g_signal_connect(
+            characteristic, "handle-read-value", G_CALLBACK(DispatchCharacteristicRead), exported);
+    }
+    if (def->write != NULL)
+    {
+        g_signal_connect(
+            characteristic,
+            "handle-write-value",
+            G_CALLBACK(DispatchCharacteristicWrite),
+            exported);
+    }
+    if (def->startNotify != NULL)
+    {
+        g_signal_connect(
+            characteristic,
+            "handle-start-notify",
+            G_CALLBACK(DispatchCharacteristicStartNotify),
+            exported);
+    }
+    if (def->stopNotify != NULL)
+    {
+        g_signal_connect(
+            characteristic,
+            "handle-stop-notify",
+            G_CALLBACK(DispatchCharacteristicStopNotify),
+            exported);
+    }
+    // The Acquired properties tell BlueZ whether the service currently has a socket handed out
+    if (def->acquireWrite != NULL)
+    {
+        bluez_gatt_characteristic1_set_write_acquired(characteristic, FALSE);
+        g_signal_connect(
+            characteristic,
+            "handle-acquire-write",
+            G_CALLBACK(DispatchCharacteristicAcquireWrite),
+            exported);
+    }
+    if (def->acquireNotify != NULL)
+    {
+        bluez_gatt_characteristic1_set_notify_acquired(characteristic, FALSE);
+        g_signal_connect(
+            characteristic,
+            "handle-acquire-notify",
+            G_CALLBACK(DispatchCharacteristicAcquireNotify),
+            exported);
+    }
+    g_dbus_object_skeleton_add_interface(obj, G_DBUS_INTERFACE_SKELETON(characteristic));
+    if (def->bind != NULL)
+    {
+        def->bind(context, characteristic);
+    }
+    g_object_unref(characteristic);
+
+    g_dbus_object_manager_server_export(objectManager, obj);
+    g_ptr_array_add(objects, obj);
+
+    for (size_t i = 0; i < def->numDescriptors; i++)
+    {
+        ExportGattDescriptor(objectManager, &def->descriptors[i], path, context, objects);
+    }
+}
+
+/*
+ * A service exported on the services object manager. Its objects are kept so it can be unexported
+ * on its own, leaving the rest of the database in place.
+ */
+struct ExportedService
+{
+    const struct GattServiceDefinition *def;
+    gpointer context;
+    // GDBusObjectSkeleton, in the order they were exported, starting with the service
+    GPtrArray *objects;
+    // Only set for bridged services, the mapping the service was loaded with
+    gchar *bridgeDescription;
+};
+
+static struct ExportedService *ExportGattService(
+    GDBusObjectManagerServer *objectManager, const struct GattServiceDefinition *def)
+{
+    struct ExportedService *exported = g_new0(struct ExportedService, 1);
+    exported->def = def;
+    exported->context = (def->init != NULL) ? def->init() : NULL;
+    exported->objects = g_ptr_array_new_with_free_func(g_object_unref);
+
+    const gchar *rootPath =
+        g_dbus_object_manager_get_object_path(G_DBUS_OBJECT_MANAGER(objectManager));
+    gchar path[GATT_OBJECT_PATH_MAX_LEN];
+    BuildGattObjectPath(path, rootPath, def->name);
+
+    GDBusObjectSkeleton *obj = g_dbus_object_skeleton_new(path);
+    BluezGattService1 *service = bluez_gatt_service1_skeleton_new();
+    bluez_gatt_service1_set_uuid(service, def->uuid);
+    bluez_gatt_service1_set_primary(service, def->primary);
+    g_dbus_object_skeleton_add_interface(obj, G_DBUS_INTERFACE_SKELETON(service));
+    g_object_unref(service);
+
+    g_dbus_object_manager_server_export(objectManager, obj);
+    g_ptr_array_add(exported->objects, obj);
+
+    for (size_t i = 0; i < def->numCharacteristics; i++)
+    {
+        ExportGattCharacteristic(
+            objectManager, &def->characteristics[i], path, exported->context, exported->objects);
+    }
+    return exported;
+}
+
+/*
+ * The dispatch handlers are disconnected first, so no call reaches the service while fini releases
+ * its context, and reads already handed to the read pool are waited for. Invocations the service
+ * deferred still hold their skeleton, so they can complete. Objects are unexported in reverse
+ * order, so BlueZ sees descriptors go before their characteristic and characteristics before their
+ * service.
+ */
+static void UnexportGattService(
+    GDBusObjectManagerServer *objectManager, struct ExportedService *exported)
+{
+    for (guint i = 0; i < exported->objects->len; i++)
+    {
+        GDBusObject *obj = g_ptr_array_index(exported->objects, i);
+        GList *interfaces = g_dbus_object_get_interfaces(obj);
+        for (GList *l = interfaces; l != NULL; l = l->next)
+        {
+            gpointer dispatch = g_object_get_data(l->data, "gatt-exported");
+            if (dispatch != NULL)
+            {
+                g_signal_handlers_disconnect_by_data(l->data, dispatch);
+            }
+            if (dispatch != NULL && BLUEZ_IS_GATT_CHARACTERISTIC1(l->data))
+            {
+                WaitForThreadedReads(dispatch);
+            }
+        }
+        g_list_free_full(interfaces, g_object_unref);
+    }
+
+    if (exported->def->fini != NULL)
+    {
+        exported->def->fini(exported->context);
+    }
+
+    for (guint i = exported->objects->len; i > 0; i--)
+    {
+        GDBusObject *obj = g_ptr_array_index(exported->objects, i - 1);
+        g_dbus_object_manager_server_unexport(objectManager, g_dbus_object_get_object_path(obj));
+    }
+    g_ptr_array_unref(exported->objects);
+}
+
+/*
+ * Only the advertised services that are enabled are listed. The advertisement keeps room for all
+ * of them, so the space left for live values doesn't change when one is enabled or disabled. The
+ * live values themselves are described by the field bitmap at the start of their payload.
+ */
+static void UpdateAdvertisedServices(struct State *state)
+{
+    const gchar *uuids[G_N_ELEMENTS(AdvertisedServices) + 1];
+    size_t numUuids = 0;
+    for (size_t i = 0; i < G_N_ELEMENTS(AdvertisedServices); i++)
+    {
+        if (g_hash_table_contains(state->services, AdvertisedServices[i]->name))
+        {
+            uuids[numUuids++] = AdvertisedServices[i]->uuid;
+        }
+    }
+    uuids[numUuids] = NULL;
+    bluez_leadvertisement1_set_service_uuids(state->advertisement, uuids);
+}
+
+static void CreateAdvertisementObject(struct State *state)
+{
+    GDBusObjectSkeleton *obj_skel = g_dbus_object_skeleton_new("/io/mangoh/advertisement");
+    BluezLEAdvertisement1 *adv_skel = bluez_leadvertisement1_skeleton_new();
+    const gchar *local_name = "mangOH";
+    bluez_leadvertisement1_set_type_(adv_skel, "peripheral");
+    bluez_leadvertisement1_set_local_name(adv_skel, local_name);
+    const uint16_t no_timeout = 0; // Never timeout
+    bluez_leadvertisement1_set_timeout(adv_skel, no_timeout);
+
+    state->advertisement = g_object_ref(adv_skel);
+    UpdateAdvertisedServices(state);
+
+    /*
+     * Refer to:
+     * https://www.bluetooth.com/wp-content/uploads/Sitecore-Media-Library/Gatt/Xml/Characteristics/org.bluetooth.characteristic.gap.appearance.xml
+     */
+    const guint16 appearance_generic_computer = 128;
+    bluez_leadvertisement1_set_appearance(adv_skel, appearance_generic_computer);
+
+    // Live values get whatever the flags BlueZ adds and the data above leave of the payload
+    const gsize used = AD_FLAGS_SIZE + AD_HEADER_SIZE + strlen(local_name) +
+        AD_HEADER_SIZE + 2 * G_N_ELEMENTS(AdvertisedServices) + AD_APPEARANCE_SIZE;
+    const gsize remaining =
+        (used < LEGACY_ADVERTISING_DATA_MAX_LEN) ? LEGACY_ADVERTISING_DATA_MAX_LEN - used : 0;
+    AdvertisementDataStart(adv_skel, remaining);
+
+    g_dbus_object_skeleton_add_interface(obj_skel, G_DBUS_INTERFACE_SKELETON(adv_skel));
+    g_object_unref(adv_skel);
+
+    g_dbus_object_manager_server_export(
+        state->servicesObjectManager, G_DBUS_OBJECT_SKELETON(obj_skel));
+    g_object_unref(obj_skel);
+}
+
+static gboolean RegistrationRetryTimerExpired(gpointer userData);
+static void TryRegisterWithAdapter(struct Adapter *adapter);
+static void RefreshApplication(struct Adapter *adapter);
+static void UpdateAdvertising(struct State *state);
+
+static bool IsCancelled(const GError *error)
+{
+    return g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+}
+
+/*
+ * BlueZ keeps registrations across some adapter power cycles, so registering an object that it
+ * still knows about is not an error.
+ */
+static bool IsAlreadyRegistered(const GError *error)
+{
+    gchar *remoteError = g_dbus_error_get_remote_error(error);
+    const bool alreadyExists = (g_strcmp0(remoteError, "org.bluez.Error.AlreadyExists") == 0);
+    g_free(remoteError);
+    return alreadyExists;
+}
+
+static struct Adapter *NewAdapter(struct State *state, const gchar *path)
+{
+    struct Adapter *adapter = g_new0(struct Adapter, 1);
+    adapter->state = state;
+    adapter->path = g_strdup(path);
+    adapter->adapterState = ADAPTER_STATE_ABSENT;
+    adapter->registrationState = REGISTRATION_STATE_IDLE;
+    adapter->connectedDevices = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    adapter->cancellable = g_cancellable_new();
+    return adapter;
+}
+
+static struct Adapter *FindAdapter(struct State *state, const gchar *path)
+{
+    for (guint i = 0; i < state->adapters->len; i++)
+    {
+        struct Adapter *adapter = g_ptr_array_index(state->adapters, i);
+        if (g_strcmp0(adapter->path, path) == 0)
+        {
+            return adapter;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Finds the adapter that a device object, eg. /org/bluez/hci0/dev_00_11_22_33_44_55, belongs to.
+ */
+static struct Adapter *FindDeviceAdapter(struct State *state, const gchar *devicePath)
+{
+    for (guint i = 0; i < state->adapters->len; i++)
+    {
+        struct Adapter *adapter = g_ptr_array_index(state->adapters, i);
+        const size_t pathLen = strlen(adapter->path);
+        if (strncmp(devicePath, adapter->path, pathLen) == 0 && devicePath[pathLen] == '/')
+        {
+            return adapter;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * An outage ends once every adapter that is present is running again, and at least one is.
+ */
+static void CheckRecovered(struct State *state)
+{
+    if (state->recovery.outageStartTime == 0)
+    {
+        return;
+    }
+
+    guint numRunning = 0;
+    for (guint i = 0; i < state->adapters->len; i++)
+    {
+        const struct Adapter *adapter = g_ptr_array_index(state->adapters, i);
+        if (adapter->registrationState == REGISTRATION_STATE_RUNNING)
+        {
+            numRunning++;
+        }
+        else if (adapter->adapterState != ADAPTER_STATE_ABSENT)
+        {
+            return;
+        }
+    }
+    if (numRunning == 0)
+    {
+        return;
+    }
+
+    const gint64 recoveryUs = g_get_monotonic_time() - state->recovery.outageStartTime;
+    state->recovery.outageStartTime = 0;
+    state->recovery.numRecoveries++;
+    state->recovery.lastRecoveryUs = recoveryUs;
+    state->recovery.maxRecoveryUs = MAX(state->recovery.maxRecoveryUs, recoveryUs);
+    LE_INFO(
+        "Recovered from BlueZ outage %u in %" G_GINT64_FORMAT " us (max %" G_GINT64_FORMAT " us)",
+        state->recovery.numRecoveries,
+        recoveryUs,
+        state->recovery.maxRecoveryUs);
+}
+
+/*
+ * Forgets everything registered with BlueZ on the adapter and cancels any registration step still
+ * in flight. The io.mangoh objects stay exported, so registering again only repeats the BlueZ
+ * calls.
+ */
+static void ResetAdapterRegistration(struct Adapter *adapter)
+{
+    struct State *state = adapter->state;
+    if (adapter->registrationState != REGISTRATION_STATE_IDLE)
+    {
+        if (state->recovery.outageStartTime == 0)
+        {
+            state->recovery.outageStartTime = g_get_monotonic_time();
+            state->recovery.numOutages++;
+        }
+        adapter->registrationState = REGISTRATION_STATE_IDLE;
+    }
+
+    g_cancellable_cancel(adapter->cancellable);
+    g_object_unref(adapter->cancellable);
+    adapter->cancellable = g_cancellable_new();
+
+    if (adapter->registrationRetryTimer != 0)
+    {
+        g_source_remove(adapter->registrationRetryTimer);
+        adapter->registrationRetryTimer = 0;
+    }
+
+    g_clear_object(&adapter->gattManager);
+    g_clear_object(&adapter->advertisingManager);
+    adapter->applicationRegistered = false;
+    adapter->applicationStale = false;
+    adapter->advertisementRegistered = false;
+    adapter->advertisementPending = false;
+}
+
+static void DropAdapterProxy(struct Adapter *adapter)
+{
+    if (adapter->proxy != NULL)
+    {
+        g_signal_handlers_disconnect_by_data(adapter->proxy, adapter);
+        g_clear_object(&adapter->proxy);
+    }
+    adapter->adapterState = ADAPTER_STATE_ABSENT;
+    g_hash_table_remove_all(adapter->connectedDevices);
+}
+
+static void UnsubscribeBluezSignal(struct State *state, guint *subscription)
+{
+    if (*subscription != 0)
+    {
+        g_dbus_connection_signal_unsubscribe(state->bluezConnection, *subscription);
+        *subscription = 0;
+    }
+}
+
+static void FreeAdapter(gpointer data)
+{
+    struct Adapter *adapter = data;
+    ResetAdapterRegistration(adapter);
+    DropAdapterProxy(adapter);
+    g_object_unref(adapter->cancellable);
+    g_hash_table_destroy(adapter->connectedDevices);
+    g_free(adapter->path);
+    g_free(adapter);
+}
+
+static void TeardownBluez(struct State *state)
+{
+    g_cancellable_cancel(state->bluezCancellable);
+    g_object_unref(state->bluezCancellable);
+    state->bluezCancellable = g_cancellable_new();
+
+    for (guint i = 0; i < state->adapters->len; i++)
+    {
+        struct Adapter *adapter = g_ptr_array_index(state->adapters, i);
+        ResetAdapterRegistration(adapter);
+        DropAdapterProxy(adapter);
+        UnsubscribeBluezSignal(state, &adapter->interfacesAddedSubscription);
+        UnsubscribeBluezSignal(state, &adapter->interfacesRemovedSubscription);
+    }
+    // The configured adapters are kept so they are looked up again when BlueZ comes back
+    if (state->trackingMode == BLUEZ_TRACKING_FULL)
+    {
+        g_ptr_array_set_size(state->adapters, 0);
+    }
+
+    if (state->bluezObjectManager != NULL)
+    {
+        g_signal_handlers_disconnect_by_data(state->bluezObjectManager, state);
+        g_clear_object(&state->bluezObjectManager);
+    }
+
+    if (state->bluezConnection != NULL)
+    {
+        UnsubscribeBluezSignal(state, &state->devicePropertiesSubscription);
+        g_clear_object(&state->bluezConnection);
+    }
+}
+
+/*
+ * Registration failed for a reason other than BlueZ going away, so start over after a delay
+ * rather than giving up on the adapter.
+ */
+static void RetryRegistrationLater(struct Adapter *adapter)
+{
+    ResetAdapterRegistration(adapter);
+    adapter->registrationRetryTimer = g_timeout_add_seconds(
+        REGISTRATION_RETRY_DELAY_S, RegistrationRetryTimerExpired, adapter);
+    // Another adapter may have to take over advertising in the meantime
+    UpdateAdvertising(adapter->state);
+}
+
+static gboolean RegistrationRetryTimerExpired(gpointer userData)
+{
+    struct Adapter *adapter = userData;
+    adapter->registrationRetryTimer = 0;
+    TryRegisterWithAdapter(adapter);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * The application and the advertising manager are set up concurrently, so whichever finishes last
+ * moves the adapter to the running state. Whether the adapter is actually advertising is up to the
+ * advertising policy.
+ */
+static void CheckRegistrationComplete(struct Adapter *adapter)
+{
+    if (adapter->registrationState != REGISTRATION_STATE_REGISTERING ||
+        !adapter->applicationRegistered ||
+        adapter->advertisingManager == NULL ||
+        adapter->advertisementPending)
+    {
+        return;
+    }
+
+    adapter->registrationState = REGISTRATION_STATE_RUNNING;
+    LE_INFO(
+        "Registered with BlueZ on %s in %" G_GINT64_FORMAT " us",
+        adapter->path,
+        g_get_monotonic_time() - adapter->registrationStartTime);
+    CheckRecovered(adapter->state);
+}
+
+static bool IsBelowConnectionLimit(const struct Adapter *adapter)
+{
+    const guint maxConnections = adapter->state->maxConnectionsPerAdapter;
+    return maxConnections == 0 || g_hash_table_size(adapter->connectedDevices) < maxConnections;
+}
+
+/*
+ * Picks the adapter that should advertise under ADVERTISING_POLICY_LEAST_LOADED. On a tie the
+ * adapter that is already advertising keeps doing so, to avoid needless re-registrations.
+ */
+static struct Adapter *SelectLeastLoadedAdapter(struct State *state)
+{
+    struct Adapter *selected = NULL;
+    for (guint i = 0; i < state->adapters->len; i++)
+    {
+        struct Adapter *adapter = g_ptr_array_index(state->adapters, i);
+        if (adapter->advertisingManager == NULL || !IsBelowConnectionLimit(adapter))
+        {
+            continue;
+        }
+
+        if (selected == NULL)
+        {
+            selected = adapter;
+            continue;
+        }
+        const guint load = g_hash_table_size(adapter->connectedDevices);
+        const guint selectedLoad = g_hash_table_size(selected->connectedDevices);
+        if (load < selectedLoad ||
+            (load == selectedLoad &&
+             adapter->advertisementRegistered &&
+             !selected->advertisementRegistered))
+        {
+            selected = adapter;
+        }
+    }
+
+    return selected;
+}
+
+static void AdvertisementRegisteredCallback(
+    GObject *sourceObject, GAsyncResult *res, gpointer userData)
+{
+    struct Adapter *adapter = userData;
+    GError *error = NULL;
+    bluez_leadvertising_manager1_call_register_advertisement_finish(
+        BLUEZ_LEADVERTISING_MANAGER1(sourceObject), res, &error);
+    if (error != NULL)
+    {
+        if (IsCancelled(error))
+        {
+            g_error_free(error);
+            return;
+        }
+        if (!IsAlreadyRegistered(error))
+        {
+            LE_ERROR("Error registering advertisement on %s: %s", adapter->path, error->message);
+            g_error_free(error);
+            RetryRegistrationLater(adapter);
+            return;
+        }
+        g_error_free(error);
+    }
+
+    adapter->advertisementPending = false;
+    adapter->advertisementRegistered = true;
+    LE_INFO(
+        "Advertising object registered on %s - time to advertising %" G_GINT64_FORMAT " us",
+        adapter->path,
+        g_get_monotonic_time() - adapter->state->initTime);
+    CheckRegistrationComplete(adapter);
+    // Connections may have come or gone while the call was in flight
+    UpdateAdvertising(adapter->state);
+}
+
+static void AdvertisementUnregisteredCallback(
+    GObject *sourceObject, GAsyncResult *res, gpointer userData)
+{
+    struct Adapter *adapter = userData;
+    GError *error = NULL;
+    bluez_leadvertising_manager1_call_unregister_advertisement_finish(
+        BLUEZ_LEADVERTISING_MANAGER1(sourceObject), res, &error);
+    if (error != NULL)
+    {
+        if (IsCancelled(error))
+        {
+            g_error_free(error);
+            return;
+        }
+        // BlueZ has no record of the advertisement, which is the outcome we wanted anyway
+        LE_WARN("Error unregistering advertisement on %s: %s", adapter->path, error->message);
+        g_error_free(error);
+    }
+
+    adapter->advertisementPending = false;
+    adapter->advertisementRegistered = false;
+    LE_INFO("Stopped advertising on %s", adapter->path);
+    CheckRegistrationComplete(adapter);
+    UpdateAdvertising(adapter->state);
+}
+
+/*
+ * Brings each adapter's advertisement in line with the advertising policy. Adapters with a call in
+ * flight are revisited when it completes.
+ */
+static void UpdateAdvertising(struct State *state)
+{
+    const struct Adapter *leastLoaded =
+        (state->advertisingPolicy == ADVERTISING_POLICY_LEAST_LOADED) ?
+        SelectLeastLoadedAdapter(state) : NULL;
+
+    for (guint i = 0; i < state->adapters->len; i++)
+    {
+        struct Adapter *adapter = g_ptr_array_index(state->adapters, i);
+        if (adapter->advertisingManager == NULL || adapter->advertisementPending)
+        {
+            continue;
+        }
+
+        const bool advertise = (state->advertisingPolicy == ADVERTISING_POLICY_LEAST_LOADED) ?
+            (adapter == leastLoaded) : IsBelowConnectionLimit(adapter);
+        if (advertise && !adapter->advertisementRegistered)
+        {
+            adapter->advertisementPending = true;
+            GVariant *options = g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0);
+            bluez_leadvertising_manager1_call_register_advertisement(
+                adapter->advertisingManager,
+                "/io/mangoh/advertisement",
+                options,
+                adapter->cancellable,
+                AdvertisementRegisteredCallback,
+                adapter);
+        }
+        else if (!advertise && adapter->advertisementRegistered)
+        {
+            adapter->advertisementPending = true;
+            bluez_leadvertising_manager1_call_unregister_advertisement(
+                adapter->advertisingManager,
+                "/io/mangoh/advertisement",
+                adapter->cancellable,
+                AdvertisementUnregisteredCallback,
+                adapter);
+        }
+    }
+}
+
+static void AdvertisingManagerCreatedCallback(
+    GObject *sourceObject, GAsyncResult *res, gpointer userData)
+{
+    struct Adapter *adapter = userData;
+    GError *error = NULL;
+    BluezLEAdvertisingManager1 *advertisingManager =
+        bluez_leadvertising_manager1_proxy_new_for_bus_finish(res, &error);
+    if (error != NULL)
+    {
+        if (!IsCancelled(error))
+        {
+            LE_ERROR(
+                "Couldn't access LE Advertising Manager on %s: %s", adapter->path, error->message);
+            RetryRegistrationLater(adapter);
+        }
+        g_error_free(error);
+        return;
+    }
+    adapter->advertisingManager = advertisingManager;
+
+    UpdateAdvertising(adapter->state);
+    CheckRegistrationComplete(adapter);
+}
+
+static void ApplicationRegisteredCallback(
+    GObject *sourceObject, GAsyncResult *res, gpointer userData)
+{
+    struct Adapter *adapter = userData;
+    GError *error = NULL;
+    bluez_gatt_manager1_call_register_application_finish(
+        BLUEZ_GATT_MANAGER1(sourceObject), res, &error);
+    if (error != NULL)
+    {
+        if (IsCancelled(error))
+        {
+            g_error_free(error);
+            return;
+        }
+        if (!IsAlreadyRegistered(error))
+        {
+            LE_ERROR(
+                "Error registering bluetooth application on %s: %s", adapter->path, error->message);
+            g_error_free(error);
+            RetryRegistrationLater(adapter);
+            return;
+        }
+        g_error_free(error);
+    }
+    LE_INFO("Registered bluetooth application on %s", adapter->path);
+
+    adapter->applicationRegistered = true;
+    if (adapter->applicationStale)
+    {
+        RefreshApplication(adapter);
+    }
+    CheckRegistrationComplete(adapter);
+}
+
+static void ApplicationUnregisteredCallback(
+    GObject *sourceObject, GAsyncResult *res, gpointer userData)
+{
+    struct Adapter *adapter = userData;
+    GError *error = NULL;
+    bluez_gatt_manager1_call_unregister_application_finish(
+        BLUEZ_GATT_MANAGER1(sourceObject), res, &error);
+    if (error != NULL)
+    {
+        if (IsCancelled(error))
+        {
+            g_error_free(error);
+            return;
+        }
+        // Registering again still picks up the new services
+        LE_WARN(
+            "Error unregistering bluetooth application on %s: %s", adapter->path, error->message);
+        g_error_free(error);
+    }
+
+    bluez_gatt_manager1_call_register_application(
+        adapter->gattManager,
+        "/io/mangoh",
+        g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0),
+        adapter->cancellable,
+        ApplicationRegisteredCallback,
+        adapter);
+}
+
+/*
+ * bluetoothd reads the application's objects once, when it is registered, and ignores objects
+ * exported later, so the application is registered again to add services. Services that are
+ * removed don't need this, since bluetoothd follows InterfacesRemoved. An adapter that hasn't got
+ * as far as registering picks up every exported service when it does.
+ */
+static void RefreshApplication(struct Adapter *adapter)
+{
+    if (adapter->gattManager == NULL)
+    {
+        return;
+    }
+    if (!adapter->applicationRegistered)
+    {
+        // bluetoothd may have read the objects before the change, so go again once it is done
+        adapter->applicationStale = true;
+        return;
+    }
+
+    LE_INFO("Registering bluetooth application on %s again to add services", adapter->path);
+    adapter->applicationRegistered = false;
+    adapter->applicationStale = false;
+    bluez_gatt_manager1_call_unregister_application(
+        adapter->gattManager,
+        "/io/mangoh",
+        adapter->cancellable,
+        ApplicationUnregisteredCallback,
+        adapter);
+}
+
+static void GattManagerCreatedCallback(
+    GObject *sourceObject, GAsyncResult *res, gpointer userData)
+{
+    struct Adapter *adapter = userData;
+    GError *error = NULL;
+    BluezGattManager1 *gattManager = bluez_gatt_manager1_proxy_new_for_bus_finish(res, &error);
+    if (error != NULL)
+    {
+        if (!IsCancelled(error))
+        {
+            LE_ERROR("Couldn't create GattManager1 on %s - %s", adapter->path, error->message);
+            RetryRegistrationLater(adapter);
+        }
+        g_error_free(error);
+        return;
+    }
+    adapter->gattManager = gattManager;
+
+    bluez_gatt_manager1_call_register_application(
+        adapter->gattManager,
+        "/io/mangoh",
+        g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0),
+        adapter->cancellable,
+        ApplicationRegisteredCallback,
+        adapter);
+}
+
+static void TryRegisterWithAdapter(struct Adapter *adapter)
+{
+    if (adapter->state->servicesState != SERVICES_STATE_EXPORTED_AT_NAME)
+    {
+        LE_INFO("Not registering with BlueZ because app is not yet on dbus");
+        return;
+    }
+
+    if (adapter->adapterState != ADAPTER_STATE_POWERED_ON)
+    {
+        LE_INFO("Not registering with BlueZ because %s is not powered on yet", adapter->path);
+        return;
+    }
+
+    if (adapter->registrationState != REGISTRATION_STATE_IDLE)
+    {
+        return;
+    }
+
+    adapter->registrationState = REGISTRATION_STATE_REGISTERING;
+    adapter->registrationStartTime = g_get_monotonic_time();
+    adapter->applicationRegistered = false;
+    adapter->advertisementRegistered = false;
+
+    /*
+     * Neither manager interface has properties or signals that we use, so skip loading them. This
+     * makes creating each proxy free of D-Bus round trips. The application and the advertisement
+     * are independent as far as BlueZ is concerned, so both are set up concurrently.
+     */
+    const GDBusProxyFlags proxyFlags =
+        G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES | G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS;
+    bluez_gatt_manager1_proxy_new_for_bus(
+        G_BUS_TYPE_SYSTEM,
+        proxyFlags,
+        "org.bluez",
+        adapter->path,
+        adapter->cancellable,
+        GattManagerCreatedCallback,
+        adapter);
+    bluez_leadvertising_manager1_proxy_new_for_bus(
+        G_BUS_TYPE_SYSTEM,
+        proxyFlags,
+        "org.bluez",
+        adapter->path,
+        adapter->cancellable,
+        AdvertisingManagerCreatedCallback,
+        adapter);
+}
+
+static void TryRegisterWithBluez(struct State *state)
+{
+    for (guint i = 0; i < state->adapters->len; i++)
+    {
+        TryRegisterWithAdapter(g_ptr_array_index(state->adapters, i));
+    }
+}
+
+static void EnableService(
+    struct State *state, const struct GattServiceDefinition *def, gchar *bridgeDescription)
+{
+    const gint64 startTime = g_get_monotonic_time();
+    struct ExportedService *exported = ExportGattService(state->servicesObjectManager, def);
+    exported->bridgeDescription = bridgeDescription;
+    g_hash_table_insert(state->services, (gpointer)def->name, exported);
+    LE_INFO(
+        "Enabled service %s (%u objects) in %" G_GINT64_FORMAT " us",
+        def->name,
+        exported->objects->len,
+        g_get_monotonic_time() - startTime);
+}
+
+static void DisableService(struct State *state, struct ExportedService *exported)
+{
+    LE_INFO("Disabling service %s", exported->def->name);
+    g_hash_table_remove(state->services, exported->def->name);
+    UnexportGattService(state->servicesObjectManager, exported);
+    if (exported->bridgeDescription != NULL)
+    {
+        DataHubBridgeFreeService((struct GattServiceDefinition *)exported->def);
+        g_free(exported->bridgeDescription);
+    }
+    g_free(exported);
+}
+
+static bool IsBuiltInService(const gchar *name)
+{
+    for (size_t i = 0; i < G_N_ELEMENTS(GattServices); i++)
+    {
+        if (strcmp(GattServices[i]->name, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Brings the exported services in line with the config tree. Built-in services are served unless
+ * /services/<name>/enabled is false (or unless it is true, for opt-in services), and bridged
+ * services follow /bridge. A bridged service whose
+ * mapping changed is released and loaded again from scratch. Returns true if anything was exported.
+ */
+static bool ReconcileServices(struct State *state)
+{
+    bool added = false;
+
+    le_cfg_IteratorRef_t iter = le_cfg_CreateReadTxn(SERVICES_CONFIG_ROOT);
+    for (size_t i = 0; i < G_N_ELEMENTS(GattServices); i++)
+    {
+        const struct GattServiceDefinition *def = GattServices[i];
+        gchar *node = g_strconcat(def->name, "/enabled", NULL);
+        const bool enabled = le_cfg_GetBool(iter, node, !def->optIn);
+        g_free(node);
+
+        struct ExportedService *exported = g_hash_table_lookup(state->services, def->name);
+        if (enabled && exported == NULL)
+        {
+            EnableService(state, def, NULL);
+            added = true;
+        }
+        else if (!enabled && exported != NULL)
+        {
+            DisableService(state, exported);
+        }
+    }
+    le_cfg_CancelTxn(iter);
+
+    // Bridged services that were removed or changed are released before any are loaded
+    GPtrArray *stale = g_ptr_array_new();
+    GHashTableIter services;
+    gpointer value;
+    g_hash_table_iter_init(&services, state->services);
+    while (g_hash_table_iter_next(&services, NULL, &value))
+    {
+        struct ExportedService *exported = value;
+        if (exported->bridgeDescription == NULL)
+        {
+            continue;
+        }
+        gchar *description = DataHubBridgeDescribeService(exported->def->name);
+        if (g_strcmp0(description, exported->bridgeDescription) != 0)
+        {
+            g_ptr_array_add(stale, exported);
+        }
+        g_free(description);
+    }
+    for (guint i = 0; i < stale->len; i++)
+    {
+        DisableService(state, g_ptr_array_index(stale, i));
+    }
+    g_ptr_array_free(stale, TRUE);
+
+    gchar **names = DataHubBridgeListServices();
+    for (gchar **name = names; *name != NULL; name++)
+    {
+        if (IsBuiltInService(*name))
+        {
+            LE_ERROR("Skipping bridge service %s, which has the name of a built-in service", *name);
+            continue;
+        }
+        if (g_hash_table_contains(state->services, *name))
+        {
+            continue;
+        }
+        struct GattServiceDefinition *def = DataHubBridgeLoadService(*name);
+        if (def != NULL)
+        {
+            EnableService(state, def, DataHubBridgeDescribeService(*name));
+            added = true;
+        }
+    }
+    g_strfreev(names);
+
+    return added;
+}
+
+/*
+ * Exports the services enabled in the config tree: the built-in services of the GattServices table,
+ * followed by the services bridged from the data hub.
+ */
+static void ExportGattDatabase(struct State *state)
+{
+    struct GattDatabaseStats *stats = &state->gattDatabaseStats;
+    const gint64 startTime = g_get_monotonic_time();
+    ReconcileServices(state);
+    stats->exportDurationUs = g_get_monotonic_time() - startTime;
+
+    size_t numBridgedServices = 0;
+    stats->numObjects = 0;
+    GHashTableIter services;
+    gpointer value;
+    g_hash_table_iter_init(&services, state->services);
+    while (g_hash_table_iter_next(&services, NULL, &value))
+    {
+        const struct ExportedService *exported = value;
+        stats->numObjects += exported->objects->len;
+        numBridgedServices += (exported->bridgeDescription != NULL);
+    }
+
+    LE_INFO(
+        "Exported %zu GATT objects for %u services (%zu bridged) in %" G_GINT64_FORMAT " us",
+        stats->numObjects,
+        g_hash_table_size(state->services),
+        numBridgedServices,
+        stats->exportDurationUs);
+}
+
+static gboolean ConfigSettleTimerExpired(gpointer userData)
+{
+    struct State *state = userData;
+    state->configSettleTimer = 0;
+
+    if (ReconcileServices(state))
+    {
+        for (guint i = 0; i < state->adapters->len; i++)
+        {
+            RefreshApplication(g_ptr_array_index(state->adapters, i));
+        }
+    }
+    UpdateAdvertisedServices(state);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void ServiceConfigChangeHandler(void *context)
+{
+    struct State *state = context;
+    if (state->configSettleTimer != 0)
+    {
+        g_source_remove(state->configSettleTimer);
+    }
+    state->configSettleTimer = g_timeout_add(CONFIG_SETTLE_MS, ConfigSettleTimerExpired, state);
+}
 
+static void AdapterPoweredOnHandler(struct Adapter *adapter)
+{
+    adapter->adapterState = ADAPTER_STATE_POWERED_ON;
+    TryRegisterWithAdapter(adapter);
+}
 
-static void TryCreateBluezObjectManager(struct State *state);
+static void PowerOnAdapter(struct Adapter *adapter)
+{
+    adapter->adapterState = ADAPTER_STATE_POWERING_ON;
+    LE_DEBUG("Adapter %s not powered - powering on", adapter->path);
+    bluez_adapter1_set_powered(adapter->proxy, TRUE);
+}
 
-static GType BluezProxyTypeFunc
-(
-    GDBusObjectManagerClient *manager,
-    const gchar *objectPath,
-    const gchar *interfaceName,
-    gpointer userData
-)
+static void AdapterPropertiesChangedHandler(
+    GDBusProxy *proxy, GVariant *changedProperties, GStrv invalidatedProperties, gpointer userData)
 {
-    LE_DEBUG("Handling request for objectPath=%s, interfaceName=%s", objectPath, interfaceName);
-    if (interfaceName == NULL)
+    struct Adapter *adapter = userData;
+    GVariant *poweredVal =
+        g_variant_lookup_value(changedProperties, "Powered", G_VARIANT_TYPE_BOOLEAN);
+    if (poweredVal == NULL)
     {
-        return g_dbus_object_proxy_get_type();
+        return;
     }
 
-    if (g_strcmp0(interfaceName, "org.bluez.Adapter1") == 0)
+    gboolean powered = g_variant_get_boolean(poweredVal);
+    g_variant_unref(poweredVal);
+    LE_DEBUG("Adapter %s Powered property = %d", adapter->path, powered);
+
+    if (powered && adapter->adapterState == ADAPTER_STATE_POWERING_ON)
     {
-        return BLUEZ_TYPE_ADAPTER1_PROXY;
+        AdapterPoweredOnHandler(adapter);
     }
-    else if (g_strcmp0(interfaceName, "org.bluez.Device1") == 0)
+    else if (!powered && adapter->adapterState == ADAPTER_STATE_POWERED_ON)
     {
-        return BLUEZ_TYPE_DEVICE1_PROXY;
+        // An adapter reset or power cycle - register again once it is back
+        LE_WARN("Adapter %s was powered off", adapter->path);
+        ResetAdapterRegistration(adapter);
+        g_hash_table_remove_all(adapter->connectedDevices);
+        UpdateAdvertising(adapter->state);
+        PowerOnAdapter(adapter);
     }
-    else if (g_strcmp0(interfaceName, "org.bluez.GattService1") == 0)
+}
+
+static void AdapterFoundHandler(struct Adapter *adapter)
+{
+    LE_INFO("Serving on adapter %s", adapter->path);
+    g_signal_connect(
+        adapter->proxy,
+        "g-properties-changed",
+        G_CALLBACK(AdapterPropertiesChangedHandler),
+        adapter);
+
+    // Ensure the adapter is powered on
+    if (!bluez_adapter1_get_powered(adapter->proxy))
     {
-        return BLUEZ_TYPE_GATT_SERVICE1_PROXY;
+        PowerOnAdapter(adapter);
     }
-    else if (g_strcmp0(interfaceName, "org.bluez.GattCharacteristic1") == 0)
+    else
     {
-        return BLUEZ_TYPE_GATT_CHARACTERISTIC1_PROXY;
+        AdapterPoweredOnHandler(adapter);
     }
-    else if (g_strcmp0(interfaceName, "org.bluez.GattDescriptor1") == 0)
+}
+
+/*
+ * Starts serving on an adapter announced by the object manager, unless it is already being served.
+ * Takes ownership of the proxy.
+ */
+static void AddAdapter(struct State *state, BluezAdapter1 *proxy)
+{
+    const gchar *path = g_dbus_proxy_get_object_path(G_DBUS_PROXY(proxy));
+    if (FindAdapter(state, path) != NULL)
     {
-        return BLUEZ_TYPE_GATT_DESCRIPTOR1_PROXY;
+        g_object_unref(proxy);
+        return;
     }
 
-    return g_dbus_proxy_get_type();
+    struct Adapter *adapter = NewAdapter(state, path);
+    adapter->proxy = proxy;
+    g_ptr_array_add(state->adapters, adapter);
+    AdapterFoundHandler(adapter);
 }
 
-static void CreateAdvertisementObject(struct State *state)
+static void SearchForAdapters(struct State *state)
 {
-    GDBusObjectSkeleton *obj_skel = g_dbus_object_skeleton_new("/io/mangoh/advertisement");
-    BluezLEAdvertisement1 *adv_skel = bluez_leadvertisement1_skeleton_new();
-    bluez_leadvertisement1_set_type_(adv_skel, "peripheral");
-    bluez_leadvertisement1_set_local_name(adv_skel, "mangOH");
-    const uint16_t no_timeout = 0; // Never timeout
-    bluez_leadvertisement1_set_timeout(adv_skel, no_timeout);
+    LE_DEBUG("Searching for adapters");
+    GList *bluezObjects = g_dbus_object_manager_get_objects(state->bluezObjectManager);
+    for (GList *node = bluezObjects; node != NULL; node = node->next)
+    {
+        GDBusObject *obj = node->data;
+        BluezAdapter1 *proxy =
+            BLUEZ_ADAPTER1(g_dbus_object_get_interface(obj, BLUEZ_INTF_ADAPTER));
+        if (proxy != NULL)
+        {
+            AddAdapter(state, proxy);
+        }
+    }
+    g_list_free_full(bluezObjects, g_object_unref);
 
-    const gchar* service_uuids[] = {
-        BLE_BATTERY_SERVICE_UUID,
-        IMMEDIATE_ALERT_SERVICE_UUID,
-        NULL,
-    };
-    bluez_leadvertisement1_set_service_uuids(adv_skel, service_uuids);
+    if (state->adapters->len == 0)
+    {
+        LE_INFO("No adapter yet");
+    }
+}
 
-    /*
-     * Refer to:
-     * https://www.bluetooth.com/wp-content/uploads/Sitecore-Media-Library/Gatt/Xml/Characteristics/org.bluetooth.characteristic.gap.appearance.xml
-     */
-    const guint16 appearance_generic_computer = 128;
-    bluez_leadvertisement1_set_appearance(adv_skel, appearance_generic_computer);
+static void AdapterRemovedHandler(struct Adapter *adapter)
+{
+    LE_WARN("Adapter %s was removed", adapter->path);
+    ResetAdapterRegistration(adapter);
+    DropAdapterProxy(adapter);
+    UpdateAdvertising(adapter->state);
+}
 
-    g_dbus_object_skeleton_add_interface(obj_skel, G_DBUS_INTERFACE_SKELETON(adv_skel));
-    g_object_unref(adv_skel);
+static void BluezObjectAddedHandler
+(
+    GDBusObjectManager *manager,
+    GDBusObject *object,
+    gpointer userData
+)
+{
+    LE_DEBUG(
+        "Received \"object-added\" signal - object_path=%s", g_dbus_object_get_object_path(object));
+    struct State *state = userData;
 
-    g_dbus_object_manager_server_export(
-        state->servicesObjectManager, G_DBUS_OBJECT_SKELETON(obj_skel));
-    g_object_unref(obj_skel);
+    BluezAdapter1 *proxy = BLUEZ_ADAPTER1(g_dbus_object_get_interface(object, BLUEZ_INTF_ADAPTER));
+    if (proxy != NULL)
+    {
+        AddAdapter(state, proxy);
+    }
 }
 
-static void AdvertisementRegisteredCallback(
-    GObject *sourceObject, GAsyncResult *res, gpointer userData)
+static void BluezObjectRemovedHandler
+(
+    GDBusObjectManager *manager,
+    GDBusObject *object,
+    gpointer userData
+)
 {
+    const gchar *objectPath = g_dbus_object_get_object_path(object);
+    LE_DEBUG("Received \"object-removed\" signal - object_path=%s", objectPath);
     struct State *state = userData;
-    GError *error = NULL;
-    bluez_leadvertising_manager1_call_register_advertisement_finish(
-        BLUEZ_LEADVERTISING_MANAGER1(sourceObject), res, &error);
-    LE_FATAL_IF(error, "Error registering bluetooth application: %s", error->message);
 
-    LE_INFO("Advertising object registered");
-    state->servicesState = SERVICES_STATE_RUNNING;
+    struct Adapter *adapter = FindAdapter(state, objectPath);
+    if (adapter != NULL)
+    {
+        AdapterRemovedHandler(adapter);
+        g_ptr_array_remove(state->adapters, adapter);
+        // The adapter that was holding up the recovery may be the one that went away
+        CheckRecovered(state);
+    }
 }
 
-static void RegisterAdvertisement(struct State *state)
+static void AdapterProxyCreatedCallback(
+    GObject *sourceObject, GAsyncResult *res, gpointer userData)
 {
-    state->servicesState = SERVICES_STATE_REGISTERING_ADVERTISEMENT;
-    const char *adapterPath = g_dbus_proxy_get_object_path(G_DBUS_PROXY(state->adapter));
+    struct Adapter *adapter = userData;
     GError *error = NULL;
-    BluezLEAdvertisingManager1 *advMgr = bluez_leadvertising_manager1_proxy_new_for_bus_sync(
-        G_BUS_TYPE_SYSTEM,
-        G_DBUS_PROXY_FLAGS_NONE,
-        "org.bluez",
-        adapterPath,
-        NULL,
-        &error);
-    LE_FATAL_IF(error, "Couldn't access LE Advertising Manager: %s", error->message);
+    BluezAdapter1 *proxy = bluez_adapter1_proxy_new_for_bus_finish(res, &error);
+    if (error != NULL)
+    {
+        if (!IsCancelled(error))
+        {
+            LE_ERROR("Couldn't create proxy for %s - %s", adapter->path, error->message);
+            adapter->adapterState = ADAPTER_STATE_ABSENT;
+        }
+        g_error_free(error);
+        return;
+    }
 
-    GVariant *options = g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0);
-    bluez_leadvertising_manager1_call_register_advertisement(
-        advMgr, "/io/mangoh/advertisement", options, NULL, AdvertisementRegisteredCallback, state);
+    /*
+     * Creating a proxy doesn't fail when there is no object at the path, it just has no
+     * properties. In that case wait for BlueZ to announce the adapter.
+     */
+    gchar **propertyNames = g_dbus_proxy_get_cached_property_names(G_DBUS_PROXY(proxy));
+    const bool present = (propertyNames != NULL && propertyNames[0] != NULL);
+    g_strfreev(propertyNames);
+    if (!present)
+    {
+        LE_INFO("Adapter %s is not present yet", adapter->path);
+        g_object_unref(proxy);
+        adapter->adapterState = ADAPTER_STATE_ABSENT;
+        return;
+    }
 
-    g_object_unref(advMgr);
-    g_print("Registered advertising object\n");
+    adapter->proxy = proxy;
+    AdapterFoundHandler(adapter);
 }
 
-static void ApplicationRegisteredCallback(
-    GObject *sourceObject, GAsyncResult *res, gpointer userData)
+static void CreateAdapterProxy(struct Adapter *adapter)
 {
-    struct State *state = userData;
-    GError *error = NULL;
-    bluez_gatt_manager1_call_register_application_finish(
-        BLUEZ_GATT_MANAGER1(sourceObject), res, &error);
+    adapter->adapterState = ADAPTER_STATE_CREATING_PROXY;
+    bluez_adapter1_proxy_new_for_bus(
+        G_BUS_TYPE_SYSTEM,
+        G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+        "org.bluez",
+        adapter->path,
+        adapter->cancellable,
+        AdapterProxyCreatedCallback,
+        adapter);
+}
 
-    LE_FATAL_IF(error, "Error registering bluetooth application: %s", error->message);
-    LE_INFO("Registered bluetooth application");
+static bool InterfaceListContains(GVariant *interfaces, const gchar *interfaceName)
+{
+    GVariantIter iter;
+    const gchar *name;
+    g_variant_iter_init(&iter, interfaces);
+    while (g_variant_iter_next(&iter, "&s", &name))
+    {
+        if (g_strcmp0(name, interfaceName) == 0)
+        {
+            return true;
+        }
+    }
 
-    RegisterAdvertisement(state);
+    return false;
 }
 
-static void TryRegisterWithBluez(struct State *state)
+static void AdapterInterfacesAddedHandler(
+    GDBusConnection *connection,
+    const gchar *senderName,
+    const gchar *objectPath,
+    const gchar *interfaceName,
+    const gchar *signalName,
+    GVariant *parameters,
+    gpointer userData)
 {
-    if (state->servicesState != SERVICES_STATE_EXPORTED_AT_NAME)
+    struct Adapter *adapter = userData;
+    GVariant *interfaces = g_variant_get_child_value(parameters, 1);
+    GVariant *adapterProperties = g_variant_lookup_value(interfaces, BLUEZ_INTF_ADAPTER, NULL);
+    g_variant_unref(interfaces);
+    const bool hasAdapter = (adapterProperties != NULL);
+    if (adapterProperties != NULL)
     {
-        LE_INFO("Not registering with BlueZ because app is not yet on dbus");
-        return;
+        g_variant_unref(adapterProperties);
     }
 
-    if (state->bluezState != BLUEZ_STATE_ADAPTER_POWERED_ON)
+    if (hasAdapter && adapter->adapterState == ADAPTER_STATE_ABSENT)
     {
-        LE_INFO("Not registering with BlueZ because the adapter is not powered on yet");
-        return;
+        LE_INFO("Adapter %s appeared", adapter->path);
+        CreateAdapterProxy(adapter);
     }
-
-    state->servicesState = SERVICES_STATE_REGISTERING_APPLICAITON;
-    const char *adapterPath = g_dbus_proxy_get_object_path(G_DBUS_PROXY(state->adapter));
-    GError *error = NULL;
-    BluezGattManager1 *gattManager = bluez_gatt_manager1_proxy_new_for_bus_sync(
-        G_BUS_TYPE_SYSTEM,
-        G_DBUS_PROXY_FLAGS_NONE,
-        "org.bluez",
-        adapterPath,
-        NULL,
-        &error);
-    LE_FATAL_IF(error, "Couldn't create GattManager1 - %s", error->message);
-    bluez_gatt_manager1_call_register_application(
-        gattManager,
-        "/io/mangoh",
-        g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0),
-        NULL,
-        ApplicationRegisteredCallback,
-        state);
-
-    g_object_unref(gattManager);
 }
 
-static void AdapterPoweredOnHandler(struct State *state)
+static void AdapterInterfacesRemovedHandler(
+    GDBusConnection *connection,
+    const gchar *senderName,
+    const gchar *objectPath,
+    const gchar *interfaceName,
+    const gchar *signalName,
+    GVariant *parameters,
+    gpointer userData)
 {
-    state->bluezState = BLUEZ_STATE_ADAPTER_POWERED_ON;
-    TryRegisterWithBluez(state);
+    struct Adapter *adapter = userData;
+    GVariant *interfaces = g_variant_get_child_value(parameters, 1);
+    const bool hasAdapter = InterfaceListContains(interfaces, BLUEZ_INTF_ADAPTER);
+    g_variant_unref(interfaces);
+
+    if (hasAdapter && adapter->adapterState != ADAPTER_STATE_ABSENT)
+    {
+        AdapterRemovedHandler(adapter);
+    }
 }
 
-static void AdapterPropertiesChangedHandler(
-    GDBusProxy *proxy, GVariant *changedProperties, GStrv invalidatedProperties, gpointer userData)
+/*
+ * Keeps the set of devices connected to each served adapter up to date from Device1 property
+ * changes, without creating a proxy for every device BlueZ knows about. Only changes are seen, so
+ * devices that were connected before the app started are not counted. A disconnect also ends the
+ * device's notification sessions.
+ */
+static void DevicePropertiesChangedHandler(
+    GDBusConnection *connection,
+    const gchar *senderName,
+    const gchar *objectPath,
+    const gchar *interfaceName,
+    const gchar *signalName,
+    GVariant *parameters,
+    gpointer userData)
 {
     struct State *state = userData;
-    if (state->bluezState == BLUEZ_STATE_POWERING_ON_ADAPTER)
+    struct Adapter *adapter = FindDeviceAdapter(state, objectPath);
+    if (adapter == NULL)
+    {
+        return;
+    }
+
+    GVariant *changed = g_variant_get_child_value(parameters, 1);
+    gboolean connected;
+    if (g_variant_lookup(changed, "Connected", "b", &connected))
     {
-        GVariant *poweredVal =
-            g_variant_lookup_value(changedProperties, "Powered", G_VARIANT_TYPE_BOOLEAN);
-        if (poweredVal != NULL)
+        const guint before = g_hash_table_size(adapter->connectedDevices);
+        if (connected)
         {
-            gboolean powered = g_variant_get_boolean(poweredVal);
-            g_variant_unref(poweredVal);
-            LE_DEBUG("Adapter Powered property = %d", powered);
-            if (powered)
-            {
-                AdapterPoweredOnHandler(state);
-            }
+            g_hash_table_add(adapter->connectedDevices, g_strdup(objectPath));
+        }
+        else
+        {
+            g_hash_table_remove(adapter->connectedDevices, objectPath);
+            SubscriptionsDeviceDisconnected(objectPath);
+        }
+        const guint after = g_hash_table_size(adapter->connectedDevices);
+        LE_DEBUG(
+            "Device %s %s - %u connected to %s",
+            objectPath,
+            connected ? "connected" : "disconnected",
+            after,
+            adapter->path);
+        if (after != before)
+        {
+            UpdateAdvertising(state);
         }
     }
+    g_variant_unref(changed);
 }
 
-static void AdapterFoundHandler(struct State *state)
+/*
+ * Every device's property changes wake the app, so they are only watched when connection counts
+ * are needed or while a device holds a session that has to end when it disconnects. Counts from
+ * the last time devices were watched are stale, so they are dropped.
+ */
+static void UpdateDeviceTracking(struct State *state)
 {
-    // Ensure the adapter is powered on
-    if (!bluez_adapter1_get_powered(state->adapter))
+    if (state->bluezConnection == NULL)
     {
-        state->bluezState = BLUEZ_STATE_POWERING_ON_ADAPTER;
-        LE_DEBUG("Adapter not powered - powering on");
-        g_signal_connect(
-            state->adapter,
-            "g-properties-changed",
-            G_CALLBACK(AdapterPropertiesChangedHandler),
-            state);
-        bluez_adapter1_set_powered(state->adapter, TRUE);
+        return;
     }
-    else
+
+    const bool track = state->trackConnectedDevices || SubscriptionsHaveDevices();
+    if (track && state->devicePropertiesSubscription == 0)
+    {
+        LE_DEBUG("Watching connected devices");
+        state->devicePropertiesSubscription = g_dbus_connection_signal_subscribe(
+            state->bluezConnection,
+            "org.bluez",
+            "org.freedesktop.DBus.Properties",
+            "PropertiesChanged",
+            NULL,
+            "org.bluez.Device1",
+            G_DBUS_SIGNAL_FLAGS_NONE,
+            DevicePropertiesChangedHandler,
+            state,
+            NULL);
+    }
+    else if (!track && state->devicePropertiesSubscription != 0)
     {
-        AdapterPoweredOnHandler(state);
+        LE_DEBUG("No device sessions left, no longer watching connected devices");
+        UnsubscribeBluezSignal(state, &state->devicePropertiesSubscription);
+        for (guint i = 0; i < state->adapters->len; i++)
+        {
+            struct Adapter *adapter = g_ptr_array_index(state->adapters, i);
+            g_hash_table_remove_all(adapter->connectedDevices);
+        }
     }
 }
 
-static void SearchForAdapter(struct State *state)
+static void DeviceSessionsChanged(bool held, gpointer context)
 {
-    LE_DEBUG("Searching for adapter");
-    GList *bluezObjects = g_dbus_object_manager_get_objects(state->bluezObjectManager);
-    for (GList *node = bluezObjects; node != NULL && state->adapter == NULL; node = node->next)
+    UpdateDeviceTracking(context);
+}
+
+/*
+ * Subscribes only to ObjectManager signals about the configured adapters, so BlueZ objects for
+ * devices and their remote GATT attributes are never proxied, then looks each adapter up directly
+ * by path rather than listing every BlueZ object.
+ */
+static void StartAdapterTracking(struct State *state)
+{
+    state->bluezState = BLUEZ_STATE_TRACKING_ADAPTERS;
+    for (guint i = 0; i < state->adapters->len; i++)
     {
-        GDBusObject *obj = node->data;
-        state->adapter = BLUEZ_ADAPTER1(g_dbus_object_get_interface(obj, "org.bluez.Adapter1"));
+        struct Adapter *adapter = g_ptr_array_index(state->adapters, i);
+        adapter->interfacesAddedSubscription = g_dbus_connection_signal_subscribe(
+            state->bluezConnection,
+            "org.bluez",
+            "org.freedesktop.DBus.ObjectManager",
+            "InterfacesAdded",
+            "/",
+            adapter->path,
+            G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH,
+            AdapterInterfacesAddedHandler,
+            adapter,
+            NULL);
+        adapter->interfacesRemovedSubscription = g_dbus_connection_signal_subscribe(
+            state->bluezConnection,
+            "org.bluez",
+            "org.freedesktop.DBus.ObjectManager",
+            "InterfacesRemoved",
+            "/",
+            adapter->path,
+            G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH,
+            AdapterInterfacesRemovedHandler,
+            adapter,
+            NULL);
+
+        CreateAdapterProxy(adapter);
     }
-    g_list_free_full(bluezObjects, g_object_unref);
+}
 
-    if (state->adapter != NULL)
+static void ConfigureAdvertisingPolicy(struct State *state)
+{
+    const char *policy = getenv(ENV_ADVERTISING_POLICY);
+    if (policy == NULL || policy[0] == '\0' || strcmp(policy, "all") == 0)
+    {
+        state->advertisingPolicy = ADVERTISING_POLICY_ALL;
+    }
+    else if (strcmp(policy, "least-loaded") == 0)
     {
-        AdapterFoundHandler(state);
+        state->advertisingPolicy = ADVERTISING_POLICY_LEAST_LOADED;
     }
+    else
+    {
+        LE_WARN("Unknown advertising policy \"%s\" - advertising on every adapter", policy);
+        state->advertisingPolicy = ADVERTISING_POLICY_ALL;
+    }
+
+    const char *maxConnections = getenv(ENV_MAX_CONNECTIONS);
+    state->maxConnectionsPerAdapter =
+        (maxConnections != NULL) ? (guint)strtoul(maxConnections, NULL, 10) : 0;
+
+    // Both the connection limit and the least loaded policy need connection counts
+    const char *trackDevices = getenv(ENV_BLUEZ_TRACK_DEVICES);
+    state->trackConnectedDevices = (trackDevices != NULL && strcmp(trackDevices, "1") == 0) ||
+        state->maxConnectionsPerAdapter > 0 ||
+        state->advertisingPolicy == ADVERTISING_POLICY_LEAST_LOADED;
+
+    LE_INFO(
+        "Advertising on %s adapter, %u connections per adapter (0 = no limit)",
+        (state->advertisingPolicy == ADVERTISING_POLICY_ALL) ? "every" : "the least loaded",
+        state->maxConnectionsPerAdapter);
 }
 
-static void BluezObjectAddedHandler
-(
-    GDBusObjectManager *manager,
-    GDBusObject *object,
-    gpointer userData
-)
+static void ConfigureBluezTracking(struct State *state)
 {
-    LE_DEBUG(
-        "Received \"object-added\" signal - object_path=%s", g_dbus_object_get_object_path(object));
-    struct State *state = userData;
+    state->adapters = g_ptr_array_new_with_free_func(FreeAdapter);
+    ConfigureAdvertisingPolicy(state);
 
-    if (state->bluezState == BLUEZ_STATE_SEARCHING_FOR_ADAPTER)
+    const char *adapterNames = getenv(ENV_BLUEZ_ADAPTER);
+    if (adapterNames != NULL)
     {
-        state->adapter = BLUEZ_ADAPTER1(g_dbus_object_get_interface(object, "org.bluez.Adapter1"));
-        if (state->adapter != NULL)
+        gchar **names = g_strsplit(adapterNames, ",", -1);
+        for (gchar **name = names; *name != NULL; name++)
         {
-            AdapterFoundHandler(state);
+            g_strstrip(*name);
+            gchar *path = g_strdup_printf("/org/bluez/%s", *name);
+            if ((*name)[0] != '\0' && FindAdapter(state, path) == NULL)
+            {
+                g_ptr_array_add(state->adapters, NewAdapter(state, path));
+            }
+            g_free(path);
         }
+        g_strfreev(names);
     }
-}
 
-static void BluezObjectRemovedHandler
-(
-    GDBusObjectManager *manager,
-    GDBusObject *object,
-    gpointer userData
-)
-{
-    LE_DEBUG(
-        "Received \"object-removed\" signal - object_path=%s",
-        g_dbus_object_get_object_path(object));
+    if (state->adapters->len == 0)
+    {
+        state->trackingMode = BLUEZ_TRACKING_FULL;
+        LE_INFO("Tracking all BlueZ objects and serving on every adapter");
+        return;
+    }
+
+    state->trackingMode = BLUEZ_TRACKING_ADAPTER;
+    LE_INFO("Tracking only BlueZ adapters %s", adapterNames);
 }
 
 
@@ -344,15 +2018,21 @@ static void BluezObjectManagerCreateCallback(
 {
     GError *error = NULL;
     struct State *state = userData;
-    state->bluezObjectManager = g_dbus_object_manager_client_new_for_bus_finish(res, &error);
+    GDBusObjectManager *objectManager =
+        g_dbus_object_manager_client_new_for_bus_finish(res, &error);
     if (error != NULL)
     {
-        LE_ERROR("Couldn't create Bluez object manager - %s", error->message);
-        TryCreateBluezObjectManager(state);
+        if (!IsCancelled(error))
+        {
+            LE_ERROR("Couldn't create Bluez object manager - %s", error->message);
+            TryCreateBluezObjectManager(state);
+        }
+        g_error_free(error);
     }
     else
     {
-        state->bluezState = BLUEZ_STATE_SEARCHING_FOR_ADAPTER;
+        state->bluezObjectManager = objectManager;
+        state->bluezState = BLUEZ_STATE_TRACKING_ADAPTERS;
         g_signal_connect(
             state->bluezObjectManager, "object-added", G_CALLBACK(BluezObjectAddedHandler), state);
         g_signal_connect(
@@ -361,7 +2041,7 @@ static void BluezObjectManagerCreateCallback(
             G_CALLBACK(BluezObjectRemovedHandler),
             state);
 
-        SearchForAdapter(state);
+        SearchForAdapters(state);
     }
 
 }
@@ -378,7 +2058,7 @@ static void TryCreateBluezObjectManager(struct State *state)
             BluezProxyTypeFunc,
             NULL,
             NULL,
-            NULL,
+            state->bluezCancellable,
             BluezObjectManagerCreateCallback,
             state);
     }
@@ -404,8 +2084,18 @@ void BluezNameAppearedCallback
 
     if (state->bluezState == BLUEZ_STATE_WAITING_FOR_NAME)
     {
-        state->bluezState = BLUEZ_STATE_CREATING_OBJECT_MANAGER;
-        TryCreateBluezObjectManager(state);
+        state->bluezConnection = g_object_ref(connection);
+        UpdateDeviceTracking(state);
+
+        if (state->trackingMode == BLUEZ_TRACKING_ADAPTER)
+        {
+            StartAdapterTracking(state);
+        }
+        else
+        {
+            state->bluezState = BLUEZ_STATE_CREATING_OBJECT_MANAGER;
+            TryCreateBluezObjectManager(state);
+        }
     }
     else
     {
@@ -421,26 +2111,77 @@ void BluezNameVanishedCallback
     gpointer userData
 )
 {
+    struct State *state = userData;
     LE_DEBUG("Received NameVanished for name=%s", name);
+
+    if (state->bluezState != BLUEZ_STATE_WAITING_FOR_NAME)
+    {
+        // bluetoothd exited or restarted. Start over once it is back on the bus.
+        LE_WARN("org.bluez vanished - waiting for it to reappear");
+        TeardownBluez(state);
+        state->bluezState = BLUEZ_STATE_WAITING_FOR_NAME;
+    }
 }
 
 
+/*
+ * Reads of characteristics that opted in are served by BLUETOOTH_SERVICES_READ_THREADS threads
+ * (one per processor by default). 0 serves them on the main loop instead.
+ */
+static void StartReadPool(void)
+{
+    guint numThreads = g_get_num_processors();
+    const char *readThreads = getenv(ENV_READ_THREADS);
+    if (readThreads != NULL)
+    {
+        numThreads = (guint)strtoul(readThreads, NULL, 10);
+    }
+    if (numThreads == 0)
+    {
+        LE_INFO("All reads are served on the main loop");
+        return;
+    }
+
+    GError *error = NULL;
+    ReadPool = g_thread_pool_new(RunThreadedRead, NULL, numThreads, FALSE, &error);
+    if (ReadPool == NULL)
+    {
+        LE_WARN(
+            "Couldn't start the read pool, reads are served on the main loop: %s",
+            error->message);
+        g_error_free(error);
+        return;
+    }
+    LE_INFO("Serving threaded reads on up to %u threads", numThreads);
+}
+
 // Runs once immediately before the event glib event loop is run
 void InitializeBluetoothServices(void)
 {
     struct State *state = g_malloc0(sizeof(*state));
+    state->initTime = g_get_monotonic_time();
     state->bluezState = BLUEZ_STATE_WAITING_FOR_NAME;
     state->servicesState = SERVICES_STATE_INIT;
+    state->bluezCancellable = g_cancellable_new();
+    ConfigureBluezTracking(state);
+    SubscriptionsWatchDevices(DeviceSessionsChanged, state);
 
-    size_t numServicesRegistered = 0;
     state->servicesObjectManager = g_dbus_object_manager_server_new("/io/mangoh");
+    state->services = g_hash_table_new(g_str_hash, g_str_equal);
 
-    battery_register_services(state->servicesObjectManager, &numServicesRegistered);
-    modem_info_register_services(state->servicesObjectManager, &numServicesRegistered);
-    alert_register_services(state->servicesObjectManager, &numServicesRegistered);
+    // Services queue their blocking provider calls while they are initialized
+    ExecutorStart();
+    StartReadPool();
+    ExportGattDatabase(state);
+    GattStatsAddSummary("valueCache", ValueCacheSummarize);
+    GattStatsStartPublishing();
     CreateAdvertisementObject(state);
     state->servicesState = SERVICES_STATE_DEFINED_IN_OM;
 
+    // Services can be enabled, disabled and rebridged without restarting the app
+    le_cfg_AddChangeHandler(SERVICES_CONFIG_ROOT, ServiceConfigChangeHandler, state);
+    le_cfg_AddChangeHandler(DATAHUB_BRIDGE_CONFIG_ROOT, ServiceConfigChangeHandler, state);
+
     state->mangohOwnHandle = g_bus_own_name(
         G_BUS_TYPE_SYSTEM,
         "io.mangoh",
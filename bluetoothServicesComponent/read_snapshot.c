@@ -0,0 +1,185 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// GLib
+#include <glib.h>
+#include <gio/gio.h>
+
+// Legato
+#include "legato.h"
+
+// Local
+#include "read_snapshot.h"
+#include "subscriptions.h"
+
+// Read Blob requests follow each other within a few connection intervals
+#define READ_SNAPSHOT_TTL_US (5 * G_USEC_PER_SEC)
+#define ATT_DEFAULT_MTU 23
+#define ATT_READ_RESPONSE_HEADER_SIZE 1
+
+struct ReadSnapshot
+{
+    GVariant *value;
+    gint64 expiresAt;
+};
+
+struct ReadRequest
+{
+    const gchar *device; // "" if bluetoothd didn't say
+    guint16 offset;
+    guint16 mtu; // The minimum if bluetoothd didn't say, so a snapshot may be kept too long
+};
+
+static GQuark SnapshotsQuark;
+// Threaded reads take and slice snapshots on the read pool
+static GMutex SnapshotsLock;
+
+static void FreeSnapshot(gpointer data)
+{
+    struct ReadSnapshot *snapshot = data;
+    g_variant_unref(snapshot->value);
+    g_free(snapshot);
+}
+
+// The snapshots of one object, by device. Created the first time a long read is seen.
+static GHashTable *Snapshots(gpointer skeleton, bool create)
+{
+    if (SnapshotsQuark == 0)
+    {
+        SnapshotsQuark = g_quark_from_static_string("read-snapshots");
+    }
+
+    GHashTable *snapshots = g_object_get_qdata(G_OBJECT(skeleton), SnapshotsQuark);
+    if (snapshots == NULL && create)
+    {
+        snapshots = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, FreeSnapshot);
+        g_object_set_qdata_full(
+            G_OBJECT(skeleton), SnapshotsQuark, snapshots, (GDestroyNotify)g_hash_table_destroy);
+    }
+    return snapshots;
+}
+
+static void ParseRequest(GVariant *options, struct ReadRequest *request)
+{
+    request->device = GattOptionsGetDevice(options);
+    if (request->device == NULL)
+    {
+        request->device = "";
+    }
+    request->offset = 0;
+    request->mtu = ATT_DEFAULT_MTU;
+    if (options != NULL)
+    {
+        g_variant_lookup(options, "offset", "q", &request->offset);
+        g_variant_lookup(options, "mtu", "q", &request->mtu);
+    }
+    request->mtu = MAX(request->mtu, ATT_DEFAULT_MTU);
+}
+
+static gboolean IsExpired(gpointer key, gpointer value, gpointer userData)
+{
+    const struct ReadSnapshot *snapshot = value;
+    const gint64 *now = userData;
+    return snapshot->expiresAt <= *now;
+}
+
+static struct ReadSnapshot *FindSnapshot(gpointer skeleton, const struct ReadRequest *request)
+{
+    GHashTable *snapshots = Snapshots(skeleton, false);
+    if (snapshots == NULL || request->offset == 0)
+    {
+        return NULL;
+    }
+
+    struct ReadSnapshot *snapshot = g_hash_table_lookup(snapshots, request->device);
+    if (snapshot != NULL && snapshot->expiresAt <= g_get_monotonic_time())
+    {
+        g_hash_table_remove(snapshots, request->device);
+        return NULL;
+    }
+    return snapshot;
+}
+
+// Whether a reply starting at offset carries the last byte of a value of the given size
+static bool IsLastReply(const struct ReadRequest *request, gsize size)
+{
+    return request->offset + (gsize)(request->mtu - ATT_READ_RESPONSE_HEADER_SIZE) >= size;
+}
+
+GVariant *ReadSnapshotLookup(gpointer skeleton, GVariant *options)
+{
+    struct ReadRequest request;
+    ParseRequest(options, &request);
+    g_mutex_lock(&SnapshotsLock);
+    const struct ReadSnapshot *snapshot = FindSnapshot(skeleton, &request);
+    GVariant *value = (snapshot != NULL) ? g_variant_ref(snapshot->value) : NULL;
+    g_mutex_unlock(&SnapshotsLock);
+    return value;
+}
+
+GVariant *ReadSnapshotPrepare(
+    gpointer skeleton, GDBusMethodInvocation *invocation, GVariant *value)
+{
+    GVariant *parameters = g_dbus_method_invocation_get_parameters(invocation);
+    GVariant *options = g_variant_get_child_value(parameters, 0);
+    struct ReadRequest request;
+    ParseRequest(options, &request);
+
+    GVariant *reply = NULL;
+    g_mutex_lock(&SnapshotsLock);
+    if (request.offset == 0)
+    {
+        GHashTable *snapshots = Snapshots(skeleton, false);
+        if (snapshots != NULL)
+        {
+            const gint64 now = g_get_monotonic_time();
+            g_hash_table_foreach_remove(snapshots, IsExpired, (gpointer)&now);
+            g_hash_table_remove(snapshots, request.device);
+        }
+
+        if (!IsLastReply(&request, g_variant_get_size(value)))
+        {
+            struct ReadSnapshot *snapshot = g_new0(struct ReadSnapshot, 1);
+            snapshot->value = g_variant_ref(value);
+            snapshot->expiresAt = g_get_monotonic_time() + READ_SNAPSHOT_TTL_US;
+            g_hash_table_insert(Snapshots(skeleton, true), g_strdup(request.device), snapshot);
+        }
+        reply = g_variant_ref(value);
+    }
+    else
+    {
+        struct ReadSnapshot *snapshot = FindSnapshot(skeleton, &request);
+        GVariant *base = (snapshot != NULL) ? snapshot->value : value;
+        gsize size;
+        const guint8 *data = g_variant_get_fixed_array(base, &size, sizeof(guint8));
+        if (request.offset <= size)
+        {
+            // The slice shares the snapshot's bytes
+            reply = g_variant_ref_sink(g_variant_new_from_data(
+                G_VARIANT_TYPE_BYTESTRING,
+                data + request.offset,
+                size - request.offset,
+                TRUE,
+                (GDestroyNotify)g_variant_unref,
+                g_variant_ref(base)));
+        }
+
+        if (snapshot != NULL)
+        {
+            if (reply == NULL || IsLastReply(&request, size))
+            {
+                g_hash_table_remove(Snapshots(skeleton, false), request.device);
+            }
+            else
+            {
+                snapshot->expiresAt = g_get_monotonic_time() + READ_SNAPSHOT_TTL_US;
+            }
+        }
+    }
+    g_mutex_unlock(&SnapshotsLock);
+
+    g_variant_unref(options);
+    return reply;
+}
@@ -0,0 +1,30 @@
+#ifndef _READ_SNAPSHOT_H
+#define _READ_SNAPSHOT_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+/*
+ * Long reads of characteristic and descriptor values. bluetoothd turns each ATT Read Blob request
+ * into a ReadValue call with an "offset" option and replies with at most MTU - 1 bytes of what the
+ * handler returns, so the reply has to start at the offset. A read at offset 0 of a value that
+ * doesn't fit in one reply keeps a snapshot of the value for the requesting device, and the
+ * following offsets are sliced from that snapshot without running the handler again. The client
+ * then reassembles a consistent value even if it changes half way through. Both functions may be
+ * called from the read pool.
+ */
+
+/*
+ * Returns a new reference to the device's snapshot of the object's value if the request continues
+ * a long read, or NULL if the handler has to produce the value.
+ */
+GVariant *ReadSnapshotLookup(gpointer skeleton, GVariant *options);
+
+/*
+ * Returns a new reference to the part of value to reply with, or NULL if the offset of the
+ * ReadValue invocation is past the end of the value.
+ */
+GVariant *ReadSnapshotPrepare(
+    gpointer skeleton, GDBusMethodInvocation *invocation, GVariant *value);
+
+#endif // _READ_SNAPSHOT_H
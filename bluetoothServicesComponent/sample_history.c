@@ -0,0 +1,133 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// GLib
+#include <glib.h>
+
+// Legato
+#include "legato.h"
+
+// Local
+#include "sample_history.h"
+
+static GPtrArray *AllHistories;
+
+struct SampleHistory *SampleHistoryNew(const gchar *name, guint capacity)
+{
+    LE_ASSERT(capacity > 0);
+    struct SampleHistory *history = g_new0(struct SampleHistory, 1);
+    history->refs = 1;
+    history->name = g_strdup(name);
+    history->samples = g_new0(struct HistorySample, capacity);
+    history->capacity = capacity;
+
+    if (AllHistories == NULL)
+    {
+        AllHistories = g_ptr_array_new();
+    }
+    for (guint id = 0; id < AllHistories->len; id++)
+    {
+        if (g_ptr_array_index(AllHistories, id) == NULL)
+        {
+            g_ptr_array_index(AllHistories, id) = history;
+            return history;
+        }
+    }
+    g_ptr_array_add(AllHistories, history);
+    return history;
+}
+
+struct SampleHistory *SampleHistoryRef(struct SampleHistory *history)
+{
+    history->refs++;
+    return history;
+}
+
+void SampleHistoryUnref(struct SampleHistory *history)
+{
+    if (--history->refs > 0)
+    {
+        return;
+    }
+    g_free(history->name);
+    g_free(history->samples);
+    g_free(history);
+}
+
+void SampleHistoryRetire(struct SampleHistory *history)
+{
+    for (guint id = 0; id < AllHistories->len; id++)
+    {
+        if (g_ptr_array_index(AllHistories, id) == history)
+        {
+            g_ptr_array_index(AllHistories, id) = NULL;
+        }
+    }
+    SampleHistoryUnref(history);
+}
+
+/*
+ * Timestamps are kept in order so readers can search them. A sample stamped earlier than the newest
+ * one (eg. after the clock was set back) is recorded with the newest timestamp instead.
+ */
+void SampleHistoryRecord(struct SampleHistory *history, double timestamp, double value)
+{
+    guint32 seconds = (guint32)CLAMP(timestamp, 0.0, (double)G_MAXUINT32);
+    if (history->length > 0)
+    {
+        seconds = MAX(seconds, SampleHistoryGet(history, history->numRecorded - 1)->timestamp);
+    }
+
+    struct HistorySample *sample = &history->samples[history->numRecorded % history->capacity];
+    sample->timestamp = seconds;
+    sample->value = (gfloat)value;
+    history->numRecorded++;
+    history->length = MIN(history->length + 1, history->capacity);
+}
+
+/*
+ * Returns the absolute index of the oldest sample stamped at or after since. If there is none, the
+ * result is the index the next sample will get.
+ */
+guint64 SampleHistoryFindSince(const struct SampleHistory *history, guint32 since)
+{
+    guint64 low = SampleHistoryFirstIndex(history);
+    guint64 high = history->numRecorded;
+    while (low < high)
+    {
+        const guint64 mid = low + (high - low) / 2;
+        if (SampleHistoryGet(history, mid)->timestamp < since)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * Returns NULL if the sample has been overwritten or hasn't been recorded yet.
+ */
+const struct HistorySample *SampleHistoryGet(const struct SampleHistory *history, guint64 index)
+{
+    if (index < SampleHistoryFirstIndex(history) || index >= history->numRecorded)
+    {
+        return NULL;
+    }
+    return &history->samples[index % history->capacity];
+}
+
+guint SampleHistoryCount(void)
+{
+    return (AllHistories != NULL) ? AllHistories->len : 0;
+}
+
+struct SampleHistory *SampleHistoryAt(guint id)
+{
+    return (id < SampleHistoryCount()) ? g_ptr_array_index(AllHistories, id) : NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef _SAMPLE_HISTORY_H
+#define _SAMPLE_HISTORY_H
+
+#include <glib.h>
+
+/*
+ * Fixed capacity record of timestamped samples for one observation. Once full, each new sample
+ * replaces the oldest one. Samples are addressed by their absolute index, which counts every sample
+ * ever recorded, so a reader walking the history can tell when it has been overtaken.
+ */
+struct HistorySample
+{
+    guint32 timestamp; // Seconds since the epoch
+    gfloat value;
+};
+
+struct SampleHistory
+{
+    guint refs;
+    gchar *name;
+    struct HistorySample *samples;
+    guint capacity;
+    guint length;
+    guint64 numRecorded;
+};
+
+struct SampleHistory *SampleHistoryNew(const gchar *name, guint capacity);
+struct SampleHistory *SampleHistoryRef(struct SampleHistory *history);
+void SampleHistoryUnref(struct SampleHistory *history);
+// Removes the history from the catalog and drops the producer's reference
+void SampleHistoryRetire(struct SampleHistory *history);
+void SampleHistoryRecord(struct SampleHistory *history, double timestamp, double value);
+guint64 SampleHistoryFindSince(const struct SampleHistory *history, guint32 since);
+const struct HistorySample *SampleHistoryGet(const struct SampleHistory *history, guint64 index);
+
+/*
+ * The catalog of histories. The position is the history's id. A retired history leaves a gap, for
+ * which SampleHistoryAt returns NULL, until a new history takes its place.
+ */
+guint SampleHistoryCount(void);
+struct SampleHistory *SampleHistoryAt(guint id);
+
+static inline guint64 SampleHistoryFirstIndex(const struct SampleHistory *history)
+{
+    return history->numRecorded - history->length;
+}
+
+#endif // _SAMPLE_HISTORY_H
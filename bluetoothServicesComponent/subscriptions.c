@@ -0,0 +1,204 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// GLib
+#include <glib.h>
+#include <gio/gio.h>
+
+// Legato
+#include "legato.h"
+
+// Local
+#include "subscriptions.h"
+
+static GPtrArray *AllSubscriptions;
+// Subscribers with a device, across every subscription
+static guint DeviceSubscribers;
+static SubscriptionsDevicesFunc DevicesWatch;
+static gpointer DevicesWatchContext;
+
+static void CountDeviceSubscriber(const gchar *device, bool added)
+{
+    if (device == NULL)
+    {
+        return;
+    }
+
+    if (added)
+    {
+        DeviceSubscribers++;
+    }
+    else
+    {
+        DeviceSubscribers--;
+    }
+    if (DevicesWatch != NULL && DeviceSubscribers == (added ? 1 : 0))
+    {
+        DevicesWatch(added, DevicesWatchContext);
+    }
+}
+
+static void FreeSubscriber(gpointer data)
+{
+    struct Subscriber *subscriber = data;
+    g_free(subscriber->device);
+    g_free(subscriber);
+}
+
+static struct Subscriber *Find(
+    struct Subscription *subscription, const gchar *device, guint *index)
+{
+    for (guint i = 0; i < subscription->subscribers->len; i++)
+    {
+        struct Subscriber *subscriber = g_ptr_array_index(subscription->subscribers, i);
+        if (g_strcmp0(subscriber->device, device) == 0)
+        {
+            if (index != NULL)
+            {
+                *index = i;
+            }
+            return subscriber;
+        }
+    }
+
+    return NULL;
+}
+
+void SubscriptionInit(
+    struct Subscription *subscription,
+    const gchar *name,
+    SubscriptionChangedFunc changed,
+    gpointer context)
+{
+    if (AllSubscriptions == NULL)
+    {
+        AllSubscriptions = g_ptr_array_new();
+    }
+
+    subscription->name = name;
+    subscription->subscribers = g_ptr_array_new_with_free_func(FreeSubscriber);
+    subscription->changed = changed;
+    subscription->context = context;
+    g_ptr_array_add(AllSubscriptions, subscription);
+}
+
+void SubscriptionFini(struct Subscription *subscription)
+{
+    g_ptr_array_remove(AllSubscriptions, subscription);
+    for (guint i = 0; i < subscription->subscribers->len; i++)
+    {
+        const struct Subscriber *subscriber = g_ptr_array_index(subscription->subscribers, i);
+        CountDeviceSubscriber(subscriber->device, false);
+    }
+    g_ptr_array_free(subscription->subscribers, TRUE);
+    subscription->subscribers = NULL;
+}
+
+/*
+ * Adding a device that is already subscribed does nothing, so a client repeating a request doesn't
+ * restart its counters.
+ */
+void SubscriptionAdd(struct Subscription *subscription, const gchar *device)
+{
+    if (Find(subscription, device, NULL) != NULL)
+    {
+        return;
+    }
+
+    struct Subscriber *subscriber = g_new0(struct Subscriber, 1);
+    subscriber->device = g_strdup(device);
+    subscriber->since = g_get_monotonic_time();
+    g_ptr_array_add(subscription->subscribers, subscriber);
+    LE_DEBUG(
+        "%s subscribed to %s - %u subscribers",
+        (device != NULL) ? device : "bluetoothd",
+        subscription->name,
+        subscription->subscribers->len);
+    CountDeviceSubscriber(device, true);
+
+    if (subscription->changed != NULL)
+    {
+        subscription->changed(subscription, device, true, subscription->context);
+    }
+}
+
+void SubscriptionRemove(struct Subscription *subscription, const gchar *device)
+{
+    guint index;
+    const struct Subscriber *subscriber = Find(subscription, device, &index);
+    if (subscriber == NULL)
+    {
+        return;
+    }
+
+    LE_INFO(
+        "%s unsubscribed from %s after %" G_GINT64_FORMAT " s, %" G_GUINT64_FORMAT
+        " notifications (%" G_GUINT64_FORMAT " bytes)",
+        (device != NULL) ? device : "bluetoothd",
+        subscription->name,
+        (g_get_monotonic_time() - subscriber->since) / G_USEC_PER_SEC,
+        subscriber->notifications,
+        subscriber->bytes);
+    g_ptr_array_remove_index_fast(subscription->subscribers, index);
+    CountDeviceSubscriber(device, false);
+
+    if (subscription->changed != NULL)
+    {
+        subscription->changed(subscription, device, false, subscription->context);
+    }
+}
+
+bool SubscriptionHas(struct Subscription *subscription, const gchar *device)
+{
+    return Find(subscription, device, NULL) != NULL;
+}
+
+/*
+ * Notifications go to every subscribed device, so each subscriber is credited with them.
+ */
+void SubscriptionRecordNotification(struct Subscription *subscription, gsize bytes)
+{
+    for (guint i = 0; i < subscription->subscribers->len; i++)
+    {
+        struct Subscriber *subscriber = g_ptr_array_index(subscription->subscribers, i);
+        subscriber->notifications++;
+        subscriber->bytes += bytes;
+    }
+}
+
+void SubscriptionsDeviceDisconnected(const gchar *device)
+{
+    if (AllSubscriptions == NULL || device == NULL)
+    {
+        return;
+    }
+
+    for (guint i = 0; i < AllSubscriptions->len; i++)
+    {
+        SubscriptionRemove(g_ptr_array_index(AllSubscriptions, i), device);
+    }
+}
+
+void SubscriptionsWatchDevices(SubscriptionsDevicesFunc func, gpointer context)
+{
+    DevicesWatch = func;
+    DevicesWatchContext = context;
+}
+
+bool SubscriptionsHaveDevices(void)
+{
+    return DeviceSubscribers > 0;
+}
+
+const gchar *GattOptionsGetDevice(GVariant *options)
+{
+    const gchar *device = NULL;
+    if (options == NULL || !g_variant_lookup(options, "device", "&o", &device))
+    {
+        return NULL;
+    }
+
+    return device;
+}
@@ -0,0 +1,70 @@
+#ifndef _SUBSCRIPTIONS_H
+#define _SUBSCRIPTIONS_H
+
+#include <stdbool.h>
+
+#include <glib.h>
+
+/*
+ * Tracks who is listening to a notifying characteristic, so services only do producer work while
+ * someone is. bluetoothd reference counts client configuration writes itself: it calls StartNotify
+ * when the first device subscribes and StopNotify after the last one unsubscribes or disconnects,
+ * without saying which devices they are. That aggregate is tracked as a subscriber without a
+ * device. Requests that carry a "device" option (eg. AcquireNotify, or a write that starts a
+ * transfer) add a subscriber for that device, which is removed when the device disconnects.
+ */
+
+struct Subscriber
+{
+    gchar *device; // NULL for the subscription bluetoothd reports through StartNotify
+    gint64 since;
+    guint64 notifications;
+    guint64 bytes;
+};
+
+struct Subscription;
+
+// Called after every subscriber that is added or removed
+typedef void (*SubscriptionChangedFunc)(
+    struct Subscription *subscription, const gchar *device, bool subscribed, gpointer context);
+
+struct Subscription
+{
+    const gchar *name;
+    GPtrArray *subscribers;
+    SubscriptionChangedFunc changed;
+    gpointer context;
+};
+
+void SubscriptionInit(
+    struct Subscription *subscription,
+    const gchar *name,
+    SubscriptionChangedFunc changed,
+    gpointer context);
+void SubscriptionAdd(struct Subscription *subscription, const gchar *device);
+void SubscriptionRemove(struct Subscription *subscription, const gchar *device);
+// Forgets every subscriber without calling the changed function
+void SubscriptionFini(struct Subscription *subscription);
+bool SubscriptionHas(struct Subscription *subscription, const gchar *device);
+void SubscriptionRecordNotification(struct Subscription *subscription, gsize bytes);
+
+static inline bool SubscriptionIsActive(const struct Subscription *subscription)
+{
+    return subscription->subscribers->len > 0;
+}
+
+// Removes the device from every subscription
+void SubscriptionsDeviceDisconnected(const gchar *device);
+
+/*
+ * Called when the first subscriber with a device is added to any subscription (held is true) and
+ * after the last one is removed, so disconnects only need watching while a device holds a session.
+ */
+typedef void (*SubscriptionsDevicesFunc)(bool held, gpointer context);
+void SubscriptionsWatchDevices(SubscriptionsDevicesFunc func, gpointer context);
+bool SubscriptionsHaveDevices(void);
+
+// Returns the "device" object path from the options of a GATT request, or NULL
+const gchar *GattOptionsGetDevice(GVariant *options);
+
+#endif // _SUBSCRIPTIONS_H
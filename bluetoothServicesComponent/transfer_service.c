@@ -0,0 +1,1007 @@
+// pread, pwrite, fsync, link, fstatvfs and O_CLOEXEC are POSIX.1-2008, beyond -std=c99
+#define _POSIX_C_SOURCE 200809L
+
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+// GLib
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+// Legato
+#include "legato.h"
+
+// Local
+#include "transfer_service.h"
+#include "notify_policy.h"
+#include "subscriptions.h"
+#include "gatt_stats.h"
+#include "executor.h"
+#include "org.bluez.GattCharacteristic1.h"
+
+#define TRANSFER_CONTROL_POINT_CHARACTERISTIC_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b6001"
+#define TRANSFER_DATA_CHARACTERISTIC_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b6002"
+
+#define ENV_TRANSFER_DIR "BLUETOOTH_SERVICES_TRANSFER_DIR"
+#define ENV_TRANSFER_MAX_SIZE "BLUETOOTH_SERVICES_TRANSFER_MAX_SIZE"
+// On flash, so received files and partial transfers survive a reboot
+#define DEFAULT_TRANSFER_DIR "/home/root/bluetoothServices/transfers"
+#define DEFAULT_TRANSFER_MAX_SIZE (16 * 1024 * 1024)
+#define TRANSFER_PARTIAL_SUFFIX ".part"
+#define TRANSFER_NAME_MAX_LEN 64
+
+#define ATT_DEFAULT_MTU 23
+#define ATT_WRITE_HEADER_SIZE 3
+#define ATT_MAX_VALUE_LEN 512
+
+// Each data write starts with the offset of its payload in the file
+#define TRANSFER_CHUNK_HEADER_SIZE 4
+
+/*
+ * The client may have this many chunks unacknowledged. An acknowledgement is sent every half
+ * window, so the client still has room to send while it is on its way and never waits for a round
+ * trip per chunk.
+ */
+#define TRANSFER_WINDOW_CHUNKS 16
+#define TRANSFER_ACK_INTERVAL (TRANSFER_WINDOW_CHUNKS / 2)
+
+// The partial file is checked in blocks this size when a transfer is resumed
+#define TRANSFER_CRC_BLOCK_SIZE 4096
+
+enum TransferOpcode
+{
+    // flags (u8), size (u32), CRC-32 of the whole file (u32), name length (u8), name
+    TRANSFER_OPCODE_START = 0x01,
+    TRANSFER_OPCODE_COMMIT = 0x02,
+    TRANSFER_OPCODE_ABORT = 0x03,
+    // Notified: request opcode (u8), status (u8) and, for start, the resume point
+    TRANSFER_OPCODE_RESPONSE = 0x80,
+    // Notified: number of bytes written so far (u32)
+    TRANSFER_OPCODE_ACK = 0x81,
+    // Notified: a chunk was lost, so resend from this offset (u32)
+    TRANSFER_OPCODE_RESEND = 0x82,
+};
+
+#define TRANSFER_START_FLAG_RESTART 0x01
+// Without it, a file that already exists under the name is never overwritten
+#define TRANSFER_START_FLAG_REPLACE 0x02
+
+enum TransferStatus
+{
+    TRANSFER_STATUS_SUCCESS = 0x00,
+    TRANSFER_STATUS_BUSY = 0x01,
+    TRANSFER_STATUS_INVALID = 0x02,
+    TRANSFER_STATUS_STORAGE_ERROR = 0x03,
+    TRANSFER_STATUS_CRC_MISMATCH = 0x04,
+    TRANSFER_STATUS_INCOMPLETE = 0x05,
+    TRANSFER_STATUS_NO_TRANSFER = 0x06,
+    TRANSFER_STATUS_TOO_LARGE = 0x07,
+    TRANSFER_STATUS_NO_SPACE = 0x08,
+    TRANSFER_STATUS_EXISTS = 0x09,
+};
+
+struct start_check;
+struct commit_job;
+
+struct TransferContext {
+    // Held by the service and by each storage job, which may finish after the service is disabled
+    guint refs;
+    BluezGattCharacteristic1 *control_point_characteristic;
+    struct Subscription control_subscription;
+    gchar *directory;
+    guint32 max_size;
+    // The start request being checked on the storage worker, if any
+    struct start_check *checking;
+    // The completed file being stored by the storage worker, if any
+    struct commit_job *committing;
+    // The transfer in progress. fd is -1 while there is none.
+    int fd;
+    gchar *name;
+    gchar *device; // NULL if the start request didn't say which device sent it
+    bool replace;
+    guint32 size;
+    guint32 expected_crc;
+    guint32 offset;
+    guint32 crc; // Of the bytes before offset
+    guint chunks_since_ack;
+    bool gap_reported;
+    guint32 resumed_at;
+    gint64 start_time;
+};
+
+/*
+ * A start request, checked on the storage worker since resuming reads back the whole partial file.
+ * The worker fills in the results, which are used on the main loop unless the request was
+ * cancelled in the meantime.
+ */
+struct start_check {
+    struct TransferContext *ctx;
+    bool cancelled;
+    gchar *name;
+    gchar *path;
+    gchar *final_path;
+    guint8 flags;
+    guint32 size;
+    guint32 expected_crc;
+    guint16 chunk_size;
+    // Written by the worker
+    guint8 status;
+    int error;
+    int fd;
+    guint32 length;
+    guint32 crc;
+};
+
+/*
+ * A complete file, handed over to the storage worker to be flushed and given its name. The
+ * transfer is over once the job is queued, and the job owns its file. The response is sent from
+ * the main loop unless the service was disabled in the meantime.
+ */
+struct commit_job {
+    struct TransferContext *ctx;
+    bool cancelled;
+    int fd;
+    gchar *path;
+    gchar *final_path;
+    bool replace;
+    guint32 size;
+    guint32 resumed_at;
+    gint64 start_time;
+    // Written by the worker
+    guint8 status;
+    int error;
+};
+
+static guint32 crc_table[256];
+
+static void init_crc_table(void)
+{
+    for (guint32 i = 0; i < G_N_ELEMENTS(crc_table); i++)
+    {
+        guint32 crc = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+        crc_table[i] = crc;
+    }
+}
+
+// CRC-32 as used by zlib and PNG. Start with 0 and feed the data in as many pieces as it comes.
+static guint32 crc32_update(guint32 crc, const guint8 *data, gsize size)
+{
+    crc = ~crc;
+    for (gsize i = 0; i < size; i++)
+    {
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put_le16(guint8 *buffer, guint16 value)
+{
+    buffer[0] = value & 0xff;
+    buffer[1] = value >> 8;
+}
+
+static void put_le32(guint8 *buffer, guint32 value)
+{
+    put_le16(&buffer[0], value & 0xffff);
+    put_le16(&buffer[2], value >> 16);
+}
+
+static guint32 get_le32(const guint8 *buffer)
+{
+    return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((guint32)buffer[3] << 24);
+}
+
+static gchar *partial_path(const struct TransferContext *ctx, const gchar *name)
+{
+    gchar *file_name = g_strconcat(name, TRANSFER_PARTIAL_SUFFIX, NULL);
+    gchar *path = g_build_filename(ctx->directory, file_name, NULL);
+    g_free(file_name);
+    return path;
+}
+
+/*
+ * Names are plain file names, so a client can't write outside the transfer directory, and can't
+ * name a file after another one's partial file.
+ */
+static bool is_valid_name(const gchar *name, gsize len)
+{
+    const gsize suffix_len = strlen(TRANSFER_PARTIAL_SUFFIX);
+    if (len == 0 || len > TRANSFER_NAME_MAX_LEN || name[0] == '.' ||
+        (len >= suffix_len &&
+         memcmp(&name[len - suffix_len], TRANSFER_PARTIAL_SUFFIX, suffix_len) == 0))
+    {
+        return false;
+    }
+    for (gsize i = 0; i < len; i++)
+    {
+        if (!g_ascii_isalnum(name[i]) && name[i] != '.' && name[i] != '_' && name[i] != '-')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void notify_control_point(struct TransferContext *ctx, const guint8 *data, gsize size)
+{
+    GVariant *value = g_variant_ref_sink(
+        g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data, size, sizeof(guint8)));
+    // Responses and acknowledgements can be sent back to back, and each one has to arrive
+    NotifyCharacteristicPacket(ctx->control_point_characteristic, value);
+    SubscriptionRecordNotification(&ctx->control_subscription, size);
+    g_variant_unref(value);
+}
+
+static void send_response(struct TransferContext *ctx, guint8 opcode, guint8 status)
+{
+    const guint8 response[] = {TRANSFER_OPCODE_RESPONSE, opcode, status};
+    notify_control_point(ctx, response, sizeof(response));
+}
+
+static void send_ack(struct TransferContext *ctx, guint8 opcode)
+{
+    guint8 ack[5];
+    ack[0] = opcode;
+    put_le32(&ack[1], ctx->offset);
+    notify_control_point(ctx, ack, sizeof(ack));
+    ctx->chunks_since_ack = 0;
+}
+
+// Runs on the storage worker
+static void run_unlink(gpointer data)
+{
+    g_unlink(data);
+}
+
+// Queued behind any job on the file, so it can't delete the file of a later start instead
+static void discard_partial_file(const gchar *path)
+{
+    gchar *queued_path = g_strdup(path);
+    const bool queued = ExecutorSubmit(
+        EXECUTOR_QUEUE_STORAGE, "transfer discard", run_unlink, NULL, queued_path, g_free, 0);
+    if (!queued)
+    {
+        LE_WARN("Keeping %s, the storage queue is full", path);
+        g_free(queued_path);
+    }
+}
+
+/*
+ * Closes the file of the transfer in progress, or cancels the start request being checked. The
+ * partial file is kept so the transfer can be resumed, unless it is being discarded.
+ */
+static void end_transfer(struct TransferContext *ctx, bool discard)
+{
+    if (ctx->checking != NULL)
+    {
+        ctx->checking->cancelled = true;
+        if (discard)
+        {
+            discard_partial_file(ctx->checking->path);
+        }
+        ctx->checking = NULL;
+    }
+    if (ctx->fd >= 0)
+    {
+        close(ctx->fd);
+        ctx->fd = -1;
+        if (discard)
+        {
+            gchar *path = partial_path(ctx, ctx->name);
+            discard_partial_file(path);
+            g_free(path);
+        }
+        else if (ctx->offset < ctx->size)
+        {
+            LE_INFO(
+                "Transfer of %s suspended at %u of %u bytes", ctx->name, ctx->offset, ctx->size);
+        }
+    }
+    g_free(ctx->name);
+    ctx->name = NULL;
+
+    gchar *device = ctx->device;
+    ctx->device = NULL;
+    if (device != NULL)
+    {
+        SubscriptionRemove(&ctx->control_subscription, device);
+        g_free(device);
+    }
+}
+
+/*
+ * Computes the CRC of what is already in the partial file, reading it a block at a time. A
+ * partial file longer than the new transfer can't belong to it, so it is emptied. Runs on the
+ * storage worker.
+ */
+static bool check_partial_file(int fd, guint32 size, guint32 *length, guint32 *crc)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        return false;
+    }
+    if ((guint64)st.st_size > size)
+    {
+        if (ftruncate(fd, 0) != 0)
+        {
+            return false;
+        }
+        st.st_size = 0;
+    }
+
+    guint8 block[TRANSFER_CRC_BLOCK_SIZE];
+    guint32 done = 0;
+    guint32 sum = 0;
+    while (done < st.st_size)
+    {
+        const ssize_t n = pread(fd, block, MIN(sizeof(block), (gsize)(st.st_size - done)), done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        sum = crc32_update(sum, block, n);
+        done += n;
+    }
+
+    *length = done;
+    *crc = sum;
+    return true;
+}
+
+static struct TransferContext *transfer_ref(struct TransferContext *ctx)
+{
+    ctx->refs++;
+    return ctx;
+}
+
+static void transfer_unref(struct TransferContext *ctx)
+{
+    if (--ctx->refs > 0)
+    {
+        return;
+    }
+    g_free(ctx->directory);
+    g_free(ctx);
+}
+
+static void free_start_check(gpointer data)
+{
+    struct start_check *check = data;
+    if (check->fd >= 0)
+    {
+        close(check->fd);
+    }
+    g_free(check->name);
+    g_free(check->path);
+    g_free(check->final_path);
+    transfer_unref(check->ctx);
+    g_free(check);
+}
+
+/*
+ * Runs on the storage worker. An existing file is only replaced if the client asked for it, and
+ * there has to be room for the rest of the file before anything is written.
+ */
+static void run_start_check(gpointer data)
+{
+    struct start_check *check = data;
+    check->status = TRANSFER_STATUS_STORAGE_ERROR;
+    if ((check->flags & TRANSFER_START_FLAG_REPLACE) == 0 &&
+        g_file_test(check->final_path, G_FILE_TEST_EXISTS))
+    {
+        check->status = TRANSFER_STATUS_EXISTS;
+        return;
+    }
+
+    if ((check->flags & TRANSFER_START_FLAG_RESTART) != 0)
+    {
+        g_unlink(check->path);
+    }
+    check->fd = open(check->path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    struct statvfs fs;
+    if (check->fd < 0 ||
+        !check_partial_file(check->fd, check->size, &check->length, &check->crc) ||
+        fstatvfs(check->fd, &fs) != 0)
+    {
+        check->error = errno;
+        return;
+    }
+    if ((guint64)fs.f_bavail * fs.f_frsize < check->size - check->length)
+    {
+        check->status = TRANSFER_STATUS_NO_SPACE;
+        return;
+    }
+
+    check->status = TRANSFER_STATUS_SUCCESS;
+}
+
+/*
+ * The response tells the client where to carry on from and the CRC of what is already stored, so
+ * it can check that the stored part matches its file before sending the rest. If it doesn't, the
+ * client starts again with the restart flag.
+ */
+static void start_check_complete(enum ExecutorResult result, gpointer data)
+{
+    struct start_check *check = data;
+    if (check->cancelled)
+    {
+        LE_INFO("Start of the transfer of %s was cancelled", check->name);
+        return;
+    }
+
+    struct TransferContext *ctx = check->ctx;
+    ctx->checking = NULL;
+    if (check->status != TRANSFER_STATUS_SUCCESS)
+    {
+        switch (check->status)
+        {
+        case TRANSFER_STATUS_EXISTS:
+            LE_WARN("Not replacing %s, the client didn't ask to", check->final_path);
+            break;
+        case TRANSFER_STATUS_NO_SPACE:
+            LE_WARN("Not enough space left for the %u bytes of %s", check->size, check->name);
+            break;
+        default:
+            LE_ERROR("Couldn't open %s: %s", check->path, strerror(check->error));
+            break;
+        }
+        // Releases the device's session
+        end_transfer(ctx, false);
+        send_response(ctx, TRANSFER_OPCODE_START, check->status);
+        return;
+    }
+
+    ctx->fd = check->fd;
+    check->fd = -1;
+    ctx->name = check->name;
+    check->name = NULL;
+    ctx->replace = (check->flags & TRANSFER_START_FLAG_REPLACE) != 0;
+    ctx->size = check->size;
+    ctx->expected_crc = check->expected_crc;
+    ctx->offset = check->length;
+    ctx->crc = check->crc;
+    ctx->chunks_since_ack = 0;
+    ctx->gap_reported = false;
+    ctx->resumed_at = check->length;
+    ctx->start_time = g_get_monotonic_time();
+
+    guint8 response[15];
+    response[0] = TRANSFER_OPCODE_RESPONSE;
+    response[1] = TRANSFER_OPCODE_START;
+    response[2] = TRANSFER_STATUS_SUCCESS;
+    put_le32(&response[3], ctx->offset);
+    put_le32(&response[7], ctx->crc);
+    put_le16(&response[11], check->chunk_size);
+    put_le16(&response[13], TRANSFER_WINDOW_CHUNKS);
+    notify_control_point(ctx, response, sizeof(response));
+
+    LE_INFO(
+        "%s %s (%u bytes) at %u with %u byte chunks",
+        (ctx->offset > 0) ? "Resuming" : "Receiving",
+        ctx->name,
+        ctx->size,
+        ctx->offset,
+        check->chunk_size);
+}
+
+/*
+ * Files larger than the configured maximum are refused straight away. Everything that touches the
+ * file system is checked on the storage worker, and the response is sent once that is done.
+ */
+static void start_transfer(
+    struct TransferContext *ctx,
+    const guint8 *request,
+    gsize request_size,
+    guint16 mtu,
+    const gchar *device)
+{
+    const guint8 flags = request[1];
+    const guint32 size = get_le32(&request[2]);
+    const guint32 expected_crc = get_le32(&request[6]);
+    const gsize name_len = request[10];
+    const gchar *name = (const gchar *)&request[11];
+    if (request_size != 11 + name_len || !is_valid_name(name, name_len))
+    {
+        send_response(ctx, TRANSFER_OPCODE_START, TRANSFER_STATUS_INVALID);
+        return;
+    }
+    if (size > ctx->max_size)
+    {
+        LE_WARN("Refusing a %u byte file, the limit is %u bytes", size, ctx->max_size);
+        send_response(ctx, TRANSFER_OPCODE_START, TRANSFER_STATUS_TOO_LARGE);
+        return;
+    }
+    if ((ctx->fd >= 0 || ctx->checking != NULL) && device != NULL && ctx->device != NULL &&
+        strcmp(device, ctx->device) != 0)
+    {
+        send_response(ctx, TRANSFER_OPCODE_START, TRANSFER_STATUS_BUSY);
+        return;
+    }
+    end_transfer(ctx, false);
+
+    struct start_check *check = g_new0(struct start_check, 1);
+    check->ctx = transfer_ref(ctx);
+    check->name = g_strndup(name, name_len);
+    check->path = partial_path(ctx, check->name);
+    check->final_path = g_build_filename(ctx->directory, check->name, NULL);
+    check->flags = flags;
+    check->size = size;
+    check->expected_crc = expected_crc;
+    check->chunk_size =
+        MIN(mtu - ATT_WRITE_HEADER_SIZE, ATT_MAX_VALUE_LEN) - TRANSFER_CHUNK_HEADER_SIZE;
+    check->fd = -1;
+    const bool queued = ExecutorSubmit(
+        EXECUTOR_QUEUE_STORAGE,
+        "transfer start",
+        run_start_check,
+        start_check_complete,
+        check,
+        free_start_check,
+        0);
+    if (!queued)
+    {
+        free_start_check(check);
+        send_response(ctx, TRANSFER_OPCODE_START, TRANSFER_STATUS_BUSY);
+        return;
+    }
+
+    ctx->checking = check;
+    if (device != NULL)
+    {
+        // The transfer is suspended if the device that started it disconnects
+        ctx->device = g_strdup(device);
+        SubscriptionAdd(&ctx->control_subscription, device);
+    }
+}
+
+static void free_commit_job(gpointer data)
+{
+    struct commit_job *job = data;
+    if (job->fd >= 0)
+    {
+        close(job->fd);
+    }
+    g_free(job->path);
+    g_free(job->final_path);
+    transfer_unref(job->ctx);
+    g_free(job);
+}
+
+/*
+ * Runs on the storage worker. Unless the client asked to replace it, a file that appeared under
+ * the name since the transfer started is left alone: the partial file is linked to the name, which
+ * fails if it is taken.
+ */
+static void run_commit(gpointer data)
+{
+    struct commit_job *job = data;
+    bool stored = (fsync(job->fd) == 0);
+    if (stored && job->replace)
+    {
+        stored = (g_rename(job->path, job->final_path) == 0);
+    }
+    else if (stored)
+    {
+        stored = (link(job->path, job->final_path) == 0);
+        if (stored)
+        {
+            g_unlink(job->path);
+        }
+    }
+    job->error = stored ? 0 : errno;
+    job->status = stored ? TRANSFER_STATUS_SUCCESS :
+        (job->error == EEXIST) ? TRANSFER_STATUS_EXISTS : TRANSFER_STATUS_STORAGE_ERROR;
+}
+
+static void commit_complete(enum ExecutorResult result, gpointer data)
+{
+    struct commit_job *job = data;
+    if (job->cancelled)
+    {
+        return;
+    }
+
+    struct TransferContext *ctx = job->ctx;
+    if (ctx->committing == job)
+    {
+        ctx->committing = NULL;
+    }
+    if (job->status != TRANSFER_STATUS_SUCCESS)
+    {
+        LE_ERROR("Couldn't store %s: %s", job->final_path, strerror(job->error));
+    }
+    else
+    {
+        const gint64 elapsed = MAX(g_get_monotonic_time() - job->start_time, 1);
+        LE_INFO(
+            "Received %s (%u bytes, %u resumed) at %" G_GINT64_FORMAT " B/s",
+            job->final_path,
+            job->size,
+            job->resumed_at,
+            (job->size - job->resumed_at) * G_USEC_PER_SEC / elapsed);
+    }
+    send_response(ctx, TRANSFER_OPCODE_COMMIT, job->status);
+}
+
+/*
+ * The file only takes its name once it is complete and its CRC matches. Flushing and naming it is
+ * left to the storage worker, and the response is sent once that is done. If the file can't be
+ * stored, the partial file is kept, so starting the transfer again resumes at the end and it can
+ * be retried.
+ */
+static void commit_transfer(struct TransferContext *ctx)
+{
+    if (ctx->fd < 0)
+    {
+        send_response(ctx, TRANSFER_OPCODE_COMMIT, TRANSFER_STATUS_NO_TRANSFER);
+        return;
+    }
+    if (ctx->offset != ctx->size)
+    {
+        send_response(ctx, TRANSFER_OPCODE_COMMIT, TRANSFER_STATUS_INCOMPLETE);
+        return;
+    }
+    if (ctx->crc != ctx->expected_crc)
+    {
+        LE_WARN(
+            "Discarding %s, its CRC is %08x instead of %08x",
+            ctx->name,
+            ctx->crc,
+            ctx->expected_crc);
+        end_transfer(ctx, true);
+        send_response(ctx, TRANSFER_OPCODE_COMMIT, TRANSFER_STATUS_CRC_MISMATCH);
+        return;
+    }
+
+    struct commit_job *job = g_new0(struct commit_job, 1);
+    job->ctx = transfer_ref(ctx);
+    job->fd = ctx->fd;
+    job->path = partial_path(ctx, ctx->name);
+    job->final_path = g_build_filename(ctx->directory, ctx->name, NULL);
+    job->replace = ctx->replace;
+    job->size = ctx->size;
+    job->resumed_at = ctx->resumed_at;
+    job->start_time = ctx->start_time;
+    const bool queued = ExecutorSubmit(
+        EXECUTOR_QUEUE_STORAGE,
+        "transfer commit",
+        run_commit,
+        commit_complete,
+        job,
+        free_commit_job,
+        0);
+    if (!queued)
+    {
+        // The transfer stays open, so the client can commit again
+        job->fd = -1;
+        free_commit_job(job);
+        send_response(ctx, TRANSFER_OPCODE_COMMIT, TRANSFER_STATUS_BUSY);
+        return;
+    }
+
+    // The job owns the file now, and the device is free to start another transfer
+    ctx->fd = -1;
+    ctx->committing = job;
+    end_transfer(ctx, false);
+}
+
+static gboolean handle_control_point_write(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *value,
+    GVariant *options,
+    gpointer user_data)
+{
+    struct TransferContext *ctx = user_data;
+    gsize size = 0;
+    const guint8 *request = NULL;
+    if (g_variant_is_of_type(value, G_VARIANT_TYPE_BYTESTRING))
+    {
+        request = g_variant_get_fixed_array(value, &size, sizeof(guint8));
+    }
+    if (size == 0)
+    {
+        GattReturnError(
+            interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.InvalidValueLength",
+            "Empty request");
+        return TRUE;
+    }
+    // Responses are notified, so there is no point accepting a request nobody will hear about
+    if (!SubscriptionHas(&ctx->control_subscription, NULL))
+    {
+        GattReturnError(
+            interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.NotPermitted",
+            "Control point notifications are off");
+        return TRUE;
+    }
+
+    switch (request[0])
+    {
+    case TRANSFER_OPCODE_START:
+    {
+        if (size < 11)
+        {
+            GattReturnError(
+                interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.InvalidValueLength",
+                "Expected opcode, flags, size, CRC and name");
+            return TRUE;
+        }
+        guint16 mtu = ATT_DEFAULT_MTU;
+        g_variant_lookup(options, "mtu", "q", &mtu);
+        // Completed first, so the client sees the write succeed before the response
+        bluez_gatt_characteristic1_complete_write_value(interface, invocation);
+        start_transfer(
+            ctx, request, size, MAX(mtu, ATT_DEFAULT_MTU), GattOptionsGetDevice(options));
+        return TRUE;
+    }
+
+    case TRANSFER_OPCODE_COMMIT:
+        bluez_gatt_characteristic1_complete_write_value(interface, invocation);
+        commit_transfer(ctx);
+        return TRUE;
+
+    case TRANSFER_OPCODE_ABORT:
+    {
+        const guint8 status = (ctx->fd >= 0 || ctx->checking != NULL) ?
+            TRANSFER_STATUS_SUCCESS : TRANSFER_STATUS_NO_TRANSFER;
+        end_transfer(ctx, true);
+        bluez_gatt_characteristic1_complete_write_value(interface, invocation);
+        send_response(ctx, TRANSFER_OPCODE_ABORT, status);
+        return TRUE;
+    }
+
+    default:
+        GattReturnError(
+            interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.NotSupported",
+            "Unknown opcode");
+        return TRUE;
+    }
+}
+
+/*
+ * Unlike opening, checking and committing a file, chunks are written on the main loop. A chunk is
+ * at most one ATT value, which pwrite() copies into the page cache without waiting for the flash,
+ * and writing it in place keeps the acknowledgements in step with what is stored. The data only
+ * has to reach the flash at commit, where fsync() runs on the storage worker.
+ */
+static bool write_chunk(struct TransferContext *ctx, const guint8 *data, gsize size)
+{
+    gsize done = 0;
+    while (done < size)
+    {
+        const ssize_t n = pwrite(ctx->fd, data + done, size - done, ctx->offset + done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+/*
+ * Chunks are written straight to the partial file at their offset, so no more than one chunk is
+ * ever held in memory. A chunk that doesn't start where the file ends means an earlier one was
+ * lost. It is dropped and the client is told once where to resend from. The chunks it sent before
+ * hearing that, and chunks that were already written, are dropped quietly.
+ */
+static gboolean handle_data_write(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *value,
+    GVariant *options,
+    gpointer user_data)
+{
+    struct TransferContext *ctx = user_data;
+    gsize size;
+    const guint8 *chunk = g_variant_get_fixed_array(value, &size, sizeof(guint8));
+    const gchar *device = GattOptionsGetDevice(options);
+    if (ctx->fd < 0 ||
+        (device != NULL && ctx->device != NULL && strcmp(device, ctx->device) != 0))
+    {
+        GattReturnError(
+            interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.NotPermitted",
+            "No transfer in progress");
+        return TRUE;
+    }
+    if (size <= TRANSFER_CHUNK_HEADER_SIZE)
+    {
+        GattReturnError(
+            interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.InvalidValueLength",
+            "Expected offset and data");
+        return TRUE;
+    }
+
+    const guint32 offset = get_le32(chunk);
+    const guint8 *data = &chunk[TRANSFER_CHUNK_HEADER_SIZE];
+    const gsize data_size = size - TRANSFER_CHUNK_HEADER_SIZE;
+    if (offset != ctx->offset)
+    {
+        if (offset > ctx->offset && !ctx->gap_reported)
+        {
+            ctx->gap_reported = true;
+            send_ack(ctx, TRANSFER_OPCODE_RESEND);
+        }
+        bluez_gatt_characteristic1_complete_write_value(interface, invocation);
+        return TRUE;
+    }
+    if (data_size > ctx->size - ctx->offset)
+    {
+        GattReturnError(
+            interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.InvalidValueLength",
+            "Past the end of the file");
+        return TRUE;
+    }
+    if (!write_chunk(ctx, data, data_size))
+    {
+        LE_ERROR("Couldn't write %s: %s", ctx->name, strerror(errno));
+        end_transfer(ctx, false);
+        GattReturnError(
+            interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.Failed",
+            "Storage error");
+        return TRUE;
+    }
+
+    ctx->crc = crc32_update(ctx->crc, data, data_size);
+    ctx->offset += data_size;
+    ctx->gap_reported = false;
+    if (++ctx->chunks_since_ack >= TRANSFER_ACK_INTERVAL || ctx->offset == ctx->size)
+    {
+        send_ack(ctx, TRANSFER_OPCODE_ACK);
+    }
+
+    bluez_gatt_characteristic1_complete_write_value(interface, invocation);
+    return TRUE;
+}
+
+static gboolean handle_control_point_start_notify(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    gpointer user_data)
+{
+    struct TransferContext *ctx = user_data;
+    SubscriptionAdd(&ctx->control_subscription, NULL);
+
+    bluez_gatt_characteristic1_complete_start_notify(interface, invocation);
+    return TRUE;
+}
+
+static gboolean handle_control_point_stop_notify(
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    gpointer user_data)
+{
+    struct TransferContext *ctx = user_data;
+    SubscriptionRemove(&ctx->control_subscription, NULL);
+
+    bluez_gatt_characteristic1_complete_stop_notify(interface, invocation);
+    return TRUE;
+}
+
+static void bind_control_point(gpointer context, BluezGattCharacteristic1 *characteristic)
+{
+    struct TransferContext *ctx = context;
+    ctx->control_point_characteristic = characteristic;
+}
+
+/*
+ * A transfer is suspended when its device disconnects, or when nobody is left to hear its
+ * acknowledgements. What was written so far stays on disk for the client to resume.
+ */
+static void control_subscription_changed(
+    struct Subscription *subscription, const gchar *device, bool subscribed, gpointer context)
+{
+    struct TransferContext *ctx = context;
+    if (!subscribed && (device == NULL || g_strcmp0(device, ctx->device) == 0))
+    {
+        end_transfer(ctx, false);
+    }
+}
+
+static gpointer transfer_init(void)
+{
+    struct TransferContext *ctx = g_malloc0(sizeof(*ctx));
+    ctx->refs = 1;
+    ctx->fd = -1;
+    const char *directory = getenv(ENV_TRANSFER_DIR);
+    ctx->directory = g_strdup((directory != NULL) ? directory : DEFAULT_TRANSFER_DIR);
+    const char *max_size = getenv(ENV_TRANSFER_MAX_SIZE);
+    ctx->max_size = (max_size != NULL) ?
+        (guint32)MIN(strtoul(max_size, NULL, 10), G_MAXUINT32) : DEFAULT_TRANSFER_MAX_SIZE;
+    if (g_mkdir_with_parents(ctx->directory, 0700) != 0)
+    {
+        LE_ERROR("Couldn't create %s: %s", ctx->directory, strerror(errno));
+    }
+    if (crc_table[1] == 0)
+    {
+        init_crc_table();
+    }
+    SubscriptionInit(
+        &ctx->control_subscription, "transfer/control_point", control_subscription_changed, ctx);
+    return ctx;
+}
+
+static void transfer_fini(gpointer context)
+{
+    struct TransferContext *ctx = context;
+    end_transfer(ctx, false);
+    if (ctx->committing != NULL)
+    {
+        // The file is still stored, but there is nobody left to respond to
+        ctx->committing->cancelled = true;
+        ctx->committing = NULL;
+    }
+    SubscriptionFini(&ctx->control_subscription);
+    // A job still on the storage worker keeps the context until it is done
+    transfer_unref(ctx);
+}
+
+/*
+ * Writes need an encrypted, authenticated (MITM protected) link, since they put files on the
+ * device.
+ */
+static const gchar *const control_point_flags[] = {
+    "write",
+    "encrypt-authenticated-write",
+    "notify",
+    NULL
+};
+
+static const gchar *const data_flags[] = {
+    "write-without-response",
+    "write",
+    "encrypt-authenticated-write",
+    NULL
+};
+
+static const struct GattCharacteristicDefinition transfer_characteristics[] = {
+    {
+        .name = "control_point",
+        .uuid = TRANSFER_CONTROL_POINT_CHARACTERISTIC_UUID,
+        .flags = control_point_flags,
+        .write = handle_control_point_write,
+        .startNotify = handle_control_point_start_notify,
+        .stopNotify = handle_control_point_stop_notify,
+        .bind = bind_control_point,
+    },
+    {
+        .name = "data",
+        .uuid = TRANSFER_DATA_CHARACTERISTIC_UUID,
+        .flags = data_flags,
+        .write = handle_data_write,
+    },
+};
+
+const struct GattServiceDefinition transfer_service_definition = {
+    .name = "transfer",
+    .uuid = TRANSFER_SERVICE_UUID,
+    .primary = true,
+    // Writes client data to storage, so it is only served when enabled explicitly
+    .optIn = true,
+    .init = transfer_init,
+    .fini = transfer_fini,
+    .characteristics = transfer_characteristics,
+    .numCharacteristics = G_N_ELEMENTS(transfer_characteristics),
+};
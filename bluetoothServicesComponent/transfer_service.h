@@ -0,0 +1,10 @@
+#ifndef _TRANSFER_SERVICE_H
+#define _TRANSFER_SERVICE_H
+
+#include "gatt_database.h"
+
+#define TRANSFER_SERVICE_UUID "a2b6f0c0-3d4e-4c8a-9b61-7f2f4c1b6000"
+
+extern const struct GattServiceDefinition transfer_service_definition;
+
+#endif // _TRANSFER_SERVICE_H
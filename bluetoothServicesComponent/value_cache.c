@@ -0,0 +1,122 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// GLib
+#include <glib.h>
+
+// Legato
+#include "legato.h"
+
+// Local
+#include "value_cache.h"
+
+static struct ValueCacheStats Totals;
+
+static void ReplaceValue(struct ValueCache *cache, GVariant *value)
+{
+    g_variant_ref_sink(value);
+    if (cache->value != NULL)
+    {
+        g_variant_unref(cache->value);
+    }
+    cache->value = value;
+    ValueCacheRenew(cache);
+}
+
+void ValueCacheInit(struct ValueCache *cache)
+{
+    memset(cache, 0, sizeof(*cache));
+}
+
+/*
+ * Initializes a cache that always serves the given constant. The data is referenced rather than
+ * copied, so it must have static storage duration.
+ */
+void ValueCacheInitStatic(struct ValueCache *cache, const guint8 *data, gsize size)
+{
+    ValueCacheInit(cache);
+    ReplaceValue(
+        cache, g_variant_new_from_data(G_VARIANT_TYPE_BYTESTRING, data, size, TRUE, NULL, NULL));
+}
+
+/*
+ * Initializes a cache whose value expires ttlUs after it is set. Reads of an expired value, or of
+ * a value that was never set, call refresh.
+ */
+void ValueCacheInitPulled(
+    struct ValueCache *cache, gint64 ttlUs, ValueCacheRefreshFunc refresh, gpointer context)
+{
+    ValueCacheInit(cache);
+    cache->ttlUs = ttlUs;
+    cache->refresh = refresh;
+    cache->refreshContext = context;
+}
+
+/*
+ * Called by the producer when the value changes. Returns the new cached variant, which remains
+ * owned by the cache.
+ */
+GVariant *ValueCacheSet(struct ValueCache *cache, const guint8 *data, gsize size)
+{
+    ReplaceValue(
+        cache, g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data, size, sizeof(guint8)));
+    return cache->value;
+}
+
+// Keeps the current value for another time to live, eg. when fetching it again failed
+void ValueCacheRenew(struct ValueCache *cache)
+{
+    cache->expiresAt = (cache->ttlUs > 0) ? (g_get_monotonic_time() + cache->ttlUs) : 0;
+    cache->refreshing = false;
+}
+
+void ValueCacheInvalidate(struct ValueCache *cache)
+{
+    if (cache->value != NULL)
+    {
+        g_variant_unref(cache->value);
+        cache->value = NULL;
+    }
+}
+
+/*
+ * Returns the cached value, which is owned by the cache. A miss means the producer hasn't set a
+ * value yet (or it was invalidated), which returns NULL, or that the value has expired, which
+ * still returns it while the producer fetches it again.
+ */
+GVariant *ValueCacheGet(struct ValueCache *cache)
+{
+    const bool expired = (cache->expiresAt != 0 && g_get_monotonic_time() >= cache->expiresAt);
+    if (cache->value != NULL && !expired)
+    {
+        cache->hits++;
+        Totals.hits++;
+        return cache->value;
+    }
+
+    cache->misses++;
+    Totals.misses++;
+    if (cache->refresh != NULL && !cache->refreshing)
+    {
+        cache->refreshing = true;
+        cache->refresh(cache->refreshContext);
+    }
+    return cache->value;
+}
+
+void ValueCacheGetTotals(struct ValueCacheStats *stats)
+{
+    *stats = Totals;
+}
+
+void ValueCacheSummarize(GString *json)
+{
+    g_string_append_printf(
+        json,
+        "{\"hits\":%" G_GUINT64_FORMAT ",\"misses\":%" G_GUINT64_FORMAT "}",
+        Totals.hits,
+        Totals.misses);
+}
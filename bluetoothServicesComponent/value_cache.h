@@ -0,0 +1,53 @@
+#ifndef _VALUE_CACHE_H
+#define _VALUE_CACHE_H
+
+#include <stdbool.h>
+
+#include <glib.h>
+
+/*
+ * Holds the serialized ("ay") GVariant served for one characteristic or descriptor. The variant is
+ * immutable, so read handlers can pass it straight to the complete function without building a new
+ * one. Producers replace it by calling ValueCacheSet when the underlying value changes. Caches are
+ * only used from the main loop.
+ *
+ * Pulled values, which nobody pushes when they change, can be given a time to live instead. A read
+ * of an expired value still gets it, and asks the producer to fetch it again. The producer sets
+ * the new value when it has it, or renews the old one if the fetch failed.
+ */
+
+// Starts fetching the value again. Called at most once until the value is set or renewed.
+typedef void (*ValueCacheRefreshFunc)(gpointer context);
+
+struct ValueCache
+{
+    GVariant *value;
+    // How long a pulled value stays valid. 0 means the value never expires.
+    gint64 ttlUs;
+    gint64 expiresAt;
+    ValueCacheRefreshFunc refresh;
+    gpointer refreshContext;
+    bool refreshing;
+    guint64 hits;
+    guint64 misses;
+};
+
+struct ValueCacheStats
+{
+    guint64 hits;
+    guint64 misses;
+};
+
+void ValueCacheInit(struct ValueCache *cache);
+void ValueCacheInitStatic(struct ValueCache *cache, const guint8 *data, gsize size);
+void ValueCacheInitPulled(
+    struct ValueCache *cache, gint64 ttlUs, ValueCacheRefreshFunc refresh, gpointer context);
+GVariant *ValueCacheSet(struct ValueCache *cache, const guint8 *data, gsize size);
+void ValueCacheRenew(struct ValueCache *cache);
+void ValueCacheInvalidate(struct ValueCache *cache);
+GVariant *ValueCacheGet(struct ValueCache *cache);
+void ValueCacheGetTotals(struct ValueCacheStats *stats);
+// Appends the totals as a JSON object, for publishing with the GATT statistics
+void ValueCacheSummarize(GString *json);
+
+#endif // _VALUE_CACHE_H
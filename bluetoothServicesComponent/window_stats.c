@@ -0,0 +1,228 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// GLib
+#include <glib.h>
+
+// Legato
+#include "legato.h"
+
+// Local
+#include "window_stats.h"
+
+#define MIN_REGRESSION_SAMPLES 3
+
+static struct WindowSample *Sample(const struct WindowStats *stats, guint64 index)
+{
+    return &stats->samples[index % stats->capacity];
+}
+
+static guint64 QueueFront(const struct WindowStats *stats, const struct WindowExtremeQueue *queue)
+{
+    return queue->indices[queue->head];
+}
+
+static guint64 QueueBack(const struct WindowStats *stats, const struct WindowExtremeQueue *queue)
+{
+    return queue->indices[(queue->head + queue->length - 1) % stats->capacity];
+}
+
+static void QueuePopFront(const struct WindowStats *stats, struct WindowExtremeQueue *queue)
+{
+    queue->head = (queue->head + 1) % stats->capacity;
+    queue->length--;
+}
+
+/*
+ * Samples that the new one dominates can never be the extreme again, since the new one outlives
+ * them, so they are dropped from the back before it is added. Each sample is pushed and popped at
+ * most once.
+ */
+static void QueuePush(
+    const struct WindowStats *stats,
+    struct WindowExtremeQueue *queue,
+    guint64 index,
+    bool isMinimum)
+{
+    const double value = Sample(stats, index)->value;
+    while (queue->length > 0)
+    {
+        const double back = Sample(stats, QueueBack(stats, queue))->value;
+        if (isMinimum ? (back < value) : (back > value))
+        {
+            break;
+        }
+        queue->length--;
+    }
+    queue->indices[(queue->head + queue->length) % stats->capacity] = index;
+    queue->length++;
+}
+
+// Welford's update, extended to the co-moment of time and value
+static void AddMoments(struct WindowStats *stats, const struct WindowSample *sample)
+{
+    const double n = WindowStatsCount(stats);
+    const double dt = sample->timestamp - stats->meanTime;
+    stats->meanTime += dt / n;
+    stats->meanValue += (sample->value - stats->meanValue) / n;
+    stats->timeSquares += dt * (sample->timestamp - stats->meanTime);
+    stats->coproducts += dt * (sample->value - stats->meanValue);
+}
+
+// The inverse of AddMoments, called before the oldest sample leaves the window
+static void RemoveMoments(struct WindowStats *stats, const struct WindowSample *sample)
+{
+    const double n = WindowStatsCount(stats);
+    if (n <= 1)
+    {
+        stats->meanTime = 0.0;
+        stats->meanValue = 0.0;
+        stats->timeSquares = 0.0;
+        stats->coproducts = 0.0;
+        return;
+    }
+
+    const double meanTime = stats->meanTime - (sample->timestamp - stats->meanTime) / (n - 1);
+    const double meanValue = stats->meanValue - (sample->value - stats->meanValue) / (n - 1);
+    stats->timeSquares -= (sample->timestamp - meanTime) * (sample->timestamp - stats->meanTime);
+    stats->timeSquares = MAX(stats->timeSquares, 0.0);
+    stats->coproducts -= (sample->timestamp - meanTime) * (sample->value - stats->meanValue);
+    stats->meanTime = meanTime;
+    stats->meanValue = meanValue;
+}
+
+/*
+ * Sliding updates slowly accumulate rounding errors, so the moments are recomputed from the window
+ * once every capacity samples, which keeps the cost per sample constant.
+ */
+static void RecomputeMoments(struct WindowStats *stats)
+{
+    const double n = WindowStatsCount(stats);
+    double sumTime = 0.0;
+    double sumValue = 0.0;
+    for (guint64 i = stats->first; i < stats->next; i++)
+    {
+        sumTime += Sample(stats, i)->timestamp;
+        sumValue += Sample(stats, i)->value;
+    }
+    stats->meanTime = sumTime / n;
+    stats->meanValue = sumValue / n;
+
+    stats->timeSquares = 0.0;
+    stats->coproducts = 0.0;
+    for (guint64 i = stats->first; i < stats->next; i++)
+    {
+        const struct WindowSample *sample = Sample(stats, i);
+        const double dt = sample->timestamp - stats->meanTime;
+        stats->timeSquares += dt * dt;
+        stats->coproducts += dt * (sample->value - stats->meanValue);
+    }
+}
+
+static void RemoveOldest(struct WindowStats *stats)
+{
+    RemoveMoments(stats, Sample(stats, stats->first));
+    if (QueueFront(stats, &stats->minimum) == stats->first)
+    {
+        QueuePopFront(stats, &stats->minimum);
+    }
+    if (QueueFront(stats, &stats->maximum) == stats->first)
+    {
+        QueuePopFront(stats, &stats->maximum);
+    }
+    stats->first++;
+}
+
+void WindowStatsInit(struct WindowStats *stats, double windowSeconds, guint capacity)
+{
+    LE_ASSERT(capacity > 0);
+    *stats = (struct WindowStats){
+        .windowSeconds = windowSeconds,
+        .samples = g_new0(struct WindowSample, capacity),
+        .capacity = capacity,
+        .minimum.indices = g_new0(guint64, capacity),
+        .maximum.indices = g_new0(guint64, capacity),
+    };
+}
+
+void WindowStatsFini(struct WindowStats *stats)
+{
+    g_free(stats->samples);
+    g_free(stats->minimum.indices);
+    g_free(stats->maximum.indices);
+}
+
+/*
+ * Samples that fall out of the window, or don't fit, are dropped first. A sample stamped earlier
+ * than the newest one (eg. after the clock was set back) is added with the newest timestamp
+ * instead, so the window stays in order.
+ */
+void WindowStatsAdd(struct WindowStats *stats, double timestamp, double value)
+{
+    if (WindowStatsCount(stats) > 0)
+    {
+        timestamp = MAX(timestamp, WindowStatsNewest(stats)->timestamp);
+    }
+    while (WindowStatsCount(stats) > 0 &&
+           (WindowStatsCount(stats) == stats->capacity ||
+            Sample(stats, stats->first)->timestamp < timestamp - stats->windowSeconds))
+    {
+        RemoveOldest(stats);
+    }
+
+    const guint64 index = stats->next++;
+    struct WindowSample *sample = Sample(stats, index);
+    sample->timestamp = timestamp;
+    sample->value = value;
+    AddMoments(stats, sample);
+    QueuePush(stats, &stats->minimum, index, true);
+    QueuePush(stats, &stats->maximum, index, false);
+
+    if (stats->next % stats->capacity == 0)
+    {
+        RecomputeMoments(stats);
+    }
+}
+
+double WindowStatsMin(const struct WindowStats *stats)
+{
+    return Sample(stats, QueueFront(stats, &stats->minimum))->value;
+}
+
+double WindowStatsMax(const struct WindowStats *stats)
+{
+    return Sample(stats, QueueFront(stats, &stats->maximum))->value;
+}
+
+const struct WindowSample *WindowStatsNewest(const struct WindowStats *stats)
+{
+    return Sample(stats, stats->next - 1);
+}
+
+double WindowStatsSpan(const struct WindowStats *stats)
+{
+    return WindowStatsNewest(stats)->timestamp - Sample(stats, stats->first)->timestamp;
+}
+
+bool WindowStatsSlope(const struct WindowStats *stats, double *slope)
+{
+    if (WindowStatsCount(stats) < MIN_REGRESSION_SAMPLES || WindowStatsSpan(stats) <= 0.0 ||
+        stats->timeSquares <= 0.0)
+    {
+        return false;
+    }
+    *slope = stats->coproducts / stats->timeSquares;
+    return true;
+}
+
+double WindowStatsFitted(const struct WindowStats *stats, double timestamp)
+{
+    double slope;
+    if (!WindowStatsSlope(stats, &slope))
+    {
+        return stats->meanValue;
+    }
+    return stats->meanValue + slope * (timestamp - stats->meanTime);
+}
@@ -0,0 +1,75 @@
+#ifndef _WINDOW_STATS_H
+#define _WINDOW_STATS_H
+
+#include <stdbool.h>
+
+#include <glib.h>
+
+/*
+ * Statistics over a sliding window of timestamped samples, updated as each sample arrives: the
+ * minimum, maximum and mean value and the least squares slope of value against time. The window
+ * keeps the samples of the last windowSeconds, and at most capacity of them. Adding a sample takes
+ * amortized constant time (the minimum and maximum are kept in monotonic queues and the regression
+ * in running moments), and every accessor is constant time, so nothing ever scans the window.
+ */
+struct WindowSample
+{
+    double timestamp; // Seconds
+    double value;
+};
+
+// Absolute indices of samples, oldest first, whose values only increase (or only decrease)
+struct WindowExtremeQueue
+{
+    guint64 *indices;
+    guint head;
+    guint length;
+};
+
+struct WindowStats
+{
+    double windowSeconds;
+    struct WindowSample *samples;
+    guint capacity;
+    // Absolute indices count every sample ever added. The window holds [first, next).
+    guint64 first;
+    guint64 next;
+    struct WindowExtremeQueue minimum;
+    struct WindowExtremeQueue maximum;
+    double meanTime;
+    double meanValue;
+    // Sums of (t - meanTime)^2 and (t - meanTime)(v - meanValue) over the window
+    double timeSquares;
+    double coproducts;
+};
+
+void WindowStatsInit(struct WindowStats *stats, double windowSeconds, guint capacity);
+void WindowStatsFini(struct WindowStats *stats);
+void WindowStatsAdd(struct WindowStats *stats, double timestamp, double value);
+
+// The accessors below may only be called on a window that isn't empty
+double WindowStatsMin(const struct WindowStats *stats);
+double WindowStatsMax(const struct WindowStats *stats);
+const struct WindowSample *WindowStatsNewest(const struct WindowStats *stats);
+// Time between the oldest and newest sample, in seconds
+double WindowStatsSpan(const struct WindowStats *stats);
+
+/*
+ * The slope of the regression line in value per second. Returns false if there are fewer than
+ * three samples or they all have the same timestamp.
+ */
+bool WindowStatsSlope(const struct WindowStats *stats, double *slope);
+// The value of the regression line at the given time, or the mean if there is no slope
+double WindowStatsFitted(const struct WindowStats *stats, double timestamp);
+
+static inline guint WindowStatsCount(const struct WindowStats *stats)
+{
+    return stats->next - stats->first;
+}
+
+static inline double WindowStatsMean(const struct WindowStats *stats)
+{
+    return stats->meanValue;
+}
+
+#endif // _WINDOW_STATS_H
@@ -0,0 +1,287 @@
+// C standard library
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// GLib
+#include <glib.h>
+#include <gio/gio.h>
+
+// Legato
+#include "legato.h"
+
+// Local
+#include "write_assembly.h"
+#include "subscriptions.h"
+#include "gatt_stats.h"
+
+// Device paths look like /org/bluez/hci0/dev_00_11_22_33_44_55
+#define DEVICE_PATH_MAX_LEN 64
+
+/*
+ * A value being assembled for one client. Free while owner is NULL.
+ */
+struct WriteSlot
+{
+    struct WriteAssembler *owner;
+    BluezGattCharacteristic1 *interface;
+    gchar device[DEVICE_PATH_MAX_LEN]; // "" if bluetoothd didn't say
+    guint8 data[WRITE_ASSEMBLY_MAX_LEN];
+    gsize size;
+    gint64 lastWriteTime;
+    guint idleTimer;
+};
+
+static struct WriteSlot Pool[WRITE_ASSEMBLY_POOL_SIZE];
+
+struct WriteRequest
+{
+    const gchar *device;
+    const gchar *type;
+    guint16 offset;
+    gboolean prepareAuthorize;
+};
+
+static void ParseRequest(GVariant *options, struct WriteRequest *request)
+{
+    request->device = GattOptionsGetDevice(options);
+    if (request->device == NULL)
+    {
+        request->device = "";
+    }
+    request->type = "request";
+    request->offset = 0;
+    request->prepareAuthorize = FALSE;
+    bool typed = false;
+    if (options != NULL)
+    {
+        typed = g_variant_lookup(options, "type", "&s", &request->type);
+        g_variant_lookup(options, "offset", "q", &request->offset);
+        g_variant_lookup(options, "prepare-authorize", "b", &request->prepareAuthorize);
+    }
+    // bluetoothd older than about 5.50 doesn't say what kind of write it is. There, only the
+    // pieces of a queued write have an offset.
+    if (!typed && request->offset != 0)
+    {
+        request->type = "reliable";
+    }
+}
+
+static struct WriteSlot *FindSlot(const struct WriteAssembler *assembler, const gchar *device)
+{
+    for (size_t i = 0; i < G_N_ELEMENTS(Pool); i++)
+    {
+        if (Pool[i].owner == assembler && strcmp(Pool[i].device, device) == 0)
+        {
+            return &Pool[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void ReleaseSlot(struct WriteSlot *slot)
+{
+    if (slot->idleTimer != 0)
+    {
+        g_source_remove(slot->idleTimer);
+        slot->idleTimer = 0;
+    }
+    slot->owner = NULL;
+    slot->interface = NULL;
+}
+
+/*
+ * Validates and commits a complete value. Returns the error name if it was rejected.
+ */
+static const gchar *Commit(struct WriteAssembler *assembler, const guint8 *data, gsize size)
+{
+    const gchar *error = (assembler->validate != NULL) ?
+        assembler->validate(data, size, assembler->context) : NULL;
+    if (error != NULL)
+    {
+        assembler->numRejected++;
+        return error;
+    }
+
+    assembler->numCommitted++;
+    assembler->commit(data, size, assembler->context);
+    return NULL;
+}
+
+static gboolean SlotIdleTimerExpired(gpointer userData)
+{
+    struct WriteSlot *slot = userData;
+    if (g_get_monotonic_time() - slot->lastWriteTime < WRITE_ASSEMBLY_IDLE_MS * 1000)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+
+    slot->idleTimer = 0;
+    struct WriteAssembler *assembler = slot->owner;
+    const gchar *error = Commit(assembler, slot->data, slot->size);
+    if (error != NULL)
+    {
+        // The client has already been told each piece was accepted
+        LE_WARN(
+            "Rejected %zu byte long write to %s from %s: %s",
+            slot->size,
+            assembler->name,
+            (slot->device[0] != '\0') ? slot->device : "unknown device",
+            error);
+        GattStatsRecordError(slot->interface, GATT_OPERATION_WRITE);
+    }
+    ReleaseSlot(slot);
+
+    return G_SOURCE_REMOVE;
+}
+
+static struct WriteSlot *AcquireSlot(
+    struct WriteAssembler *assembler,
+    BluezGattCharacteristic1 *interface,
+    const gchar *device)
+{
+    if (strlen(device) >= DEVICE_PATH_MAX_LEN)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < G_N_ELEMENTS(Pool); i++)
+    {
+        struct WriteSlot *slot = &Pool[i];
+        if (slot->owner == NULL)
+        {
+            slot->owner = assembler;
+            slot->interface = interface;
+            g_strlcpy(slot->device, device, sizeof(slot->device));
+            slot->size = 0;
+            // One timer per value, checked against the time of the latest piece
+            slot->idleTimer = g_timeout_add(WRITE_ASSEMBLY_IDLE_MS, SlotIdleTimerExpired, slot);
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+void WriteAssemblerInit(
+    struct WriteAssembler *assembler,
+    const gchar *name,
+    gsize maxSize,
+    WriteValidateFunc validate,
+    WriteCommitFunc commit,
+    gpointer context)
+{
+    memset(assembler, 0, sizeof(*assembler));
+    assembler->name = name;
+    assembler->maxSize = MIN(maxSize, WRITE_ASSEMBLY_MAX_LEN);
+    assembler->validate = validate;
+    assembler->commit = commit;
+    assembler->context = context;
+}
+
+void WriteAssemblerFini(struct WriteAssembler *assembler)
+{
+    for (size_t i = 0; i < G_N_ELEMENTS(Pool); i++)
+    {
+        if (Pool[i].owner == assembler)
+        {
+            ReleaseSlot(&Pool[i]);
+        }
+    }
+}
+
+void WriteAssemblerHandle(
+    struct WriteAssembler *assembler,
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *value,
+    GVariant *options)
+{
+    if (!g_variant_is_of_type(value, G_VARIANT_TYPE_BYTESTRING))
+    {
+        GattReturnError(
+            interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.Failed",
+            "Expected a byte array");
+        return;
+    }
+
+    gsize size;
+    const guint8 *data = g_variant_get_fixed_array(value, &size, sizeof(guint8));
+    struct WriteRequest request;
+    ParseRequest(options, &request);
+
+    if (request.offset + size > assembler->maxSize)
+    {
+        struct WriteSlot *slot = FindSlot(assembler, request.device);
+        if (slot != NULL && !request.prepareAuthorize)
+        {
+            ReleaseSlot(slot);
+        }
+        GattReturnError(
+            interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.InvalidValueLength",
+            "Value too long");
+        return;
+    }
+
+    // bluetoothd asks before queueing a Prepare Write. The data follows when it is executed.
+    if (request.prepareAuthorize)
+    {
+        bluez_gatt_characteristic1_complete_write_value(interface, invocation);
+        return;
+    }
+
+    // Write Requests and Write Commands carry the whole value, whatever its size
+    if (strcmp(request.type, "reliable") != 0)
+    {
+        if (request.offset != 0)
+        {
+            GattReturnError(
+                interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.InvalidOffset",
+                "Only queued writes have an offset");
+            return;
+        }
+
+        const gchar *error = Commit(assembler, data, size);
+        if (error != NULL)
+        {
+            GattReturnError(interface, invocation, GATT_OPERATION_WRITE, error, "Invalid value");
+            return;
+        }
+        bluez_gatt_characteristic1_complete_write_value(interface, invocation);
+        return;
+    }
+
+    struct WriteSlot *slot = FindSlot(assembler, request.device);
+    if (request.offset == 0)
+    {
+        // A queued write at offset 0 always starts a new value
+        if (slot != NULL)
+        {
+            ReleaseSlot(slot);
+        }
+
+        slot = AcquireSlot(assembler, interface, request.device);
+        if (slot == NULL)
+        {
+            LE_WARN("No buffer free to assemble a long write to %s", assembler->name);
+            GattReturnError(
+                interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.Failed",
+                "No buffer free");
+            return;
+        }
+    }
+    else if (slot == NULL || request.offset > slot->size)
+    {
+        GattReturnError(
+            interface, invocation, GATT_OPERATION_WRITE, "org.bluez.Error.InvalidOffset",
+            "Offset doesn't continue a write in progress");
+        return;
+    }
+
+    memcpy(&slot->data[request.offset], data, size);
+    slot->size = MAX(slot->size, request.offset + size);
+    slot->lastWriteTime = g_get_monotonic_time();
+    bluez_gatt_characteristic1_complete_write_value(interface, invocation);
+}
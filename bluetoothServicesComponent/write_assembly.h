@@ -0,0 +1,66 @@
+#ifndef _WRITE_ASSEMBLY_H
+#define _WRITE_ASSEMBLY_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "org.bluez.GattCharacteristic1.h"
+
+/*
+ * Assembles characteristic values written in several pieces: long writes and reliable writes,
+ * which bluetoothd queues from ATT Prepare Write requests and replays as one WriteValue call per
+ * piece, with the "offset" option and type "reliable", when the client executes them. Pieces are
+ * collected per client in buffers from a fixed pool, so nothing is allocated per piece and memory
+ * stays bounded however many clients write at once.
+ *
+ * bluetoothd waits for each piece to complete before sending the next and doesn't say which piece
+ * is the last, so a value is committed once its client has been quiet for
+ * WRITE_ASSEMBLY_IDLE_MS. The whole value is validated once, at that point, and a rejected value
+ * can only be logged. Write Requests and Write Commands (types "request" and "command") always
+ * carry the whole value, so they are committed straight away and validation errors are returned to
+ * the client.
+ */
+
+// The longest attribute value ATT allows
+#define WRITE_ASSEMBLY_MAX_LEN 512
+#define WRITE_ASSEMBLY_POOL_SIZE 8
+#define WRITE_ASSEMBLY_IDLE_MS 50
+
+/*
+ * Returns NULL if the complete value may be committed, otherwise the org.bluez.Error name to fail
+ * the write with.
+ */
+typedef const gchar *(*WriteValidateFunc)(const guint8 *data, gsize size, gpointer context);
+typedef void (*WriteCommitFunc)(const guint8 *data, gsize size, gpointer context);
+
+struct WriteAssembler
+{
+    const gchar *name;
+    gsize maxSize;
+    WriteValidateFunc validate;
+    WriteCommitFunc commit;
+    gpointer context;
+    guint64 numCommitted;
+    guint64 numRejected;
+};
+
+void WriteAssemblerInit(
+    struct WriteAssembler *assembler,
+    const gchar *name,
+    gsize maxSize,
+    WriteValidateFunc validate,
+    WriteCommitFunc commit,
+    gpointer context);
+
+// Abandons any value still being assembled for the characteristic
+void WriteAssemblerFini(struct WriteAssembler *assembler);
+
+// Handles a WriteValue call and completes the invocation
+void WriteAssemblerHandle(
+    struct WriteAssembler *assembler,
+    BluezGattCharacteristic1 *interface,
+    GDBusMethodInvocation *invocation,
+    GVariant *value,
+    GVariant *options);
+
+#endif // _WRITE_ASSEMBLY_H